@@ -1,8 +1,11 @@
-// SPDX-FileCopyrightText: (c) 2021-2023 Shawn Silverman <shawn@pobox.com>
+// SPDX-FileCopyrightText: (c) 2021-2024 Shawn Silverman <shawn@pobox.com>
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
 // FixedWidthServer demonstrates how to serve a protocol having a
-// continuous stream of fixed-size messages from multiple clients.
+// continuous stream of fixed-size messages from multiple clients. The
+// messages are split out of the stream with MessageFramer, which hands
+// over each complete message straight from the connection's
+// receive buffer.
 //
 // This file is part of the QNEthernet library.
 
@@ -36,8 +39,7 @@ struct ClientState {
       : client(std::move(client)) {}
 
   EthernetClient client;
-  int bufSize = 0;  // Keeps track of how many bytes have been read
-  uint8_t buf[kMessageSize];
+  MessageFramer framer{MessageFramer::Format::kFixed, kMessageSize};
   bool closed = false;
 };
 
@@ -96,11 +98,12 @@ void setup() {
 
 // Process one message. This implementation simply dumps to Serial.
 //
-// We could pass just the buffer, but we're passing the whole state
-// here so we know which client it's from.
-void processMessage(const ClientState &state) {
+// We're also passing the whole state here so we know which client
+// it's from.
+void processMessage(const ClientState &state,
+                    const uint8_t *data, size_t size) {
   printf("Message: ");
-  fwrite(state.buf, sizeof(state.buf[0]), kMessageSize, stdout);
+  fwrite(data, sizeof(data[0]), size, stdout);
   printf("\r\n");
 }
 
@@ -121,15 +124,12 @@ void loop() {
       continue;
     }
 
-    int avail = state.client.available();
-    if (avail > 0) {
-      int toRead = std::min(kMessageSize - state.bufSize, avail);
-      state.bufSize += state.client.read(&state.buf[state.bufSize], toRead);
-      if (state.bufSize >= kMessageSize) {
-        processMessage(state);
-        state.bufSize = 0;
-      }
-    }
+    // Process all the complete messages
+    state.framer.process(state.client,
+                         [&state](const uint8_t *data, size_t size) {
+                           processMessage(state, data, size);
+                           return true;
+                         });
   }
 
   // Clean up all the closed clients
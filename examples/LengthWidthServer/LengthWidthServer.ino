@@ -1,12 +1,13 @@
-// SPDX-FileCopyrightText: (c) 2021-2023 Shawn Silverman <shawn@pobox.com>
+// SPDX-FileCopyrightText: (c) 2021-2024 Shawn Silverman <shawn@pobox.com>
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
 // LengthWidthServer demonstrates how to serve a protocol having a
 // continuous stream of messages from multiple clients, where each
 // message starts with a one-byte length field. This is similar to the
 // FixedWidthServer example, but the data stream indicates the size of
-// each message. It shows a simple version of how to use states when
-// parsing, when the position in the client stream is arbitrary.
+// each message. The messages are split out of the stream with
+// MessageFramer, which hands over each complete message straight from
+// the connection's receive buffer.
 //
 // This file is part of the QNEthernet library.
 
@@ -31,33 +32,16 @@ constexpr uint16_t kServerPort = 5000;
 //  Types
 // --------------------------------------------------------------------------
 
-// Where are we with message parsing?
-enum class MessageParseState {
-  kStart,  // Starting state
-  kValue,  // Reading the value
-};
-
 // Keeps track of state for a single client.
 struct ClientState {
   ClientState(EthernetClient client)
-      : client(std::move(client)) {
-    reset();
-  }
+      : client(std::move(client)) {}
 
   EthernetClient client;
   bool closed = false;
 
-  MessageParseState parseState;
-  int messageSize;   // The current message size
-  int bufSize;       // Keeps track of how many bytes have been read
-  uint8_t buf[255];  // Do the easy thing and allocate the maximum possible
-
-  // Reset the client state.
-  void reset() {
-    messageSize = 0;
-    bufSize = 0;
-    parseState = MessageParseState::kStart;
-  }
+  // Each message starts with a one-byte length
+  MessageFramer framer{MessageFramer::Format::kLength8, 255};
 };
 
 // --------------------------------------------------------------------------
@@ -116,12 +100,13 @@ void setup() {
 // Process one message. This implementation simply prints to Serial,
 // escaping some characters.
 //
-// We could pass just the buffer, but we're passing the whole state
-// here so we know which client it's from.
-void processMessage(const ClientState &state) {
-  printf("Message [%d]: ", state.messageSize);
-  for (int i = 0; i < state.messageSize; i++) {
-    uint8_t b = state.buf[i];
+// We're also passing the whole state here so we know which client
+// it's from.
+void processMessage(const ClientState &state,
+                    const uint8_t *data, size_t size) {
+  printf("Message [%zu]: ", size);
+  for (size_t i = 0; i < size; i++) {
+    uint8_t b = data[i];
     if (b < 0x20) {
       switch (b) {
         case '\a': printf("\\q"); break;
@@ -161,33 +146,16 @@ void loop() {
       continue;
     }
 
-    int avail = state.client.available();
-    while (avail > 0) {
-      switch (state.parseState) {
-        case MessageParseState::kStart:
-          state.messageSize = state.client.read();
-          printf("Message size: %d\r\n", state.messageSize);
-          avail--;
-          state.parseState = MessageParseState::kValue;
-          break;
-
-        case MessageParseState::kValue: {
-          int read = std::min(state.messageSize - state.bufSize, avail);
-          read = state.client.read(&state.buf[state.bufSize], read);
-          state.bufSize += read;
-          avail -= read;
-          if (state.bufSize >= state.messageSize) {
-            processMessage(state);
-            state.messageSize = 0;
-            state.bufSize = 0;
-            state.parseState = MessageParseState::kStart;
-          }
-          break;
-        }
-
-        default:
-          break;  // Shouldn't happen because we put in all the states
-      }
+    // Process all the complete messages
+    int count = state.framer.process(
+        state.client, [&state](const uint8_t *data, size_t size) {
+          processMessage(state, data, size);
+          return true;
+        });
+    if (count < 0) {
+      printf("Bad message stream; closing\r\n");
+      state.client.stop();
+      state.closed = true;
     }
   }
 
@@ -1,4 +1,4 @@
-// SPDX-FileCopyrightText: (c) 2021-2023 Shawn Silverman <shawn@pobox.com>
+// SPDX-FileCopyrightText: (c) 2021-2024 Shawn Silverman <shawn@pobox.com>
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
 // OSCPrinter prints received OSC messages. It uses the well-known
@@ -6,7 +6,8 @@
 // To see messages, discover this example using a program such as
 // TouchOSC and then send some messages.
 //
-// This example relies on the LiteOSCParser library.
+// Messages are parsed in place, straight from the UDP buffer, with the
+// library's OSCMessage and OSCBundle classes.
 //
 // This file is part of the QNEthernet library.
 
@@ -23,8 +24,6 @@ constexpr uint16_t kOSCPort = 8000;
 constexpr char kServiceName[] = "osc-example";
 
 EthernetUDP udp;
-uint8_t buf[Ethernet.mtu() - 20 - 8];  // Maximum UDP payload size
-                                       // 20-byte IP, 8-byte UDP header
 
 // Main program setup.
 void setup() {
@@ -85,8 +84,7 @@ void setup() {
 // Main program loop.
 void loop() {
   int size = udp.parsePacket();
-  if (0 < size && static_cast<unsigned int>(size) <= sizeof(buf)) {
-    udp.read(buf, size);
-    printOSC(Serial, buf, size);
+  if (0 < size) {
+    printOSC(Serial, udp.data(), size);
   }
 }
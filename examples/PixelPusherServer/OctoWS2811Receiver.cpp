@@ -59,13 +59,13 @@ uint8_t OctoWS2811Receiver::stripFlags(size_t stripNum) const {
 void OctoWS2811Receiver::handleCommand(uint8_t command,
                                        const uint8_t *data, size_t len) {
   switch (command) {
-    case PixelPusherServer::Commands::GLOBALBRIGHTNESS_SET:
+    case PixelPusherServer::Commands::kGlobalBrightnessSet:
       if (len >= 2) {
         std::memcpy(&globalBri_, data, 2);
       }
       break;
 
-    case PixelPusherServer::Commands::LED_CONFIGURE:
+    case PixelPusherServer::Commands::kLEDConfigure:
       // uint32_t num_strips
       // uint32_t strip_length
       // uint8_t strip_type[8]
@@ -79,32 +79,32 @@ void OctoWS2811Receiver::handleCommand(uint8_t command,
         for (size_t i = 0; i < 8; i++) {
           auto &config = stripConfigs_[i];
           switch (data[16 + i]) {
-            case PixelPusherServer::ColourOrders::RGB:
+            case PixelPusherServer::ColourOrders::kRGB:
               config.rgbOrder[0] = 0;
               config.rgbOrder[1] = 1;
               config.rgbOrder[2] = 2;
               break;
-            case PixelPusherServer::ColourOrders::RBG:
+            case PixelPusherServer::ColourOrders::kRBG:
               config.rgbOrder[0] = 0;
               config.rgbOrder[1] = 2;
               config.rgbOrder[2] = 1;
               break;
-            case PixelPusherServer::ColourOrders::GBR:
+            case PixelPusherServer::ColourOrders::kGBR:
               config.rgbOrder[0] = 1;
               config.rgbOrder[1] = 2;
               config.rgbOrder[2] = 0;
               break;
-            case PixelPusherServer::ColourOrders::GRB:
+            case PixelPusherServer::ColourOrders::kGRB:
               config.rgbOrder[0] = 1;
               config.rgbOrder[1] = 0;
               config.rgbOrder[2] = 2;
               break;
-            case PixelPusherServer::ColourOrders::BGR:
+            case PixelPusherServer::ColourOrders::kBGR:
               config.rgbOrder[0] = 2;
               config.rgbOrder[1] = 1;
               config.rgbOrder[2] = 0;
               break;
-            case PixelPusherServer::ColourOrders::BRG:
+            case PixelPusherServer::ColourOrders::kBRG:
               config.rgbOrder[0] = 2;
               config.rgbOrder[1] = 0;
               config.rgbOrder[2] = 1;
@@ -120,7 +120,7 @@ void OctoWS2811Receiver::handleCommand(uint8_t command,
       }
       break;
 
-    case PixelPusherServer::Commands::STRIPBRIGHTNESS_SET:
+    case PixelPusherServer::Commands::kStripBrightnessSet:
       if (len >= 3) {
         if (data[0] < 8) {  // Strip number
           std::memcpy(&stripConfigs_[data[0]].brightness, &data[1], 2);
@@ -15,11 +15,11 @@
 #include <memory>
 
 #include <OctoWS2811.h>
+#include <QNEthernet.h>
 
-#include "PixelPusherServer.h"
-#include "Receiver.h"
+using namespace qindesign::network;
 
-class OctoWS2811Receiver : public Receiver {
+class OctoWS2811Receiver : public PixelPusherReceiver {
  public:
   // Creates a new object. The parameters are restricted:
   // * 'numStrips': 0-255
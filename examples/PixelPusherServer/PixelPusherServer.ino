@@ -1,9 +1,9 @@
 // SPDX-FileCopyrightText: (c) 2022-2024 Shawn Silverman <shawn@pobox.com>
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-// PixelPusherServer implements a simple PixelPusher receiver. The
-// output is sent to an OctoWS2811. The parameters are configurable
-// via constants.
+// PixelPusherServer implements a simple PixelPusher receiver using the
+// library's PixelPusherServer. The output is sent to an OctoWS2811.
+// The parameters are configurable via constants.
 //
 // Easy things to alter:
 // 1. Number of strips (this file)
@@ -31,7 +31,6 @@
 #include <QNEthernet.h>
 
 #include "OctoWS2811Receiver.h"
-#include "PixelPusherServer.h"
 
 using namespace qindesign::network;
 
@@ -52,8 +51,8 @@ constexpr uint16_t kHWRev          = 0;
 // The OctoWS2811Receiver implementation supports global brightness
 // and per-strip brightness.
 constexpr uint32_t kPixelPusherFlags =
-    PixelPusherServer::PusherFlags::GLOBALBRIGHTNESS |
-    PixelPusherServer::PusherFlags::STRIPBRIGHTNESS;
+    PixelPusherServer::PusherFlags::kGlobalBrightness |
+    PixelPusherServer::PusherFlags::kStripBrightness;
 
 // -------------------------------------------------------------------
 //  Main Program
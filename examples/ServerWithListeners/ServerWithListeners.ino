@@ -12,8 +12,9 @@
 // 3. Managing connections and attaching state to each connection,
 // 4. How to use `printf`,
 // 5. Very rudimentary HTTP server behaviour,
-// 6. Client timeouts, and
-// 7. Use of a half closed connection.
+// 6. Client timeouts,
+// 7. Use of a half closed connection, and
+// 8. Parsing lines in place with readUntil().
 //
 // This is a rudimentary basis for a complete server program.
 //
@@ -198,29 +199,44 @@ bool initEthernet() {
 // The simplest possible (very non-compliant) HTTP server. Respond to
 // any input with an HTTP/1.1 response.
 void processClientData(ClientState &state) {
-  // Loop over available data until an empty line or no more data
+  // Loop over available lines until an empty line or no more data. The
+  // lines are looked at in place, in the receive buffer, instead of
+  // being read one byte at a time.
   // Note that if emptyLine starts as false then this will ignore any
   // initial blank line.
   while (true) {
-    int avail = state.client.available();
-    if (avail <= 0) {
-      return;
+    size_t size;
+    const uint8_t *line = state.client.readUntil('\n', size);
+    const bool complete = (line != nullptr);
+    if (!complete) {
+      // Take any partial line so that a long line can't fill the
+      // receive buffer
+      line = state.client.readableSpan(size);
+      if (line == nullptr || size == 0) {
+        return;
+      }
+      state.client.consume(size);
     }
 
     state.lastRead = millis();
-    int c = state.client.read();
-    printf("%c", c);
-    if (c == '\n') {
+    printf("%.*s", static_cast<int>(size),
+           reinterpret_cast<const char *>(line));
+
+    // Ignore carriage returns because CRLF is a likely pattern in
+    // an HTTP request
+    for (size_t i = 0; i < size; i++) {
+      if (line[i] != '\r' && line[i] != '\n') {
+        state.emptyLine = false;
+        break;
+      }
+    }
+    if (complete) {
       if (state.emptyLine) {
         break;
       }
 
       // Start a new empty line
       state.emptyLine = true;
-    } else if (c != '\r') {
-      // Ignore carriage returns because CRLF is a likely pattern in
-      // an HTTP request
-      state.emptyLine = false;
     }
   }
 
@@ -0,0 +1,142 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNConnectionPool.cpp implements the connection pool.
+// This file is part of the QNEthernet library.
+
+#include "QNConnectionPool.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <algorithm>
+#include <utility>
+
+#include "QNDNSClient.h"
+#include "lwip/dns.h"
+#include "lwip/sys.h"
+#include "qnethernet_opts.h"
+#include "util/ip_tools.h"
+
+namespace qindesign {
+namespace network {
+
+ConnectionPool::ConnectionPool(size_t maxIdle, uint32_t idleTimeout)
+    : maxIdle_(maxIdle),
+      idleTimeout_(idleTimeout) {}
+
+ConnectionPool::~ConnectionPool() {
+  closeAll();
+}
+
+bool ConnectionPool::isHealthy(EthernetClient &client) {
+  // A closed connection or unsolicited data means it can't be reused
+  if (!client || client.available() > 0) {
+    return false;
+  }
+  return (healthCheck_ == nullptr) || healthCheck_(client);
+}
+
+bool ConnectionPool::lookup(const char *host, IPAddress &ip) {
+#if LWIP_DNS
+  if (host == nullptr) {
+    return false;
+  }
+
+  uint32_t t = sys_now();
+  auto it = std::find_if(hosts_.begin(), hosts_.end(),
+                         [host](const Host &h) { return h.name == host; });
+  if (it != hosts_.end() && (t - it->time) < dnsCacheTime_) {
+    ip = it->ip;
+    return true;
+  }
+
+  if (!DNSClient::getHostByName(host, ip,
+                                QNETHERNET_DEFAULT_DNS_LOOKUP_TIMEOUT)) {
+    return false;
+  }
+  if (it != hosts_.end()) {
+    it->ip   = ip;
+    it->time = t;
+  } else {
+    hosts_.push_back(Host{host, ip, t});
+  }
+  return true;
+#else
+  LWIP_UNUSED_ARG(host);
+  LWIP_UNUSED_ARG(ip);
+  return false;
+#endif  // LWIP_DNS
+}
+
+bool ConnectionPool::checkOut(const char *host, uint16_t port,
+                              EthernetClient &client) {
+  IPAddress ip;
+  if (!lookup(host, ip)) {
+    return false;
+  }
+  return checkOut(ip, port, client);
+}
+
+bool ConnectionPool::checkOut(const IPAddress &ip, uint16_t port,
+                              EthernetClient &client) {
+  closeExpired();
+
+  // Prefer the most recently used connection
+  for (auto it = idle_.end(); it != idle_.begin(); ) {
+    --it;
+    if (it->port != port || it->ip != ip) {
+      continue;
+    }
+    EthernetClient c = std::move(it->client);
+    it = idle_.erase(it);
+    if (isHealthy(c)) {
+      client = std::move(c);
+      return true;
+    }
+    c.close();
+  }
+
+  client.setConnectionTimeout(connTimeout_);
+  return client.connect(ip, port);
+}
+
+void ConnectionPool::checkIn(EthernetClient &client) {
+  if (!isHealthy(client)) {
+    client.close();
+  } else {
+    idle_.push_back(Idle{client, client.remoteIP(), client.remotePort(),
+                         sys_now()});
+  }
+  client = EthernetClient{};
+
+  closeExpired();
+  while (idle_.size() > maxIdle_) {
+    idle_.front().client.close();
+    idle_.erase(idle_.begin());
+  }
+}
+
+void ConnectionPool::closeExpired() {
+  uint32_t t = sys_now();
+  for (auto it = idle_.begin(); it != idle_.end(); ) {
+    if ((t - it->since) >= idleTimeout_ || !it->client) {
+      it->client.close();
+      it = idle_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void ConnectionPool::closeAll() {
+  for (Idle &i : idle_) {
+    i.client.close();
+  }
+  idle_.clear();
+}
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
@@ -0,0 +1,149 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNConnectionPool.h defines a pool of persistent outbound TCP connections.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <IPAddress.h>
+#include <WString.h>
+
+#include "QNEthernetClient.h"
+
+namespace qindesign {
+namespace network {
+
+// ConnectionPool keeps idle connections to remote hosts open so they can be
+// reused. This avoids a DNS lookup, a handshake, and a TIME_WAIT PCB for each
+// request. A connection is checked out, used, and then checked back in.
+//
+// Note that a server may close an idle connection at any time, including just
+// after it passed its health check, so it's a good idea to retry a failed
+// request once on a new connection.
+class ConnectionPool final {
+ public:
+  // Creates a pool that keeps at most 'maxIdle' idle connections, each for at
+  // most 'idleTimeout' milliseconds.
+  ConnectionPool(size_t maxIdle, uint32_t idleTimeout);
+
+  // Creates a pool that keeps at most 4 idle connections, each for at most
+  // 30 seconds.
+  ConnectionPool() : ConnectionPool(4, 30'000) {}
+
+  // Closes all idle connections.
+  ~ConnectionPool();
+
+  // Disallow copying
+  ConnectionPool(const ConnectionPool &) = delete;
+  ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+  // Checks out a connection to the given host and port. A healthy idle
+  // connection is reused if there is one, otherwise a new connection is made.
+  // Host addresses are cached, so a DNS lookup is only done when there's no
+  // recent address for the host. This returns whether 'client' is connected.
+  //
+  // An idle connection is healthy if it's still connected, has no unread data,
+  // and passes any health check.
+  bool checkOut(const char *host, uint16_t port, EthernetClient &client);
+
+  // Checks out a connection to the given address and port. This is similar to
+  // checkOut(host, port, client), but without the DNS lookup.
+  bool checkOut(const IPAddress &ip, uint16_t port, EthernetClient &client);
+
+  // Returns a connection to the pool. The connection is keyed by its remote
+  // address and port. A connection that's closed or has unread data is closed
+  // instead of kept. If there are too many idle connections then the oldest
+  // one is closed. 'client' no longer refers to the connection afterwards.
+  void checkIn(EthernetClient &client);
+
+  // Closes idle connections that have been idle for too long or that were
+  // closed by the remote host. This is also done when checking connections out
+  // and in, but calling this periodically frees resources sooner.
+  void closeExpired();
+
+  // Closes all idle connections.
+  void closeAll();
+
+  // Returns the number of idle connections.
+  size_t idleCount() const {
+    return idle_.size();
+  }
+
+  // Sets an additional health check for idle connections. It's called before
+  // an idle connection is reused, and the connection is closed if it returns
+  // false. Set to NULL to remove.
+  void setHealthCheck(std::function<bool(EthernetClient &client)> check) {
+    healthCheck_ = std::move(check);
+  }
+
+  // Sets the connection timeout, in milliseconds, for new connections. The
+  // default is 1000.
+  void setConnectionTimeout(uint16_t timeout) {
+    connTimeout_ = timeout;
+  }
+
+  // Returns the connection timeout for new connections.
+  uint16_t connectionTimeout() const {
+    return connTimeout_;
+  }
+
+  // Sets how long, in milliseconds, a looked-up host address is reused. The
+  // default is 60 seconds.
+  void setDNSCacheTime(uint32_t time) {
+    dnsCacheTime_ = time;
+  }
+
+  // Returns how long a looked-up host address is reused.
+  uint32_t dnsCacheTime() const {
+    return dnsCacheTime_;
+  }
+
+ private:
+  // An idle connection and its key.
+  struct Idle final {
+    EthernetClient client;
+    IPAddress ip;
+    uint16_t port;
+    uint32_t since;  // When it was checked in
+  };
+
+  // A cached host address.
+  struct Host final {
+    String name;
+    IPAddress ip;
+    uint32_t time;  // When it was looked up
+  };
+
+  // Returns whether an idle connection can be reused.
+  bool isHealthy(EthernetClient &client);
+
+  // Looks up a host, using the cache if the address is recent enough. This
+  // returns whether the address was found.
+  bool lookup(const char *host, IPAddress &ip);
+
+  size_t maxIdle_;
+  uint32_t idleTimeout_;
+  uint16_t connTimeout_ = 1000;
+  uint32_t dnsCacheTime_ = 60'000;
+  std::function<bool(EthernetClient &client)> healthCheck_ = nullptr;
+
+  std::vector<Idle> idle_;  // Oldest first
+  std::vector<Host> hosts_;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
@@ -0,0 +1,629 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNDMXServer.cpp implements DMXServer.
+// This file is part of the QNEthernet library.
+
+#include "QNDMXServer.h"
+
+#if LWIP_UDP
+
+// C++ includes
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "QNEthernet.h"
+#include "lwip/sys.h"
+
+namespace qindesign {
+namespace network {
+
+// sACN (E1.31) offsets and values
+static constexpr uint8_t kACNPacketID[12]{
+    'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0,
+};
+static constexpr size_t kRootVectorOffset      = 18;
+static constexpr size_t kCIDOffset             = 22;
+static constexpr size_t kFramingVectorOffset   = 40;
+static constexpr size_t kPriorityOffset        = 108;
+static constexpr size_t kSyncAddressOffset     = 109;
+static constexpr size_t kSequenceOffset        = 111;
+static constexpr size_t kOptionsOffset         = 112;
+static constexpr size_t kUniverseOffset        = 113;
+static constexpr size_t kDMPVectorOffset       = 117;
+static constexpr size_t kDMPTypeOffset         = 118;
+static constexpr size_t kPropertyCountOffset   = 123;
+static constexpr size_t kStartCodeOffset       = 125;
+static constexpr size_t kSyncSequenceOffset    = 44;
+static constexpr size_t kSyncAddressSyncOffset = 45;
+static constexpr size_t kMinSyncSize           = 49;
+
+static constexpr uint32_t kVectorRootData        = 0x00000004;
+static constexpr uint32_t kVectorRootExtended    = 0x00000008;
+static constexpr uint32_t kVectorFramingData     = 0x00000002;
+static constexpr uint32_t kVectorFramingSync     = 0x00000001;
+static constexpr uint8_t kVectorDMPSetProperty   = 0x02;
+static constexpr uint8_t kDMPAddressType         = 0xa1;
+
+static constexpr uint8_t kOptionPreview    = (1 << 7);
+static constexpr uint8_t kOptionTerminated = (1 << 6);
+
+static constexpr uint8_t kMaxPriority     = 200;
+static constexpr uint8_t kDefaultPriority = 100;  // Used for Art-Net
+
+static constexpr uint16_t kMaxSACNUniverse   = 63999;
+static constexpr uint16_t kMaxArtNetUniverse = 0x7fff;
+
+// Art-Net offsets and values
+static constexpr uint8_t kArtNetID[8]{'A', 'r', 't', '-', 'N', 'e', 't', 0};
+static constexpr size_t kArtOpCodeOffset   = 8;
+static constexpr size_t kArtSequenceOffset = 12;
+static constexpr size_t kArtSubUniOffset   = 14;
+static constexpr size_t kArtLengthOffset   = 16;
+static constexpr size_t kArtDataOffset     = 18;
+static constexpr size_t kMinArtSyncSize    = 14;
+static constexpr uint16_t kOpDmx  = 0x5000;
+static constexpr uint16_t kOpSync = 0x5200;
+
+// How long synchronized output is kept up without sync packets, in
+// milliseconds
+static constexpr uint32_t kSACNSyncTimeout   = 2'500;
+static constexpr uint32_t kArtNetSyncTimeout = 4'000;
+
+static inline uint16_t getU16BE(const uint8_t *p) {
+  return (uint16_t{p[0]} << 8) | p[1];
+}
+
+static inline uint32_t getU32BE(const uint8_t *p) {
+  return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) |
+         (uint32_t{p[2]} << 8) | p[3];
+}
+
+DMXServer::DMXServer(size_t maxUniverses, size_t maxSources)
+    : maxUniverses_(maxUniverses),
+      maxSources_(std::max(maxSources, size_t{1})) {
+  // Avoid allocating while receiving
+  universes_.reserve(maxUniverses_);
+  syncGroups_.reserve(maxUniverses_);
+}
+
+DMXServer::~DMXServer() {
+  end();
+}
+
+bool DMXServer::begin(DMXReceiver *recv) {
+  end();
+
+  recv_ = recv;
+  for (const Universe &u : universes_) {
+    if (!startSocket(u.protocol)) {
+      end();
+      return false;
+    }
+    if (u.protocol == DMXProtocol::kSACN && !joinSACN(u.number)) {
+      end();
+      return false;
+    }
+  }
+  started_ = true;
+  return true;
+}
+
+void DMXServer::end() {
+  if (!started_ && !sacnUDP_ && !artNetUDP_) {
+    return;
+  }
+  started_ = false;
+
+  sacnUDP_.stop();
+  sacnUDP_.onPacket(nullptr);
+  artNetUDP_.stop();
+  artNetUDP_.onPacket(nullptr);
+
+  for (Universe &u : universes_) {
+    if (u.protocol == DMXProtocol::kSACN) {
+      leaveSACN(u.number);
+    }
+    for (size_t i = 0; i < maxSources_; i++) {
+      u.sources[i].active = false;
+    }
+    u.dirty = false;
+  }
+  for (const SyncGroup &g : syncGroups_) {
+    if (g.joined) {
+      leaveSACN(g.address);
+    }
+  }
+  syncGroups_.clear();
+  artSyncSeen_ = false;
+}
+
+bool DMXServer::startSocket(DMXProtocol protocol) {
+  switch (protocol) {
+    case DMXProtocol::kSACN:
+      if (!sacnUDP_) {
+        sacnUDP_.onPacket([this](const EthernetUDP::PacketView &packet) {
+          processSACN(packet);
+        });
+        return sacnUDP_.begin(kSACNPort);
+      }
+      return true;
+    case DMXProtocol::kArtNet:
+      if (!artNetUDP_) {
+        artNetUDP_.onPacket([this](const EthernetUDP::PacketView &packet) {
+          processArtNet(packet);
+        });
+        return artNetUDP_.begin(kArtNetPort);
+      }
+      return true;
+  }
+  return false;
+}
+
+bool DMXServer::joinSACN(uint16_t universe) {
+  return Ethernet.joinGroup(
+      IPAddress{239, 255, static_cast<uint8_t>(universe >> 8),
+                static_cast<uint8_t>(universe)});
+}
+
+void DMXServer::leaveSACN(uint16_t universe) {
+  Ethernet.leaveGroup(
+      IPAddress{239, 255, static_cast<uint8_t>(universe >> 8),
+                static_cast<uint8_t>(universe)});
+}
+
+// --------------------------------------------------------------------------
+//  Universes
+// --------------------------------------------------------------------------
+
+bool DMXServer::addUniverse(DMXProtocol protocol, uint16_t universe,
+                            DMXMergeMode mode) {
+  const bool valid = (protocol == DMXProtocol::kSACN)
+                         ? (1 <= universe && universe <= kMaxSACNUniverse)
+                         : (universe <= kMaxArtNetUniverse);
+  if (!valid || find(protocol, universe) != nullptr) {
+    errno = EINVAL;
+    return false;
+  }
+  if (universes_.size() >= maxUniverses_) {
+    errno = ENOBUFS;
+    return false;
+  }
+
+  if (started_) {
+    if (!startSocket(protocol)) {
+      return false;
+    }
+    if (protocol == DMXProtocol::kSACN && !joinSACN(universe)) {
+      return false;
+    }
+  }
+
+  Universe u;
+  u.protocol = protocol;
+  u.number = universe;
+  u.mode = mode;
+  u.buf = std::make_unique<uint8_t[]>((1 + maxSources_) * kUniverseSize);
+  u.sources = std::make_unique<Source[]>(maxSources_);
+  for (size_t i = 0; i < maxSources_; i++) {
+    u.sources[i].slots = &u.buf[(1 + i) * kUniverseSize];
+  }
+  universes_.push_back(std::move(u));
+  return true;
+}
+
+bool DMXServer::removeUniverse(DMXProtocol protocol, uint16_t universe) {
+  for (auto it = universes_.begin(); it != universes_.end(); ++it) {
+    if (it->protocol == protocol && it->number == universe) {
+      if (started_ && protocol == DMXProtocol::kSACN) {
+        leaveSACN(universe);
+      }
+      universes_.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+DMXServer::Universe *DMXServer::find(DMXProtocol protocol, uint16_t universe) {
+  for (Universe &u : universes_) {
+    if (u.number == universe && u.protocol == protocol) {
+      return &u;
+    }
+  }
+  return nullptr;
+}
+
+size_t DMXServer::sourceCount(DMXProtocol protocol, uint16_t universe) const {
+  for (const Universe &u : universes_) {
+    if (u.number == universe && u.protocol == protocol) {
+      size_t n = 0;
+      for (size_t i = 0; i < maxSources_; i++) {
+        if (u.sources[i].active) {
+          n++;
+        }
+      }
+      return n;
+    }
+  }
+  return 0;
+}
+
+// --------------------------------------------------------------------------
+//  Receiving
+// --------------------------------------------------------------------------
+
+void DMXServer::processSACN(const EthernetUDP::PacketView &packet) {
+  const uint8_t *p = packet.data;
+  const size_t size = packet.size;
+  if (size < kMinSyncSize ||
+      getU16BE(&p[0]) != 0x0010 ||
+      std::memcmp(&p[4], kACNPacketID, sizeof(kACNPacketID)) != 0) {
+    droppedCount_++;
+    return;
+  }
+
+  const uint32_t rootVector = getU32BE(&p[kRootVectorOffset]);
+  const uint32_t framingVector = getU32BE(&p[kFramingVectorOffset]);
+
+  if (rootVector == kVectorRootExtended) {
+    if (framingVector == kVectorFramingSync) {
+      processSync(DMXProtocol::kSACN, getU16BE(&p[kSyncAddressSyncOffset]));
+    }
+    // Universe discovery is ignored
+    return;
+  }
+
+  if (rootVector != kVectorRootData || framingVector != kVectorFramingData ||
+      size <= kStartCodeOffset ||
+      p[kDMPVectorOffset] != kVectorDMPSetProperty ||
+      p[kDMPTypeOffset] != kDMPAddressType) {
+    droppedCount_++;
+    return;
+  }
+
+  Universe *u = find(DMXProtocol::kSACN, getU16BE(&p[kUniverseOffset]));
+  if (u == nullptr) {
+    return;
+  }
+
+  // The property count includes the START code
+  const size_t propertyCount = getU16BE(&p[kPropertyCountOffset]);
+  if (propertyCount < 1 || propertyCount > 1 + kUniverseSize ||
+      kStartCodeOffset + propertyCount > size) {
+    droppedCount_++;
+    return;
+  }
+
+  const uint8_t options = p[kOptionsOffset];
+  if ((options & kOptionPreview) != 0) {
+    return;
+  }
+  if ((options & kOptionTerminated) != 0) {
+    for (size_t i = 0; i < maxSources_; i++) {
+      Source &s = u->sources[i];
+      if (s.active && std::memcmp(s.id, &p[kCIDOffset], 16) == 0) {
+        removeSource(*u, s);
+        break;
+      }
+    }
+    return;
+  }
+
+  if (p[kStartCodeOffset] != 0) {
+    return;
+  }
+
+  u->syncAddress = getU16BE(&p[kSyncAddressOffset]);
+  accept(*u, &p[kCIDOffset],
+         std::min(p[kPriorityOffset], kMaxPriority),
+         p[kSequenceOffset], true,
+         &p[kStartCodeOffset + 1], propertyCount - 1);
+}
+
+void DMXServer::processArtNet(const EthernetUDP::PacketView &packet) {
+  const uint8_t *p = packet.data;
+  const size_t size = packet.size;
+  if (size < kMinArtSyncSize ||
+      std::memcmp(p, kArtNetID, sizeof(kArtNetID)) != 0) {
+    droppedCount_++;
+    return;
+  }
+
+  // The opcode is little-endian
+  const uint16_t opCode = p[kArtOpCodeOffset] |
+                          (uint16_t{p[kArtOpCodeOffset + 1]} << 8);
+  if (opCode == kOpSync) {
+    processSync(DMXProtocol::kArtNet, 0);
+    return;
+  }
+  if (opCode != kOpDmx) {
+    return;
+  }
+
+  if (size < kArtDataOffset) {
+    droppedCount_++;
+    return;
+  }
+  const uint16_t portAddress =
+      (p[kArtSubUniOffset] | (uint16_t{p[kArtSubUniOffset + 1]} << 8)) &
+      kMaxArtNetUniverse;
+  Universe *u = find(DMXProtocol::kArtNet, portAddress);
+  if (u == nullptr) {
+    return;
+  }
+
+  const size_t length = getU16BE(&p[kArtLengthOffset]);
+  if (length > kUniverseSize || kArtDataOffset + length > size) {
+    droppedCount_++;
+    return;
+  }
+
+  // Art-Net sources are identified by their address
+  uint8_t id[16]{0};
+  id[0] = packet.remoteIP[0];
+  id[1] = packet.remoteIP[1];
+  id[2] = packet.remoteIP[2];
+  id[3] = packet.remoteIP[3];
+
+  // A sequence of zero means sequencing is disabled
+  const uint8_t seq = p[kArtSequenceOffset];
+  accept(*u, id, kDefaultPriority, seq, seq != 0, &p[kArtDataOffset], length);
+}
+
+void DMXServer::accept(Universe &u, const uint8_t id[16], uint8_t priority,
+                       uint8_t seq, bool checkSeq,
+                       const uint8_t *slots, size_t count) {
+  const uint32_t now = sys_now();
+
+  // Find the source, or a free slot for it
+  Source *src = nullptr;
+  Source *free = nullptr;
+  for (size_t i = 0; i < maxSources_; i++) {
+    Source &s = u.sources[i];
+    if (!s.active) {
+      if (free == nullptr) {
+        free = &s;
+      }
+    } else if (std::memcmp(s.id, id, 16) == 0) {
+      src = &s;
+      break;
+    } else if ((now - s.lastTime) >= sourceTimeout_) {
+      // Reuse a silent source
+      free = &s;
+    }
+  }
+
+  if (src != nullptr) {
+    // E1.31 6.7.2: Discard out-of-order packets, but allow a large jump
+    // backwards in case the source restarted
+    if (checkSeq) {
+      const int8_t diff = static_cast<int8_t>(seq - src->seq);
+      if (diff <= 0 && diff > -20) {
+        droppedCount_++;
+        return;
+      }
+    }
+  } else if (free != nullptr) {
+    src = free;
+    std::memcpy(src->id, id, 16);
+    src->active = true;
+  } else {
+    droppedCount_++;
+    return;
+  }
+
+  src->priority = priority;
+  src->seq = seq;
+  src->lastTime = now;
+  src->order = ++order_;
+  std::memcpy(src->slots, slots, count);
+  src->count = count;
+  packetCount_++;
+
+  u.dirty = true;
+  if (!isHeld(u)) {
+    output(u);
+  }
+}
+
+void DMXServer::removeSource(Universe &u, Source &s) {
+  s.active = false;
+  for (size_t i = 0; i < maxSources_; i++) {
+    if (u.sources[i].active) {
+      u.dirty = true;
+      if (!isHeld(u)) {
+        output(u);
+      }
+      return;
+    }
+  }
+  u.dirty = false;
+  if (recv_ != nullptr) {
+    recv_->universeLost(u.protocol, u.number);
+  }
+}
+
+bool DMXServer::isHeld(const Universe &u) const {
+  const uint32_t now = sys_now();
+  if (u.protocol == DMXProtocol::kArtNet) {
+    return artSyncSeen_ && (now - artSyncTime_) < kArtNetSyncTimeout;
+  }
+  if (u.syncAddress == 0) {
+    return false;
+  }
+  for (const SyncGroup &g : syncGroups_) {
+    if (g.address == u.syncAddress) {
+      return g.seen && (now - g.lastTime) < kSACNSyncTimeout;
+    }
+  }
+  return false;
+}
+
+void DMXServer::output(Universe &u) {
+  u.dirty = false;
+  if (recv_ == nullptr) {
+    return;
+  }
+
+  // Find the highest priority and the sources that have it
+  uint8_t maxPriority = 0;
+  size_t winners = 0;
+  Source *latest = nullptr;
+  for (size_t i = 0; i < maxSources_; i++) {
+    Source &s = u.sources[i];
+    if (!s.active) {
+      continue;
+    }
+    if (winners == 0 || s.priority > maxPriority) {
+      maxPriority = s.priority;
+      winners = 1;
+      latest = &s;
+    } else if (s.priority == maxPriority) {
+      winners++;
+      if (static_cast<int32_t>(s.order - latest->order) > 0) {
+        latest = &s;
+      }
+    }
+  }
+  if (winners == 0) {
+    return;
+  }
+
+  // A single source, or LTP, needs no merging
+  if (winners == 1 || u.mode == DMXMergeMode::kLTP) {
+    recv_->universe(u.protocol, u.number, latest->slots, latest->count);
+    return;
+  }
+
+  // HTP: the highest level for each slot; missing slots count as zero
+  uint8_t *out = u.buf.get();
+  size_t count = 0;
+  bool first = true;
+  for (size_t i = 0; i < maxSources_; i++) {
+    const Source &s = u.sources[i];
+    if (!s.active || s.priority != maxPriority) {
+      continue;
+    }
+    if (first) {
+      std::memcpy(out, s.slots, s.count);
+      count = s.count;
+      first = false;
+      continue;
+    }
+    // A local pointer, so that the stores to 'out' don't force a reload
+    const uint8_t *const in = s.slots;
+    const size_t n = std::min(count, s.count);
+    for (size_t j = 0; j < n; j++) {
+      out[j] = std::max(out[j], in[j]);
+    }
+    if (s.count > count) {
+      std::memcpy(&out[count], &s.slots[count], s.count - count);
+      count = s.count;
+    }
+  }
+  recv_->universe(u.protocol, u.number, out, count);
+}
+
+void DMXServer::processSync(DMXProtocol protocol, uint16_t syncAddress) {
+  const uint32_t now = sys_now();
+  syncCount_++;
+
+  if (protocol == DMXProtocol::kArtNet) {
+    artSyncSeen_ = true;
+    artSyncTime_ = now;
+  } else {
+    bool found = false;
+    for (SyncGroup &g : syncGroups_) {
+      if (g.address == syncAddress) {
+        g.seen = true;
+        g.lastTime = now;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      // Not for any of the universes
+      return;
+    }
+  }
+
+  for (Universe &u : universes_) {
+    if (u.protocol != protocol || !u.dirty) {
+      continue;
+    }
+    if (protocol == DMXProtocol::kSACN && u.syncAddress != syncAddress) {
+      continue;
+    }
+    output(u);
+  }
+  if (recv_ != nullptr) {
+    recv_->sync(protocol, syncAddress);
+  }
+}
+
+// --------------------------------------------------------------------------
+//  Housekeeping
+// --------------------------------------------------------------------------
+
+void DMXServer::loop() {
+  if (!started_) {
+    return;
+  }
+
+  const uint32_t now = sys_now();
+
+  for (Universe &u : universes_) {
+    // Drop silent sources
+    for (size_t i = 0; i < maxSources_; i++) {
+      Source &s = u.sources[i];
+      if (s.active && (now - s.lastTime) >= sourceTimeout_) {
+        removeSource(u, s);
+      }
+    }
+
+    // Pass on data that was held for a sync that didn't come
+    if (u.dirty && !isHeld(u)) {
+      output(u);
+    }
+
+    // Track the sACN sync addresses in use
+    if (u.protocol == DMXProtocol::kSACN && u.syncAddress != 0) {
+      auto it = std::find_if(syncGroups_.begin(), syncGroups_.end(),
+                             [&u](const SyncGroup &g) {
+                               return g.address == u.syncAddress;
+                             });
+      if (it == syncGroups_.end()) {
+        syncGroups_.push_back(SyncGroup{u.syncAddress, false, false, 0});
+        it = syncGroups_.end() - 1;
+      }
+      if (!it->joined) {
+        // Sync packets are multicast to the sync address's universe
+        it->joined = joinSACN(u.syncAddress);
+      }
+    }
+  }
+
+  // Leave sync groups that are no longer used
+  for (auto it = syncGroups_.begin(); it != syncGroups_.end();) {
+    const uint16_t address = it->address;
+    const bool used = std::any_of(
+        universes_.begin(), universes_.end(), [address](const Universe &u) {
+          return u.protocol == DMXProtocol::kSACN && u.syncAddress == address;
+        });
+    if (used) {
+      ++it;
+      continue;
+    }
+    if (it->joined) {
+      leaveSACN(address);
+    }
+    it = syncGroups_.erase(it);
+  }
+}
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP
@@ -0,0 +1,261 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNDMXServer.h defines a receiver for DMX over sACN (E1.31) and Art-Net.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_UDP
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <IPAddress.h>
+
+#include "QNEthernetUDP.h"
+
+namespace qindesign {
+namespace network {
+
+// Lighting control protocols.
+enum class DMXProtocol {
+  kSACN,    // ANSI E1.31, port 5568
+  kArtNet,  // Art-Net 4, port 6454
+};
+
+// How data from sources with the same priority is combined.
+enum class DMXMergeMode {
+  kHTP,  // Highest takes precedence, per slot
+  kLTP,  // Latest takes precedence: the last packet wins
+};
+
+// DMXReceiver handles merged universe data.
+class DMXReceiver {
+ public:
+  DMXReceiver() = default;
+  virtual ~DMXReceiver() = default;
+
+  // Avoid slicing
+  DMXReceiver(const DMXReceiver &) = delete;
+  DMXReceiver &operator=(const DMXReceiver &) = delete;
+
+  // Processes new data for a universe. The slots don't include the START code.
+  // The data is only valid during the call.
+  virtual void universe(DMXProtocol protocol, uint16_t universe,
+                        const uint8_t *slots, size_t count) = 0;
+
+  // Called after the universes waiting for a synchronization packet have been
+  // passed to universe(), so that their outputs can be updated together. The
+  // sync address is zero for Art-Net.
+  virtual void sync(DMXProtocol protocol, uint16_t syncAddress) {
+    (void)protocol;
+    (void)syncAddress;
+  }
+
+  // Called when the last source of a universe has stopped sending.
+  virtual void universeLost(DMXProtocol protocol, uint16_t universe) {
+    (void)protocol;
+    (void)universe;
+  }
+};
+
+// DMXServer receives sACN and Art-Net DMX data for a set of universes.
+//
+// There's one UDP socket per protocol, no matter how many universes are
+// received; packets are sorted by the universe number in their headers.
+// Packets are processed as they arrive, from inside Ethernet.loop(), using the
+// EthernetUDP packet handler.
+//
+// Each universe tracks up to a fixed number of sources. Data from the sources
+// with the highest priority is merged, either HTP or LTP, and the result is
+// passed to the receiver. A source is dropped after it stops sending for the
+// source timeout or when it says it's terminating its stream.
+//
+// sACN universes are received by joining their multicast groups, which are
+// limited by MEMP_NUM_IGMP_GROUP. Art-Net data is received when it's sent to
+// this device or broadcast. ArtPoll isn't answered.
+//
+// Synchronization: sACN data with a synchronization address, and Art-Net data
+// after an ArtSync has been seen, is held until the matching sync packet
+// arrives. If sync packets stop arriving, data is passed on immediately again.
+// sACN per-slot priorities (START code 0xDD) aren't supported; packets with
+// START codes other than zero are ignored.
+class DMXServer final {
+ public:
+  static constexpr uint16_t kSACNPort   = 5568;
+  static constexpr uint16_t kArtNetPort = 6454;
+
+  // Maximum number of slots in a universe.
+  static constexpr size_t kUniverseSize = 512;
+
+  // Creates a server that receives at most 'maxUniverses' universes, each
+  // with at most 'maxSources' sources.
+  DMXServer(size_t maxUniverses, size_t maxSources);
+
+  // Creates a server for up to 8 universes, each with up to 2 sources.
+  DMXServer() : DMXServer(8, 2) {}
+
+  ~DMXServer();
+
+  // Disallow copying
+  DMXServer(const DMXServer &) = delete;
+  DMXServer &operator=(const DMXServer &) = delete;
+
+  // Starts receiving for the added universes. This should be called whenever
+  // the Ethernet information changes. This returns whether successful.
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool begin(DMXReceiver *recv);
+
+  // Stops receiving. The universes are kept.
+  void end();
+
+  // Adds a universe. sACN universes are 1-63999 and Art-Net port addresses
+  // are 0-32767. If the server is running then any multicast group is joined
+  // now. This returns whether successful; it fails if the universe is out of
+  // range or already added, or if there's no room.
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool addUniverse(DMXProtocol protocol, uint16_t universe,
+                   DMXMergeMode mode = DMXMergeMode::kHTP);
+
+  // Removes a universe. This returns whether it was found.
+  bool removeUniverse(DMXProtocol protocol, uint16_t universe);
+
+  // Returns the number of universes.
+  size_t universeCount() const {
+    return universes_.size();
+  }
+
+  // Returns the number of active sources for a universe.
+  size_t sourceCount(DMXProtocol protocol, uint16_t universe) const;
+
+  // Sets how long, in milliseconds, a source may be silent before it's
+  // dropped. The default is 2500, from E1.31.
+  void setSourceTimeout(uint32_t timeout) {
+    sourceTimeout_ = timeout;
+  }
+
+  uint32_t sourceTimeout() const {
+    return sourceTimeout_;
+  }
+
+  // Drops silent sources and joins the multicast groups of sACN sync
+  // addresses. Call this regularly. Data is processed by Ethernet.loop().
+  void loop();
+
+  // Returns the number of data packets accepted for added universes.
+  uint32_t packetCount() const {
+    return packetCount_;
+  }
+
+  // Returns the number of packets dropped because they were malformed, out of
+  // sequence, or for a universe with no room for another source.
+  uint32_t droppedCount() const {
+    return droppedCount_;
+  }
+
+  // Returns the number of sync packets received.
+  uint32_t syncCount() const {
+    return syncCount_;
+  }
+
+  // Tests if the server has been started.
+  explicit operator bool() const {
+    return started_;
+  }
+
+ private:
+  struct Source final {
+    uint8_t id[16];         // sACN CID or Art-Net IP address
+    bool active = false;
+    uint8_t priority = 0;
+    uint8_t seq = 0;
+    uint32_t lastTime = 0;  // When the last packet arrived
+    uint32_t order = 0;     // Arrival order of the last packet, for LTP
+    size_t count = 0;       // Number of slots
+    uint8_t *slots = nullptr;
+  };
+
+  struct Universe final {
+    DMXProtocol protocol;
+    uint16_t number;
+    DMXMergeMode mode;
+    uint16_t syncAddress = 0;  // sACN sync address of the last packet
+    bool dirty = false;        // Has data that hasn't been passed on
+    std::unique_ptr<uint8_t[]> buf;  // Merged slots, then each source's
+    std::unique_ptr<Source[]> sources;
+  };
+
+  // Processes received packets.
+  void processSACN(const EthernetUDP::PacketView &packet);
+  void processArtNet(const EthernetUDP::PacketView &packet);
+
+  // Stores a source's data for a universe and passes it on if it isn't held.
+  // 'id' is 16 bytes.
+  void accept(Universe &u, const uint8_t id[16], uint8_t priority, uint8_t seq,
+              bool checkSeq, const uint8_t *slots, size_t count);
+
+  // Removes a source and passes on the remaining data.
+  void removeSource(Universe &u, Source &s);
+
+  // Returns whether a universe's data is currently held for a sync packet.
+  bool isHeld(const Universe &u) const;
+
+  // Merges a universe's sources and passes the result to the receiver.
+  void output(Universe &u);
+
+  // Handles a sync packet.
+  void processSync(DMXProtocol protocol, uint16_t syncAddress);
+
+  Universe *find(DMXProtocol protocol, uint16_t universe);
+
+  // Opens the socket for a protocol, if not already open.
+  bool startSocket(DMXProtocol protocol);
+
+  // Joins or leaves the multicast group for an sACN universe.
+  static bool joinSACN(uint16_t universe);
+  static void leaveSACN(uint16_t universe);
+
+  const size_t maxUniverses_;
+  const size_t maxSources_;
+  uint32_t sourceTimeout_ = 2'500;
+
+  bool started_ = false;
+  DMXReceiver *recv_ = nullptr;
+
+  EthernetUDP sacnUDP_;
+  EthernetUDP artNetUDP_;
+
+  std::vector<Universe> universes_;
+  uint32_t order_ = 0;
+
+  // sACN sync state
+  struct SyncGroup final {
+    uint16_t address;
+    bool joined;       // Whether this joined the group
+    bool seen;         // Whether a sync packet has been seen
+    uint32_t lastTime;
+  };
+  std::vector<SyncGroup> syncGroups_;
+
+  // Art-Net sync state
+  bool artSyncSeen_ = false;
+  uint32_t artSyncTime_ = 0;
+
+  // Counters
+  uint32_t packetCount_ = 0;
+  uint32_t droppedCount_ = 0;
+  uint32_t syncCount_ = 0;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP
@@ -21,6 +21,8 @@
 #include <avr/pgmspace.h>
 
 #include "QNDNSClient.h"
+#include "QNLogSink.h"
+#include "internal/ConnectionState.h"
 #include "lwip/arch.h"
 #include "lwip/dhcp.h"
 #include "lwip/err.h"
@@ -178,6 +180,15 @@ void EthernetClass::loop() {
     enet_poll();
     lastPollTime_ = sys_now();
   }
+
+#if LWIP_UDP || LWIP_TCP
+  LogSink::pollAll();
+#endif  // LWIP_UDP || LWIP_TCP
+
+#if LWIP_TCP
+  // Outside of any lwIP callback, so these may do anything
+  internal::ConnectionState::callCompletedPosted();
+#endif  // LWIP_TCP
 }
 
 bool EthernetClass::begin() {
@@ -14,11 +14,20 @@
 #include <IPAddress.h>
 #include <WString.h>
 
+#include "QNConnectionPool.h"
+#include "QNDMXServer.h"
 #include "QNEthernetClient.h"
 #include "QNEthernetFrame.h"
 #include "QNEthernetServer.h"
 #include "QNEthernetUDP.h"
+#include "QNHTTPServer.h"
+#include "QNLogSink.h"
 #include "QNMDNS.h"
+#include "QNMessageFramer.h"
+#include "QNOSC.h"
+#include "QNPixelPusherServer.h"
+#include "QNTFTP.h"
+#include "QNWebSocketServer.h"
 #include "StaticInit.h"
 #include "lwip/apps/mdns_opts.h"
 #include "lwip/dns.h"
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <cerrno>
 #include <cstring>
+#include <utility>
 
 #include "QNDNSClient.h"
 #include "QNEthernet.h"
@@ -22,13 +23,13 @@
 #include "lwip/dns.h"
 #include "lwip/err.h"
 #include "lwip/netif.h"
+#include "lwip/priv/tcp_priv.h"
 #include "lwip/sys.h"
-#if LWIP_ALTCP
 #include "lwip/tcp.h"
-#endif  // LWIP_ALTCP
 #include "qnethernet_opts.h"
 #include "util/PrintUtils.h"
 #include "util/ip_tools.h"
+#include "util/mem_tools.h"
 
 extern "C" void yield();
 
@@ -46,6 +47,7 @@ EthernetClient::EthernetClient() : EthernetClient(nullptr) {}
 
 EthernetClient::EthernetClient(std::shared_ptr<internal::ConnectionHolder> conn)
     : connTimeout_(1000),
+      corkTimeout_(200),
       pendingConnect_(false),
       conn_(conn) {}
 
@@ -84,6 +86,20 @@ int EthernetClient::connect(const char *host, uint16_t port) {
 #endif  // LWIP_DNS
 }
 
+bool EthernetClient::connect(const IPAddress &ip, uint16_t port,
+                             const uint8_t *data, size_t size) {
+#if LWIP_IPV4
+  ip_addr_t ipaddr IPADDR4_INIT(get_uint32(ip));
+  return connect(&ipaddr, port, true, data, size);
+#else
+  LWIP_UNUSED_ARG(ip);
+  LWIP_UNUSED_ARG(port);
+  LWIP_UNUSED_ARG(data);
+  LWIP_UNUSED_ARG(size);
+  return false;
+#endif  // LWIP_IPV4
+}
+
 bool EthernetClient::connectNoWait(const IPAddress &ip, uint16_t port) {
 #if LWIP_IPV4
   ip_addr_t ipaddr IPADDR4_INIT(get_uint32(ip));
@@ -95,6 +111,20 @@ bool EthernetClient::connectNoWait(const IPAddress &ip, uint16_t port) {
 #endif  // LWIP_IPV4
 }
 
+bool EthernetClient::connectNoWait(const IPAddress &ip, uint16_t port,
+                                   const uint8_t *data, size_t size) {
+#if LWIP_IPV4
+  ip_addr_t ipaddr IPADDR4_INIT(get_uint32(ip));
+  return connect(&ipaddr, port, false, data, size);
+#else
+  LWIP_UNUSED_ARG(ip);
+  LWIP_UNUSED_ARG(port);
+  LWIP_UNUSED_ARG(data);
+  LWIP_UNUSED_ARG(size);
+  return false;
+#endif  // LWIP_IPV4
+}
+
 bool EthernetClient::connectNoWait(const char *host, uint16_t port) {
 #if LWIP_DNS
   IPAddress ip;
@@ -111,11 +141,13 @@ bool EthernetClient::connectNoWait(const char *host, uint16_t port) {
 #endif  // LWIP_DNS
 }
 
-bool EthernetClient::connect(const ip_addr_t *ipaddr, uint16_t port, bool wait) {
+bool EthernetClient::connect(const ip_addr_t *ipaddr, uint16_t port, bool wait,
+                             const uint8_t *data, size_t size) {
   // First close any existing connection (without waiting)
   close();
 
-  conn_ = internal::ConnectionManager::instance().connect(ipaddr, port);
+  conn_ = internal::ConnectionManager::instance().connect(ipaddr, port,
+                                                          data, size);
   if (conn_ == nullptr) {
     return false;
   }
@@ -221,6 +253,113 @@ bool EthernetClient::isNoDelay() {
   return altcp_nagle_disabled(state->pcb);
 }
 
+bool EthernetClient::isKeepAlive() const {
+  if (conn_ == nullptr) {
+    return false;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
+  }
+  const tcp_pcb *tpcb = internal::innermostTCPPCB(state->pcb);
+  if (tpcb == nullptr) {
+    return false;
+  }
+  return ip_get_option(tpcb, SOF_KEEPALIVE);
+}
+
+bool EthernetClient::setCork(bool flag) {
+  if (conn_ == nullptr) {
+    return false;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
+  }
+  if (flag) {
+    state->corkTimeout = corkTimeout_;
+    state->corkBuf.reserve(altcp_mss(state->pcb));
+  } else {
+    state->pushCorked();
+  }
+  state->corked = flag;
+  return true;
+}
+
+bool EthernetClient::isCork() const {
+  if (conn_ == nullptr) {
+    return false;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
+  }
+  return state->corked;
+}
+
+void EthernetClient::setCorkTimeout(uint32_t timeout) {
+  timeout = std::max(timeout, uint32_t{1});
+  corkTimeout_ = timeout;
+  if (conn_ != nullptr && conn_->state != nullptr) {
+    conn_->state->corkTimeout = timeout;
+  }
+}
+
+bool EthernetClient::setAckPolicy(AckPolicy policy, uint16_t quickCount,
+                                  uint32_t quickIdle) {
+  if (conn_ == nullptr) {
+    return false;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
+  }
+  state->setAckPolicy(policy, quickCount, quickIdle);
+  return true;
+}
+
+AckPolicy EthernetClient::ackPolicy() const {
+  if (conn_ == nullptr) {
+    return AckPolicy::kDelayed;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return AckPolicy::kDelayed;
+  }
+  return state->ackPolicy;
+}
+
+bool EthernetClient::setCongestionControl(CongestionControl cc) {
+  if (conn_ == nullptr) {
+    return false;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
+  }
+  tcp_pcb *tpcb = internal::innermostTCPPCB(state->pcb);
+  if (tpcb == nullptr) {
+    return false;
+  }
+  tcp_set_cc(tpcb, internal::toTCPCC(cc));
+  return true;
+}
+
+CongestionControl EthernetClient::congestionControl() const {
+  if (conn_ == nullptr) {
+    return CongestionControl::kDefault;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return CongestionControl::kDefault;
+  }
+  const tcp_pcb *tpcb = internal::innermostTCPPCB(state->pcb);
+  if (tpcb == nullptr) {
+    return CongestionControl::kDefault;
+  }
+  return internal::fromTCPCC(tpcb->cc);
+}
+
 bool EthernetClient::setOutgoingDiffServ(uint8_t ds) {
   if (conn_ == nullptr) {
     return false;
@@ -231,15 +370,11 @@ bool EthernetClient::setOutgoingDiffServ(uint8_t ds) {
     return false;
   }
 
-#if LWIP_ALTCP
-  altcp_pcb *innermost = state->pcb;
-  while (innermost->inner_conn != nullptr) {
-    innermost = innermost->inner_conn;
+  tcp_pcb *tpcb = internal::innermostTCPPCB(state->pcb);
+  if (tpcb == nullptr) {
+    return false;
   }
-  static_cast<tcp_pcb *>(innermost->state)->tos = ds;
-#else
-  state->pcb->tos = ds;
-#endif  // LWIP_ALTCP
+  tpcb->tos = ds;
   return true;
 }
 
@@ -253,21 +388,144 @@ uint8_t EthernetClient::outgoingDiffServ() const {
     return 0;
   }
 
-#if LWIP_ALTCP
-  altcp_pcb *innermost = state->pcb;
-  while (innermost->inner_conn != nullptr) {
-    innermost = innermost->inner_conn;
+  const tcp_pcb *tpcb = internal::innermostTCPPCB(state->pcb);
+  if (tpcb == nullptr) {
+    return 0;
+  }
+  return tpcb->tos;
+}
+
+// Counts the segments in the given queue.
+static uint16_t countSegs(const struct tcp_seg *seg) {
+  uint16_t count = 0;
+  for (; seg != nullptr; seg = seg->next) {
+    count++;
+  }
+  return count;
+}
+
+bool EthernetClient::tcpInfo(TCPInfo &info) const {
+  if (conn_ == nullptr) {
+    return false;
+  }
+
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
   }
-  return static_cast<tcp_pcb *>(innermost->state)->tos;
+
+  const tcp_pcb *tpcb = internal::innermostTCPPCB(state->pcb);
+  if (tpcb == nullptr) {
+    return false;
+  }
+
+  info.state = tpcb->state;
+
+  // 'sa' is 8 times the smoothed RTT and 'sv' is 4 times the variance, both in
+  // slow timer ticks
+  info.rtt    = uint32_t(tpcb->sa >> 3) * TCP_SLOW_INTERVAL;
+  info.rttVar = uint32_t(tpcb->sv >> 2) * TCP_SLOW_INTERVAL;
+  info.rto    = uint32_t(tpcb->rto) * TCP_SLOW_INTERVAL;
+
+  info.cwnd     = tpcb->cwnd;
+  info.ssthresh = tpcb->ssthresh;
+  info.sndWnd   = tpcb->snd_wnd;
+  info.rcvWnd   = tpcb->rcv_wnd;
+  info.mss      = tpcb->mss;
+
+  info.bytesInFlight = tpcb->snd_nxt - tpcb->lastack;
+  info.sndQueueLen   = tpcb->snd_queuelen;
+  info.unsentSegs    = countSegs(tpcb->unsent);
+  info.unackedSegs   = countSegs(tpcb->unacked);
+#if TCP_QUEUE_OOSEQ
+  info.ooseqSegs = countSegs(tpcb->ooseq);
 #else
-  return state->pcb->tos;
-#endif  // LWIP_ALTCP
+  info.ooseqSegs = 0;
+#endif  // TCP_QUEUE_OOSEQ
+
+  info.retransmits      = tpcb->nrtx;
+  info.dupAcks          = tpcb->dupacks;
+  info.zeroWindowProbes = tpcb->persist_probe;
+
+  info.sndBufUsed = TCP_SND_BUF - tpcb->snd_buf;
+  info.rcvBufUsed = state->buf.size() - state->bufPos;
+
+  return true;
+}
+
+bool EthernetClient::splice(EthernetClient &to) {
+  if (conn_ == nullptr || to.conn_ == nullptr) {
+    return false;
+  }
+  return internal::ConnectionManager::instance().splice(conn_, to.conn_);
+}
+
+void EthernetClient::unsplice() {
+  if (conn_ == nullptr) {
+    return;
+  }
+  const auto &state = conn_->state;
+  if (state != nullptr) {
+    state->unsplice(true);
+  }
+}
+
+bool EthernetClient::isSpliced() const {
+  if (conn_ == nullptr) {
+    return false;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
+  }
+  return (state->spliceTo != nullptr);
+}
+
+bool EthernetClient::postReceive(
+    uint8_t *buf, size_t size,
+    std::function<void(uint8_t *buf, size_t len)> callback,
+    uint32_t idleTimeout) {
+  if (buf == nullptr || size == 0 || conn_ == nullptr) {
+    return false;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return false;
+  }
+  state->postReceive(buf, size, std::move(callback), idleTimeout);
+  return true;
+}
+
+size_t EthernetClient::postedReceiveCount() const {
+  if (conn_ == nullptr) {
+    return 0;
+  }
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return 0;
+  }
+  return state->posted.size();
 }
 
 void EthernetClient::stop() {
   close(true);
 }
 
+// Writes out any corked data before the connection stops sending. Anything
+// that still doesn't fit after moving the stack along is discarded. This may
+// reset the state.
+static void finishCorked(
+    const std::unique_ptr<internal::ConnectionState> &state) {
+  if (state->pushCorked()) {
+    return;
+  }
+  Ethernet.loop();  // Allow ACKs to free some space
+  if (state != nullptr && !state->pushCorked()) {
+    state->stopCorkTimer();
+    state->corkBuf.clear();
+  }
+}
+
 void EthernetClient::close() {
   close(false);
 }
@@ -292,6 +550,11 @@ void EthernetClient::close(bool wait) {
   if (pendingConnect_ || conn_->connected) {
     if (!pendingConnect_) {
       // First try to flush any data
+      finishCorked(state);
+      if (state == nullptr) {
+        conn_ = nullptr;
+        return;
+      }
       altcp_output(state->pcb);
       Ethernet.loop();  // Maybe some TCP data gets in
       // NOTE: loop() requires a re-check of the state
@@ -333,6 +596,10 @@ void EthernetClient::closeOutput() {
   }
 
   // First try to flush any data
+  finishCorked(state);
+  if (state == nullptr) {
+    return;
+  }
   altcp_output(state->pcb);
   Ethernet.loop();  // Maybe some TCP data gets in
   // NOTE: loop() requires a re-check of the state
@@ -448,6 +715,11 @@ size_t EthernetClient::write(uint8_t b) {
 }
 
 size_t EthernetClient::write(const uint8_t *buf, size_t size) {
+  const IOVec iov{buf, size};
+  return writev(&iov, 1);
+}
+
+size_t EthernetClient::writev(const IOVec *iov, size_t count) {
   if (!static_cast<bool>(*this)) {
     return 0;
   }
@@ -457,11 +729,150 @@ size_t EthernetClient::write(const uint8_t *buf, size_t size) {
     return 0;
   }
 
+  if (iov == nullptr) {
+    count = 0;
+  }
+  size_t size = iovecSize(iov, count);
   if (size == 0) {
     Ethernet.loop();  // Loop to allow incoming TCP data
     return 0;
   }
 
+  // Hold data until there's a full segment
+  if (state->corked) {
+    const size_t mss = altcp_mss(state->pcb);
+    auto &v = state->corkBuf;
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++) {
+      const uint8_t *buf = iov[i].data;
+      size_t segWritten = 0;
+      while (segWritten < iov[i].size) {
+        size_t n = std::min(iov[i].size - segWritten,
+                            mss - std::min(mss, v.size()));
+        v.insert(v.end(), &buf[segWritten], &buf[segWritten + n]);
+        segWritten += n;
+        if (v.size() >= mss && !state->pushCorked()) {
+          break;
+        }
+      }
+      written += segWritten;
+      if (segWritten < iov[i].size) {
+        break;
+      }
+    }
+    if (!v.empty()) {
+      state->startCorkTimer();
+    }
+    Ethernet.loop();  // Loop to allow incoming TCP data
+    return written;
+  }
+
+  // Corked data that was left over goes first
+  if (!state->pushCorked()) {
+    Ethernet.loop();  // Loop to allow incoming data
+    return 0;
+  }
+
+  size_t sndBufSize = altcp_sndbuf(state->pcb);
+  if (sndBufSize == 0) {  // Possibly flush if there's no space
+    altcp_output(state->pcb);
+    Ethernet.loop();  // Loop to allow incoming data
+    if (state == nullptr) {  // Re-check the state
+      return 0;
+    }
+    sndBufSize = altcp_sndbuf(state->pcb);
+  }
+  size = std::min(size, sndBufSize);
+
+  // Enqueue the segments as one write; TCP_WRITE_FLAG_MORE keeps PSH off all
+  // but the last part, and lwIP fills each TCP segment from successive parts
+  size_t written = 0;
+  for (size_t i = 0; i < count && written < size; i++) {
+    size_t n = std::min(iov[i].size, size - written);
+    if (n == 0) {
+      continue;
+    }
+    u8_t flags = TCP_WRITE_FLAG_COPY;
+    if (written + n < size) {
+      flags |= TCP_WRITE_FLAG_MORE;
+    }
+    err_t err;
+    if ((err = altcp_write(state->pcb, iov[i].data, n, flags)) != ERR_OK) {
+      if (written == 0) {
+        errno = err_to_errno(err);
+      } else {
+        // What's queued was written expecting more, so nothing else would
+        // push it out
+        altcp_output(state->pcb);
+      }
+      break;
+    }
+    written += n;
+  }
+#if QNETHERNET_FLUSH_AFTER_WRITE
+  if (written > 0) {
+    altcp_output(state->pcb);
+  }
+#endif  // QNETHERNET_FLUSH_AFTER_WRITE
+
+  Ethernet.loop();  // Loop to allow incoming TCP data
+  return written;
+}
+
+size_t EthernetClient::writevFully(const IOVec *iov, size_t count) {
+  size_t total = 0;
+  while (count > 0 && static_cast<bool>(*this)) {
+    size_t n = writev(iov, count);
+    total += n;
+
+    // Skip the segments that were completely written
+    while (count > 0 && n >= iov->size) {
+      n -= iov->size;
+      iov++;
+      count--;
+    }
+
+    // Finish any partly-written segment on its own
+    if (count > 0 && n > 0) {
+      size_t rem = iov->size - n;
+      size_t written = writeFully(iov->data + n, rem);
+      total += written;
+      if (written < rem) {
+        break;
+      }
+      iov++;
+      count--;
+    }
+  }
+  return total;
+}
+
+size_t EthernetClient::writeRef(const uint8_t *buf, size_t size) {
+  if (!static_cast<bool>(*this)) {
+    return 0;
+  }
+
+  const auto &state = conn_->state;
+  if (state == nullptr) {
+    return 0;
+  }
+
+  // Corked data is gathered into a buffer anyway
+  if (state->corked) {
+    return write(buf, size);
+  }
+
+  if (size == 0) {
+    Ethernet.loop();  // Loop to allow incoming TCP data
+    return 0;
+  }
+
+  // Corked data that was left over goes first
+  if (!state->pushCorked()) {
+    Ethernet.loop();  // Loop to allow incoming data
+    return 0;
+  }
+
   size_t sndBufSize = altcp_sndbuf(state->pcb);
   if (sndBufSize == 0) {  // Possibly flush if there's no space
     altcp_output(state->pcb);
@@ -473,8 +884,9 @@ size_t EthernetClient::write(const uint8_t *buf, size_t size) {
   }
   size = std::min(size, sndBufSize);
   if (size > 0) {
+    // Without TCP_WRITE_FLAG_COPY, lwIP references the data in a PBUF_ROM
     err_t err;
-    if ((err = altcp_write(state->pcb, buf, size, TCP_WRITE_FLAG_COPY)) != ERR_OK) {
+    if ((err = altcp_write(state->pcb, buf, size, 0)) != ERR_OK) {
       errno = err_to_errno(err);
       size = 0;
     }
@@ -518,6 +930,9 @@ void EthernetClient::flush() {
     return;
   }
 
+  // Flushing also removes the cork
+  state->corked = false;
+  state->pushCorked();
   altcp_output(state->pcb);
   Ethernet.loop();  // Loop to allow incoming TCP data
 }
@@ -690,6 +1105,123 @@ int EthernetClient::peek() {
   return state->buf[state->bufPos];
 }
 
+const uint8_t *EthernetClient::readableSpan(size_t &size) {
+  size = 0;
+  if (conn_ == nullptr) {
+    return nullptr;
+  }
+
+  // For non-blocking connect
+  if (pendingConnect_) {
+    watchPendingConnect();
+    return nullptr;
+  }
+
+  if (conn_->remaining.empty()) {
+    if (!conn_->connected) {
+      conn_ = nullptr;
+      return nullptr;
+    }
+    if (conn_->state != nullptr) {
+      Ethernet.loop();  // Allow data to come in
+    }
+  }
+
+  // NOTE: loop() may have moved unread data into 'remaining'
+  if (!conn_->remaining.empty()) {
+    size = conn_->remaining.size() - conn_->remainingPos;
+    return &conn_->remaining[conn_->remainingPos];
+  }
+
+  const auto &state = conn_->state;
+  if (!conn_->connected || !isAvailable(state)) {
+    return nullptr;
+  }
+  size = state->buf.size() - state->bufPos;
+  return &state->buf[state->bufPos];
+}
+
+size_t EthernetClient::consume(size_t n) {
+  if (conn_ == nullptr) {
+    return 0;
+  }
+
+  auto &rem = conn_->remaining;
+  if (!rem.empty()) {
+    n = std::min(n, rem.size() - conn_->remainingPos);
+    conn_->remainingPos += n;
+    if (conn_->remainingPos >= rem.size()) {
+      rem.clear();
+      conn_->remainingPos = 0;
+    }
+    return n;
+  }
+
+  const auto &state = conn_->state;
+  if (!isAvailable(state)) {
+    return 0;
+  }
+  n = std::min(n, state->buf.size() - state->bufPos);
+  state->bufPos += n;
+  return n;
+}
+
+void EthernetClient::setBufferPinned(bool flag) {
+  if (conn_ != nullptr) {
+    conn_->bufPinned = flag;
+  }
+}
+
+size_t EthernetClient::bufferCapacity() const {
+  // The buffer reserves TCP_WND bytes; see ConnectionState
+  if (conn_ == nullptr || conn_->state == nullptr) {
+    return TCP_WND;
+  }
+  return conn_->state->buf.capacity();
+}
+
+int EthernetClient::findDelimiter(uint8_t delim) {
+  size_t size;
+  const uint8_t *data = readableSpan(size);
+  if (data == nullptr) {
+    return -1;
+  }
+  const void *p = std::memchr(data, delim, size);
+  if (p == nullptr) {
+    return -1;
+  }
+  return static_cast<const uint8_t *>(p) - data;
+}
+
+int EthernetClient::findDelimiter(const char *delim) {
+  if (delim == nullptr) {
+    return -1;
+  }
+  size_t size;
+  const uint8_t *data = readableSpan(size);
+  return mem_find(data, size, reinterpret_cast<const uint8_t *>(delim),
+                  std::strlen(delim));
+}
+
+const uint8_t *EthernetClient::readUntil(uint8_t delim, size_t &size) {
+  size_t avail;
+  const uint8_t *data = readableSpan(avail);
+  size = 0;
+  if (data == nullptr) {
+    return nullptr;
+  }
+  const void *p = std::memchr(data, delim, avail);
+  if (p == nullptr) {
+    return nullptr;
+  }
+  size = static_cast<const uint8_t *>(p) - data + 1;
+
+  // Consuming doesn't move or free the data; that only happens when the
+  // stack is moved along
+  consume(size);
+  return data;
+}
+
 #if !LWIP_ALTCP || defined(LWIP_DEBUG)
 // LWIP_DEBUG is required for altcp_dbg_get_tcp_state(), but not for
 // tcp_dbg_get_tcp_state(), for some reason
@@ -13,6 +13,7 @@
 // C++ includes
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
 
 #include <Client.h>
@@ -22,8 +23,10 @@
 #include "internal/ConnectionHolder.h"
 #include "internal/DiffServ.h"
 #include "internal/PrintfChecked.h"
+#include "internal/SocketOptions.h"
 #include "lwip/ip_addr.h"
 #include "lwip/tcpbase.h"
+#include "util/IOVec.h"
 
 namespace qindesign {
 namespace network {
@@ -32,7 +35,7 @@ class EthernetServer;
 
 class EthernetClient : public Client,
                        public internal::DiffServ,
-                       public internal::PrintfChecked {
+                       public internal::PrintfChecked<EthernetClient> {
  public:
   EthernetClient();
   ~EthernetClient();
@@ -59,10 +62,29 @@ class EthernetClient : public Client,
   // If this returns false and there was an error then errno will be set.
   int connect(const char *host, uint16_t port) final;
 
+  // Connects and queues initial data before the SYN is sent. This uses TCP
+  // Fast Open (RFC 7413) if LWIP_TCP_FASTOPEN is enabled: if the server gave
+  // this client a cookie on an earlier connection then the start of the data
+  // goes with the SYN, otherwise the SYN asks for a cookie and the data leaves
+  // with the ACK that completes the handshake. Fast Open isn't used over TLS or
+  // hardware TCP sockets. All the data must fit in the send buffer, see
+  // availableForWrite().
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool connect(const IPAddress &ip, uint16_t port,
+               const uint8_t *data, size_t size);
+
   // Starts the connection process but doesn't wait for the connection to
   // be complete.
   bool connectNoWait(const IPAddress &ip, uint16_t port);
 
+  // Starts the connection process with initial data but doesn't wait for the
+  // connection to be complete. See connect(ip, port, data, size).
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool connectNoWait(const IPAddress &ip, uint16_t port,
+                     const uint8_t *data, size_t size);
+
   // Starts the connection process but doesn't wait for the connection to
   // be complete. Note that DNS lookup might still take some time.
   //
@@ -127,7 +149,7 @@ class EthernetClient : public Client,
   size_t writeFully(const uint8_t *buf, size_t size);
 
   // Use the one from here instead of the one from Print
-  using internal::PrintfChecked::printf;
+  using internal::PrintfChecked<EthernetClient>::printf;
 
   // If this returns zero and there was an error then errno will be set.
   size_t write(uint8_t b) final;
@@ -135,6 +157,27 @@ class EthernetClient : public Client,
   // If this returns zero and there was an error then errno will be set.
   size_t write(const uint8_t *buf, size_t size) final;
 
+  // Writes the given segments, in order, as one write. This avoids copying them
+  // into one buffer first and avoids the extra TCP segments that separate
+  // write() calls could cause. Like write(), this may write fewer bytes than the
+  // total if there isn't enough space in the send buffer; the return value is
+  // the number of bytes written from the front of the segment list.
+  //
+  // If this returns zero and there was an error then errno will be set.
+  size_t writev(const IOVec *iov, size_t count);
+
+  // Like writev(), but loops until all the segments are written or the
+  // connection is closed. This returns the number of bytes written.
+  size_t writevFully(const IOVec *iov, size_t count);
+
+  // Writes data without copying it into the send buffer. The data is
+  // referenced until it's acknowledged, so it must stay valid and unchanged for
+  // as long as the connection exists; for example, constant data in flash.
+  // Otherwise, this behaves like write(). In cork mode the data is copied.
+  //
+  // If this returns zero and there was an error then errno will be set.
+  size_t writeRef(const uint8_t *buf, size_t size);
+
   int availableForWrite() final;
   void flush() final;
 
@@ -147,6 +190,46 @@ class EthernetClient : public Client,
 
   int peek() final;
 
+  // ------------------
+  //  In-Place Parsing
+  // ------------------
+
+  // Returns a view of the received data that hasn't been read yet, without
+  // copying it. The size is returned in 'size'. This moves the stack along
+  // once and returns NULL if there's no data.
+  //
+  // The view is only valid until the next call that moves the stack along,
+  // for example, any of the reading functions or Ethernet.loop(), because new
+  // data may cause the buffer to be rearranged.
+  const uint8_t *readableSpan(size_t &size);
+
+  // Removes up to 'n' bytes from the front of the received data without
+  // moving the stack along. This returns the number of bytes removed.
+  size_t consume(size_t n);
+
+  // Returns the most received data that can be buffered, and so the largest
+  // span that readableSpan() can return.
+  size_t bufferCapacity() const;
+
+  // Returns the offset of the first 'delim' in the received data, or -1 if
+  // it's not there. This moves the stack along once.
+  int findDelimiter(uint8_t delim);
+
+  // Returns the offset of the first occurrence of the NUL-terminated 'delim'
+  // in the received data, or -1 if it's not there or is empty. This moves the
+  // stack along once.
+  int findDelimiter(const char *delim);
+
+  // Consumes the received data up to and including the first 'delim' and
+  // returns a view of it, including the delimiter. The size is returned in
+  // 'size'. This moves the stack along once and returns NULL if there's no
+  // delimiter yet. The view is valid for as long as one from readableSpan().
+  //
+  // Use readableSpan() to get at data without a delimiter, for example, the
+  // last line before the connection was closed, or a line that's too long to
+  // fit in the receive buffer.
+  const uint8_t *readUntil(uint8_t delim, size_t &size);
+
 #if !LWIP_ALTCP || defined(LWIP_DEBUG)
   // Returns one of the TCP states from:
   // [RFC 9293, Section 3.3.2](https://www.rfc-editor.org/rfc/rfc9293#name-state-machine-overview)
@@ -170,6 +253,71 @@ class EthernetClient : public Client,
   // returns false if not connected.
   bool isNoDelay();
 
+  // Returns whether SO_KEEPALIVE is set for the current connection. This
+  // returns false if not connected or if there's no underlying lwIP TCP PCB.
+  bool isKeepAlive() const;
+
+  // Enables or disables cork mode. While corked, written data is held until
+  // there's a full segment, the cork is removed, flush() is called, or the cork
+  // timeout passes since data was first held. flush() sends what's held and
+  // ends cork mode, like setCork(false). The timeout sends what's held but
+  // leaves cork mode on, so later writes are held again. This works with altcp
+  // and with or without Nagle's algorithm. Note that this option must be set
+  // for each new connection.
+  //
+  // This returns true if connected and the option was set, and false otherwise.
+  bool setCork(bool flag);
+
+  // Returns whether cork mode is enabled for the current connection. This
+  // returns false if not connected.
+  bool isCork() const;
+
+  // Sets the cork timeout, in milliseconds. The default is 200ms. This applies
+  // to the current connection and to any later ones. The timeout is checked
+  // about 8 times a second. A timeout of zero is set as 1ms.
+  void setCorkTimeout(uint32_t timeout);
+
+  // Returns the cork timeout, in milliseconds.
+  uint32_t corkTimeout() const {
+    return corkTimeout_;
+  }
+
+  // Sets how received data is acknowledged. AckPolicy::kDelayed is lwIP's
+  // default of acknowledging every second full segment or on the next fast
+  // timer tick, AckPolicy::kImmediate acknowledges every segment as soon as
+  // it's received, and AckPolicy::kQuick acknowledges the first 'quickCount'
+  // segments immediately, and again after the connection has been idle for
+  // 'quickIdle' milliseconds, and delays otherwise. Note that this option must
+  // be set for each new connection.
+  //
+  // This returns true if connected and the option was set, and false otherwise.
+  bool setAckPolicy(AckPolicy policy,
+                    uint16_t quickCount = internal::kDefaultQuickAckCount,
+                    uint32_t quickIdle = internal::kDefaultQuickAckIdle);
+
+  // Returns the ACK policy for the current connection. This returns
+  // AckPolicy::kDelayed if not connected.
+  AckPolicy ackPolicy() const;
+
+  // Sets the congestion control algorithm for the current connection.
+  // CongestionControl::kLAN starts with a 10-segment window instead of about 3,
+  // which sends most short responses in one round trip, but a burst that size
+  // can overflow a switch with small buffers. CongestionControl::kLANDelay also
+  // backs off when the round-trip time rises LWIP_TCP_CC_DELAY_TARGET
+  // milliseconds above the smallest seen, which keeps queues short on slow
+  // links. The initial window only applies if this is set before the
+  // handshake completes, for example right after connectNoWait(); for servers,
+  // use EthernetServer::setCongestionControl(). Note that this option must be
+  // set for each new connection.
+  //
+  // This returns true if connected and the option was set, and false
+  // otherwise, including if there's no underlying lwIP TCP PCB.
+  bool setCongestionControl(CongestionControl cc);
+
+  // Returns the congestion control algorithm for the current connection. This
+  // returns CongestionControl::kDefault if not connected.
+  CongestionControl congestionControl() const;
+
   // Sets the differentiated services (DiffServ, DS) field in the outgoing IP
   // header. The top 6 bits are the differentiated services code point (DSCP)
   // value, and the bottom 2 bits are the explicit congestion notification
@@ -184,13 +332,113 @@ class EthernetClient : public Client,
   // header. This will return zero if not connected.
   uint8_t outgoingDiffServ() const final;
 
+  // ---------------
+  //  Introspection
+  // ---------------
+
+  // TCP connection internals, similar to Linux's TCP_INFO. Times are in
+  // milliseconds and have the resolution of lwIP's TCP slow timer. lwIP doesn't
+  // keep lifetime counters, so the retransmission, duplicate ACK, and
+  // zero-window values only describe the current episode.
+  struct TCPInfo final {
+    tcp_state state;
+
+    uint32_t rtt;     // Smoothed round-trip time
+    uint32_t rttVar;  // Round-trip time variance
+    uint32_t rto;     // Retransmission timeout
+
+    uint32_t cwnd;      // Congestion window
+    uint32_t ssthresh;  // Slow start threshold
+    uint32_t sndWnd;    // Peer's advertised receive window
+    uint32_t rcvWnd;    // Our receive window
+    uint16_t mss;
+
+    uint32_t bytesInFlight;  // Sent but not yet acknowledged
+    uint16_t sndQueueLen;    // Number of pbufs in the send queue
+    uint16_t unsentSegs;
+    uint16_t unackedSegs;
+    uint16_t ooseqSegs;  // Received out of order and queued
+
+    uint8_t retransmits;       // Retransmissions of the oldest unacked segment
+    uint8_t dupAcks;           // Duplicate ACKs received in a row
+    uint8_t zeroWindowProbes;  // Window probes sent while the window is zero
+
+    uint32_t sndBufUsed;  // Bytes waiting in the TCP send buffer
+    uint32_t rcvBufUsed;  // Bytes received but not yet read
+  };
+
+  // Fills in TCP internals for the current connection. This works through any
+  // altcp layers by using the innermost lwIP TCP PCB. This returns false if not
+  // connected or if the connection isn't backed by lwIP's TCP.
+  bool tcpInfo(TCPInfo &info) const;
+
+  // ----------
+  //  Splicing
+  // ----------
+
+  // Forwards all data received on this connection to the given connection,
+  // starting with any data that hasn't been read yet. Received data is
+  // written to the other connection straight from the received packets and is
+  // only acknowledged to the sender once it fits into the other connection's
+  // send buffer, so a slow receiver slows down the sender. This works with
+  // altcp, for example, for forwarding from TLS to plaintext. For a two-way
+  // relay, splice each connection to the other.
+  //
+  // The splice ends when either connection is closed or unsplice() is called.
+  // Any received data that wasn't forwarded can then be read as usual. Don't
+  // read from this connection while it's spliced.
+  //
+  // This returns false if either connection isn't connected, if they're the
+  // same connection, or if this connection is already spliced to another
+  // connection or the other connection is already the target of a splice.
+  bool splice(EthernetClient &to);
+
+  // Ends any splice this connection is a part of, in either direction.
+  void unsplice();
+
+  // Returns whether data received on this connection is being forwarded to
+  // another connection.
+  bool isSpliced() const;
+
+  // ------------------------
+  //  Posted Receive Buffers
+  // ------------------------
+
+  // Posts an application buffer that received data is copied straight into,
+  // instead of into the internal buffer, which saves a copy. Any data that's
+  // already buffered is copied first. Buffers are filled in the order they
+  // were posted. Data only goes to the internal buffer, to be read as usual,
+  // when no posted buffer has space.
+  //
+  // The callback is called with the buffer and the amount received into it
+  // when it's full, when a received segment has the TCP PSH flag, when no
+  // data has arrived for 'idleTimeout' milliseconds and it has some data,
+  // and when the connection is closed, in which case the amount may be zero.
+  // An idle timeout of zero disables the idle check. Note that the PSH flag
+  // isn't seen through TLS, so an idle timeout is useful there.
+  //
+  // The callback is called from Ethernet.loop(), after the stack has been
+  // moved along, and never from inside lwIP, so it may post more buffers,
+  // close the connection, or move the stack along itself.
+  //
+  // This returns false if not connected or if the buffer is NULL or empty.
+  bool postReceive(uint8_t *buf, size_t size,
+                   std::function<void(uint8_t *buf, size_t len)> callback,
+                   uint32_t idleTimeout = 0);
+
+  // Returns the number of posted receive buffers that haven't been completed.
+  // This returns zero if not connected.
+  size_t postedReceiveCount() const;
+
  private:
   // Sets up an already-connected client. If the holder is NULL then a new
   // unconnected client will be created.
   explicit EthernetClient(std::shared_ptr<internal::ConnectionHolder> holder);
 
-  // ip_addr_t version of connect() function.
-  bool connect(const ip_addr_t *ipaddr, uint16_t port, bool wait);
+  // ip_addr_t version of connect() function. Any initial data is queued before
+  // the handshake starts.
+  bool connect(const ip_addr_t *ipaddr, uint16_t port, bool wait,
+               const uint8_t *data = nullptr, size_t size = 0);
 
   // Checks if there's a pending connection. If there is, the state is modified
   // appropriately. This returns false if the connection is inactive; 'conn_' is
@@ -210,8 +458,15 @@ class EthernetClient : public Client,
   // connected and there was information to get.
   bool getAddrInfo(bool local, ip_addr_t *addr, u16_t *port);
 
+  // Sets whether the unread received data must stay where it is. While it's
+  // pinned, new data is only appended after it, and data that doesn't fit is
+  // held back by the stack until it's unpinned. This is used by MessageFramer
+  // so that a message stays valid while its handler runs.
+  void setBufferPinned(bool flag);
+
   // Connection state
   uint16_t connTimeout_;
+  uint32_t corkTimeout_;
   bool pendingConnect_;
 
   std::shared_ptr<internal::ConnectionHolder> conn_;
@@ -220,6 +475,7 @@ class EthernetClient : public Client,
       // conn_->connected.
 
   friend class EthernetServer;
+  friend class MessageFramer;
 };
 
 }  // namespace network
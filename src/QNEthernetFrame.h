@@ -38,7 +38,9 @@ namespace network {
 // 1. IPv4 (0x0800)
 // 2. ARP  (0x0806)
 // 3. IPv6 (0x86DD) (if enabled)
-class EthernetFrameClass final : public Stream, public internal::PrintfChecked {
+class EthernetFrameClass final
+    : public Stream,
+      public internal::PrintfChecked<EthernetFrameClass> {
  public:
   // EthernetFrameClass is neither copyable nor movable
   EthernetFrameClass(const EthernetFrameClass &) = delete;
@@ -107,7 +109,7 @@ class EthernetFrameClass final : public Stream, public internal::PrintfChecked {
   bool send(const uint8_t *frame, size_t len) const;
 
   // Use the one from here instead of the one from Print
-  using internal::PrintfChecked::printf;
+  using internal::PrintfChecked<EthernetFrameClass>::printf;
 
   // Bring Print::write functions into scope
   using Print::write;
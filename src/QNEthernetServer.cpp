@@ -67,7 +67,8 @@ bool EthernetServer::begin(uint16_t port, bool reuse) {
   }
 
   // Only change the port if listening was successful
-  int32_t p = internal::ConnectionManager::instance().listen(port, reuse);
+  int32_t p =
+      internal::ConnectionManager::instance().listen(port, reuse, options_);
   if (p > 0) {
     listeningPort_ = p;
     port_ = (port == 0) ? 0 : p;
@@ -116,6 +117,71 @@ EthernetServer::operator bool() const {
   return listeningPort_ > 0;
 }
 
+void EthernetServer::updateOptions() {
+  if (listeningPort_ > 0) {
+    internal::ConnectionManager::instance().setListenerOptions(listeningPort_,
+                                                               options_);
+  }
+}
+
+void EthernetServer::setNoDelay(bool flag) {
+  options_.noDelay = flag;
+  updateOptions();
+}
+
+bool EthernetServer::setOutgoingDiffServ(uint8_t ds) {
+  options_.diffServ = ds;
+  updateOptions();
+  return true;
+}
+
+void EthernetServer::setKeepAlive(bool flag) {
+  options_.keepAlive = flag;
+  updateOptions();
+}
+
+#if LWIP_TCP_KEEPALIVE
+void EthernetServer::setKeepAlive(uint32_t idle, uint32_t intvl,
+                                  uint32_t count) {
+  options_.keepAlive = true;
+  options_.keepIdle  = idle;
+  options_.keepIntvl = intvl;
+  options_.keepCount = count;
+  updateOptions();
+}
+#endif  // LWIP_TCP_KEEPALIVE
+
+void EthernetServer::setAckPolicy(AckPolicy policy, uint16_t quickCount,
+                                  uint32_t quickIdle) {
+  options_.ackPolicy     = policy;
+  options_.quickAckCount = quickCount;
+  options_.quickAckIdle  = quickIdle;
+  updateOptions();
+}
+
+void EthernetServer::setCongestionControl(CongestionControl cc) {
+  options_.congestionControl = cc;
+  updateOptions();
+}
+
+void EthernetServer::setBacklog(uint8_t backlog) {
+  options_.backlog = backlog;
+  updateOptions();
+}
+
+void EthernetServer::setFastOpen(bool flag) {
+  options_.fastOpen = flag;
+  updateOptions();
+}
+
+bool EthernetServer::acceptStats(AcceptStats &stats) const {
+  if (listeningPort_ == 0) {
+    return false;
+  }
+  return internal::ConnectionManager::instance().acceptStats(listeningPort_,
+                                                             stats);
+}
+
 size_t EthernetServer::write(uint8_t b) {
   if (listeningPort_ == 0) {
     return 1;
@@ -18,12 +18,16 @@
 #include <Server.h>
 
 #include "QNEthernetClient.h"
+#include "internal/DiffServ.h"
 #include "internal/PrintfChecked.h"
+#include "internal/SocketOptions.h"
 
 namespace qindesign {
 namespace network {
 
-class EthernetServer : public Server, public internal::PrintfChecked {
+class EthernetServer : public Server,
+                       public internal::DiffServ,
+                       public internal::PrintfChecked<EthernetServer> {
  public:
   EthernetServer();
   explicit EthernetServer(uint16_t port);
@@ -88,7 +92,7 @@ class EthernetServer : public Server, public internal::PrintfChecked {
   EthernetClient available() const;
 
   // Use the one from here instead of the one from Print
-  using internal::PrintfChecked::printf;
+  using internal::PrintfChecked<EthernetServer>::printf;
 
   // Bring Print::write functions into scope
   using Print::write;
@@ -110,9 +114,102 @@ class EthernetServer : public Server, public internal::PrintfChecked {
 
   explicit operator bool() const;
 
+  // ----------------
+  //  Socket Options
+  // ----------------
+
+  // These set defaults that are applied to every accepted connection before
+  // it's returned from accept() or available(). They may be set before or
+  // after listening starts; changes only affect future connections.
+
+  // Sets the TCP_NODELAY default for accepted connections. If the flag is true
+  // then Nagle's algorithm is disabled, otherwise it is enabled.
+  void setNoDelay(bool flag);
+
+  // Returns the TCP_NODELAY default for accepted connections.
+  bool isNoDelay() const {
+    return options_.noDelay;
+  }
+
+  // Sets the default differentiated services (DiffServ, DS) field for accepted
+  // connections. This always returns true.
+  bool setOutgoingDiffServ(uint8_t ds) final;
+
+  // Returns the default DiffServ value for accepted connections.
+  uint8_t outgoingDiffServ() const final {
+    return options_.diffServ;
+  }
+
+  // Sets the SO_KEEPALIVE default for accepted connections.
+  void setKeepAlive(bool flag);
+
+#if LWIP_TCP_KEEPALIVE
+  // Enables SO_KEEPALIVE for accepted connections and sets the keep-alive
+  // parameters. The idle time and interval are in milliseconds.
+  void setKeepAlive(uint32_t idle, uint32_t intvl, uint32_t count);
+#endif  // LWIP_TCP_KEEPALIVE
+
+  // Returns the SO_KEEPALIVE default for accepted connections.
+  bool isKeepAlive() const {
+    return options_.keepAlive;
+  }
+
+  // Sets the default ACK policy for accepted connections. See
+  // EthernetClient::setAckPolicy() for the meaning of the parameters.
+  void setAckPolicy(AckPolicy policy,
+                    uint16_t quickCount = internal::kDefaultQuickAckCount,
+                    uint32_t quickIdle = internal::kDefaultQuickAckIdle);
+
+  // Returns the default ACK policy for accepted connections.
+  AckPolicy ackPolicy() const {
+    return options_.ackPolicy;
+  }
+
+  // Sets the congestion control algorithm for accepted connections. Unlike
+  // EthernetClient::setCongestionControl(), this takes effect before the
+  // handshake completes, so the initial window is the algorithm's.
+  void setCongestionControl(CongestionControl cc);
+
+  // Returns the congestion control algorithm for accepted connections.
+  CongestionControl congestionControl() const {
+    return options_.congestionControl;
+  }
+
+  // Sets the maximum number of half-open connections, ones whose handshake
+  // hasn't completed. Connection requests beyond this are answered with a SYN
+  // cookie if enabled, otherwise they're dropped. Zero means 1. This limits how
+  // many connections a burst of requests can occupy.
+  void setBacklog(uint8_t backlog);
+
+  // Returns the maximum number of half-open connections.
+  uint8_t backlog() const {
+    return options_.backlog;
+  }
+
+  // Sets whether to accept TCP Fast Open (RFC 7413) connections. When enabled,
+  // the server gives clients a cookie, and data that arrives in a SYN with a
+  // valid cookie is delivered before the handshake completes. Only enable this
+  // if the application can tolerate the first request being processed twice,
+  // because a duplicated SYN can deliver the same data to a second connection.
+  // This has no effect if LWIP_TCP_FASTOPEN is disabled or if the connections
+  // are backed by hardware TCP sockets.
+  void setFastOpen(bool flag);
+
+  // Returns whether TCP Fast Open connections are accepted.
+  bool isFastOpen() const {
+    return options_.fastOpen;
+  }
+
+  // Fills in connection statistics for this server. This returns false if the
+  // server isn't listening.
+  bool acceptStats(AcceptStats &stats) const;
+
  private:
   bool begin(uint16_t port, bool reuse);
 
+  // Passes changed options to the listener, if listening.
+  void updateOptions();
+
   bool hasPort_ = false;
   uint16_t port_ = 0;   // Zero means let the system choose a port
   bool reuse_ = false;  // Whether the SO_REUSEADDR socket option is set
@@ -120,6 +217,9 @@ class EthernetServer : public Server, public internal::PrintfChecked {
   // The listening port may be different from the requested port, say if the
   // requested port is zero.
   uint16_t listeningPort_ = 0;
+
+  // Options applied to accepted connections
+  internal::SocketOptions options_;
 };
 
 }  // namespace network
@@ -11,6 +11,7 @@
 // C++ includes
 #include <algorithm>
 #include <cerrno>
+#include <cstring>
 
 #include "QNDNSClient.h"
 #include "QNEthernet.h"
@@ -21,6 +22,7 @@
 #include "lwip/sys.h"
 #include "qnethernet_opts.h"
 #include "util/ip_tools.h"
+#include "util/mem_tools.h"
 
 namespace qindesign {
 namespace network {
@@ -47,6 +49,24 @@ void EthernetUDP::recvFunc(void *arg, struct udp_pcb *pcb, struct pbuf *p,
     return;
   }
 
+  // Fast path: hand the packet over without queuing it
+  if (udp->packetHandler_ != nullptr) {
+    const uint8_t *data = static_cast<const uint8_t *>(p->payload);
+    if (p->len != p->tot_len) {
+      udp->gatherBuf_.resize(p->tot_len);
+      pbuf_copy_partial(p, udp->gatherBuf_.data(), p->tot_len, 0);
+      data = udp->gatherBuf_.data();
+    }
+#if LWIP_IPV4
+    const IPAddress ip{ip_addr_get_ip4_uint32(addr)};
+#else
+    const IPAddress ip{INADDR_NONE};
+#endif  // LWIP_IPV4
+    udp->packetHandler_(PacketView{data, p->tot_len, ip, port, pcb->tos});
+    pbuf_free(p);
+    return;
+  }
+
   uint32_t timestamp = sys_now();
 
   struct pbuf *pHead = p;
@@ -351,6 +371,59 @@ const uint8_t *EthernetUDP::data() const {
   return packet_.data.data();
 }
 
+const uint8_t *EthernetUDP::readableSpan(size_t &size) const {
+  if (!isAvailable()) {
+    size = 0;
+    return nullptr;
+  }
+  size = packet_.data.size() - packetPos_;
+  return &packet_.data.data()[packetPos_];
+}
+
+size_t EthernetUDP::consume(size_t n) {
+  if (!isAvailable()) {
+    return 0;
+  }
+  n = std::min(n, packet_.data.size() - packetPos_);
+  packetPos_ += n;
+  return n;
+}
+
+int EthernetUDP::findDelimiter(uint8_t delim) const {
+  size_t size;
+  const uint8_t *data = readableSpan(size);
+  if (data == nullptr) {
+    return -1;
+  }
+  const void *p = std::memchr(data, delim, size);
+  if (p == nullptr) {
+    return -1;
+  }
+  return static_cast<const uint8_t *>(p) - data;
+}
+
+int EthernetUDP::findDelimiter(const char *delim) const {
+  if (delim == nullptr) {
+    return -1;
+  }
+  size_t size;
+  const uint8_t *data = readableSpan(size);
+  return mem_find(data, size, reinterpret_cast<const uint8_t *>(delim),
+                  std::strlen(delim));
+}
+
+const uint8_t *EthernetUDP::readUntil(uint8_t delim, size_t &size) {
+  const int i = findDelimiter(delim);
+  if (i < 0) {
+    size = 0;
+    return nullptr;
+  }
+  const uint8_t *data = &packet_.data.data()[packetPos_];
+  size = i + 1;
+  packetPos_ += size;
+  return data;
+}
+
 IPAddress EthernetUDP::remoteIP() {
 #if LWIP_IPV4
   return ip_addr_get_ip4_uint32(&packet_.addr);
@@ -442,28 +515,9 @@ int EthernetUDP::endPacket() {
     return false;
   }
 
-  // Repeat until not ERR_WOULDBLOCK because the low-level driver returns that
-  // if there are no internal TX buffers available
-  do {
-    err = udp_sendto(pcb_, p, &outPacket_.addr, outPacket_.port);
-    if (err != ERR_WOULDBLOCK) {
-      break;
-    }
-
-    // udp_sendto() may have added a header
-    if (p->tot_len > outPacket_.data.size()) {
-      pbuf_remove_header(p, p->tot_len - outPacket_.data.size());
-    }
-  } while (true);
-
+  bool retval = sendPbuf(&outPacket_.addr, outPacket_.port, p);
   outPacket_.clear();
-  pbuf_free(p);
-
-  if (err != ERR_OK) {
-    errno = err_to_errno(err);
-    return false;
-  }
-  return true;
+  return retval;
 }
 
 bool EthernetUDP::send(const IPAddress &ip, uint16_t port,
@@ -522,8 +576,95 @@ bool EthernetUDP::send(const ip_addr_t *ipaddr, uint16_t port,
     return false;
   }
 
+  return sendPbuf(ipaddr, port, p);
+}
+
+bool EthernetUDP::sendv(const IPAddress &ip, uint16_t port,
+                        const IOVec *iov, size_t count) {
+#if LWIP_IPV4
+  ip_addr_t ipaddr IPADDR4_INIT(get_uint32(ip));
+  return sendv(&ipaddr, port, iov, count);
+#else
+  return false;
+#endif  // LWIP_IPV4
+}
+
+bool EthernetUDP::sendv(const char *host, uint16_t port,
+                        const IOVec *iov, size_t count) {
+#if LWIP_DNS
+  IPAddress ip;
+  if (!DNSClient::getHostByName(host, ip,
+                                QNETHERNET_DEFAULT_DNS_LOOKUP_TIMEOUT)) {
+    return false;
+  }
+  return sendv(ip, port, iov, count);
+#else
+  LWIP_UNUSED_ARG(host);
+  LWIP_UNUSED_ARG(port);
+  LWIP_UNUSED_ARG(iov);
+  LWIP_UNUSED_ARG(count);
+  return false;
+#endif  // LWIP_DNS
+}
+
+bool EthernetUDP::sendv(const ip_addr_t *ipaddr, uint16_t port,
+                        const IOVec *iov, size_t count) {
+  if (iov == nullptr) {
+    count = 0;
+  }
+  if (iovecSize(iov, count) > kMaxPossiblePayloadSize) {
+    errno = ENOBUFS;
+    return false;
+  }
+  tryCreatePCB();
+  if (pcb_ == nullptr) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  // Reference the caller's segments instead of copying them; lwIP copies
+  // referenced data if it needs to queue the packet
+  struct pbuf *p = nullptr;
+  for (size_t i = 0; i < count; i++) {
+    if (iov[i].size == 0) {
+      continue;
+    }
+    struct pbuf *q = pbuf_alloc(PBUF_RAW, iov[i].size, PBUF_REF);
+    if (q == nullptr) {
+      if (p != nullptr) {
+        pbuf_free(p);
+      }
+      Ethernet.loop();  // Allow the stack to move along
+      errno = ENOMEM;
+      return false;
+    }
+    q->payload = const_cast<uint8_t *>(iov[i].data);
+    if (p == nullptr) {
+      p = q;
+    } else {
+      pbuf_cat(p, q);
+    }
+  }
+  if (p == nullptr) {  // Zero-length packet
+    // Note: Use PBUF_RAM for TX
+    p = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_RAM);
+    if (p == nullptr) {
+      Ethernet.loop();  // Allow the stack to move along
+      errno = ENOMEM;
+      return false;
+    }
+  }
+
+  return sendPbuf(ipaddr, port, p);
+}
+
+bool EthernetUDP::sendPbuf(const ip_addr_t *ipaddr, uint16_t port,
+                           struct pbuf *p) {
+  const u16_t len = p->tot_len;
+
   // Repeat until not ERR_WOULDBLOCK because the low-level driver returns that
   // if there are no internal TX buffers available
+  err_t err;
   do {
     err = udp_sendto(pcb_, p, ipaddr, port);
     if (err != ERR_WOULDBLOCK) {
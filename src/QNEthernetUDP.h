@@ -13,6 +13,8 @@
 // C++ includes
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <utility>
 #include <vector>
 
 #include <IPAddress.h>
@@ -22,13 +24,14 @@
 #include "internal/PrintfChecked.h"
 #include "lwip/ip_addr.h"
 #include "lwip/udp.h"
+#include "util/IOVec.h"
 
 namespace qindesign {
 namespace network {
 
 class EthernetUDP : public UDP,
                     public internal::DiffServ,
-                    public internal::PrintfChecked {
+                    public internal::PrintfChecked<EthernetUDP> {
  public:
   EthernetUDP();
 
@@ -60,6 +63,27 @@ class EthernetUDP : public UDP,
   // all the oldest packets that don't fit are dropped.
   void setReceiveQueueSize(size_t size);
 
+  // A received packet, as passed to a packet handler. The data is only valid
+  // inside the handler.
+  struct PacketView final {
+    const uint8_t *data;
+    size_t size;
+    IPAddress remoteIP;
+    uint16_t remotePort;
+    uint8_t diffServ;
+  };
+
+  using PacketHandler = std::function<void(const PacketView &packet)>;
+
+  // Sets a handler that's given each received packet straight from the stack,
+  // from inside Ethernet.loop(), instead of queuing it for parsePacket(). A
+  // packet that arrived in one piece, which is the case for any packet that
+  // fits in one frame, is passed without being copied; a reassembled packet is
+  // first gathered into an internal buffer. Set to NULL to go back to queuing.
+  void onPacket(PacketHandler handler) {
+    packetHandler_ = std::move(handler);
+  }
+
   // Starts listening on a port. This returns true if successful and false if
   // the port is in use.
   //
@@ -116,8 +140,21 @@ class EthernetUDP : public UDP,
   // If this returns false and there was an error then errno will be set.
   bool send(const char *host, uint16_t port, const uint8_t *data, size_t len);
 
+  // Sends one UDP packet made from the given segments, in order, without first
+  // copying them into one buffer. This returns whether the attempt
+  // was successful.
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool sendv(const IPAddress &ip, uint16_t port,
+             const IOVec *iov, size_t count);
+
+  // Calls the other sendv() function after performing a DNS lookup.
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool sendv(const char *host, uint16_t port, const IOVec *iov, size_t count);
+
   // Use the one from here instead of the one from Print
-  using internal::PrintfChecked::printf;
+  using internal::PrintfChecked<EthernetUDP>::printf;
 
   // Bring Print::write functions into scope
   using Print::write;
@@ -151,6 +188,30 @@ class EthernetUDP : public UDP,
   // size is zero.
   const uint8_t *data() const;
 
+  // Returns a view of the rest of the current packet, the part that hasn't
+  // been read yet, without copying it. The size is returned in 'size'. This
+  // returns NULL if there's no data. The view is valid until the next call to
+  // parsePacket().
+  const uint8_t *readableSpan(size_t &size) const;
+
+  // Skips up to 'n' bytes of the current packet. This returns the number of
+  // bytes skipped.
+  size_t consume(size_t n);
+
+  // Returns the offset of the first 'delim' in the rest of the current packet,
+  // or -1 if it's not there.
+  int findDelimiter(uint8_t delim) const;
+
+  // Returns the offset of the first occurrence of the NUL-terminated 'delim'
+  // in the rest of the current packet, or -1 if it's not there or is empty.
+  int findDelimiter(const char *delim) const;
+
+  // Consumes the rest of the current packet up to and including the first
+  // 'delim' and returns a view of it, including the delimiter. The size is
+  // returned in 'size'. This returns NULL if there's no delimiter; use
+  // readableSpan() to get at the remaining data.
+  const uint8_t *readUntil(uint8_t delim, size_t &size);
+
   IPAddress remoteIP() final;
   uint16_t remotePort() final;
 
@@ -227,6 +288,16 @@ class EthernetUDP : public UDP,
   bool send(const ip_addr_t *ipaddr, uint16_t port,
             const uint8_t *data, size_t len);
 
+  // If this returns false and there was an error then errno will be set.
+  bool sendv(const ip_addr_t *ipaddr, uint16_t port,
+             const IOVec *iov, size_t count);
+
+  // Sends a packet and frees it. This retries while the driver has no
+  // TX buffers.
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool sendPbuf(const ip_addr_t *ipaddr, uint16_t port, struct pbuf *p);
+
   // Checks if there's data still available in the packet.
   bool isAvailable() const;
 
@@ -251,6 +322,10 @@ class EthernetUDP : public UDP,
   // Outgoing packets
   Packet outPacket_;
   bool hasOutPacket_;
+
+  // Fast path
+  PacketHandler packetHandler_ = nullptr;
+  std::vector<uint8_t> gatherBuf_;  // For packets that aren't in one piece
 };
 
 }  // namespace network
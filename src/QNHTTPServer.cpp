@@ -0,0 +1,708 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNHTTPServer.cpp implements the HTTP server.
+// This file is part of the QNEthernet library.
+
+#include "QNHTTPServer.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include <strings.h>
+
+#include "lwip/sys.h"
+#include "util/IOVec.h"
+#include "util/http_tools.h"
+
+namespace qindesign {
+namespace network {
+
+// Returns the reason phrase for the given status code.
+static const char *statusText(int status) {
+  switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Content Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default:
+      if (status < 200) return "Informational";
+      if (status < 300) return "Success";
+      if (status < 400) return "Redirection";
+      if (status < 500) return "Client Error";
+      return "Server Error";
+  }
+}
+
+static HTTPServer::Method toMethod(const char *s) {
+  static constexpr struct {
+    const char *name;
+    HTTPServer::Method method;
+  } kMethods[]{
+      {"GET",     HTTPServer::Method::kGet},
+      {"HEAD",    HTTPServer::Method::kHead},
+      {"POST",    HTTPServer::Method::kPost},
+      {"PUT",     HTTPServer::Method::kPut},
+      {"DELETE",  HTTPServer::Method::kDelete},
+      {"OPTIONS", HTTPServer::Method::kOptions},
+      {"PATCH",   HTTPServer::Method::kPatch},
+  };
+  for (const auto &m : kMethods) {
+    if (std::strcmp(s, m.name) == 0) {
+      return m.method;
+    }
+  }
+  return HTTPServer::Method::kOther;
+}
+
+// Returns whether the connection should stay open after the response.
+static bool isKeepAlive(const HTTPServer::Request &req, bool http11) {
+  const char *conn = req.header("Connection");
+  if (conn != nullptr) {
+    if (http_has_token(conn, "close")) {
+      return false;
+    }
+    if (http_has_token(conn, "keep-alive")) {
+      return true;
+    }
+  }
+  return http11;
+}
+
+// --------------------------------------------------------------------------
+//  Request
+// --------------------------------------------------------------------------
+
+const char *HTTPServer::Request::header(const char *name) const {
+  for (const Header &h : headers_) {
+    if (strcasecmp(h.name, name) == 0) {
+      return h.value;
+    }
+  }
+  return nullptr;
+}
+
+// --------------------------------------------------------------------------
+//  Response
+// --------------------------------------------------------------------------
+
+void HTTPServer::Response::addHeader(const char *name, const char *value) {
+  if (started_) {
+    return;
+  }
+  headers_ += name;
+  headers_ += ": ";
+  headers_ += value;
+  headers_ += "\r\n";
+}
+
+bool HTTPServer::Response::output(const uint8_t *data, size_t size,
+                                  bool ref) {
+  if (!client_.connected()) {
+    return false;
+  }
+  if (out_.empty()) {
+    size_t n = std::min(size, static_cast<size_t>(
+                                  std::max(client_.availableForWrite(), 0)));
+    if (n > 0) {
+      n = ref ? client_.writeRef(data, n) : client_.write(data, n);
+    }
+    data += n;
+    size -= n;
+  }
+  if (size > 0) {
+    Output o;
+    if (ref) {
+      o.ref = data;
+    } else {
+      o.copy.assign(data, data + size);
+    }
+    o.size = size;
+    out_.push_back(std::move(o));
+  }
+  return true;
+}
+
+bool HTTPServer::Response::outputv(const IOVec *iov, size_t count) {
+  if (!client_.connected()) {
+    return false;
+  }
+  size_t n = 0;
+  if (out_.empty()) {
+    n = client_.writev(iov, count);  // Limited to availableForWrite()
+  }
+
+  // Copy what's left into one piece
+  Output o;
+  for (size_t i = 0; i < count; i++) {
+    if (n >= iov[i].size) {
+      n -= iov[i].size;
+      continue;
+    }
+    o.copy.insert(o.copy.end(), iov[i].data + n, iov[i].data + iov[i].size);
+    n = 0;
+  }
+  if (!o.copy.empty()) {
+    o.size = o.copy.size();
+    out_.push_back(std::move(o));
+  }
+  return true;
+}
+
+bool HTTPServer::Response::sendHeaders(int status, const char *contentType,
+                                       bool chunked, size_t contentLength) {
+  if (started_) {
+    return false;
+  }
+  started_ = true;
+  chunked_ = chunked;
+
+  char statusLine[48];
+  int n = std::snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %d %s\r\n",
+                        status, statusText(status));
+  if (n < 0 || static_cast<size_t>(n) >= sizeof(statusLine)) {
+    ok_ = false;
+    return false;
+  }
+  const size_t statusLen = n;
+
+  // The content type has no length limit, so it goes out as its own segment
+  char fields[80];
+  if (chunked) {
+    n = std::snprintf(fields, sizeof(fields), "Transfer-Encoding: chunked\r\n");
+  } else if (status >= 200 && status != 204 && status != 304) {
+    n = std::snprintf(fields, sizeof(fields), "Content-Length: %zu\r\n",
+                      contentLength);
+  } else {
+    n = 0;
+  }
+  if (n < 0 || static_cast<size_t>(n) >= sizeof(fields)) {
+    ok_ = false;
+    return false;
+  }
+  size_t fieldsLen = n;
+  if (!keepAlive_) {
+    n = std::snprintf(&fields[fieldsLen], sizeof(fields) - fieldsLen,
+                      "Connection: close\r\n");
+    if (n < 0 || static_cast<size_t>(n) >= sizeof(fields) - fieldsLen) {
+      ok_ = false;
+      return false;
+    }
+    fieldsLen += n;
+  }
+
+  const bool hasType = (contentType != nullptr);
+  const IOVec iov[]{
+      {reinterpret_cast<const uint8_t *>(statusLine), statusLen},
+      {reinterpret_cast<const uint8_t *>("Content-Type: "), hasType ? 14u : 0u},
+      {reinterpret_cast<const uint8_t *>(contentType),
+       hasType ? std::strlen(contentType) : 0},
+      {reinterpret_cast<const uint8_t *>("\r\n"), hasType ? 2u : 0u},
+      {reinterpret_cast<const uint8_t *>(fields), fieldsLen},
+      {reinterpret_cast<const uint8_t *>(headers_.c_str()), headers_.length()},
+      {reinterpret_cast<const uint8_t *>("\r\n"), 2},
+  };
+  ok_ = outputv(iov, sizeof(iov)/sizeof(iov[0])) && ok_;
+  return ok_;
+}
+
+bool HTTPServer::Response::send(int status, const char *contentType,
+                                const uint8_t *data, size_t size) {
+  if (!sendHeaders(status, contentType, false, size)) {
+    return false;
+  }
+  if (!headOnly_ && size > 0) {
+    ok_ = output(data, size, false) && ok_;
+  }
+  return ok_;
+}
+
+bool HTTPServer::Response::send(int status, const char *contentType,
+                                const char *s) {
+  return send(status, contentType, reinterpret_cast<const uint8_t *>(s),
+              std::strlen(s));
+}
+
+bool HTTPServer::Response::send(int status) {
+  return send(status, nullptr, nullptr, 0);
+}
+
+bool HTTPServer::Response::beginChunked(int status, const char *contentType) {
+  return sendHeaders(status, contentType, true, 0);
+}
+
+bool HTTPServer::Response::sendChunk(const uint8_t *data, size_t size) {
+  if (size == 0) {
+    return true;
+  }
+  char sizeLine[12];
+  int n = std::snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", size);
+  const IOVec iov[]{
+      {reinterpret_cast<const uint8_t *>(sizeLine), static_cast<size_t>(n)},
+      {data, size},
+      {reinterpret_cast<const uint8_t *>("\r\n"), 2},
+  };
+  ok_ = outputv(iov, 3) && ok_;
+  return ok_;
+}
+
+size_t HTTPServer::Response::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t HTTPServer::Response::write(const uint8_t *buffer, size_t size) {
+  if (!started_ || !chunked_) {
+    setWriteError();
+    return 0;
+  }
+  if (headOnly_) {
+    return size;
+  }
+
+  // Big writes become their own chunk
+  if (chunkLen_ == 0 && size >= sizeof(chunkBuf_)) {
+    return sendChunk(buffer, size) ? size : 0;
+  }
+
+  size_t written = 0;
+  while (written < size) {
+    size_t n = std::min(size - written, sizeof(chunkBuf_) - chunkLen_);
+    std::memcpy(&chunkBuf_[chunkLen_], &buffer[written], n);
+    chunkLen_ += n;
+    written += n;
+    if (chunkLen_ == sizeof(chunkBuf_)) {
+      flush();
+      if (!ok_) {
+        break;
+      }
+    }
+  }
+  return written;
+}
+
+void HTTPServer::Response::flush() {
+  if (chunkLen_ > 0) {
+    sendChunk(chunkBuf_, chunkLen_);
+    chunkLen_ = 0;
+  }
+}
+
+bool HTTPServer::Response::end() {
+  if (!started_ || !chunked_) {
+    return false;
+  }
+  chunked_ = false;  // Prevent further writes and a second end()
+  if (headOnly_) {
+    return ok_;
+  }
+  sendChunk(chunkBuf_, chunkLen_);
+  chunkLen_ = 0;
+  ok_ = output(reinterpret_cast<const uint8_t *>("0\r\n\r\n"), 5, true) && ok_;
+  return ok_;
+}
+
+// --------------------------------------------------------------------------
+//  HTTPServer
+// --------------------------------------------------------------------------
+
+HTTPServer::HTTPServer(uint16_t port, size_t maxConnections,
+                       size_t requestBufSize)
+    : server_(port),
+      maxConns_(maxConnections),
+      bufSize_(requestBufSize) {}
+
+HTTPServer::~HTTPServer() {
+  end();
+}
+
+bool HTTPServer::begin() {
+  return server_.beginWithReuse();
+}
+
+void HTTPServer::end() {
+  for (Conn &c : conns_) {
+    c.client.close();
+  }
+  conns_.clear();
+  server_.end();
+}
+
+void HTTPServer::on(Method method, const char *path, Handler handler) {
+  Route r{method, path, false, std::move(handler)};
+  if (r.path.endsWith("*")) {
+    r.path.remove(r.path.length() - 1);
+    r.prefix = true;
+  }
+  routes_.push_back(std::move(r));
+}
+
+void HTTPServer::serveStatic(const char *path, const StaticAsset &asset) {
+  on(Method::kGet, path, [asset](Request &req, Response &res) {
+    sendStatic(asset, req, res);
+  });
+}
+
+void HTTPServer::sendStatic(const StaticAsset &asset, Request &req,
+                            Response &res) {
+  if (asset.etag != nullptr) {
+    res.addHeader("ETag", asset.etag);
+    const char *inm = req.header("If-None-Match");
+    if (inm != nullptr && http_etag_matches(inm, asset.etag)) {
+      res.send(304);
+      return;
+    }
+  }
+
+  const uint8_t *data = asset.data;
+  size_t size = asset.size;
+  if (asset.gzipData != nullptr) {
+    res.addHeader("Vary", "Accept-Encoding");
+    const char *ae = req.header("Accept-Encoding");
+    if (ae != nullptr && http_has_token(ae, "gzip")) {
+      res.addHeader("Content-Encoding", "gzip");
+      data = asset.gzipData;
+      size = asset.gzipSize;
+    }
+  }
+
+  if (res.sendHeaders(200, asset.contentType, false, size) && !res.headOnly_) {
+    res.ok_ = res.output(data, size, true) && res.ok_;
+  }
+}
+
+HTTPServer::ParseResult HTTPServer::parse(Conn &conn, Request &req,
+                                          size_t &used) {
+  char *buf = reinterpret_cast<char *>(conn.buf.get());
+
+  if (conn.reqSize == 0) {
+    // Find the end of the headers, continuing where the last search ended
+    size_t headerEnd = 0;
+    size_t i = (conn.scanned >= 2) ? conn.scanned - 2 : 0;
+    while (i < conn.len) {
+      const char *nl = static_cast<const char *>(
+          std::memchr(&buf[i], '\n', conn.len - i));
+      if (nl == nullptr) {
+        break;
+      }
+      i = nl - buf + 1;
+      if (i < conn.len && buf[i] == '\n') {
+        headerEnd = i + 1;
+        break;
+      }
+      if (i + 1 < conn.len && buf[i] == '\r' && buf[i + 1] == '\n') {
+        headerEnd = i + 2;
+        break;
+      }
+    }
+    if (headerEnd == 0) {
+      conn.scanned = conn.len;
+      return (conn.len >= bufSize_) ? ParseResult::kTooLarge
+                                    : ParseResult::kIncomplete;
+    }
+
+    // Split the lines in place
+    for (size_t j = 0; j < headerEnd; j++) {
+      if (buf[j] == '\r' || buf[j] == '\n') {
+        buf[j] = '\0';
+      }
+    }
+
+    // Request line: method SP target SP version
+    req = Request{};
+    char *line = buf;
+    char *sp1 = std::strchr(line, ' ');
+    char *sp2 = (sp1 != nullptr) ? std::strchr(sp1 + 1, ' ') : nullptr;
+    if (sp2 == nullptr) {
+      return ParseResult::kError;
+    }
+    *sp1 = '\0';
+    *sp2 = '\0';
+    const char *version = sp2 + 1;
+    if (std::strncmp(version, "HTTP/1.", 7) != 0) {
+      return ParseResult::kError;
+    }
+    req.http11_     = (version[7] != '0');
+    req.methodName_ = line;
+    req.method_     = toMethod(line);
+    req.path_       = sp1 + 1;
+    char *q = std::strchr(sp1 + 1, '?');
+    if (q != nullptr) {
+      *q = '\0';
+      req.query_ = q + 1;
+    }
+
+    // Headers
+    size_t contentLength = 0;
+    char *p = sp2 + 1 + std::strlen(sp2 + 1);
+    while (true) {
+      while (p < &buf[headerEnd] && *p == '\0') {
+        p++;
+      }
+      if (p >= &buf[headerEnd]) {
+        break;
+      }
+      char *colon = std::strchr(p, ':');
+      if (colon == nullptr || colon == p) {
+        return ParseResult::kError;
+      }
+      *colon = '\0';
+      char *value = colon + 1;
+      while (*value == ' ' || *value == '\t') {
+        value++;
+      }
+      char *end = value + std::strlen(value);
+      char *next = end;
+      while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        *--end = '\0';
+      }
+      req.headers_.push_back(Request::Header{p, value});
+
+      if (strcasecmp(p, "Content-Length") == 0) {
+        char *numEnd;
+        unsigned long v = std::strtoul(value, &numEnd, 10);
+        if (numEnd == value || *numEnd != '\0') {
+          return ParseResult::kError;
+        }
+        contentLength = v;
+      } else if (strcasecmp(p, "Transfer-Encoding") == 0) {
+        return ParseResult::kUnsupported;
+      }
+      p = next;
+    }
+
+    if (contentLength > bufSize_ - headerEnd) {
+      return ParseResult::kTooLarge;
+    }
+    conn.reqSize = headerEnd + contentLength;
+    req.body_     = conn.buf.get() + headerEnd;
+    req.bodySize_ = contentLength;
+  }
+
+  if (conn.len < conn.reqSize) {
+    return ParseResult::kIncomplete;
+  }
+  used = conn.reqSize;
+  return ParseResult::kOk;
+}
+
+void HTTPServer::dispatch(Request &req, Response &res) {
+  const char *path = req.path();
+  for (Route &r : routes_) {
+    if (r.method != req.method() &&
+        !(r.method == Method::kGet && req.method() == Method::kHead)) {
+      continue;
+    }
+    bool match = r.prefix
+                     ? (std::strncmp(path, r.path.c_str(), r.path.length()) == 0)
+                     : (std::strcmp(path, r.path.c_str()) == 0);
+    if (match) {
+      r.handler(req, res);
+      return;
+    }
+  }
+  if (notFound_ != nullptr) {
+    notFound_(req, res);
+  } else {
+    res.send(404, "text/plain", "Not Found\n");
+  }
+}
+
+void HTTPServer::sendError(Conn &conn, int status) {
+  Response res{conn.client, conn.out};
+  res.keepAlive_ = false;
+  res.send(status, "text/plain", statusText(status));
+  conn.closing = true;
+}
+
+bool HTTPServer::processRequests(Conn &conn) {
+  conn.pipelined = false;
+  while (true) {
+    // Skip empty lines between requests
+    if (conn.reqSize == 0) {
+      size_t skip = 0;
+      while (skip < conn.len &&
+             (conn.buf[skip] == '\r' || conn.buf[skip] == '\n')) {
+        skip++;
+      }
+      if (skip > 0) {
+        std::memmove(conn.buf.get(), &conn.buf[skip], conn.len - skip);
+        conn.len -= skip;
+        conn.scanned = 0;
+      }
+    }
+    if (conn.len == 0) {
+      return true;
+    }
+
+    size_t used = 0;
+    switch (parse(conn, conn.req, used)) {
+      case ParseResult::kIncomplete:
+        return true;
+      case ParseResult::kError:
+        sendError(conn, 400);
+        return !conn.out.empty();
+      case ParseResult::kTooLarge:
+        sendError(conn, 413);
+        return !conn.out.empty();
+      case ParseResult::kUnsupported:
+        sendError(conn, 501);
+        return !conn.out.empty();
+      case ParseResult::kOk:
+        break;
+    }
+
+    Request &req = conn.req;
+    Response res{conn.client, conn.out};
+    res.headOnly_  = (req.method() == Method::kHead);
+    res.keepAlive_ = isKeepAlive(req, req.http11_);
+    dispatch(req, res);
+    if (!res.started_) {
+      res.send(500);
+    } else if (res.chunked_) {
+      res.end();
+    }
+    if (!res.ok_) {
+      return false;
+    }
+    if (!res.keepAlive_) {
+      conn.closing = true;
+      return !conn.out.empty();
+    }
+
+    // Keep any pipelined requests
+    std::memmove(conn.buf.get(), &conn.buf[used], conn.len - used);
+    conn.len -= used;
+    conn.scanned = 0;
+    conn.reqSize = 0;
+    conn.lastActive = sys_now();
+
+    // Wait for the rest of this response before handling the next request
+    if (!conn.out.empty()) {
+      conn.pipelined = (conn.len > 0);
+      return true;
+    }
+  }
+}
+
+bool HTTPServer::sendQueued(Conn &conn) {
+  if (!conn.client.connected()) {
+    return false;
+  }
+  bool progress = false;
+  while (!conn.out.empty()) {
+    Output &o = conn.out.front();
+    size_t n = std::min(o.size - o.sent,
+                        static_cast<size_t>(
+                            std::max(conn.client.availableForWrite(), 0)));
+    if (n == 0) {
+      break;
+    }
+    if (o.ref != nullptr) {
+      n = conn.client.writeRef(o.data() + o.sent, n);
+    } else {
+      n = conn.client.write(o.data() + o.sent, n);
+    }
+    if (n == 0) {
+      break;
+    }
+    progress = true;
+    o.sent += n;
+    if (o.sent >= o.size) {
+      conn.out.erase(conn.out.begin());
+    }
+  }
+
+  if (progress) {
+    conn.client.flush();
+    conn.lastActive = sys_now();
+  } else if (sys_now() - conn.lastActive >= idleTimeout_) {
+    conn.client.abort();  // The client stopped reading
+    return false;
+  }
+  return !(conn.out.empty() && conn.closing);
+}
+
+void HTTPServer::loop() {
+  // Accept new connections while there's room
+  while (conns_.size() < maxConns_) {
+    EthernetClient c = server_.accept();
+    if (!c) {
+      break;
+    }
+    Conn conn;
+    conn.client = std::move(c);
+    conn.buf = std::make_unique<uint8_t[]>(bufSize_);
+    conn.lastActive = sys_now();
+    conns_.push_back(std::move(conn));
+  }
+
+  for (size_t i = 0; i < conns_.size(); ) {
+    Conn &conn = conns_[i];
+    bool keep = true;
+
+    // Finish sending any queued response before reading more requests
+    if (!conn.out.empty()) {
+      keep = sendQueued(conn);
+      if (keep && conn.out.empty() && conn.pipelined) {
+        keep = processRequests(conn);
+      }
+      if (keep) {
+        i++;
+      } else {
+        conn.client.close();
+        conns_.erase(conns_.begin() + i);
+      }
+      continue;
+    }
+
+    int avail = conn.client.available();
+    if (avail > 0) {
+      size_t n = std::min(static_cast<size_t>(avail), bufSize_ - conn.len);
+      if (n > 0) {
+        int r = conn.client.read(&conn.buf[conn.len], n);
+        if (r > 0) {
+          conn.len += r;
+          conn.lastActive = sys_now();
+        }
+      }
+      keep = processRequests(conn);
+    } else if (conn.closing) {
+      keep = false;
+    } else if (!conn.client.connected()) {
+      keep = false;
+    } else if (sys_now() - conn.lastActive >= idleTimeout_) {
+      keep = false;
+    }
+
+    if (keep) {
+      i++;
+    } else {
+      conn.client.close();
+      conns_.erase(conns_.begin() + i);
+    }
+  }
+}
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
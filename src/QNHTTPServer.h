@@ -0,0 +1,317 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNHTTPServer.h defines a small HTTP/1.1 server.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <Print.h>
+#include <WString.h>
+
+#include "QNEthernetClient.h"
+#include "QNEthernetServer.h"
+
+namespace qindesign {
+namespace network {
+
+// HTTPServer is an HTTP/1.1 server with persistent connections, pipelining,
+// chunked responses, and static assets that are sent without being copied.
+//
+// Requests are parsed in place as data arrives, so a request, including its
+// body, must fit in the request buffer. Handlers run from loop(), one request
+// at a time.
+//
+// Responses never block. What a connection can't take right away is queued and
+// sent from later loop() calls, up to availableForWrite() at a time. Static
+// assets are queued by reference and everything else is copied, so a handler
+// that produces a large body uses as much memory until it's sent.
+class HTTPServer final {
+ private:
+  // Response data waiting to be sent.
+  struct Output final {
+    std::vector<uint8_t> copy;     // Copied data
+    const uint8_t *ref = nullptr;  // Or referenced data, if not null
+    size_t size = 0;
+    size_t sent = 0;
+
+    const uint8_t *data() const {
+      return (ref != nullptr) ? ref : copy.data();
+    }
+  };
+
+ public:
+  // Request methods.
+  enum class Method {
+    kGet,
+    kHead,
+    kPost,
+    kPut,
+    kDelete,
+    kOptions,
+    kPatch,
+    kOther,
+  };
+
+  // A request, valid only inside the handler.
+  class Request final {
+   public:
+    Method method() const {
+      return method_;
+    }
+
+    // Returns the method as it appeared in the request.
+    const char *methodName() const {
+      return methodName_;
+    }
+
+    // Returns the path, without the query.
+    const char *path() const {
+      return path_;
+    }
+
+    // Returns the query, the part after the '?', or an empty string if there
+    // isn't one.
+    const char *query() const {
+      return query_;
+    }
+
+    // Returns the value of the named header, or NULL if there's no such
+    // header. Names are case-insensitive.
+    const char *header(const char *name) const;
+
+    const uint8_t *body() const {
+      return body_;
+    }
+
+    size_t bodySize() const {
+      return bodySize_;
+    }
+
+   private:
+    struct Header final {
+      const char *name;
+      const char *value;
+    };
+
+    Method method_ = Method::kOther;
+    const char *methodName_ = "";
+    const char *path_ = "";
+    const char *query_ = "";
+    std::vector<Header> headers_;
+    const uint8_t *body_ = nullptr;
+    size_t bodySize_ = 0;
+    bool http11_ = true;
+
+    friend class HTTPServer;
+  };
+
+  // A response. A handler either calls send() or calls beginChunked(), then
+  // writes the body, and then calls end(). A handler that does neither gets a
+  // "500 Internal Server Error".
+  class Response final : public Print {
+   public:
+    // Adds a header. This must be called before the response is started.
+    void addHeader(const char *name, const char *value);
+
+    // Sends a complete response. This returns whether all of it was sent or
+    // queued, and false if the connection is gone.
+    bool send(int status, const char *contentType,
+              const uint8_t *data, size_t size);
+
+    // Sends a complete response with a string body.
+    bool send(int status, const char *contentType, const char *s);
+
+    // Sends a response with no body.
+    bool send(int status);
+
+    // Starts a chunked response. The body is written with the Print functions
+    // and finished with end(). This returns whether the headers were sent or
+    // queued.
+    bool beginChunked(int status, const char *contentType);
+
+    // Finishes a chunked response. This returns whether the rest was sent or
+    // queued.
+    bool end();
+
+    // Bring Print::write functions into scope
+    using Print::write;
+
+    // Writes body data for a chunked response. Small writes are gathered into
+    // larger chunks.
+    size_t write(uint8_t b) final;
+    size_t write(const uint8_t *buffer, size_t size) final;
+    void flush() final;
+
+   private:
+    Response(EthernetClient &client, std::vector<Output> &out)
+        : client_(client),
+          out_(out) {}
+
+    bool sendHeaders(int status, const char *contentType, bool chunked,
+                     size_t contentLength);
+    bool sendChunk(const uint8_t *data, size_t size);
+
+    // These write what the connection can take now and queue the rest behind
+    // anything already queued. Referenced data must stay valid for the
+    // lifetime of the server; other data is copied. These return false if the
+    // connection is gone.
+    bool output(const uint8_t *data, size_t size, bool ref);
+    bool outputv(const IOVec *iov, size_t count);
+
+    EthernetClient &client_;
+    std::vector<Output> &out_;
+    String headers_;
+    bool headOnly_   = false;
+    bool keepAlive_  = true;
+    bool started_    = false;
+    bool chunked_    = false;
+    bool ok_         = true;  // Whether everything was sent
+    uint8_t chunkBuf_[256];
+    size_t chunkLen_ = 0;
+
+    friend class HTTPServer;
+  };
+
+  // A static asset, usually stored in flash. The data is sent without being
+  // copied, so it must stay valid for the lifetime of the server.
+  struct StaticAsset final {
+    const uint8_t *data;
+    size_t size;
+    const char *contentType;
+    const uint8_t *gzipData = nullptr;  // Optional pre-compressed variant
+    size_t gzipSize = 0;
+    const char *etag = nullptr;  // Optional, including the quotes
+  };
+
+  using Handler = std::function<void(Request &req, Response &res)>;
+
+  // Creates a server on the given port that handles at most 'maxConnections'
+  // connections at once, each with a request buffer of 'requestBufSize' bytes.
+  HTTPServer(uint16_t port, size_t maxConnections, size_t requestBufSize);
+
+  // Creates a server with 4 connections and 1024-byte request buffers.
+  explicit HTTPServer(uint16_t port) : HTTPServer(port, 4, 1024) {}
+
+  ~HTTPServer();
+
+  // Disallow copying
+  HTTPServer(const HTTPServer &) = delete;
+  HTTPServer &operator=(const HTTPServer &) = delete;
+
+  // Starts listening. This returns whether successful.
+  bool begin();
+
+  // Closes all connections and stops listening.
+  void end();
+
+  // Adds a route. A path ending in '*' matches any path with that prefix.
+  // Routes are matched in the order they were added.
+  void on(Method method, const char *path, Handler handler);
+
+  // Serves a static asset for GET and HEAD requests. The gzip variant is sent
+  // to clients that accept it, and a matching If-None-Match gets a
+  // "304 Not Modified".
+  void serveStatic(const char *path, const StaticAsset &asset);
+
+  // Sets the handler for requests that don't match any route. The default
+  // sends a "404 Not Found".
+  void onNotFound(Handler handler) {
+    notFound_ = std::move(handler);
+  }
+
+  // Sets how long, in milliseconds, an idle persistent connection is kept. The
+  // default is 10 seconds. This is also how long a queued response may go
+  // without being able to send anything before its connection is dropped.
+  void setIdleTimeout(uint32_t timeout) {
+    idleTimeout_ = timeout;
+  }
+
+  uint32_t idleTimeout() const {
+    return idleTimeout_;
+  }
+
+  // Returns the number of open connections.
+  size_t connectionCount() const {
+    return conns_.size();
+  }
+
+  // Accepts connections, reads requests, and calls handlers. Call this
+  // regularly, for example from the main loop.
+  void loop();
+
+ private:
+  struct Route final {
+    Method method;
+    String path;
+    bool prefix;
+    Handler handler;
+  };
+
+  struct Conn final {
+    EthernetClient client;
+    std::unique_ptr<uint8_t[]> buf;
+    size_t len = 0;      // Bytes in the buffer
+    size_t scanned = 0;  // Bytes already searched for the end of the headers
+    uint32_t lastActive = 0;
+    Request req;         // The request whose headers have been parsed
+    size_t reqSize = 0;  // Its total size, or zero if not parsed yet
+    std::vector<Output> out;  // Queued response data
+    bool closing = false;     // Close once 'out' is sent
+    bool pipelined = false;   // Requests remain in the buffer
+  };
+
+  enum class ParseResult {
+    kIncomplete,
+    kOk,
+    kError,     // 400
+    kTooLarge,  // 413
+    kUnsupported,  // 501
+  };
+
+  // Parses one request from the front of the connection buffer. On success,
+  // 'used' is the size of the request.
+  ParseResult parse(Conn &conn, Request &req, size_t &used);
+
+  // Handles the complete requests in the buffer, stopping at one whose
+  // response couldn't be sent completely. This returns false if the
+  // connection should be closed now.
+  bool processRequests(Conn &conn);
+
+  // Sends as much queued response data as the connection takes, without
+  // blocking. This returns false if the connection should be closed now.
+  bool sendQueued(Conn &conn);
+
+  void dispatch(Request &req, Response &res);
+
+  // Sends a simple response and closes the connection after it.
+  void sendError(Conn &conn, int status);
+
+  static void sendStatic(const StaticAsset &asset, Request &req,
+                         Response &res);
+
+  EthernetServer server_;
+  const size_t maxConns_;
+  const size_t bufSize_;
+  uint32_t idleTimeout_ = 10'000;
+
+  std::vector<Conn> conns_;
+  std::vector<Route> routes_;
+  Handler notFound_ = nullptr;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
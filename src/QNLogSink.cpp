@@ -0,0 +1,368 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNLogSink.cpp implements LogSink.
+// This file is part of the QNEthernet library.
+
+#include "QNLogSink.h"
+
+#if LWIP_UDP || LWIP_TCP
+
+// C++ includes
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <Arduino.h>  // For micros()
+
+#include "QNEthernet.h"
+#include "lwip/sys.h"
+
+namespace qindesign {
+namespace network {
+
+// Room reserved in a batch for the syslog header and the TCP framing.
+static constexpr size_t kMaxHeaderSize = 160;
+
+// How long to wait, in milliseconds, between TCP connection attempts.
+static constexpr uint32_t kReconnectInterval = 5'000;
+
+LogSink *LogSink::first_ = nullptr;
+
+LogSink::LogSink(size_t bufSize)
+    : buf_{new uint8_t[bufSize]},
+      bufSize_(bufSize) {}
+
+LogSink::~LogSink() {
+  end();
+}
+
+#if LWIP_UDP
+bool LogSink::beginUDP(const IPAddress &ip, uint16_t port) {
+  stopTransport();
+  if (!udp_.begin(0)) {
+    return false;
+  }
+  transport_ = Transport::kUDP;
+  ip_ = ip;
+  port_ = port;
+  link();
+  return true;
+}
+#endif  // LWIP_UDP
+
+#if LWIP_TCP
+bool LogSink::beginTCP(const IPAddress &ip, uint16_t port) {
+  stopTransport();
+  transport_ = Transport::kTCP;
+  ip_ = ip;
+  port_ = port;
+  lastConnectAttempt_ = sys_now() - kReconnectInterval;
+  link();
+  return true;
+}
+#endif  // LWIP_TCP
+
+void LogSink::end() {
+  stopTransport();
+  head_ = 0;
+  count_ = 0;
+}
+
+void LogSink::stopTransport() {
+  unlink();
+#if LWIP_UDP
+  udp_.stop();
+#endif  // LWIP_UDP
+#if LWIP_TCP
+  client_.close();
+#endif  // LWIP_TCP
+  transport_ = Transport::kNone;
+  batchLen_ = 0;
+  batchSent_ = 0;
+  batchLines_ = 0;
+}
+
+void LogSink::link() {
+  allowance_ = std::max(rate_, static_cast<uint32_t>(kBatchSize));
+  lastRefill_ = sys_now();
+  next_ = first_;
+  first_ = this;
+}
+
+void LogSink::unlink() {
+  for (LogSink **p = &first_; *p != nullptr; p = &(*p)->next_) {
+    if (*p == this) {
+      *p = next_;
+      break;
+    }
+  }
+  next_ = nullptr;
+}
+
+// --------------------------------------------------------------------------
+//  Buffering
+// --------------------------------------------------------------------------
+
+size_t LogSink::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t LogSink::write(const uint8_t *buffer, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+
+  // Drop the whole write rather than a part of it so that lines aren't cut
+  // in the middle; report success either way so the caller never waits
+  if (size > bufSize_ - count_) {
+    dropped_ += size;
+    droppedWrites_++;
+    return size;
+  }
+
+  size_t n = std::min(size, bufSize_ - head_);
+  std::memcpy(&buf_[head_], buffer, n);
+  std::memcpy(&buf_[0], &buffer[n], size - n);
+  head_ = (head_ + size) % bufSize_;
+  count_ += size;
+  lastWrite_ = sys_now();
+  return size;
+}
+
+int LogSink::availableForWrite() {
+  return bufSize_ - count_;
+}
+
+size_t LogSink::nextLine(bool force) const {
+  const size_t maxLine = kBatchSize - kMaxHeaderSize;
+  const size_t limit = std::min(count_, maxLine);
+  size_t tail = (head_ + bufSize_ - count_) % bufSize_;
+  for (size_t i = 0; i < limit; i++) {
+    if (buf_[tail] == '\n') {
+      return i + 1;
+    }
+    if (++tail >= bufSize_) {
+      tail = 0;
+    }
+  }
+
+  // No newline: split long lines and send unfinished ones after a while
+  if (count_ >= maxLine) {
+    return maxLine;
+  }
+  if (count_ > 0 && (force || (sys_now() - lastWrite_) >= kPartialLineDelay)) {
+    return count_;
+  }
+  return 0;
+}
+
+void LogSink::peek(uint8_t *out, size_t size) const {
+  const size_t tail = (head_ + bufSize_ - count_) % bufSize_;
+  const size_t n = std::min(size, bufSize_ - tail);
+  std::memcpy(out, &buf_[tail], n);
+  std::memcpy(&out[n], &buf_[0], size - n);
+}
+
+void LogSink::consume(size_t size) {
+  count_ -= size;
+  if (count_ == 0) {
+    head_ = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+//  Sending
+// --------------------------------------------------------------------------
+
+bool LogSink::appendLine(bool force) {
+  // A syslog datagram holds exactly one message
+  if (format_ == Format::kSyslog && transport_ == Transport::kUDP &&
+      batchLen_ > 0) {
+    return false;
+  }
+
+  const size_t lineLen = nextLine(force);
+  if (lineLen == 0) {
+    return false;
+  }
+
+  if (format_ == Format::kRaw) {
+    if (batchLen_ + lineLen > kBatchSize) {
+      return false;
+    }
+    peek(&batch_[batchLen_], lineLen);
+    batchLen_ += lineLen;
+    consume(lineLen);
+    batchLines_++;
+    return true;
+  }
+
+  // Syslog: "<PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD MSG", with
+  // the unknown fields left as "-"
+  char header[kMaxHeaderSize];
+  String host = Ethernet.hostname();
+  if (host.length() == 0) {
+    // RFC 5424 prefers the IP address when there's no hostname
+    const IPAddress ip = Ethernet.localIP();
+    char s[16];
+    std::snprintf(s, sizeof(s), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    host = s;
+  }
+  int headerLen = std::snprintf(
+      header, sizeof(header), "<%u>1 - %.64s %.48s - - - ",
+      (unsigned{facility_} << 3) | (severity_ & 0x07),
+      host.c_str(),
+      (appName_.length() == 0) ? "-" : appName_.c_str());
+  if (headerLen < 0) {
+    return false;
+  }
+
+  // The trailing newline isn't part of the message
+  size_t msgLen = lineLen;
+  if (buf_[(head_ + bufSize_ - count_ + lineLen - 1) % bufSize_] == '\n') {
+    msgLen--;
+  }
+
+  // RFC 6587 octet counting for TCP
+  char frame[12];
+  int frameLen = 0;
+  if (transport_ == Transport::kTCP) {
+    frameLen = std::snprintf(frame, sizeof(frame), "%u ",
+                             static_cast<unsigned>(headerLen + msgLen));
+  }
+
+  const size_t total = frameLen + headerLen + msgLen;
+  if (batchLen_ + total > kBatchSize) {
+    return false;
+  }
+  std::memcpy(&batch_[batchLen_], frame, frameLen);
+  batchLen_ += frameLen;
+  std::memcpy(&batch_[batchLen_], header, headerLen);
+  batchLen_ += headerLen;
+  peek(&batch_[batchLen_], msgLen);
+  batchLen_ += msgLen;
+  consume(lineLen);
+  batchLines_++;
+  return true;
+}
+
+bool LogSink::sendBatch() {
+  switch (transport_) {
+#if LWIP_UDP
+    case Transport::kUDP:
+      if (!udp_.send(ip_, port_, batch_, batchLen_)) {
+        return false;
+      }
+      allowance_ -= std::min(static_cast<size_t>(allowance_), batchLen_);
+      break;
+#endif  // LWIP_UDP
+
+#if LWIP_TCP
+    case Transport::kTCP: {
+      if (!client_.connected()) {
+        if ((sys_now() - lastConnectAttempt_) >= kReconnectInterval) {
+          lastConnectAttempt_ = sys_now();
+          client_.connectNoWait(ip_, port_);
+        }
+        // Anything partly sent on the old connection is sent again
+        batchSent_ = 0;
+        return false;
+      }
+      size_t n = client_.write(&batch_[batchSent_], batchLen_ - batchSent_);
+      allowance_ -= std::min(static_cast<size_t>(allowance_), n);
+      batchSent_ += n;
+      if (batchSent_ < batchLen_) {
+        return false;
+      }
+      client_.flush();
+      break;
+    }
+#endif  // LWIP_TCP
+
+    default:
+      return false;
+  }
+
+  sentLines_ += batchLines_;
+  batchLen_ = 0;
+  batchSent_ = 0;
+  batchLines_ = 0;
+  return true;
+}
+
+void LogSink::refill() {
+  if (rate_ == 0) {
+    return;
+  }
+  const uint32_t now = sys_now();
+  const uint64_t add = uint64_t{now - lastRefill_} * rate_ / 1000;
+  if (add == 0) {
+    return;
+  }
+  const uint32_t cap = std::max(rate_, static_cast<uint32_t>(kBatchSize));
+  allowance_ = static_cast<uint32_t>(std::min(uint64_t{allowance_} + add,
+                                              uint64_t{cap}));
+  lastRefill_ = now;
+}
+
+void LogSink::send(bool force) {
+  const uint32_t start = micros();
+  refill();
+
+  while (true) {
+    if (batchLen_ == 0) {
+      while (appendLine(force)) {
+        // Fill the batch
+      }
+      if (batchLen_ == 0) {
+        break;
+      }
+    }
+    if (rate_ != 0 && allowance_ < batchLen_ - batchSent_) {
+      break;
+    }
+    if (!sendBatch()) {
+      break;
+    }
+    if ((micros() - start) >= timeBudget_) {
+      break;
+    }
+  }
+}
+
+void LogSink::flush() {
+  if (polling_ || transport_ == Transport::kNone) {
+    return;
+  }
+  polling_ = true;
+  send(true);
+  polling_ = false;
+}
+
+void LogSink::poll() {
+  if (polling_ || transport_ == Transport::kNone) {
+    return;
+  }
+  polling_ = true;
+  send(false);
+  polling_ = false;
+}
+
+void LogSink::pollAll() {
+  // Sending may call Ethernet.loop(), which calls this
+  static bool busy = false;
+  if (busy) {
+    return;
+  }
+  busy = true;
+  for (LogSink *s = first_; s != nullptr; s = s->next_) {
+    s->poll();
+  }
+  busy = false;
+}
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP || LWIP_TCP
@@ -0,0 +1,241 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNLogSink.h defines a non-blocking Print that ships log lines over
+// the network.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_UDP || LWIP_TCP
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <IPAddress.h>
+#include <Print.h>
+#include <WString.h>
+
+#include "QNEthernetClient.h"
+#include "QNEthernetUDP.h"
+
+namespace qindesign {
+namespace network {
+
+// LogSink is a Print that never blocks. Writes are copied into a RAM ring
+// buffer and the buffered lines are sent, in batches, from Ethernet.loop(),
+// under a rate limit and a time budget. When the ring is full, writes are
+// dropped and counted.
+//
+// This is meant to be used as the stdoutPrint or stderrPrint target so that
+// printf() doesn't wait for the network. Anything written before one of the
+// begin functions is called is kept and sent once started, for example, boot
+// messages printed before the network is up. Note that it isn't safe to write
+// to this from an interrupt.
+class LogSink final : public Print {
+ public:
+  // How lines are sent.
+  enum class Format {
+    kRaw,     // Lines as they are
+    kSyslog,  // RFC 5424 syslog messages
+  };
+
+  // Creates a sink with a ring buffer of the given size.
+  explicit LogSink(size_t bufSize);
+
+  // Creates a sink with a 4096-byte ring buffer.
+  LogSink() : LogSink(4096) {}
+
+  ~LogSink();
+
+  // Disallow copying
+  LogSink(const LogSink &) = delete;
+  LogSink &operator=(const LogSink &) = delete;
+
+#if LWIP_UDP
+  // Starts sending to the given address over UDP. For syslog, each line is
+  // sent as its own datagram, as RFC 5426 requires. Raw lines are packed into
+  // datagrams. This returns whether successful.
+  bool beginUDP(const IPAddress &ip, uint16_t port = 514);
+#endif  // LWIP_UDP
+
+#if LWIP_TCP
+  // Starts sending to the given address over TCP. The connection is made, and
+  // remade after it's lost, in the background. Syslog messages use RFC 6587
+  // octet-counting framing. This returns whether successful.
+  bool beginTCP(const IPAddress &ip, uint16_t port = 514);
+#endif  // LWIP_TCP
+
+  // Stops sending and discards any buffered data.
+  void end();
+
+  void setFormat(Format format) {
+    format_ = format;
+  }
+
+  Format format() const {
+    return format_;
+  }
+
+  // Sets the syslog facility, 0-23. The default is 1, "user-level messages".
+  void setFacility(uint8_t facility) {
+    facility_ = facility;
+  }
+
+  // Sets the syslog severity, 0-7. The default is 6, "informational". For
+  // example, a sink for stderr might use 3, "error".
+  void setSeverity(uint8_t severity) {
+    severity_ = severity;
+  }
+
+  // Sets the syslog APP-NAME. The default is "-", meaning none.
+  void setAppName(const char *name) {
+    appName_ = name;
+  }
+
+  // Sets the maximum send rate, in bytes per second. Zero means no limit, the
+  // default.
+  void setRate(uint32_t bytesPerSecond) {
+    rate_ = bytesPerSecond;
+  }
+
+  // Sets the most time, in microseconds, spent sending during each
+  // Ethernet.loop() call. The default is 200.
+  void setTimeBudget(uint32_t micros) {
+    timeBudget_ = micros;
+  }
+
+  // Print functions. These always "succeed", even if the data was dropped.
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int availableForWrite() override;
+
+  // Sends what it can without blocking. Unfinished lines are sent too.
+  void flush() override;
+
+  // Returns the number of bytes that were dropped because the ring was full.
+  size_t dropped() const {
+    return dropped_;
+  }
+
+  // Returns the number of writes that were dropped.
+  size_t droppedWrites() const {
+    return droppedWrites_;
+  }
+
+  // Returns the number of lines sent.
+  size_t sentLines() const {
+    return sentLines_;
+  }
+
+  // Returns the number of bytes waiting in the ring.
+  size_t pending() const {
+    return count_;
+  }
+
+  // Resets the counters.
+  void resetCounters() {
+    dropped_ = 0;
+    droppedWrites_ = 0;
+    sentLines_ = 0;
+  }
+
+  // Sends buffered lines within the budget. This is called for every active
+  // sink from Ethernet.loop().
+  void poll();
+
+  // Polls all active sinks.
+  static void pollAll();
+
+ private:
+  // Largest datagram or batch. This keeps UDP datagrams within one frame.
+  static constexpr size_t kBatchSize = 1400;
+
+  // A line without a newline is sent after waiting this long, in milliseconds.
+  static constexpr uint32_t kPartialLineDelay = 100;
+
+  enum class Transport {
+    kNone,
+    kUDP,
+    kTCP,
+  };
+
+  // Gets the size of the next line in the ring, including any newline, or
+  // zero if there's no line ready. 'force' sends an unfinished line.
+  size_t nextLine(bool force) const;
+
+  // Copies bytes from the ring without removing them.
+  void peek(uint8_t *out, size_t size) const;
+
+  // Removes bytes from the ring.
+  void consume(size_t size);
+
+  // Appends the next line to the batch, formatted. This returns false if
+  // there's no line ready or it doesn't fit.
+  bool appendLine(bool force);
+
+  // Sends the batch. This returns whether all of it was sent.
+  bool sendBatch();
+
+  // Refills the rate limiter's allowance.
+  void refill();
+
+  // Sends within the budget.
+  void send(bool force);
+
+  // Closes the transport and discards the batch, keeping the ring.
+  void stopTransport();
+
+  void link();
+  void unlink();
+
+  std::unique_ptr<uint8_t[]> buf_;
+  const size_t bufSize_;
+  size_t head_ = 0;   // Where the next byte is written
+  size_t count_ = 0;  // Bytes in the ring
+  uint32_t lastWrite_ = 0;
+
+  Transport transport_ = Transport::kNone;
+  IPAddress ip_;
+  uint16_t port_ = 0;
+#if LWIP_UDP
+  EthernetUDP udp_;
+#endif  // LWIP_UDP
+#if LWIP_TCP
+  EthernetClient client_;
+  uint32_t lastConnectAttempt_ = 0;
+#endif  // LWIP_TCP
+
+  Format format_ = Format::kSyslog;
+  uint8_t facility_ = 1;
+  uint8_t severity_ = 6;
+  String appName_{"-"};
+  uint32_t rate_ = 0;
+  uint32_t allowance_ = 0;  // Bytes that may be sent now
+  uint32_t lastRefill_ = 0;
+  uint32_t timeBudget_ = 200;
+
+  uint8_t batch_[kBatchSize];
+  size_t batchLen_ = 0;
+  size_t batchSent_ = 0;  // For TCP, the part already written
+  size_t batchLines_ = 0;
+
+  size_t dropped_ = 0;
+  size_t droppedWrites_ = 0;
+  size_t sentLines_ = 0;
+
+  bool polling_ = false;
+
+  // All active sinks
+  LogSink *next_ = nullptr;
+  static LogSink *first_;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP || LWIP_TCP
@@ -0,0 +1,225 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNMessageFramer.cpp implements MessageFramer.
+// This file is part of the QNEthernet library.
+
+#include "QNMessageFramer.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <algorithm>
+#include <cerrno>
+
+#include "util/IOVec.h"
+
+namespace qindesign {
+namespace network {
+
+MessageFramer::MessageFramer(Format format, size_t size)
+    : format_(format),
+      maxSize_(size) {}
+
+bool MessageFramer::decodePrefix(const uint8_t *data, size_t avail,
+                                 size_t &prefixSize, size_t &size) {
+  switch (format_) {
+    case Format::kFixed:
+      prefixSize = 0;
+      size = maxSize_;
+      return true;
+
+    case Format::kLength8:
+      if (avail < 1) {
+        return false;
+      }
+      prefixSize = 1;
+      size = data[0];
+      return true;
+
+    case Format::kLength16:
+      if (avail < 2) {
+        return false;
+      }
+      prefixSize = 2;
+      size = littleEndian_ ? (data[0] | (size_t{data[1]} << 8))
+                           : ((size_t{data[0]} << 8) | data[1]);
+      return true;
+
+    case Format::kLength32: {
+      if (avail < 4) {
+        return false;
+      }
+      prefixSize = 4;
+      uint32_t v;
+      if (littleEndian_) {
+        v = data[0] | (uint32_t{data[1]} << 8) | (uint32_t{data[2]} << 16) |
+            (uint32_t{data[3]} << 24);
+      } else {
+        v = (uint32_t{data[0]} << 24) | (uint32_t{data[1]} << 16) |
+            (uint32_t{data[2]} << 8) | data[3];
+      }
+      size = v;
+      return true;
+    }
+
+    case Format::kVarint: {
+      uint32_t v = 0;
+      for (size_t i = 0; i < kMaxPrefixSize; i++) {
+        if (i >= avail) {
+          return false;
+        }
+        const uint8_t b = data[i];
+        if (i == kMaxPrefixSize - 1 && (b & 0xf0) != 0) {
+          // More than 32 bits
+          error_ = EBADMSG;
+          return false;
+        }
+        v |= uint32_t{b & 0x7fu} << (7 * i);
+        if ((b & 0x80) == 0) {
+          prefixSize = i + 1;
+          size = v;
+          return true;
+        }
+      }
+      error_ = EBADMSG;
+      return false;
+    }
+  }
+  return false;
+}
+
+int MessageFramer::process(EthernetClient &client, const Handler &handler,
+                           size_t maxMessages) {
+  if (error_ != 0) {
+    errno = error_;
+    return -1;
+  }
+  if (format_ == Format::kFixed && maxSize_ == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int count = 0;
+  while (static_cast<size_t>(count) < maxMessages) {
+    // Get the span again each time because the handler may have moved the
+    // stack along, which can rearrange the buffer
+    size_t avail;
+    const uint8_t *data = client.readableSpan(avail);
+    if (data == nullptr || avail == 0) {
+      break;
+    }
+
+    size_t prefixSize;
+    size_t size;
+    if (!decodePrefix(data, avail, prefixSize, size)) {
+      if (error_ != 0) {
+        errno = error_;
+        return -1;
+      }
+      break;
+    }
+
+    // A message that can't fit in the receive buffer would never complete
+    if (size > maxSize_ || prefixSize + size > client.bufferCapacity()) {
+      error_ = EMSGSIZE;
+      errno = error_;
+      return -1;
+    }
+    if (avail - prefixSize < size) {
+      break;
+    }
+
+    // Keep the message where it is while the handler runs, even if it moves
+    // the stack along, for example, by writing a reply
+    client.setBufferPinned(true);
+    const bool consumed = handler(&data[prefixSize], size);
+    client.setBufferPinned(false);
+    if (!consumed) {
+      break;
+    }
+    client.consume(prefixSize + size);
+    messageCount_++;
+    count++;
+  }
+  return count;
+}
+
+size_t MessageFramer::encodePrefix(size_t size,
+                                   uint8_t prefix[kMaxPrefixSize]) const {
+  switch (format_) {
+    case Format::kFixed:
+      return 0;
+
+    case Format::kLength8:
+      prefix[0] = size;
+      return 1;
+
+    case Format::kLength16:
+      if (littleEndian_) {
+        prefix[0] = size;
+        prefix[1] = size >> 8;
+      } else {
+        prefix[0] = size >> 8;
+        prefix[1] = size;
+      }
+      return 2;
+
+    case Format::kLength32:
+      for (size_t i = 0; i < 4; i++) {
+        prefix[littleEndian_ ? i : (3 - i)] = size >> (8 * i);
+      }
+      return 4;
+
+    case Format::kVarint: {
+      size_t n = 0;
+      uint32_t v = size;
+      while (v >= 0x80) {
+        prefix[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+      }
+      prefix[n++] = v;
+      return n;
+    }
+  }
+  return 0;
+}
+
+bool MessageFramer::write(EthernetClient &client, const uint8_t *data,
+                          size_t size) const {
+  size_t limit = maxSize_;
+  switch (format_) {
+    case Format::kFixed:
+      if (size != maxSize_) {
+        errno = EINVAL;
+        return false;
+      }
+      break;
+    case Format::kLength8:
+      limit = std::min(limit, size_t{UINT8_MAX});
+      break;
+    case Format::kLength16:
+      limit = std::min(limit, size_t{UINT16_MAX});
+      break;
+    case Format::kLength32:
+    case Format::kVarint:
+      limit = std::min(limit, size_t{UINT32_MAX});
+      break;
+  }
+  if (size > limit) {
+    errno = EMSGSIZE;
+    return false;
+  }
+
+  uint8_t prefix[kMaxPrefixSize];
+  const IOVec iov[]{
+      {prefix, encodePrefix(size, prefix)},
+      {data, size},
+  };
+  return client.writevFully(iov, 2) == iovecSize(iov, 2);
+}
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
@@ -0,0 +1,142 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNMessageFramer.h defines a message framing codec for TCP connections.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "QNEthernetClient.h"
+
+namespace qindesign {
+namespace network {
+
+// MessageFramer splits a TCP stream into messages, either of a fixed size or
+// each starting with a length prefix, and frames outgoing messages the
+// same way.
+//
+// Complete messages are passed to a handler as views into the connection's
+// receive buffer. Unread data in that buffer is always contiguous, so no
+// message is copied on the way. A message stays in the buffer until its
+// handler accepts it, which keeps the TCP window closed while the application
+// is busy.
+//
+// The maximum message size is limited by the size of the connection's receive
+// buffer, TCP_WND.
+class MessageFramer final {
+ public:
+  enum class Format {
+    kFixed,     // No prefix; every message is the same size
+    kLength8,   // 8-bit length prefix
+    kLength16,  // 16-bit length prefix
+    kLength32,  // 32-bit length prefix
+    kVarint,    // LEB128 length prefix, up to 32 bits, as in Protocol Buffers
+  };
+
+  // Handles one message. The data is only valid during the call, but it stays
+  // valid if the handler writes to the connection or calls Ethernet.loop(),
+  // because the receive buffer is pinned while the handler runs. Data that
+  // arrives meanwhile is appended or held back until the handler returns. The
+  // handler must not close the connection. Return true to consume the message
+  // or false to leave it in the buffer and stop.
+  using Handler = std::function<bool(const uint8_t *data, size_t size)>;
+
+  // Creates a framer. For kFixed, 'size' is the message size; for the other
+  // formats, it's the maximum message size, not including the prefix.
+  MessageFramer(Format format, size_t size);
+
+  ~MessageFramer() = default;
+
+  Format format() const {
+    return format_;
+  }
+
+  // Sets the maximum message size. For kFixed, this is the message size.
+  void setMaxSize(size_t size) {
+    maxSize_ = size;
+  }
+
+  size_t maxSize() const {
+    return maxSize_;
+  }
+
+  // Sets whether 16- and 32-bit length prefixes are little-endian. The default
+  // is big-endian, network order.
+  void setLittleEndian(bool flag) {
+    littleEndian_ = flag;
+  }
+
+  bool isLittleEndian() const {
+    return littleEndian_;
+  }
+
+  // Passes each complete message in the client's receive buffer to the
+  // handler, stopping after 'maxMessages' messages or when the handler returns
+  // false. This moves the stack along once per message instead of once per
+  // byte read.
+  //
+  // This returns the number of messages consumed, or -1 if the stream is
+  // invalid. The stream is invalid if a message is too large or a varint is
+  // too long; errno is set to EMSGSIZE or EBADMSG, and the stream can't be
+  // parsed further, so the connection should be closed. Call reset() to use
+  // this framer with a different connection.
+  int process(EthernetClient &client, const Handler &handler,
+              size_t maxMessages = SIZE_MAX);
+
+  // Writes one message with its prefix. This returns whether the whole
+  // message was written; it fails if the message is too large, or for
+  // kFixed, if it isn't the right size.
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool write(EthernetClient &client, const uint8_t *data, size_t size) const;
+
+  // Clears any error.
+  void reset() {
+    error_ = 0;
+  }
+
+  // Returns the error that stopped parsing, an errno value, or zero if
+  // there's no error.
+  int error() const {
+    return error_;
+  }
+
+  // Returns the number of messages consumed.
+  uint32_t messageCount() const {
+    return messageCount_;
+  }
+
+ private:
+  // Maximum prefix size, for a 32-bit varint.
+  static constexpr size_t kMaxPrefixSize = 5;
+
+  // Decodes the prefix at the start of the data. This returns whether there
+  // was a whole prefix, and if so, sets 'prefixSize' and 'size'. This sets
+  // error_ if the prefix is invalid.
+  bool decodePrefix(const uint8_t *data, size_t avail, size_t &prefixSize,
+                    size_t &size);
+
+  // Encodes a prefix and returns its size.
+  size_t encodePrefix(size_t size, uint8_t prefix[kMaxPrefixSize]) const;
+
+  Format format_;
+  size_t maxSize_;
+  bool littleEndian_ = false;
+
+  int error_ = 0;
+  uint32_t messageCount_ = 0;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
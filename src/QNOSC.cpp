@@ -0,0 +1,646 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNOSC.cpp implements the OSC parser and dispatcher.
+// This file is part of the QNEthernet library.
+
+#include "QNOSC.h"
+
+// C++ includes
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace qindesign {
+namespace network {
+
+// Maximum bundle nesting.
+static constexpr int kMaxBundleDepth = 4;
+
+// Characters that make an address part a pattern.
+static constexpr char kPatternChars[] = "?*[]{},";
+
+static inline uint32_t getU32BE(const uint8_t *p) {
+  return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) |
+         (uint32_t{p[2]} << 8) | p[3];
+}
+
+static inline uint64_t getU64BE(const uint8_t *p) {
+  return (uint64_t{getU32BE(p)} << 32) | getU32BE(&p[4]);
+}
+
+// Rounds up to a multiple of 4.
+static inline size_t pad4(size_t n) {
+  return (n + 3) & ~size_t{3};
+}
+
+// FNV-1a
+static uint32_t hashPart(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ static_cast<uint8_t>(s[i])) * 16777619u;
+  }
+  return h;
+}
+
+static bool isPattern(const char *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (std::strchr(kPatternChars, s[i]) != nullptr && s[i] != '\0') {
+      return true;
+    }
+  }
+  return false;
+}
+
+// --------------------------------------------------------------------------
+//  OSCArg
+// --------------------------------------------------------------------------
+
+int32_t OSCArg::asInt32() const {
+  switch (type_) {
+    case 'i':
+    case 'c':
+      return static_cast<int32_t>(getU32BE(data_));
+    case 'h':
+    case 'f':
+    case 'd':
+      return static_cast<int32_t>(asInt64());
+    case 'T':
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+int64_t OSCArg::asInt64() const {
+  switch (type_) {
+    case 'h':
+      return static_cast<int64_t>(getU64BE(data_));
+    case 'f':
+      return static_cast<int64_t>(asFloat());
+    case 'd':
+      return static_cast<int64_t>(asDouble());
+    default:
+      return asInt32();
+  }
+}
+
+float OSCArg::asFloat() const {
+  if (type_ == 'f') {
+    const uint32_t bits = getU32BE(data_);
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+  return static_cast<float>(asDouble());
+}
+
+double OSCArg::asDouble() const {
+  switch (type_) {
+    case 'd': {
+      const uint64_t bits = getU64BE(data_);
+      double d;
+      std::memcpy(&d, &bits, sizeof(d));
+      return d;
+    }
+    case 'f':
+      return asFloat();
+    case 'i':
+      return asInt32();
+    case 'h':
+      return static_cast<double>(asInt64());
+    default:
+      return 0;
+  }
+}
+
+bool OSCArg::asBool() const {
+  switch (type_) {
+    case 'T':
+      return true;
+    case 'f':
+    case 'd':
+      return asDouble() != 0;
+    default:
+      return asInt64() != 0;
+  }
+}
+
+uint64_t OSCArg::asTime() const {
+  return (type_ == 't') ? getU64BE(data_) : 0;
+}
+
+const char *OSCArg::asString() const {
+  if (type_ == 's' || type_ == 'S') {
+    return reinterpret_cast<const char *>(data_);
+  }
+  return nullptr;
+}
+
+const uint8_t *OSCArg::asBlob(size_t &size) const {
+  if (type_ != 'b') {
+    size = 0;
+    return nullptr;
+  }
+  size = getU32BE(data_);
+  return &data_[4];
+}
+
+// --------------------------------------------------------------------------
+//  OSCMessage
+// --------------------------------------------------------------------------
+
+bool OSCMessage::parse(const uint8_t *data, size_t size) {
+  data_ = nullptr;
+  argCount_ = 0;
+  timeTag_ = kOSCImmediately;
+
+  if (size < 4 || (size & 0x03) != 0 || size > UINT16_MAX || data[0] != '/') {
+    return false;
+  }
+
+  // Address
+  const uint8_t *nul = static_cast<const uint8_t *>(std::memchr(data, 0, size));
+  if (nul == nullptr) {
+    return false;
+  }
+  address_ = reinterpret_cast<const char *>(data);
+  addressLen_ = nul - data;
+  size_t pos = pad4(addressLen_ + 1);
+
+  // Old implementations may leave out the type tags
+  if (pos == size) {
+    typeTags_ = "";
+    argOffsets_[0] = pos;
+    data_ = data;
+    size_ = size;
+    return true;
+  }
+  if (data[pos] != ',') {
+    return false;
+  }
+  nul = static_cast<const uint8_t *>(std::memchr(&data[pos], 0, size - pos));
+  if (nul == nullptr) {
+    return false;
+  }
+  typeTags_ = reinterpret_cast<const char *>(&data[pos + 1]);
+  const size_t tagCount = nul - &data[pos + 1];
+  pos = pad4((nul - data) + 1);
+  if (tagCount > kMaxArgs) {
+    return false;
+  }
+
+  // Arguments
+  for (size_t i = 0; i < tagCount; i++) {
+    argOffsets_[i] = pos;
+    switch (typeTags_[i]) {
+      case 'i':
+      case 'f':
+      case 'c':
+      case 'r':
+      case 'm':
+        pos += 4;
+        break;
+      case 'h':
+      case 't':
+      case 'd':
+        pos += 8;
+        break;
+      case 's':
+      case 'S':
+        nul = static_cast<const uint8_t *>(
+            std::memchr(&data[pos], 0, size - std::min(pos, size)));
+        if (nul == nullptr) {
+          return false;
+        }
+        pos = pad4((nul - data) + 1);
+        break;
+      case 'b':
+        if (pos + 4 > size || getU32BE(&data[pos]) > size - pos - 4) {
+          return false;
+        }
+        pos += 4 + pad4(getU32BE(&data[pos]));
+        break;
+      case 'T':
+      case 'F':
+      case 'N':
+      case 'I':
+      case '[':
+      case ']':
+        break;
+      default:
+        return false;
+    }
+    if (pos > size) {
+      return false;
+    }
+  }
+  argOffsets_[tagCount] = pos;
+  argCount_ = tagCount;
+
+  data_ = data;
+  size_ = size;
+  return true;
+}
+
+OSCArg OSCMessage::arg(size_t index) const {
+  if (index >= argCount_) {
+    return OSCArg{};
+  }
+  return OSCArg{typeTags_[index], &data_[argOffsets_[index]],
+                size_t{argOffsets_[index + 1]} - argOffsets_[index]};
+}
+
+// --------------------------------------------------------------------------
+//  OSCBundle
+// --------------------------------------------------------------------------
+
+bool OSCBundle::isBundle(const uint8_t *data, size_t size) {
+  return size >= 16 && std::memcmp(data, "#bundle", 8) == 0;
+}
+
+bool OSCBundle::parse(const uint8_t *data, size_t size) {
+  data_ = nullptr;
+  if (!isBundle(data, size) || (size & 0x03) != 0) {
+    return false;
+  }
+
+  // Check the element sizes
+  size_t pos = 16;
+  while (pos < size) {
+    if (pos + 4 > size) {
+      return false;
+    }
+    const size_t n = getU32BE(&data[pos]);
+    if ((n & 0x03) != 0 || n > size - pos - 4) {
+      return false;
+    }
+    pos += 4 + n;
+  }
+
+  data_ = data;
+  size_ = size;
+  pos_ = 16;
+  timeTag_ = getU64BE(&data[8]);
+  return true;
+}
+
+bool OSCBundle::next(const uint8_t *&data, size_t &size) {
+  if (data_ == nullptr || pos_ + 4 > size_) {
+    return false;
+  }
+  size = getU32BE(&data_[pos_]);
+  data = &data_[pos_ + 4];
+  pos_ += 4 + size;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+//  OSCDispatcher
+// --------------------------------------------------------------------------
+
+OSCDispatcher::OSCDispatcher(size_t maxScheduled, size_t maxScheduledSize)
+    : maxScheduled_(maxScheduled),
+      maxScheduledSize_(maxScheduledSize) {
+  nodes_.emplace_back();
+  if (maxScheduled_ > 0) {
+    scheduled_ = std::make_unique<Scheduled[]>(maxScheduled_);
+    scheduledBuf_ =
+        std::make_unique<uint8_t[]>(maxScheduled_ * maxScheduledSize_);
+  }
+}
+
+int32_t OSCDispatcher::findNode(const char *address, bool create) {
+  if (address == nullptr || address[0] != '/') {
+    return -1;
+  }
+
+  int32_t node = 0;
+  const char *part = address;
+  while (*part == '/') {
+    part++;
+    const char *end = std::strchr(part, '/');
+    const size_t len = (end == nullptr) ? std::strlen(part) : (end - part);
+    if (len == 0 || isPattern(part, len)) {
+      return -1;
+    }
+
+    const uint32_t h = hashPart(part, len);
+    int32_t child = nodes_[node].firstChild;
+    while (child >= 0) {
+      const Node &n = nodes_[child];
+      if (n.hash == h && n.name.size() == len &&
+          std::memcmp(n.name.data(), part, len) == 0) {
+        break;
+      }
+      child = n.nextSibling;
+    }
+    if (child < 0) {
+      if (!create) {
+        return -1;
+      }
+      Node n;
+      n.name.assign(part, len);
+      n.hash = h;
+      n.nextSibling = nodes_[node].firstChild;
+      child = static_cast<int32_t>(nodes_.size());
+      nodes_.push_back(std::move(n));
+      nodes_[node].firstChild = child;
+    }
+    node = child;
+    part += len;
+  }
+  return node;
+}
+
+bool OSCDispatcher::add(const char *address, Handler handler) {
+  const int32_t node = findNode(address, true);
+  if (node < 0) {
+    errno = EINVAL;
+    return false;
+  }
+  nodes_[node].handler = std::move(handler);
+  return true;
+}
+
+bool OSCDispatcher::remove(const char *address) {
+  const int32_t node = findNode(address, false);
+  if (node < 0 || !nodes_[node].handler) {
+    return false;
+  }
+  nodes_[node].handler = nullptr;
+  return true;
+}
+
+void OSCDispatcher::clear() {
+  nodes_.clear();
+  nodes_.emplace_back();
+}
+
+bool OSCDispatcher::matchPattern(const char *pattern, size_t patternLen,
+                                 const char *name, size_t nameLen) {
+  const char *p = pattern;
+  const char *const pe = pattern + patternLen;
+  const char *s = name;
+  const char *const se = name + nameLen;
+
+  while (p < pe) {
+    switch (*p) {
+      case '?':
+        if (s == se) {
+          return false;
+        }
+        p++;
+        s++;
+        break;
+
+      case '*':
+        while (p < pe && *p == '*') {
+          p++;
+        }
+        if (p == pe) {
+          return true;
+        }
+        for (; s <= se; s++) {
+          if (matchPattern(p, pe - p, s, se - s)) {
+            return true;
+          }
+        }
+        return false;
+
+      case '[': {
+        if (s == se) {
+          return false;
+        }
+        p++;
+        bool negate = false;
+        if (p < pe && *p == '!') {
+          negate = true;
+          p++;
+        }
+        bool found = false;
+        while (p < pe && *p != ']') {
+          if (p + 2 < pe && p[1] == '-' && p[2] != ']') {
+            if (p[0] <= *s && *s <= p[2]) {
+              found = true;
+            }
+            p += 3;
+          } else {
+            if (*p == *s) {
+              found = true;
+            }
+            p++;
+          }
+        }
+        if (p == pe || found == negate) {
+          return false;
+        }
+        p++;  // Skip the ']'
+        s++;
+        break;
+      }
+
+      case '{': {
+        const char *close =
+            static_cast<const char *>(std::memchr(p, '}', pe - p));
+        if (close == nullptr) {
+          return false;
+        }
+        const char *alt = p + 1;
+        while (alt <= close) {
+          const char *altEnd =
+              static_cast<const char *>(std::memchr(alt, ',', close - alt));
+          if (altEnd == nullptr) {
+            altEnd = close;
+          }
+          const size_t altLen = altEnd - alt;
+          if (altLen <= static_cast<size_t>(se - s) &&
+              std::memcmp(s, alt, altLen) == 0 &&
+              matchPattern(close + 1, pe - close - 1, s + altLen,
+                           se - s - altLen)) {
+            return true;
+          }
+          alt = altEnd + 1;
+        }
+        return false;
+      }
+
+      default:
+        if (s == se || *s != *p) {
+          return false;
+        }
+        p++;
+        s++;
+        break;
+    }
+  }
+  return s == se;
+}
+
+size_t OSCDispatcher::match(int32_t node, const char *part, const char *end,
+                            const OSCMessage &msg) {
+  // 'part' points to a '/'
+  part++;
+  const char *partEnd =
+      static_cast<const char *>(std::memchr(part, '/', end - part));
+  if (partEnd == nullptr) {
+    partEnd = end;
+  }
+  const size_t len = partEnd - part;
+  const bool last = (partEnd == end);
+
+  size_t count = 0;
+  if (!isPattern(part, len)) {
+    // Literal part: follow at most one child
+    const uint32_t h = hashPart(part, len);
+    for (int32_t c = nodes_[node].firstChild; c >= 0;
+         c = nodes_[c].nextSibling) {
+      const Node &n = nodes_[c];
+      if (n.hash != h || n.name.size() != len ||
+          std::memcmp(n.name.data(), part, len) != 0) {
+        continue;
+      }
+      if (!last) {
+        return match(c, partEnd, end, msg);
+      }
+      if (n.handler) {
+        n.handler(msg);
+        return 1;
+      }
+      return 0;
+    }
+    return 0;
+  }
+
+  for (int32_t c = nodes_[node].firstChild; c >= 0;
+       c = nodes_[c].nextSibling) {
+    const Node &n = nodes_[c];
+    if (!matchPattern(part, len, n.name.data(), n.name.size())) {
+      continue;
+    }
+    if (!last) {
+      count += match(c, partEnd, end, msg);
+    } else if (n.handler) {
+      n.handler(msg);
+      count++;
+    }
+  }
+  return count;
+}
+
+bool OSCDispatcher::dispatch(const uint8_t *data, size_t size) {
+  return dispatch(data, size, kOSCImmediately, 0);
+}
+
+bool OSCDispatcher::dispatch(const uint8_t *data, size_t size,
+                             uint64_t timeTag, int depth) {
+  if (OSCBundle::isBundle(data, size)) {
+    OSCBundle bundle;
+    if (depth >= kMaxBundleDepth || !bundle.parse(data, size)) {
+      errorCount_++;
+      return false;
+    }
+    const uint64_t t = bundle.timeTag();
+    if (clock_ != nullptr && t != kOSCImmediately &&
+        static_cast<int64_t>(t - clock_()) > 0) {
+      if (!schedule(t, data, size)) {
+        droppedCount_++;
+      }
+      return true;
+    }
+    return dispatchBundle(bundle, depth);
+  }
+
+  OSCMessage msg;
+  if (!msg.parse(data, size)) {
+    errorCount_++;
+    return false;
+  }
+  msg.timeTag_ = timeTag;
+  if (match(0, msg.address_, msg.address_ + msg.addressLen_, msg) > 0) {
+    messageCount_++;
+  } else {
+    unmatchedCount_++;
+  }
+  return true;
+}
+
+bool OSCDispatcher::dispatchBundle(OSCBundle &bundle, int depth) {
+  bool ok = true;
+  const uint8_t *data;
+  size_t size;
+  while (bundle.next(data, size)) {
+    if (size > 0 && !dispatch(data, size, bundle.timeTag(), depth + 1)) {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool OSCDispatcher::schedule(uint64_t time, const uint8_t *data, size_t size) {
+  if (size > maxScheduledSize_) {
+    return false;
+  }
+  for (size_t i = 0; i < maxScheduled_; i++) {
+    Scheduled &s = scheduled_[i];
+    if (s.size == 0) {
+      std::memcpy(&scheduledBuf_[i * maxScheduledSize_], data, size);
+      s.time = time;
+      s.size = size;
+      s.order = scheduleOrder_++;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t OSCDispatcher::scheduledCount() const {
+  size_t n = 0;
+  for (size_t i = 0; i < maxScheduled_; i++) {
+    if (scheduled_[i].size != 0) {
+      n++;
+    }
+  }
+  return n;
+}
+
+void OSCDispatcher::loop() {
+  // Without a clock, everything is due
+  const bool haveClock = (clock_ != nullptr);
+  const uint64_t now = haveClock ? clock_() : 0;
+
+  while (true) {
+    // Find the earliest due bundle
+    Scheduled *next = nullptr;
+    size_t nextIndex = 0;
+    for (size_t i = 0; i < maxScheduled_; i++) {
+      Scheduled &s = scheduled_[i];
+      if (s.size == 0 ||
+          (haveClock && static_cast<int64_t>(s.time - now) > 0)) {
+        continue;
+      }
+      if (next == nullptr ||
+          static_cast<int64_t>(s.time - next->time) < 0 ||
+          (s.time == next->time &&
+           static_cast<int32_t>(s.order - next->order) < 0)) {
+        next = &s;
+        nextIndex = i;
+      }
+    }
+    if (next == nullptr) {
+      break;
+    }
+
+    // The slot stays in use while delivering so that nested bundles don't
+    // overwrite it
+    OSCBundle bundle;
+    if (bundle.parse(&scheduledBuf_[nextIndex * maxScheduledSize_],
+                     next->size)) {
+      dispatchBundle(bundle, 0);
+    }
+    next->size = 0;
+  }
+}
+
+}  // namespace network
+}  // namespace qindesign
@@ -0,0 +1,324 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNOSC.h defines an Open Sound Control (OSC) parser and dispatcher.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace qindesign {
+namespace network {
+
+// OSC time tag meaning "immediately".
+constexpr uint64_t kOSCImmediately = 1;
+
+// OSCArg is a view of one OSC message argument. It points into the message
+// data and is only valid while that data is.
+class OSCArg final {
+ public:
+  OSCArg() = default;
+  OSCArg(char type, const uint8_t *data, size_t size)
+      : type_(type), data_(data), size_(size) {}
+
+  // Returns the type tag, or '\0' if this is not a valid argument.
+  char type() const {
+    return type_;
+  }
+
+  // Returns the argument as an integer. Numbers, 'c', 'T', and 'F' are
+  // converted and anything else returns zero.
+  int32_t asInt32() const;
+  int64_t asInt64() const;
+
+  // Returns the argument as a float or double. Numbers are converted and
+  // anything else returns zero.
+  float asFloat() const;
+  double asDouble() const;
+
+  // Returns whether the argument is 'T' or a nonzero number.
+  bool asBool() const;
+
+  // Returns the time tag for a 't' argument, or zero otherwise.
+  uint64_t asTime() const;
+
+  // Returns the NUL-terminated string for an 's' or 'S' argument, or nullptr
+  // otherwise. This points into the message data.
+  const char *asString() const;
+
+  // Returns the data for a 'b' argument, or nullptr otherwise. The size is
+  // returned in 'size'. This points into the message data.
+  const uint8_t *asBlob(size_t &size) const;
+
+  // Returns the raw argument data, in network byte order.
+  const uint8_t *data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // Tests if this is a valid argument.
+  explicit operator bool() const {
+    return type_ != '\0';
+  }
+
+ private:
+  char type_ = '\0';
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// OSCMessage parses an OSC message in place. Nothing is copied; the address,
+// strings, and blobs point into the original data, which must stay valid for
+// as long as the message is used.
+//
+// Array delimiters, '[' and ']', appear as arguments with no data.
+class OSCMessage final {
+ public:
+  // Maximum number of arguments, including array delimiters.
+  static constexpr size_t kMaxArgs = 32;
+
+  OSCMessage() = default;
+
+  // Parses and validates a message. This returns whether the data is a valid
+  // OSC message.
+  bool parse(const uint8_t *data, size_t size);
+
+  // Returns the address pattern. This is NUL-terminated.
+  const char *address() const {
+    return address_;
+  }
+
+  size_t addressLength() const {
+    return addressLen_;
+  }
+
+  // Returns the type tags without the leading ','. This is NUL-terminated.
+  const char *typeTags() const {
+    return typeTags_;
+  }
+
+  size_t argCount() const {
+    return argCount_;
+  }
+
+  // Returns an argument. The returned argument is invalid if the index is out
+  // of range.
+  OSCArg arg(size_t index) const;
+
+  // Returns the time tag of the enclosing bundle, or kOSCImmediately if the
+  // message wasn't in a bundle.
+  uint64_t timeTag() const {
+    return timeTag_;
+  }
+
+  // Returns the message data.
+  const uint8_t *data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // Tests if this is a valid message.
+  explicit operator bool() const {
+    return data_ != nullptr;
+  }
+
+ private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  const char *address_ = "";
+  size_t addressLen_ = 0;
+  const char *typeTags_ = "";
+  size_t argCount_ = 0;
+  uint16_t argOffsets_[kMaxArgs + 1];  // The extra one marks the end
+  uint64_t timeTag_ = kOSCImmediately;
+
+  friend class OSCDispatcher;
+};
+
+// OSCBundle parses an OSC bundle in place and iterates over its elements,
+// which are messages or other bundles.
+class OSCBundle final {
+ public:
+  OSCBundle() = default;
+
+  // Tests if the data starts like a bundle.
+  static bool isBundle(const uint8_t *data, size_t size);
+
+  // Parses and validates a bundle. The elements themselves aren't validated.
+  // This returns whether the data is a valid bundle.
+  bool parse(const uint8_t *data, size_t size);
+
+  uint64_t timeTag() const {
+    return timeTag_;
+  }
+
+  // Gets the next element. This returns false if there are no more.
+  bool next(const uint8_t *&data, size_t &size);
+
+  // Goes back to the first element.
+  void rewind() {
+    pos_ = 16;
+  }
+
+ private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  size_t pos_ = 0;
+  uint64_t timeTag_ = kOSCImmediately;
+};
+
+// OSCDispatcher passes OSC messages to the handlers registered for their
+// addresses.
+//
+// Addresses are stored in a trie, one node per address part, so a message is
+// matched by walking the trie instead of by comparing it against every
+// address. Literal address parts are looked up by hash. Parts with OSC pattern
+// characters, '?', '*', "[]", and "{}", are matched against each child. The
+// OSC 1.1 "//" wildcard isn't supported.
+//
+// Bundles with a time tag in the future are copied and held until their time,
+// if a clock has been set; otherwise they're delivered immediately. Held
+// bundles are delivered by loop().
+//
+// Dispatching doesn't allocate memory.
+class OSCDispatcher final {
+ public:
+  using Handler = std::function<void(const OSCMessage &msg)>;
+
+  // Returns the current time as an OSC (NTP) time tag.
+  using Clock = std::function<uint64_t()>;
+
+  // Creates a dispatcher that can hold 'maxScheduled' future bundles, each up
+  // to 'maxScheduledSize' bytes.
+  OSCDispatcher(size_t maxScheduled, size_t maxScheduledSize);
+
+  // Creates a dispatcher that can hold 4 future bundles of up to 512 bytes.
+  OSCDispatcher() : OSCDispatcher(4, 512) {}
+
+  ~OSCDispatcher() = default;
+
+  // Disallow copying
+  OSCDispatcher(const OSCDispatcher &) = delete;
+  OSCDispatcher &operator=(const OSCDispatcher &) = delete;
+
+  // Adds a handler for an address, replacing any existing one. The address
+  // must start with '/' and must not contain pattern characters or empty
+  // parts. This returns whether successful.
+  //
+  // If this returns false and there was an error then errno will be set.
+  bool add(const char *address, Handler handler);
+
+  // Removes the handler for an address. This returns whether there was one.
+  bool remove(const char *address);
+
+  // Removes all handlers.
+  void clear();
+
+  // Sets the clock used for bundle time tags. Set to nullptr to deliver all
+  // bundles immediately.
+  void setClock(Clock clock) {
+    clock_ = std::move(clock);
+  }
+
+  // Dispatches a message or bundle. This returns whether the data was valid.
+  // The data is only used during the call; future bundles are copied.
+  bool dispatch(const uint8_t *data, size_t size);
+
+  // Delivers held bundles whose time has come. Call this regularly.
+  void loop();
+
+  // Returns the number of held bundles.
+  size_t scheduledCount() const;
+
+  // Returns the number of messages passed to at least one handler.
+  uint32_t messageCount() const {
+    return messageCount_;
+  }
+
+  // Returns the number of messages that didn't match any handler.
+  uint32_t unmatchedCount() const {
+    return unmatchedCount_;
+  }
+
+  // Returns the number of malformed messages and bundles.
+  uint32_t errorCount() const {
+    return errorCount_;
+  }
+
+  // Returns the number of future bundles dropped because they didn't fit.
+  uint32_t droppedCount() const {
+    return droppedCount_;
+  }
+
+  // Matches one address part against an OSC pattern part. Neither may
+  // contain '/'.
+  static bool matchPattern(const char *pattern, size_t patternLen,
+                           const char *name, size_t nameLen);
+
+ private:
+  struct Node final {
+    std::string name;
+    uint32_t hash;
+    int32_t firstChild = -1;
+    int32_t nextSibling = -1;
+    Handler handler = nullptr;
+  };
+
+  struct Scheduled final {
+    uint64_t time;
+    size_t size = 0;  // Zero if unused
+    uint32_t order;   // For delivering bundles with the same time in order
+  };
+
+  // Finds a node for an address, optionally creating it. This returns -1 if
+  // the address is invalid or not found.
+  int32_t findNode(const char *address, bool create);
+
+  // Dispatches a message or bundle, with the time tag of the enclosing
+  // bundle. 'depth' limits nested bundles.
+  bool dispatch(const uint8_t *data, size_t size, uint64_t timeTag, int depth);
+
+  // Dispatches a bundle's elements.
+  bool dispatchBundle(OSCBundle &bundle, int depth);
+
+  // Matches a message against the trie, starting at a node and the address
+  // part at 'part'. This returns the number of handlers called.
+  size_t match(int32_t node, const char *part, const char *end,
+               const OSCMessage &msg);
+
+  // Copies a bundle to be delivered later. This returns whether there
+  // was room.
+  bool schedule(uint64_t time, const uint8_t *data, size_t size);
+
+  std::vector<Node> nodes_;  // The root is the first node
+
+  Clock clock_ = nullptr;
+
+  const size_t maxScheduled_;
+  const size_t maxScheduledSize_;
+  std::unique_ptr<Scheduled[]> scheduled_;
+  std::unique_ptr<uint8_t[]> scheduledBuf_;
+  uint32_t scheduleOrder_ = 0;
+
+  // Counters
+  uint32_t messageCount_ = 0;
+  uint32_t unmatchedCount_ = 0;
+  uint32_t errorCount_ = 0;
+  uint32_t droppedCount_ = 0;
+};
+
+}  // namespace network
+}  // namespace qindesign
@@ -1,20 +1,26 @@
 // SPDX-FileCopyrightText: (c) 2022-2024 Shawn Silverman <shawn@pobox.com>
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
-// PixelPusherServer.cpp implements the PixelPusher server.
+// QNPixelPusherServer.cpp implements the PixelPusher server.
 //
 // This file is part of the QNEthernet library.
 
-#include "PixelPusherServer.h"
+#include "QNPixelPusherServer.h"
+
+#if LWIP_UDP
 
 // C++ includes
 #include <algorithm>
 #include <cstring>
 
-#include <IPAddress.h>
-#include <QNEthernet.h>
+#include <Arduino.h>  // For micros()
+
+#include "QNEthernet.h"
+#include "lwip/sys.h"
+#include "util/IOVec.h"
 
-using namespace qindesign::network;
+namespace qindesign {
+namespace network {
 
 // This uses direct memory copies and the protocol is little-endian,
 // so check that this is being compiled on a little-endian platform.
@@ -36,22 +42,24 @@ PixelPusherServer::~PixelPusherServer() {
   end();
 }
 
-bool PixelPusherServer::begin(Receiver *recv, uint16_t port,
+bool PixelPusherServer::begin(PixelPusherReceiver *recv, uint16_t port,
                               int controllerNum, int groupNum,
                               uint16_t vendorId, uint16_t productId,
                               uint16_t hwRevision,
                               uint32_t flags) {
+  end();
+
   if (recv == nullptr) {
     recv = &nullReceiver_;
   }
   recv_ = recv;
-  size_t numStrips = std::min(recv->numStrips(), size_t{UINT8_MAX});
+  numStrips_ = std::min(recv->numStrips(), size_t{UINT8_MAX});
   size_t pixelsPerStrip = std::min(recv->pixelsPerStrip(), kMaxPixelsPerStrip);
 
   broadcastIP_ = Ethernet.broadcastIP();
   stripSize_ = 1 + pixelsPerStrip*3;
   lastSeq_ = -1;
-  stripFlagsSize_ = std::max(size_t{8}, numStrips);
+  stripFlagsSize_ = std::max(size_t{8}, numStrips_);
   stripFlags_ = std::make_unique<uint8_t[]>(stripFlagsSize_);
 
   Ethernet.macAddress(deviceData_.macAddr);
@@ -60,7 +68,7 @@ bool PixelPusherServer::begin(Receiver *recv, uint16_t port,
   deviceData_.ipAddr[1] = localIP[1];
   deviceData_.ipAddr[2] = localIP[2];
   deviceData_.ipAddr[3] = localIP[3];
-  deviceData_.deviceType = DeviceTypes::PIXELPUSHER;
+  deviceData_.deviceType = DeviceTypes::kPixelPusher;
   deviceData_.protocolVersion = 1;  // ?
   deviceData_.vendorId = vendorId;
   deviceData_.productId = productId;
@@ -68,9 +76,9 @@ bool PixelPusherServer::begin(Receiver *recv, uint16_t port,
   deviceData_.swRevision = kSoftwareRevision;
   deviceData_.linkSpeed = Ethernet.linkSpeed() * 1'000'000;
 
-  ppData1_.stripsAttached = numStrips;
+  ppData1_.stripsAttached = numStrips_;
   ppData1_.maxStripsPerPacket =
-      std::min((kMaxUDPSize - 4)/stripSize_, numStrips);
+      std::min((kMaxUDPSize - 4)/stripSize_, numStrips_);
   ppData1_.pixelsPerStrip = pixelsPerStrip;
   ppData1_.updatePeriod = 100'000;  // Start at 100ms
   ppData1_.powerTotal = 0;
@@ -90,27 +98,37 @@ bool PixelPusherServer::begin(Receiver *recv, uint16_t port,
   ppData2_.lastDrivenPort = 0;
 
   // Fill in the strip flags
-  for (size_t i = 0; i < numStrips; i++) {
+  for (size_t i = 0; i < numStrips_; i++) {
     stripFlags_[i] = recv->stripFlags(i);
   }
 
-  // Prepare the circular buffer with capacity equal to the minimum
-  // number of packets needed to accomplish one frame
-  size_t packetsPerFrame = (numStrips + ppData1_.maxStripsPerPacket - 1) /
-                           size_t{ppData1_.maxStripsPerPacket};
-  lastUpdateTimes_ =
-      std::make_unique<CircularBuffer<uint32_t>>(packetsPerFrame);
-  printf("k=%zu\r\n", lastUpdateTimes_->capacity());
+  // Average the update time over the minimum number of packets needed
+  // to accomplish one frame
+  size_t packetsPerFrame = 1;
+  if (ppData1_.maxStripsPerPacket > 0) {
+    packetsPerFrame = (numStrips_ + ppData1_.maxStripsPerPacket - 1) /
+                      size_t{ppData1_.maxStripsPerPacket};
+  }
+  updateTimesCap_ = std::max(packetsPerFrame, size_t{1});
+  updateTimes_ = std::make_unique<uint32_t[]>(updateTimesCap_);
+  updateTimesSize_ = 0;
+  updateTimesPos_ = 0;
+  updateTimesSum_ = 0;
 
   // Prepare the frame strip tracker
-  frameStrips_.resize(numStrips);
-  frameStrips_.clear();
-
-  if (started_) {
-    end();
+  frameStrips_.reset();
+  frameStripCount_ = 0;
+  inFrame_ = false;
+
+  pixelsUDP_.onPacket([this](const EthernetUDP::PacketView &packet) {
+    processPacket(packet);
+  });
+  if (!pixelsUDP_.begin(port)) {
+    return false;
   }
+  discoveryTime_ = sys_now() - kDiscoveryPeriod;
   started_ = true;
-  return pixelsUDP_.begin(port);
+  return true;
 }
 
 void PixelPusherServer::end() {
@@ -119,10 +137,11 @@ void PixelPusherServer::end() {
   }
   started_ = false;
   pixelsUDP_.stop();
-  lastUpdateTimes_ = nullptr;
+  pixelsUDP_.onPacket(nullptr);
+  updateTimes_ = nullptr;
 }
 
-uint16_t PixelPusherServer::pixelsPort() {
+uint16_t PixelPusherServer::pixelsPort() const {
   return pixelsUDP_.localPort();
 }
 
@@ -134,42 +153,42 @@ void PixelPusherServer::setGroupNum(int n) {
   ppData1_.groupOrdinal = n;
 }
 
-// Checks if all values in a std::vector<bool> are a specific value.
-static bool isAll(const std::vector<bool> &v, bool flag) {
-  return (std::find(v.begin(), v.end(), !flag) == v.end());
-}
-
 void PixelPusherServer::loop() {
   if (!started_) {
     return;
   }
 
   // Send the discovery packet every once in a while
-  if (discoveryTimer_ >= kDiscoveryPeriod) {
+  if ((sys_now() - discoveryTime_) >= kDiscoveryPeriod) {
     sendDiscovery();
-    discoveryTimer_ = 0;
+    discoveryTime_ = sys_now();
   }
 
   recv_->loop();
+}
+
+void PixelPusherServer::endFrame() {
+  recv_->endPixels();
+  frameStrips_.reset();
+  frameStripCount_ = 0;
+  inFrame_ = false;
+  frameCount_++;
+}
 
-  // Check for a valid packet
-  int packetSize = pixelsUDP_.parsePacket();
-  if (packetSize < 4) {
+void PixelPusherServer::processPacket(const EthernetUDP::PacketView &packet) {
+  if (!started_) {
     return;
   }
-  size_t size = packetSize;
 
   uint32_t startTime = micros();
 
-  // Packet length == 4 + strips*(1 + width*3)
-  // Allow extra strips in this packet, but ignore them, for robustness
-  size_t stripsInPacket = (size - 4)/stripSize_;
-  if (stripsInPacket*stripSize_ != size - 4) {
+  const uint8_t *data = packet.data;
+  size_t size = packet.size;
+  if (size < 4) {
+    invalidCount_++;
     return;
   }
 
-  const uint8_t *data = pixelsUDP_.data();
-
   uint32_t seq;
   std::memcpy(&seq, data, 4);
   data += 4;
@@ -187,103 +206,103 @@ void PixelPusherServer::loop() {
     return;
   }
 
-  if (stripsInPacket > 0) {
-    // Start a new frame if no strips have been received
-    if (isAll(frameStrips_, false)) {
-      recv_->startPixels();
+  // Packet length == 4 + strips*(1 + width*3)
+  // Allow extra strips in this packet, but ignore them, for robustness
+  size_t stripsInPacket = size/stripSize_;
+  if (stripsInPacket*stripSize_ != size) {
+    invalidCount_++;
+    return;
+  }
+  if (seq == lastSeq_) {
+    // A duplicate packet
+    return;
+  }
+  packetCount_++;
+
+  // Check for an incrementing sequence, in case we're seeing an old
+  // packet
+  const bool newer = (static_cast<int32_t>(seq - lastSeq_) > 0);
+
+  for (size_t i = 0; i < stripsInPacket; i++, data += stripSize_) {
+    size_t stripNum = *data;
+    if (stripNum >= numStrips_) {
+      continue;
     }
 
-    for (size_t i = 0; i < stripsInPacket; i++) {
+    if (frameStrips_[stripNum]) {
+      if (!newer) {
+        // This appears to be old data
+        continue;
+      }
       // If we've already seen a particular strip, it probably means a
       // new frame has started, so show what we've got and start again
+      endFrame();
+    }
+    if (!inFrame_) {
+      recv_->startPixels();
+      inFrame_ = true;
+    }
+    frameStrips_.set(stripNum);
+    frameStripCount_++;
 
-      size_t stripNum = *data;
-      bool useData = true;  // Only use if we haven't seen this strip
-                            // or the sequence number increased
-
-      if (stripNum < frameStrips_.size()) {
-        if (frameStrips_[stripNum]) {
-          // Check for incrementing sequence, in case we're seeing an
-          // old or duplicate packet
-          if (seq - lastSeq_ > 0) {
-            // We've already seen the strip so trigger an end-of-frame
-            // and restart
-            recv_->endPixels();
-            frameStrips_.clear();
-            recv_->startPixels();
-          } else {
-            // This appears to be duplicate data
-            useData = false;
-          }
-        }
-        frameStrips_[stripNum] = true;
-      }
-
-      if (useData) {
-        recv_->pixels(stripNum, data + 1, ppData1_.pixelsPerStrip);
-      }
-      data += 1 + uintptr_t{ppData1_.pixelsPerStrip}*3;
+    recv_->pixels(stripNum, data + 1, ppData1_.pixelsPerStrip);
+    stripCount_++;
   }
 
-    // If there's a whole frame then show the pixels
-    if (isAll(frameStrips_, true)) {
-      recv_->endPixels();
-      frameStrips_.clear();
-    }
+  // If there's a whole frame then show the pixels
+  if (inFrame_ && frameStripCount_ == numStrips_) {
+    endFrame();
   }
 
   // Update the discovery packet
-  IPAddress ip = pixelsUDP_.remoteIP();
+  const IPAddress &ip = packet.remoteIP;
   ppData2_.lastDrivenIp[0] = ip[0];
   ppData2_.lastDrivenIp[1] = ip[1];
   ppData2_.lastDrivenIp[2] = ip[2];
   ppData2_.lastDrivenIp[3] = ip[3];
-  ppData2_.lastDrivenPort = pixelsUDP_.remotePort();
+  ppData2_.lastDrivenPort = packet.remotePort;
   int32_t seqDiff = seq - lastSeq_ - 1;
   if (seqDiff > 0) {  // Want a difference of at least 2
     ppData1_.deltaSequence += seqDiff;
   }
   lastSeq_ = seq;
 
-  // Take the average of the last 'k' times
-  uint32_t updateTime = micros() - startTime;
-  size_t k = lastUpdateTimes_->capacity();
-  if (lastUpdateTimes_->size() < k) {
-    avUpdateTime_ = (avUpdateTime_*lastUpdateTimes_->size() + updateTime)/
-                    static_cast<float>(lastUpdateTimes_->size() + 1);
+  addUpdateTime(micros() - startTime);
+}
+
+void PixelPusherServer::addUpdateTime(uint32_t t) {
+  if (updateTimes_ == nullptr) {
+    return;
+  }
+  if (updateTimesSize_ < updateTimesCap_) {
+    updateTimesSize_++;
   } else {
-    avUpdateTime_ = avUpdateTime_ +
-                    static_cast<int32_t>(updateTime - lastUpdateTimes_->get())/
-                        static_cast<float>(k);
+    updateTimesSum_ -= updateTimes_[updateTimesPos_];
   }
-  lastUpdateTimes_->put(updateTime);
-  ppData1_.updatePeriod = avUpdateTime_;
+  updateTimes_[updateTimesPos_] = t;
+  updateTimesSum_ += t;
+  updateTimesPos_ = (updateTimesPos_ + 1) % updateTimesCap_;
+  ppData1_.updatePeriod = updateTimesSum_/updateTimesSize_;
 }
 
 void PixelPusherServer::sendDiscovery() {
-  discoveryUDP_.beginPacket(broadcastIP_, kDiscoveryPort);
-  discoveryUDP_.write(reinterpret_cast<unsigned char *>(&deviceData_),
-                      sizeof(deviceData_));
-  discoveryUDP_.write(reinterpret_cast<unsigned char *>(&ppData1_),
-                      sizeof(ppData1_));
-
   // Mystery padding. Why?
   // The claim is that the compiler for later versions of PixelPusher
   // software aligns the strip flags, a byte array, on a 4-byte
   // boundary, even though this goes against common C struct alignment
   // rules, where byte arrays don't need to be aligned.
-  discoveryUDP_.write(uint8_t{0});
-  discoveryUDP_.write(uint8_t{0});
-
-  discoveryUDP_.write(stripFlags_.get(), stripFlagsSize_);
-
-  // More mystery padding
-  discoveryUDP_.write(uint8_t{0});
-  discoveryUDP_.write(uint8_t{0});
-
-  discoveryUDP_.write(reinterpret_cast<unsigned char *>(&ppData2_),
-                      sizeof(ppData2_));
-  discoveryUDP_.endPacket();
+  static constexpr uint8_t kPadding[2]{0, 0};
+
+  const IOVec iov[]{
+      {reinterpret_cast<const uint8_t *>(&deviceData_), sizeof(deviceData_)},
+      {reinterpret_cast<const uint8_t *>(&ppData1_), sizeof(ppData1_)},
+      {kPadding, sizeof(kPadding)},
+      {stripFlags_.get(), stripFlagsSize_},
+      {kPadding, sizeof(kPadding)},  // More mystery padding
+      {reinterpret_cast<const uint8_t *>(&ppData2_), sizeof(ppData2_)},
+  };
+  discoveryUDP_.sendv(broadcastIP_, kDiscoveryPort, iov,
+                      sizeof(iov)/sizeof(iov[0]));
 
   // Some debug output
   // printf("update=%" PRIu32 " delta=%" PRIu32 "\r\n",
@@ -291,3 +310,8 @@ void PixelPusherServer::sendDiscovery() {
 
   ppData1_.deltaSequence = 0;
 }
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP
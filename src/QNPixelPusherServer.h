@@ -0,0 +1,327 @@
+// SPDX-FileCopyrightText: (c) 2022-2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNPixelPusherServer.h defines a PixelPusher server.
+//
+// Useful links that helped decipher the protocol:
+// * https://github.com/hzeller/pixelpusher-server
+// * https://github.com/robot-head/PixelPusher-java
+//
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_UDP
+
+// C++ includes
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <IPAddress.h>
+
+#include "QNEthernetUDP.h"
+
+namespace qindesign {
+namespace network {
+
+// PixelPusherReceiver handles PixelPusher commands and pixel data.
+class PixelPusherReceiver {
+ public:
+  PixelPusherReceiver() = default;
+  virtual ~PixelPusherReceiver() = default;
+
+  // Avoid slicing
+  PixelPusherReceiver(const PixelPusherReceiver &) = delete;
+  PixelPusherReceiver &operator=(const PixelPusherReceiver &) = delete;
+
+  // Initializes the receiver. This performs tasks that must be done
+  // after the system is booted and is meant to be called from setup()
+  // or later. This returns whether the call was successful.
+  virtual bool begin() = 0;
+
+  // Stops the receiver. For some receivers, this may be a no-op.
+  virtual void end() = 0;
+
+  // Returns the total number of strips. This will be limited to 255.
+  virtual size_t numStrips() const = 0;
+
+  // Returns the number of pixels per strip.
+  virtual size_t pixelsPerStrip() const = 0;
+
+  // Gets the strip flags for the given strip number.
+  virtual uint8_t stripFlags(size_t stripNum) const = 0;
+
+  // Handles a PixelPusher command.
+  virtual void handleCommand(uint8_t command, const uint8_t *data, size_t len) {
+    (void)command;
+    (void)data;
+    (void)len;
+  }
+
+  // Starts receiving the pixels for a frame.
+  virtual void startPixels() {}
+
+  // Processes pixels for one strip. The data points into the received packet
+  // and is only valid during the call.
+  virtual void pixels(size_t stripNum, const uint8_t *pixels,
+                      size_t pixelsPerStrip) = 0;
+
+  // All the pixels for a frame have been sent to this receiver, or a strip was
+  // seen again, meaning a new frame started.
+  virtual void endPixels() = 0;
+
+  // Executes periodically whenever PixelPusherServer::loop()
+  // is called.
+  virtual void loop() {}
+};
+
+// PixelPusherServer receives PixelPusher pixel data and commands, and
+// announces itself with discovery packets.
+//
+// Pixel packets are processed as they arrive, from inside Ethernet.loop(),
+// using the EthernetUDP packet handler. Each strip is passed to the receiver
+// with a pointer into the received packet, so the pixel data isn't copied
+// on the way.
+class PixelPusherServer final {
+ public:
+  // Not classes so we can use the values directly
+  enum StripFlags : uint8_t {
+    kRGBOW         = (1 << 0),
+    kWidePixels    = (1 << 1),
+    kLogarithmic   = (1 << 2),
+    kMotion        = (1 << 3),
+    kNotIdempotent = (1 << 4),
+    kBrightness    = (1 << 5),
+    kMonochrome    = (1 << 6),
+  };
+
+  enum PusherFlags : uint32_t {
+    kProtected           = (1 << 0),
+    kFixedSize           = (1 << 1),
+    kGlobalBrightness    = (1 << 2),
+    kStripBrightness     = (1 << 3),
+    kMonochromeNotPacked = (1 << 4),
+  };
+
+  enum Commands : uint8_t {
+    kReset               = 0x01,
+    kGlobalBrightnessSet = 0x02,
+    kWifiConfigure       = 0x03,
+    kLEDConfigure        = 0x04,
+    kStripBrightnessSet  = 0x05,
+  };
+
+  enum ColourOrders : uint8_t {
+    kRGB = 0,
+    kRBG = 1,
+    kGBR = 2,
+    kGRB = 3,
+    kBGR = 4,
+    kBRG = 5,
+  };
+
+  enum StripTypes : uint8_t {
+    kLPD8806 = 0,
+    kWS2801  = 1,
+    kWS2811  = 2,
+    kAPA102  = 3,
+  };
+
+  // The default port on which to receive pixel data.
+  static constexpr uint16_t kDefaultPixelsPort = 5078;//9897;
+
+  PixelPusherServer() = default;
+  ~PixelPusherServer();
+
+  // Disallow copying
+  PixelPusherServer(const PixelPusherServer &) = delete;
+  PixelPusherServer &operator=(const PixelPusherServer &) = delete;
+
+  // Initializes the server and starts listening for pixel data on the
+  // specified port. This uses the current Ethernet information. This
+  // should be called whenever the Ethernet information changes.
+  //
+  // This will return false if there was a problem starting the UDP
+  // listening socket.
+  //
+  // This does not call recv->begin().
+  //
+  // See: kDefaultPixelsPort
+  bool begin(PixelPusherReceiver *recv, uint16_t port,
+             int controllerNum, int groupNum,
+             uint16_t vendorId, uint16_t productId,
+             uint16_t hwRevision,
+             uint32_t flags);
+
+  // Stops listening for pixels.
+  //
+  // This does not call PixelPusherReceiver::end().
+  void end();
+
+  // Sends discovery packets and calls the receiver's loop(). Call this
+  // repeatedly. Pixel data is processed by Ethernet.loop().
+  void loop();
+
+  // Returns the port on which this listens for pixel data.
+  uint16_t pixelsPort() const;
+
+  void setControllerNum(int n);
+  void setGroupNum(int n);
+
+  // Returns the number of pixel packets received.
+  uint32_t packetCount() const {
+    return packetCount_;
+  }
+
+  // Returns the number of strips passed to the receiver.
+  uint32_t stripCount() const {
+    return stripCount_;
+  }
+
+  // Returns the number of frames ended.
+  uint32_t frameCount() const {
+    return frameCount_;
+  }
+
+  // Returns the number of packets dropped because they were malformed.
+  uint32_t invalidCount() const {
+    return invalidCount_;
+  }
+
+  // Tests if the server has been started.
+  explicit operator bool() const {
+    return started_;
+  }
+
+ private:
+  enum DeviceTypes : uint8_t {
+    kEtherDream  = 0,
+    kLumiaBridge = 1,
+    kPixelPusher = 2,
+  };
+
+  // Device data, stores the data in wire format.
+  struct [[gnu::packed]] DeviceData {
+    uint8_t macAddr[6];
+    uint8_t ipAddr[4];
+    uint8_t deviceType;
+    uint8_t protocolVersion;  // For the device, not the discovery
+    uint16_t vendorId;
+    uint16_t productId;
+    uint16_t hwRevision;
+    uint16_t swRevision;
+    uint32_t linkSpeed;  // In bits per second
+  };
+
+  // Data 1, stores the data in wire format.
+  struct [[gnu::packed]] PixelPusherData1 {
+    uint8_t stripsAttached;
+    uint8_t maxStripsPerPacket;
+    uint16_t pixelsPerStrip;    // uint16_t used to make alignment work
+    uint32_t updatePeriod;      // In microseconds
+    uint32_t powerTotal;        // In PWM units
+    uint32_t deltaSequence;     // Difference between received and expected
+                                // sequence numbers
+    int32_t controllerOrdinal;  // Configured order number for this controller
+    int32_t groupOrdinal;       // Configured group number for this controller
+
+    uint16_t artnetUniverse;  // Index 24
+    uint16_t artnetChannel;
+    uint16_t myPort;  // Index 28
+
+    // [strip flags, one per strip, at least 8], Index 32
+  };
+
+  // Data 2, stores the data in wire format.
+  struct [[gnu::packed]] PixelPusherData2 {
+    uint32_t pusherFlags;  // Flags for the whole pusher
+    uint32_t segments;     // Number of segments in each strip
+    uint32_t powerDomain;  // Power domain of this pusher
+    uint8_t lastDrivenIp[4];
+    uint16_t lastDrivenPort;
+  };
+
+  class NullReceiver final : public PixelPusherReceiver {
+    bool begin() override { return true; }
+    void end() override {}
+    size_t numStrips() const override { return 0; }
+    size_t pixelsPerStrip() const override { return 0; }
+    uint8_t stripFlags(size_t stripNum) const override { return 0; }
+
+    void pixels(size_t stripNum, const uint8_t *pixels,
+                size_t pixelsPerStrip) override {}
+    void endPixels() override {}
+  };
+
+  static constexpr uint32_t kDiscoveryPeriod = 1'000;  // In milliseconds
+
+  static constexpr uint16_t kSoftwareRevision = 142;
+
+  static constexpr uint16_t kDiscoveryPort = 7331;
+
+  // Processes one received pixel or command packet.
+  void processPacket(const EthernetUDP::PacketView &packet);
+
+  // Tells the receiver the frame is done and starts tracking a new one.
+  void endFrame();
+
+  // Adds a packet processing time to the running average.
+  void addUpdateTime(uint32_t t);
+
+  void sendDiscovery();
+
+  static NullReceiver nullReceiver_;
+
+  bool started_ = false;
+
+  // UDP sockets
+  EthernetUDP discoveryUDP_;  // Send
+  EthernetUDP pixelsUDP_;     // Receive
+
+  // Data receiver.
+  PixelPusherReceiver *recv_ = &nullReceiver_;
+
+  // Useful cached values
+  IPAddress broadcastIP_;
+  size_t numStrips_ = 0;
+  size_t stripSize_ = 0;  // Strip size in bytes, including the strip number
+
+  // Computed packet data
+  uint32_t discoveryTime_ = 0;
+  uint32_t lastSeq_ = 0;
+
+  // The last 'k' packet processing times, for averaging
+  std::unique_ptr<uint32_t[]> updateTimes_;
+  size_t updateTimesCap_ = 0;
+  size_t updateTimesSize_ = 0;
+  size_t updateTimesPos_ = 0;
+  uint32_t updateTimesSum_ = 0;
+
+  // Track frames and which strips have been received; strip numbers are
+  // one byte
+  std::bitset<256> frameStrips_;
+  size_t frameStripCount_ = 0;
+  bool inFrame_ = false;
+
+  // Counters
+  uint32_t packetCount_ = 0;
+  uint32_t stripCount_ = 0;
+  uint32_t frameCount_ = 0;
+  uint32_t invalidCount_ = 0;
+
+  // Packet data
+  DeviceData deviceData_;
+  size_t stripFlagsSize_ = 8;
+  std::unique_ptr<uint8_t[]> stripFlags_{std::make_unique<uint8_t[]>(8)};
+  PixelPusherData1 ppData1_;
+  PixelPusherData2 ppData2_;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP
@@ -0,0 +1,882 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNTFTP.cpp implements the TFTP server and client.
+// This file is part of the QNEthernet library.
+
+#include "QNTFTP.h"
+
+#if LWIP_UDP
+
+// C++ includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <Arduino.h>  // For yield()
+#include <strings.h>
+
+#include "lwip/sys.h"
+#include "util/IOVec.h"
+#include "util/ip_tools.h"
+
+#ifndef TFTP_MAX_FILENAME_LEN
+#define TFTP_MAX_FILENAME_LEN 20
+#endif  // !TFTP_MAX_FILENAME_LEN
+
+namespace qindesign {
+namespace network {
+
+// Opcodes
+static constexpr uint16_t kOpRRQ   = 1;
+static constexpr uint16_t kOpWRQ   = 2;
+static constexpr uint16_t kOpData  = 3;
+static constexpr uint16_t kOpAck   = 4;
+static constexpr uint16_t kOpError = 5;
+static constexpr uint16_t kOpOACK  = 6;
+
+// Protocol defaults, used when options aren't negotiated
+static constexpr size_t kDefaultBlockSize = 512;
+static constexpr size_t kMinBlockSize     = 8;
+static constexpr size_t kMaxBlockSize     = 65464;
+
+static inline uint16_t get16(const uint8_t *p) {
+  return (uint16_t{p[0]} << 8) | p[1];
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+  p[0] = static_cast<uint8_t>(v >> 8);
+  p[1] = static_cast<uint8_t>(v);
+}
+
+// Appends a NUL-terminated string to a packet.
+static void appendString(std::vector<uint8_t> &v, const char *s) {
+  v.insert(v.end(), s, s + std::strlen(s) + 1);
+}
+
+// Appends an option and its numeric value to a packet.
+static void appendOption(std::vector<uint8_t> &v, const char *name,
+                         unsigned long long value) {
+  char buf[21];
+  std::snprintf(buf, sizeof(buf), "%llu", value);
+  appendString(v, name);
+  appendString(v, buf);
+}
+
+// Gets the next NUL-terminated string from a packet, or NULL if there isn't a
+// complete one.
+static const char *nextString(const uint8_t *&p, const uint8_t *end) {
+  const uint8_t *nul =
+      static_cast<const uint8_t *>(std::memchr(p, '\0', end - p));
+  if (nul == nullptr) {
+    return nullptr;
+  }
+  const char *s = reinterpret_cast<const char *>(p);
+  p = nul + 1;
+  return s;
+}
+
+// Parses an option value. This returns false if it isn't a number.
+static bool parseValue(const char *s, unsigned long long &value) {
+  char *end;
+  value = std::strtoull(s, &end, 10);
+  return end != s && *end == '\0';
+}
+
+// Sends an error packet.
+static void sendError(EthernetUDP &udp, const IPAddress &ip, uint16_t port,
+                      TFTPError code, const char *msg) {
+  uint8_t header[4];
+  put16(&header[0], kOpError);
+  put16(&header[2], static_cast<uint16_t>(code));
+  const IOVec iov[]{
+      {header, sizeof(header)},
+      {reinterpret_cast<const uint8_t *>(msg), std::strlen(msg) + 1},
+  };
+  udp.sendv(ip, port, iov, 2);
+}
+
+// --------------------------------------------------------------------------
+//  Memory sources and sinks
+// --------------------------------------------------------------------------
+
+int TFTPMemorySource::read(uint8_t *buf, size_t size) {
+  size_t n = std::min(size, size_ - pos_);
+  std::memcpy(buf, &data_[pos_], n);
+  pos_ += n;
+  return static_cast<int>(n);
+}
+
+bool TFTPMemorySink::write(const uint8_t *data, size_t size) {
+  if (size > capacity_ - size_) {
+    return false;
+  }
+  std::memcpy(&buf_[size_], data, size);
+  size_ += size;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+//  TFTPSession
+// --------------------------------------------------------------------------
+
+namespace internal {
+
+// TFTPSession runs one transfer, either sending or receiving, with RFC 7440
+// windows.
+//
+// The sender keeps a ring of two windows of blocks. While one window is in
+// flight, the next is read from the source, so the source's latency overlaps
+// with the round trip. The receiver gathers a window of blocks and acknowledges
+// it before writing it to the sink, so the peer sends the next window, into the
+// socket's receive queue, while the sink is busy.
+class TFTPSession final {
+ public:
+  enum class Role {
+    kSender,
+    kReceiver,
+  };
+
+  TFTPSession(Role role, const TFTPOptions &options)
+      : role_(role),
+        timeout_(options.timeout),
+        retries_(options.retries) {}
+
+  ~TFTPSession() {
+    finish(false);
+  }
+
+  // Binds to an ephemeral port. This returns whether successful.
+  bool begin() {
+    return udp_.begin(0);
+  }
+
+  // Sets the peer. If 'portKnown' is false then the port is learned from the
+  // first reply and 'port' is only used for the request.
+  void setPeer(const IPAddress &ip, uint16_t port, bool portKnown) {
+    peerIP_ = ip;
+    peerPort_ = port;
+    peerPortKnown_ = portKnown;
+  }
+
+  // Returns whether the given address and port are the peer's.
+  bool isPeer(const IPAddress &ip, uint16_t port) const {
+    return peerPortKnown_ && port == peerPort_ && ip == peerIP_;
+  }
+
+  void setSource(TFTPSource *source) {
+    source_ = source;
+  }
+
+  void setSink(TFTPSink *sink) {
+    sink_ = sink;
+  }
+
+  void setLinger(bool flag) {
+    linger_ = flag;
+  }
+
+  void setBlockSize(size_t size) {
+    blockSize_ = size;
+  }
+
+  void setWindowSize(uint16_t size) {
+    windowSize_ = size;
+  }
+
+  void setTimeout(uint32_t timeout) {
+    timeout_ = timeout;
+  }
+
+  // Sends a request and waits for the reply. The requested option values are
+  // the most that will be accepted from the peer.
+  void sendRequest(std::vector<uint8_t> request, size_t blockSize,
+                   uint16_t windowSize) {
+    reqBlockSize_ = blockSize;
+    reqWindowSize_ = windowSize;
+    ctrl_ = std::move(request);
+    state_ = State::kRequest;
+    sendCtrl();
+  }
+
+  // Sends an OACK. A sender then waits for ACK 0 and a receiver waits for the
+  // first block.
+  void sendOACK(std::vector<uint8_t> oack) {
+    ctrl_ = std::move(oack);
+    if (role_ == Role::kSender) {
+      state_ = State::kOACKSent;
+    } else {
+      startReceiving();
+    }
+    sendCtrl();
+  }
+
+  // Starts a transfer without option negotiation.
+  void start() {
+    if (role_ == Role::kSender) {
+      startSending();
+    } else {
+      startReceiving();
+      sendAck(0);
+    }
+  }
+
+  // Processes packets and timeouts. This returns false when the transfer
+  // is finished.
+  bool poll();
+
+  TFTPError error() const {
+    return error_;
+  }
+
+  size_t transferred() const {
+    return transferred_;
+  }
+
+ private:
+  enum class State {
+    kRequest,   // A request was sent
+    kOACKSent,  // Sender: an OACK was sent
+    kTransfer,
+    kLinger,    // Receiver: the last ACK was sent
+    kDone,
+  };
+
+  void handlePacket(const uint8_t *data, size_t size);
+  bool parseOACK(const uint8_t *p, const uint8_t *end);
+
+  void startSending();
+  bool fillRing(uint32_t limit);
+  void sendData(uint32_t block);
+  void sendWindow();
+  void handleAck(uint16_t block);
+
+  void startReceiving();
+  void handleData(uint16_t block, const uint8_t *data, size_t size);
+  void sendAck(uint32_t block);
+  bool flushStaging();
+
+  void sendCtrl();
+
+  // Fails the transfer, sending an error to the peer.
+  void fail(TFTPError code, const char *msg);
+
+  // Finishes the transfer and closes the source or sink.
+  void finish(bool ok);
+
+  EthernetUDP udp_;
+  const Role role_;
+  State state_ = State::kTransfer;
+  IPAddress peerIP_;
+  uint16_t peerPort_ = 0;
+  bool peerPortKnown_ = true;
+  TFTPSource *source_ = nullptr;
+  TFTPSink *sink_ = nullptr;
+  bool linger_ = false;
+  bool closed_ = false;
+
+  // Negotiated parameters
+  size_t blockSize_ = kDefaultBlockSize;
+  uint16_t windowSize_ = 1;
+  uint32_t timeout_;
+  int retries_;
+  size_t reqBlockSize_ = kDefaultBlockSize;
+  uint16_t reqWindowSize_ = 1;
+
+  std::vector<uint8_t> ctrl_;  // The last request, OACK, or ACK sent
+  uint32_t lastSend_ = 0;
+  int tries_ = 0;
+  TFTPError error_ = TFTPError::kNone;
+  size_t transferred_ = 0;
+
+  // Sender
+  std::unique_ptr<uint8_t[]> ring_;
+  uint32_t ringBlocks_ = 0;
+  uint32_t acked_ = 0;      // Last block acknowledged
+  uint32_t sent_ = 0;       // Last block sent
+  uint32_t filled_ = 0;     // Last block read into the ring
+  bool eof_ = false;
+  uint32_t lastBlock_ = 0;  // Valid if eof_
+  size_t lastSize_ = 0;
+
+  // Receiver
+  std::unique_ptr<uint8_t[]> staging_;
+  size_t staged_ = 0;
+  uint32_t received_ = 0;     // Last block received in order
+  uint32_t windowStart_ = 0;  // Last block acknowledged
+  bool gapAcked_ = false;
+};
+
+bool TFTPSession::poll() {
+  if (state_ == State::kDone) {
+    return false;
+  }
+
+  while (state_ != State::kDone && udp_.parsePacket() >= 0) {
+    IPAddress ip = udp_.remoteIP();
+    uint16_t port = udp_.remotePort();
+    if (!peerPortKnown_ && ip == peerIP_) {
+      peerPort_ = port;
+      peerPortKnown_ = true;
+    }
+    if (ip != peerIP_ || port != peerPort_) {
+      sendError(udp_, ip, port, TFTPError::kUnknownTransferID,
+                "Unknown transfer ID");
+      continue;
+    }
+    handlePacket(udp_.data(), udp_.size());
+  }
+  if (state_ == State::kDone) {
+    return false;
+  }
+
+  if (sys_now() - lastSend_ >= timeout_) {
+    if (state_ == State::kLinger) {
+      finish(true);
+      return false;
+    }
+    if (++tries_ > retries_) {
+      error_ = TFTPError::kTimeout;
+      finish(false);
+      return false;
+    }
+    if (role_ == Role::kSender && state_ == State::kTransfer) {
+      sendWindow();
+    } else {
+      sendCtrl();
+    }
+  }
+  return true;
+}
+
+void TFTPSession::handlePacket(const uint8_t *data, size_t size) {
+  if (size < 4) {
+    fail(TFTPError::kIllegalOperation, "Short packet");
+    return;
+  }
+  const uint16_t op = get16(data);
+  const uint16_t block = get16(&data[2]);
+
+  if (op == kOpError) {
+    error_ = (block <= static_cast<uint16_t>(TFTPError::kOptionRefused))
+                 ? static_cast<TFTPError>(block)
+                 : TFTPError::kNotDefined;
+    finish(false);
+    return;
+  }
+
+  switch (state_) {
+    case State::kRequest:
+      if (op == kOpOACK) {
+        if (!parseOACK(&data[2], &data[size])) {
+          fail(TFTPError::kOptionRefused, "Bad option");
+          return;
+        }
+        if (role_ == Role::kSender) {
+          startSending();
+        } else {
+          startReceiving();
+          sendAck(0);
+        }
+        return;
+      }
+      // The peer ignored the options
+      if (role_ == Role::kSender && op == kOpAck && block == 0) {
+        startSending();
+        return;
+      }
+      if (role_ == Role::kReceiver && op == kOpData) {
+        startReceiving();
+        handleData(block, &data[4], size - 4);
+        return;
+      }
+      break;
+
+    case State::kOACKSent:
+      if (op == kOpAck && block == 0) {
+        startSending();
+        return;
+      }
+      break;
+
+    case State::kTransfer:
+      if (role_ == Role::kSender && op == kOpAck) {
+        handleAck(block);
+        return;
+      }
+      if (role_ == Role::kReceiver && op == kOpData) {
+        handleData(block, &data[4], size - 4);
+        return;
+      }
+      break;
+
+    case State::kLinger:
+      // The last ACK was lost
+      if (op == kOpData && block == static_cast<uint16_t>(received_)) {
+        sendCtrl();
+      }
+      return;
+
+    case State::kDone:
+      return;
+  }
+
+  fail(TFTPError::kIllegalOperation, "Unexpected packet");
+}
+
+bool TFTPSession::parseOACK(const uint8_t *p, const uint8_t *end) {
+  while (p < end) {
+    const char *name = nextString(p, end);
+    const char *value = (name != nullptr) ? nextString(p, end) : nullptr;
+    unsigned long long v;
+    if (value == nullptr || !parseValue(value, v)) {
+      return false;
+    }
+    if (strcasecmp(name, "blksize") == 0) {
+      if (v < kMinBlockSize || v > reqBlockSize_) {
+        return false;
+      }
+      blockSize_ = v;
+    } else if (strcasecmp(name, "windowsize") == 0) {
+      if (v < 1 || v > reqWindowSize_) {
+        return false;
+      }
+      windowSize_ = v;
+    } else if (strcasecmp(name, "timeout") == 0) {
+      if (v < 1 || v > 255) {
+        return false;
+      }
+      timeout_ = v * 1000;
+    }
+    // "tsize" is informational
+  }
+  return true;
+}
+
+void TFTPSession::sendCtrl() {
+  udp_.send(peerIP_, peerPort_, ctrl_.data(), ctrl_.size());
+  lastSend_ = sys_now();
+}
+
+void TFTPSession::fail(TFTPError code, const char *msg) {
+  sendError(udp_, peerIP_, peerPort_, code, msg);
+  error_ = code;
+  finish(false);
+}
+
+void TFTPSession::finish(bool ok) {
+  state_ = State::kDone;
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  if (source_ != nullptr) {
+    source_->close(ok);
+  }
+  if (sink_ != nullptr) {
+    sink_->close(ok);
+  }
+  udp_.stop();
+}
+
+// Sending
+
+void TFTPSession::startSending() {
+  state_ = State::kTransfer;
+  tries_ = 0;
+  ringBlocks_ = 2 * uint32_t{windowSize_};
+  ring_ = std::make_unique<uint8_t[]>(ringBlocks_ * blockSize_);
+  if (!fillRing(windowSize_)) {
+    return;
+  }
+  sendWindow();
+  fillRing(ringBlocks_);
+}
+
+bool TFTPSession::fillRing(uint32_t limit) {
+  while (!eof_ && filled_ < acked_ + limit) {
+    uint8_t *buf = &ring_[(filled_ % ringBlocks_) * blockSize_];
+    int n = source_->read(buf, blockSize_);
+    if (n < 0) {
+      fail(TFTPError::kNotDefined, "Read error");
+      return false;
+    }
+    filled_++;
+    if (static_cast<size_t>(n) < blockSize_) {
+      eof_ = true;
+      lastBlock_ = filled_;
+      lastSize_ = n;
+    }
+  }
+  return true;
+}
+
+void TFTPSession::sendData(uint32_t block) {
+  uint8_t header[4];
+  put16(&header[0], kOpData);
+  put16(&header[2], static_cast<uint16_t>(block));
+  const IOVec iov[]{
+      {header, sizeof(header)},
+      {&ring_[((block - 1) % ringBlocks_) * blockSize_],
+       (eof_ && block == lastBlock_) ? lastSize_ : blockSize_},
+  };
+  udp_.sendv(peerIP_, peerPort_, iov, 2);
+}
+
+void TFTPSession::sendWindow() {
+  uint32_t end = std::min(acked_ + windowSize_, filled_);
+  for (uint32_t b = acked_ + 1; b <= end; b++) {
+    sendData(b);
+  }
+  sent_ = end;
+  lastSend_ = sys_now();
+}
+
+void TFTPSession::handleAck(uint16_t block) {
+  const uint16_t delta = block - static_cast<uint16_t>(acked_);
+  if (delta == 0) {
+    // With windows, this means the receiver saw a gap and wants a resend;
+    // without, it's a duplicate and resending would double the traffic
+    if (windowSize_ > 1 && sent_ > acked_) {
+      sendWindow();
+    }
+    return;
+  }
+  if (delta > sent_ - acked_) {
+    return;  // Old
+  }
+  acked_ += delta;
+  tries_ = 0;
+  if (eof_ && acked_ >= lastBlock_) {
+    transferred_ = (lastBlock_ - 1) * blockSize_ + lastSize_;
+    finish(true);
+    return;
+  }
+  transferred_ = acked_ * blockSize_;
+
+  // The next window was normally read while this one was in flight
+  if (!fillRing(windowSize_)) {
+    return;
+  }
+  sendWindow();
+  fillRing(ringBlocks_);
+}
+
+// Receiving
+
+void TFTPSession::startReceiving() {
+  state_ = State::kTransfer;
+  tries_ = 0;
+  staging_ = std::make_unique<uint8_t[]>(uint32_t{windowSize_} * blockSize_);
+  udp_.setReceiveQueueSize(windowSize_);
+}
+
+void TFTPSession::sendAck(uint32_t block) {
+  ctrl_.resize(4);
+  put16(&ctrl_[0], kOpAck);
+  put16(&ctrl_[2], static_cast<uint16_t>(block));
+  sendCtrl();
+}
+
+bool TFTPSession::flushStaging() {
+  if (staged_ > 0 && !sink_->write(staging_.get(), staged_)) {
+    fail(TFTPError::kDiskFull, "Write error");
+    return false;
+  }
+  staged_ = 0;
+  return true;
+}
+
+void TFTPSession::handleData(uint16_t block, const uint8_t *data,
+                             size_t size) {
+  if (size > blockSize_) {
+    fail(TFTPError::kIllegalOperation, "Block too large");
+    return;
+  }
+
+  const uint16_t expected = static_cast<uint16_t>(received_ + 1);
+  if (block == expected) {
+    std::memcpy(&staging_[staged_], data, size);
+    staged_ += size;
+    received_++;
+    transferred_ += size;
+    tries_ = 0;
+    gapAcked_ = false;
+
+    const bool last = (size < blockSize_);
+    if (last || received_ - windowStart_ >= windowSize_) {
+      // Acknowledge first so the peer can send while the sink is busy
+      sendAck(received_);
+      windowStart_ = received_;
+      if (!flushStaging()) {
+        return;
+      }
+      if (last) {
+        sink_->close(true);
+        closed_ = true;
+        if (linger_) {
+          state_ = State::kLinger;
+        } else {
+          finish(true);
+        }
+      }
+    }
+    return;
+  }
+
+  if (block == static_cast<uint16_t>(received_)) {
+    // The last ACK was probably lost
+    if (received_ == windowStart_) {
+      sendCtrl();
+    }
+  } else if (static_cast<uint16_t>(block - expected) < 0x8000 && !gapAcked_) {
+    // A gap: acknowledge what was received so the peer resends from there
+    sendAck(received_);
+    windowStart_ = received_;
+    gapAcked_ = true;
+    flushStaging();
+  }
+}
+
+}  // namespace internal
+
+// --------------------------------------------------------------------------
+//  TFTPServer
+// --------------------------------------------------------------------------
+
+TFTPServer::TFTPServer(size_t maxTransfers)
+    : maxTransfers_(maxTransfers) {}
+
+TFTPServer::~TFTPServer() {
+  end();
+}
+
+bool TFTPServer::begin(uint16_t port) {
+  return udp_.begin(port);
+}
+
+void TFTPServer::end() {
+  sessions_.clear();
+  udp_.stop();
+}
+
+void TFTPServer::handleRequest() {
+  const IPAddress ip = udp_.remoteIP();
+  const uint16_t port = udp_.remotePort();
+  const uint8_t *p = udp_.data();
+  const uint8_t *end = p + udp_.size();
+
+  if (udp_.size() < 2) {
+    return;
+  }
+  const uint16_t op = get16(p);
+  p += 2;
+  if (op != kOpRRQ && op != kOpWRQ) {
+    sendError(udp_, ip, port, TFTPError::kIllegalOperation,
+              "Illegal operation");
+    return;
+  }
+  const char *filename = nextString(p, end);
+  const char *mode = (filename != nullptr) ? nextString(p, end) : nullptr;
+  if (mode == nullptr || std::strlen(filename) > TFTP_MAX_FILENAME_LEN) {
+    sendError(udp_, ip, port, TFTPError::kIllegalOperation, "Bad request");
+    return;
+  }
+  if (strcasecmp(mode, "octet") != 0) {
+    sendError(udp_, ip, port, TFTPError::kNotDefined,
+              "Only octet mode is supported");
+    return;
+  }
+  // A repeated request; the transfer resends its reply
+  for (const auto &session : sessions_) {
+    if (session->isPeer(ip, port)) {
+      return;
+    }
+  }
+  if (sessions_.size() >= maxTransfers_) {
+    sendError(udp_, ip, port, TFTPError::kNotDefined, "Server busy");
+    return;
+  }
+
+  // Options; unknown ones are ignored
+  std::vector<uint8_t> oack(2);
+  put16(&oack[0], kOpOACK);
+  size_t blockSize = kDefaultBlockSize;
+  uint16_t windowSize = 1;
+  uint32_t timeout = options_.timeout;
+  int64_t tsize = -1;
+  bool tsizeRequested = false;
+  while (p < end) {
+    const char *name = nextString(p, end);
+    const char *value = (name != nullptr) ? nextString(p, end) : nullptr;
+    unsigned long long v;
+    if (value == nullptr || !parseValue(value, v)) {
+      break;
+    }
+    if (strcasecmp(name, "blksize") == 0 && v >= kMinBlockSize) {
+      blockSize = std::min(
+          static_cast<size_t>(std::min<unsigned long long>(v, kMaxBlockSize)),
+          std::max(options_.blockSize, kMinBlockSize));
+      appendOption(oack, "blksize", blockSize);
+    } else if (strcasecmp(name, "windowsize") == 0 && v >= 1) {
+      windowSize = static_cast<uint16_t>(std::min<unsigned long long>(
+          v, std::max<uint16_t>(options_.windowSize, 1)));
+      appendOption(oack, "windowsize", windowSize);
+    } else if (strcasecmp(name, "timeout") == 0 && v >= 1 && v <= 255) {
+      timeout = v * 1000;
+      appendOption(oack, "timeout", v);
+    } else if (strcasecmp(name, "tsize") == 0) {
+      tsize = v;
+      tsizeRequested = true;
+    }
+  }
+
+  TFTPSource *source = nullptr;
+  TFTPSink *sink = nullptr;
+  if (op == kOpRRQ) {
+    if (readHandler_ != nullptr) {
+      source = readHandler_(filename);
+    }
+    if (source == nullptr) {
+      sendError(udp_, ip, port, TFTPError::kFileNotFound, "File not found");
+      return;
+    }
+    if (tsizeRequested && source->size() >= 0) {
+      appendOption(oack, "tsize", source->size());
+    }
+  } else {
+    if (writeHandler_ != nullptr) {
+      sink = writeHandler_(filename, tsize);
+    }
+    if (sink == nullptr) {
+      sendError(udp_, ip, port, TFTPError::kAccessViolation,
+                "Access violation");
+      return;
+    }
+    if (tsizeRequested) {
+      appendOption(oack, "tsize", tsize);
+    }
+  }
+
+  auto session = std::make_unique<internal::TFTPSession>(
+      (op == kOpRRQ) ? internal::TFTPSession::Role::kSender
+                     : internal::TFTPSession::Role::kReceiver,
+      options_);
+  session->setSource(source);
+  session->setSink(sink);
+  if (!session->begin()) {
+    sendError(udp_, ip, port, TFTPError::kNotDefined, "No socket");
+    return;  // The session closes the source or sink
+  }
+  session->setPeer(ip, port, true);
+  session->setLinger(true);
+  session->setBlockSize(blockSize);
+  session->setWindowSize(windowSize);
+  session->setTimeout(timeout);
+  if (oack.size() > 2) {
+    session->sendOACK(std::move(oack));
+  } else {
+    session->start();
+  }
+  sessions_.push_back(std::move(session));
+}
+
+void TFTPServer::loop() {
+  // Run the transfers first so that finished ones make room for new requests
+  for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+    if ((*it)->poll()) {
+      ++it;
+    } else {
+      it = sessions_.erase(it);
+    }
+  }
+
+  while (udp_.parsePacket() >= 0) {
+    handleRequest();
+  }
+}
+
+// --------------------------------------------------------------------------
+//  TFTPClient
+// --------------------------------------------------------------------------
+
+// Builds a request with the options that differ from the defaults.
+static std::vector<uint8_t> makeRequest(uint16_t op, const char *filename,
+                                        size_t blockSize, uint16_t windowSize,
+                                        int64_t tsize) {
+  std::vector<uint8_t> v(2);
+  put16(&v[0], op);
+  appendString(v, filename);
+  appendString(v, "octet");
+  if (blockSize != kDefaultBlockSize) {
+    appendOption(v, "blksize", blockSize);
+  }
+  if (windowSize > 1) {
+    appendOption(v, "windowsize", windowSize);
+  }
+  if (tsize >= 0) {
+    appendOption(v, "tsize", tsize);
+  }
+  return v;
+}
+
+bool TFTPClient::run(internal::TFTPSession &session) {
+  while (session.poll()) {
+    // NOTE: Depends on Ethernet loop being called from yield()
+    yield();
+  }
+  error_ = session.error();
+  transferred_ = session.transferred();
+  return error_ == TFTPError::kNone;
+}
+
+bool TFTPClient::get(const IPAddress &server, const char *filename,
+                     TFTPSink &sink, uint16_t port) {
+  error_ = TFTPError::kNone;
+  transferred_ = 0;
+
+  const size_t blockSize =
+      std::clamp(options_.blockSize, kMinBlockSize, kMaxBlockSize);
+  const uint16_t windowSize = std::max<uint16_t>(options_.windowSize, 1);
+
+  internal::TFTPSession session{internal::TFTPSession::Role::kReceiver,
+                                options_};
+  session.setSink(&sink);
+  if (!session.begin()) {
+    error_ = TFTPError::kNotDefined;
+    return false;
+  }
+  session.setPeer(server, port, false);
+  session.sendRequest(makeRequest(kOpRRQ, filename, blockSize, windowSize, 0),
+                      blockSize, windowSize);
+  return run(session);
+}
+
+bool TFTPClient::put(const IPAddress &server, const char *filename,
+                     TFTPSource &source, uint16_t port) {
+  error_ = TFTPError::kNone;
+  transferred_ = 0;
+
+  const size_t blockSize =
+      std::clamp(options_.blockSize, kMinBlockSize, kMaxBlockSize);
+  const uint16_t windowSize = std::max<uint16_t>(options_.windowSize, 1);
+
+  internal::TFTPSession session{internal::TFTPSession::Role::kSender,
+                                options_};
+  session.setSource(&source);
+  if (!session.begin()) {
+    error_ = TFTPError::kNotDefined;
+    return false;
+  }
+  session.setPeer(server, port, false);
+  session.sendRequest(makeRequest(kOpWRQ, filename, blockSize, windowSize,
+                                  source.size()),
+                      blockSize, windowSize);
+  return run(session);
+}
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP
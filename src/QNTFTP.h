@@ -0,0 +1,259 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNTFTP.h defines a TFTP server and client.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_UDP
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <IPAddress.h>
+
+#include "QNEthernetUDP.h"
+
+namespace qindesign {
+namespace network {
+
+// TFTPSource provides the data for a transfer; for example, a file on an SD
+// card, or flash.
+class TFTPSource {
+ public:
+  virtual ~TFTPSource() = default;
+
+  // Reads up to 'size' bytes into 'buf' and returns the number read. Returning
+  // fewer than 'size' bytes means the end was reached. This returns -1 on
+  // error, which aborts the transfer.
+  virtual int read(uint8_t *buf, size_t size) = 0;
+
+  // Returns the total size, for the "tsize" option, or -1 if it isn't known.
+  virtual int64_t size() const {
+    return -1;
+  }
+
+  // Called when the transfer is finished. 'ok' is whether it completed.
+  virtual void close(bool ok) {
+    (void)ok;
+  }
+};
+
+// TFTPSink receives the data from a transfer.
+class TFTPSink {
+ public:
+  virtual ~TFTPSink() = default;
+
+  // Writes the data and returns whether successful. Returning false aborts the
+  // transfer with a "disk full" error.
+  virtual bool write(const uint8_t *data, size_t size) = 0;
+
+  // Called when the transfer is finished. 'ok' is whether it completed.
+  virtual void close(bool ok) {
+    (void)ok;
+  }
+};
+
+// TFTPMemorySource is a TFTPSource that reads from memory.
+class TFTPMemorySource final : public TFTPSource {
+ public:
+  TFTPMemorySource(const uint8_t *data, size_t size)
+      : data_(data), size_(size) {}
+
+  int read(uint8_t *buf, size_t size) override;
+  int64_t size() const override {
+    return size_;
+  }
+
+  // Moves back to the start.
+  void rewind() {
+    pos_ = 0;
+  }
+
+ private:
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_ = 0;
+};
+
+// TFTPMemorySink is a TFTPSink that writes to memory.
+class TFTPMemorySink final : public TFTPSink {
+ public:
+  TFTPMemorySink(uint8_t *buf, size_t capacity)
+      : buf_(buf), capacity_(capacity) {}
+
+  bool write(const uint8_t *data, size_t size) override;
+
+  // Returns the number of bytes written.
+  size_t size() const {
+    return size_;
+  }
+
+  // Moves back to the start.
+  void rewind() {
+    size_ = 0;
+  }
+
+ private:
+  uint8_t *buf_;
+  size_t capacity_;
+  size_t size_ = 0;
+};
+
+// TFTP error codes (RFC 1350 and RFC 2347).
+enum class TFTPError {
+  kNone              = -1,  // No error
+  kNotDefined        = 0,
+  kFileNotFound      = 1,
+  kAccessViolation   = 2,
+  kDiskFull          = 3,
+  kIllegalOperation  = 4,
+  kUnknownTransferID = 5,
+  kFileExists        = 6,
+  kNoSuchUser        = 7,
+  kOptionRefused     = 8,
+  kTimeout           = 100,  // Local: the peer stopped responding
+};
+
+// Transfer options. Options other than the defaults are requested from the
+// peer with RFC 2347 option negotiation; a peer that doesn't support them
+// falls back to 512-byte blocks and a window of 1.
+struct TFTPOptions final {
+  size_t blockSize    = 1428;  // RFC 2348 "blksize", 8-65464
+  uint16_t windowSize = 8;     // RFC 7440 "windowsize", 1-65535
+  uint32_t timeout    = 1000;  // Retransmit timeout, in milliseconds
+  int retries         = 5;     // Retransmits before giving up
+};
+
+namespace internal {
+class TFTPSession;
+}  // namespace internal
+
+// TFTPServer serves TFTP read and write requests in "octet" mode. The
+// transfers are driven by loop(). Each transfer uses its own UDP socket.
+class TFTPServer final {
+ public:
+  // Returns the source for a read request, or NULL if the file can't be read.
+  using ReadHandler = std::function<TFTPSource *(const char *filename)>;
+
+  // Returns the sink for a write request, or NULL if the file can't be
+  // written. 'size' is the transfer size from the "tsize" option, or -1 if it
+  // wasn't given.
+  using WriteHandler =
+      std::function<TFTPSink *(const char *filename, int64_t size)>;
+
+  // Creates a server that runs at most 'maxTransfers' transfers at once.
+  explicit TFTPServer(size_t maxTransfers);
+
+  // Creates a server that runs one transfer at a time.
+  TFTPServer() : TFTPServer(1) {}
+
+  ~TFTPServer();
+
+  // Disallow copying
+  TFTPServer(const TFTPServer &) = delete;
+  TFTPServer &operator=(const TFTPServer &) = delete;
+
+  // Starts listening on the given port. This returns whether successful.
+  bool begin(uint16_t port = 69);
+
+  // Aborts all transfers and stops listening.
+  void end();
+
+  void onRead(ReadHandler handler) {
+    readHandler_ = std::move(handler);
+  }
+
+  void onWrite(WriteHandler handler) {
+    writeHandler_ = std::move(handler);
+  }
+
+  // Sets the limits for negotiated options and the timeouts. Block sizes and
+  // window sizes requested by clients are reduced to these.
+  void setOptions(const TFTPOptions &options) {
+    options_ = options;
+  }
+
+  const TFTPOptions &options() const {
+    return options_;
+  }
+
+  // Returns the number of transfers in progress.
+  size_t transferCount() const {
+    return sessions_.size();
+  }
+
+  // Receives requests and runs the transfers. Call this regularly, for example
+  // from the main loop.
+  void loop();
+
+ private:
+  // Handles a request received on the server port.
+  void handleRequest();
+
+  EthernetUDP udp_;
+  const size_t maxTransfers_;
+  TFTPOptions options_;
+  std::vector<std::unique_ptr<internal::TFTPSession>> sessions_;
+  ReadHandler readHandler_ = nullptr;
+  WriteHandler writeHandler_ = nullptr;
+};
+
+// TFTPClient downloads and uploads files in "octet" mode. The transfer
+// functions block until the transfer is done.
+class TFTPClient final {
+ public:
+  TFTPClient() = default;
+  ~TFTPClient() = default;
+
+  // Disallow copying
+  TFTPClient(const TFTPClient &) = delete;
+  TFTPClient &operator=(const TFTPClient &) = delete;
+
+  // Sets the options to request, and the timeouts.
+  void setOptions(const TFTPOptions &options) {
+    options_ = options;
+  }
+
+  const TFTPOptions &options() const {
+    return options_;
+  }
+
+  // Downloads a file into the sink. This returns whether successful.
+  bool get(const IPAddress &server, const char *filename, TFTPSink &sink,
+           uint16_t port = 69);
+
+  // Uploads a file from the source. This returns whether successful.
+  bool put(const IPAddress &server, const char *filename, TFTPSource &source,
+           uint16_t port = 69);
+
+  // Returns the error from the last transfer, or kNone if it succeeded.
+  TFTPError error() const {
+    return error_;
+  }
+
+  // Returns the number of bytes sent or received in the last transfer.
+  size_t transferred() const {
+    return transferred_;
+  }
+
+ private:
+  bool run(internal::TFTPSession &session);
+
+  TFTPOptions options_;
+  TFTPError error_ = TFTPError::kNone;
+  size_t transferred_ = 0;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_UDP
@@ -0,0 +1,659 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNWebSocketServer.cpp implements the WebSocket server.
+// This file is part of the QNEthernet library.
+
+#include "QNWebSocketServer.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <strings.h>
+
+#include "lwip/sys.h"
+#include "security/sha1.h"
+#include "util/IOVec.h"
+#include "util/http_tools.h"
+
+namespace qindesign {
+namespace network {
+
+// Opcodes
+static constexpr uint8_t kOpContinuation = 0x0;
+static constexpr uint8_t kOpText         = 0x1;
+static constexpr uint8_t kOpBinary       = 0x2;
+static constexpr uint8_t kOpClose        = 0x8;
+static constexpr uint8_t kOpPing         = 0x9;
+static constexpr uint8_t kOpPong         = 0xA;
+
+// Close codes
+static constexpr uint16_t kCloseProtocolError = 1002;
+
+// Appended to the client's key to make the accept value.
+static constexpr char kAcceptGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Unmasks data in place. 'pos' is the position of the data in the payload,
+// which selects the starting mask byte. Aligned words are unmasked 32 bits at
+// a time.
+static void unmask(uint8_t *data, size_t size, const uint8_t mask[4],
+                   uint64_t pos) {
+  size_t i = 0;
+
+  // Bytes up to the first aligned word
+  while (i < size && (reinterpret_cast<uintptr_t>(&data[i]) & 3) != 0) {
+    data[i] ^= mask[(pos + i) & 3];
+    i++;
+  }
+
+  if (size - i >= 4) {
+    // The mask, rotated to line up with the word boundary
+    uint8_t m[4];
+    for (size_t j = 0; j < 4; j++) {
+      m[j] = mask[(pos + i + j) & 3];
+    }
+    uint32_t m32;
+    std::memcpy(&m32, m, 4);
+
+    uint8_t *p = static_cast<uint8_t *>(__builtin_assume_aligned(&data[i], 4));
+    size_t words = (size - i) / 4;
+    for (size_t w = 0; w < words; w++) {
+      uint32_t v;
+      std::memcpy(&v, &p[w*4], 4);
+      v ^= m32;
+      std::memcpy(&p[w*4], &v, 4);
+    }
+    i += words * 4;
+  }
+
+  // The rest
+  for (; i < size; i++) {
+    data[i] ^= mask[(pos + i) & 3];
+  }
+}
+
+// Builds a server frame header, with FIN set and no mask, and returns
+// its size.
+static size_t makeHeader(uint8_t header[10], uint8_t opcode, size_t size) {
+  header[0] = 0x80 | opcode;
+  if (size < 126) {
+    header[1] = static_cast<uint8_t>(size);
+    return 2;
+  }
+  if (size <= UINT16_MAX) {
+    header[1] = 126;
+    header[2] = static_cast<uint8_t>(size >> 8);
+    header[3] = static_cast<uint8_t>(size);
+    return 4;
+  }
+  header[1] = 127;
+  uint64_t size64 = size;
+  for (int i = 0; i < 8; i++) {
+    header[2 + i] = static_cast<uint8_t>(size64 >> (56 - i*8));
+  }
+  return 10;
+}
+
+// Base64-encodes the data into 'out', which must have room for the
+// terminating NUL.
+static void base64Encode(const uint8_t *data, size_t size, char *out) {
+  static constexpr char kChars[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t i = 0;
+  for (; i + 2 < size; i += 3) {
+    uint32_t v = (uint32_t{data[i]} << 16) | (uint32_t{data[i + 1]} << 8) |
+                 data[i + 2];
+    *out++ = kChars[(v >> 18) & 0x3f];
+    *out++ = kChars[(v >> 12) & 0x3f];
+    *out++ = kChars[(v >> 6) & 0x3f];
+    *out++ = kChars[v & 0x3f];
+  }
+  if (i < size) {
+    uint32_t v = uint32_t{data[i]} << 16;
+    if (i + 1 < size) {
+      v |= uint32_t{data[i + 1]} << 8;
+    }
+    *out++ = kChars[(v >> 18) & 0x3f];
+    *out++ = kChars[(v >> 12) & 0x3f];
+    *out++ = (i + 1 < size) ? kChars[(v >> 6) & 0x3f] : '=';
+    *out++ = '=';
+  }
+  *out = '\0';
+}
+
+// Sends a handshake failure response.
+static void sendHandshakeError(EthernetClient &client, const char *status,
+                               const char *extraHeaders) {
+  char buf[160];
+  int n = std::snprintf(buf, sizeof(buf),
+                        "HTTP/1.1 %s\r\n"
+                        "%s"
+                        "Content-Length: 0\r\n"
+                        "Connection: close\r\n"
+                        "\r\n",
+                        status, extraHeaders);
+  if (n > 0 && static_cast<size_t>(n) < sizeof(buf)) {
+    client.writeFully(buf, n);
+    client.flush();
+  }
+}
+
+WebSocketServer::WebSocketServer(uint16_t port, size_t maxConnections)
+    : server_(port),
+      maxConns_(maxConnections) {}
+
+WebSocketServer::~WebSocketServer() {
+  end();
+}
+
+bool WebSocketServer::begin() {
+  return server_.beginWithReuse();
+}
+
+void WebSocketServer::end() {
+  for (Conn &c : conns_) {
+    c.client.close();
+  }
+  conns_.clear();
+  server_.end();
+}
+
+size_t WebSocketServer::connectionCount() const {
+  return std::count_if(conns_.begin(), conns_.end(), [](const Conn &c) {
+    return c.state == State::kOpen;
+  });
+}
+
+WebSocketServer::Conn *WebSocketServer::find(ConnectionId id) {
+  for (Conn &c : conns_) {
+    if (c.id == id) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+// --------------------------------------------------------------------------
+//  Handshake
+// --------------------------------------------------------------------------
+
+bool WebSocketServer::processHandshake(Conn &conn) {
+  int avail = conn.client.available();
+  if (avail <= 0) {
+    return static_cast<bool>(conn.client);
+  }
+
+  // Leave room for a terminating NUL
+  size_t n = std::min(static_cast<size_t>(avail),
+                      kHandshakeBufSize - 1 - conn.hsLen);
+  int r = conn.client.read(reinterpret_cast<uint8_t *>(&conn.hs[conn.hsLen]),
+                           n);
+  if (r <= 0) {
+    return true;
+  }
+  size_t start = (conn.hsLen >= 3) ? conn.hsLen - 3 : 0;
+  conn.hsLen += r;
+  char *buf = conn.hs.get();
+  buf[conn.hsLen] = '\0';
+
+  char *end = std::strstr(&buf[start], "\r\n\r\n");
+  if (end == nullptr) {
+    if (conn.hsLen >= kHandshakeBufSize - 1) {
+      sendHandshakeError(conn.client, "431 Request Header Fields Too Large",
+                         "");
+      return false;
+    }
+    return true;
+  }
+  *end = '\0';
+  size_t used = (end - buf) + 4;
+
+  // Request line
+  char *line = buf;
+  char *eol = std::strstr(line, "\r\n");
+  if (eol != nullptr) {
+    *eol = '\0';
+  }
+  char *sp1 = std::strchr(line, ' ');
+  char *sp2 = (sp1 != nullptr) ? std::strchr(sp1 + 1, ' ') : nullptr;
+  if (sp2 == nullptr || std::strncmp(line, "GET ", 4) != 0 ||
+      std::strcmp(sp2 + 1, "HTTP/1.1") != 0) {
+    sendHandshakeError(conn.client, "400 Bad Request", "");
+    return false;
+  }
+  *sp2 = '\0';
+  const char *path = sp1 + 1;
+
+  // Headers
+  const char *upgrade    = nullptr;
+  const char *connection = nullptr;
+  const char *key        = nullptr;
+  const char *version    = nullptr;
+  char *p = (eol != nullptr) ? eol + 2 : nullptr;
+  while (p != nullptr && *p != '\0') {
+    char *next = std::strstr(p, "\r\n");
+    if (next != nullptr) {
+      *next = '\0';
+      next += 2;
+    }
+    char *colon = std::strchr(p, ':');
+    if (colon != nullptr) {
+      *colon = '\0';
+      char *value = colon + 1;
+      while (*value == ' ' || *value == '\t') {
+        value++;
+      }
+      char *valueEnd = value + std::strlen(value);
+      while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+        *--valueEnd = '\0';
+      }
+      if (strcasecmp(p, "Upgrade") == 0) {
+        upgrade = value;
+      } else if (strcasecmp(p, "Connection") == 0) {
+        connection = value;
+      } else if (strcasecmp(p, "Sec-WebSocket-Key") == 0) {
+        key = value;
+      } else if (strcasecmp(p, "Sec-WebSocket-Version") == 0) {
+        version = value;
+      }
+    }
+    p = next;
+  }
+
+  if (upgrade == nullptr || !http_has_token(upgrade, "websocket") ||
+      connection == nullptr || !http_has_token(connection, "upgrade") ||
+      key == nullptr || std::strlen(key) != 24) {
+    sendHandshakeError(conn.client, "400 Bad Request", "");
+    return false;
+  }
+  if (version == nullptr || std::strcmp(version, "13") != 0) {
+    sendHandshakeError(conn.client, "426 Upgrade Required",
+                       "Sec-WebSocket-Version: 13\r\n");
+    return false;
+  }
+  if (connectHandler_ != nullptr && !connectHandler_(conn.id, path)) {
+    sendHandshakeError(conn.client, "403 Forbidden", "");
+    return false;
+  }
+
+  // Accept value: base64(SHA-1(key + GUID))
+  security::SHA1 sha1;
+  sha1.update(key, 24);
+  sha1.update(kAcceptGUID, sizeof(kAcceptGUID) - 1);
+  uint8_t digest[security::SHA1::kDigestSize];
+  sha1.final(digest);
+  char accept[29];
+  base64Encode(digest, sizeof(digest), accept);
+
+  char resp[160];
+  int respLen = std::snprintf(resp, sizeof(resp),
+                              "HTTP/1.1 101 Switching Protocols\r\n"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Accept: %s\r\n"
+                              "\r\n",
+                              accept);
+  if (conn.client.writeFully(resp, respLen) != static_cast<size_t>(respLen)) {
+    return false;
+  }
+  conn.client.flush();
+
+  conn.state = State::kOpen;
+
+  // Any frames sent right after the handshake
+  size_t rest = conn.hsLen - used;
+  if (rest > 0) {
+    std::memmove(buf, &buf[used], rest);
+  }
+  std::unique_ptr<char[]> hs = std::move(conn.hs);
+  conn.hsLen = 0;
+  if (rest > 0) {
+    processFrames(conn, reinterpret_cast<uint8_t *>(hs.get()), rest);
+  }
+  return true;
+}
+
+// --------------------------------------------------------------------------
+//  Frames
+// --------------------------------------------------------------------------
+
+bool WebSocketServer::checkHeader(Conn &conn) {
+  const uint8_t *h = conn.header;
+  conn.fin    = (h[0] & 0x80) != 0;
+  conn.opcode = h[0] & 0x0f;
+
+  // No extensions are negotiated, so the RSV bits must be zero, and all
+  // client frames must be masked
+  if ((h[0] & 0x70) != 0 || (h[1] & 0x80) == 0) {
+    startClose(conn, kCloseProtocolError);
+    conn.state = State::kClosed;
+    return false;
+  }
+
+  uint64_t len = h[1] & 0x7f;
+  size_t maskAt = 2;
+  if (len == 126) {
+    len = (uint64_t{h[2]} << 8) | h[3];
+    maskAt = 4;
+  } else if (len == 127) {
+    len = 0;
+    for (int i = 0; i < 8; i++) {
+      len = (len << 8) | h[2 + i];
+    }
+    maskAt = 10;
+  }
+  std::memcpy(conn.mask, &h[maskAt], 4);
+
+  bool ok;
+  if ((conn.opcode & 0x08) != 0) {
+    ok = conn.fin && len <= sizeof(conn.control) &&
+         (conn.opcode == kOpClose || conn.opcode == kOpPing ||
+          conn.opcode == kOpPong);
+    conn.controlLen = 0;
+  } else if (conn.opcode == kOpContinuation) {
+    ok = conn.inMessage;
+  } else if (conn.opcode == kOpText || conn.opcode == kOpBinary) {
+    ok = !conn.inMessage;
+    conn.inMessage = true;
+    conn.msgType = (conn.opcode == kOpText) ? MessageType::kText
+                                            : MessageType::kBinary;
+    conn.msgOffset = 0;
+  } else {
+    ok = false;
+  }
+  if (!ok || (len >> 63) != 0) {
+    startClose(conn, kCloseProtocolError);
+    conn.state = State::kClosed;
+    return false;
+  }
+
+  conn.payloadLeft = len;
+  conn.payloadPos  = 0;
+  return true;
+}
+
+void WebSocketServer::processControl(Conn &conn) {
+  switch (conn.opcode) {
+    case kOpClose:
+      if (conn.state == State::kOpen) {
+        // Echo the status code
+        sendFrame(conn, kOpClose, conn.control, std::min(conn.controlLen,
+                                                         size_t{2}));
+        conn.client.flush();
+      }
+      conn.state = State::kClosed;
+      break;
+    case kOpPing:
+      if (conn.state == State::kOpen) {
+        sendFrame(conn, kOpPong, conn.control, conn.controlLen);
+        conn.client.flush();
+      }
+      break;
+    default:  // Pong
+      break;
+  }
+}
+
+void WebSocketServer::processFrames(Conn &conn, uint8_t *data, size_t size) {
+  while (size > 0 && conn.state != State::kClosed) {
+    // Header
+    if (conn.headerLen < conn.headerNeed) {
+      size_t n = std::min(conn.headerNeed - conn.headerLen, size);
+      std::memcpy(&conn.header[conn.headerLen], data, n);
+      conn.headerLen += n;
+      data += n;
+      size -= n;
+      if (conn.headerLen == 2) {
+        uint8_t len = conn.header[1] & 0x7f;
+        conn.headerNeed = 2 + ((len == 126) ? 2 : (len == 127) ? 8 : 0) +
+                          (((conn.header[1] & 0x80) != 0) ? 4 : 0);
+      }
+      if (conn.headerLen < conn.headerNeed || !checkHeader(conn)) {
+        continue;
+      }
+    } else {
+      // Payload
+      size_t n = static_cast<size_t>(
+          std::min(conn.payloadLeft, static_cast<uint64_t>(size)));
+      unmask(data, n, conn.mask, conn.payloadPos);
+      conn.payloadPos  += n;
+      conn.payloadLeft -= n;
+
+      if ((conn.opcode & 0x08) != 0) {
+        std::memcpy(&conn.control[conn.controlLen], data, n);
+        conn.controlLen += n;
+      } else {
+        if (messageHandler_ != nullptr) {
+          const Fragment f{conn.msgType, data, n, conn.msgOffset,
+                           conn.fin && conn.payloadLeft == 0};
+          messageHandler_(conn.id, f);
+        }
+        conn.msgOffset += n;  // Control frames aren't part of the message
+      }
+      data += n;
+      size -= n;
+    }
+
+    if (conn.payloadLeft > 0) {
+      continue;
+    }
+
+    // The frame is done
+    if ((conn.opcode & 0x08) != 0) {
+      processControl(conn);
+    } else {
+      if (conn.fin) {
+        // Deliver the end of a message that ended with an empty frame
+        if (conn.payloadPos == 0 && messageHandler_ != nullptr) {
+          const Fragment f{conn.msgType, data, 0, conn.msgOffset, true};
+          messageHandler_(conn.id, f);
+        }
+        conn.inMessage = false;
+      }
+    }
+    conn.headerLen  = 0;
+    conn.headerNeed = 2;
+  }
+}
+
+// --------------------------------------------------------------------------
+//  Sending
+// --------------------------------------------------------------------------
+
+bool WebSocketServer::sendFrame(Conn &conn, uint8_t opcode,
+                                const uint8_t *data, size_t size) {
+  uint8_t header[10];
+  const IOVec iov[]{
+      {header, makeHeader(header, opcode, size)},
+      {data, size},
+  };
+  const size_t total = iovecSize(iov, 2);
+  if (conn.client.writevFully(iov, 2) != total) {
+    conn.state = State::kClosed;
+    return false;
+  }
+  return true;
+}
+
+void WebSocketServer::startClose(Conn &conn, uint16_t code) {
+  if (conn.state != State::kOpen) {
+    return;
+  }
+  const uint8_t payload[2]{static_cast<uint8_t>(code >> 8),
+                           static_cast<uint8_t>(code)};
+  if (sendFrame(conn, kOpClose, payload, 2)) {
+    conn.client.flush();
+    conn.state = State::kClosing;
+    conn.stateTime = sys_now();
+  }
+}
+
+bool WebSocketServer::send(ConnectionId id, MessageType type,
+                           const uint8_t *data, size_t size) {
+  Conn *conn = find(id);
+  if (conn == nullptr || conn->state != State::kOpen) {
+    return false;
+  }
+  return sendFrame(*conn, (type == MessageType::kText) ? kOpText : kOpBinary,
+                   data, size);
+}
+
+bool WebSocketServer::sendText(ConnectionId id, const char *s) {
+  return send(id, MessageType::kText, reinterpret_cast<const uint8_t *>(s),
+              std::strlen(s));
+}
+
+size_t WebSocketServer::broadcast(MessageType type, const uint8_t *data,
+                                  size_t size) {
+  uint8_t header[10];
+  const IOVec iov[]{
+      {header, makeHeader(header,
+                          (type == MessageType::kText) ? kOpText : kOpBinary,
+                          size)},
+      {data, size},
+  };
+  const size_t total = iovecSize(iov, 2);
+
+  size_t count = 0;
+  for (Conn &conn : conns_) {
+    if (conn.state != State::kOpen) {
+      continue;
+    }
+
+    // Skip a connection that can't take anything right now; once any part of
+    // a frame is written, the rest has to follow
+    size_t n = conn.client.writev(iov, 2);
+    if (n == 0) {
+      continue;
+    }
+    if (n < total) {
+      size_t rest = total - n;
+      size_t written;
+      if (n < iov[0].size) {
+        const IOVec restIov[]{
+            {&header[n], iov[0].size - n},
+            {data, size},
+        };
+        written = conn.client.writevFully(restIov, 2);
+      } else {
+        written = conn.client.writeFully(&data[n - iov[0].size], rest);
+      }
+      if (written != rest) {
+        conn.state = State::kClosed;
+        continue;
+      }
+    }
+    count++;
+  }
+  return count;
+}
+
+size_t WebSocketServer::broadcastText(const char *s) {
+  return broadcast(MessageType::kText, reinterpret_cast<const uint8_t *>(s),
+                   std::strlen(s));
+}
+
+bool WebSocketServer::ping(ConnectionId id, const uint8_t *data, size_t size) {
+  Conn *conn = find(id);
+  if (conn == nullptr || conn->state != State::kOpen || size > 125) {
+    return false;
+  }
+  return sendFrame(*conn, kOpPing, data, size);
+}
+
+void WebSocketServer::close(ConnectionId id, uint16_t code) {
+  Conn *conn = find(id);
+  if (conn != nullptr) {
+    if (conn->state == State::kHandshake) {
+      conn->state = State::kClosed;
+    } else {
+      startClose(*conn, code);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+//  Loop
+// --------------------------------------------------------------------------
+
+void WebSocketServer::loop() {
+  // Accept new connections while there's room
+  while (conns_.size() < maxConns_) {
+    EthernetClient c = server_.accept();
+    if (!c) {
+      break;
+    }
+    Conn conn;
+    conn.client = std::move(c);
+    conn.id = nextId_++;
+    conn.stateTime = sys_now();
+    conn.hs = std::make_unique<char[]>(kHandshakeBufSize);
+    conns_.push_back(std::move(conn));
+  }
+
+  // Frames are unmasked in place in this buffer, so align it for the
+  // word-wise fast path
+  alignas(4) uint8_t buf[512];
+
+  for (Conn &conn : conns_) {
+    switch (conn.state) {
+      case State::kHandshake:
+        if (!processHandshake(conn)) {
+          conn.state = State::kClosed;
+        } else if (conn.state == State::kHandshake &&
+                   sys_now() - conn.stateTime >= timeout_) {
+          conn.state = State::kClosed;
+        }
+        break;
+
+      case State::kOpen:
+      case State::kClosing: {
+        int avail;
+        while (conn.state != State::kClosed &&
+               (avail = conn.client.available()) > 0) {
+          int r = conn.client.read(
+              buf, std::min(static_cast<size_t>(avail), sizeof(buf)));
+          if (r <= 0) {
+            break;
+          }
+          processFrames(conn, buf, r);
+        }
+        if (!conn.client.connected()) {
+          conn.state = State::kClosed;
+        } else if (conn.state == State::kClosing &&
+                   sys_now() - conn.stateTime >= timeout_) {
+          conn.state = State::kClosed;
+        }
+        break;
+      }
+
+      case State::kClosed:
+        break;
+    }
+  }
+
+  // Remove closed connections. The handshake buffer is freed once the
+  // connection is open, so its absence means the handler saw it.
+  for (size_t i = 0; i < conns_.size(); ) {
+    if (conns_[i].state != State::kClosed) {
+      i++;
+      continue;
+    }
+    conns_[i].client.close();
+    ConnectionId id = conns_[i].id;
+    bool wasOpen = (conns_[i].hs == nullptr);
+    conns_.erase(conns_.begin() + i);
+    if (wasOpen && disconnectHandler_ != nullptr) {
+      disconnectHandler_(id);
+    }
+  }
+}
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
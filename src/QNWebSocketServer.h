@@ -0,0 +1,222 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// QNWebSocketServer.h defines a WebSocket server.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "QNEthernetClient.h"
+#include "QNEthernetServer.h"
+
+namespace qindesign {
+namespace network {
+
+// WebSocketServer is an RFC 6455 WebSocket server.
+//
+// Frames are parsed incrementally as data arrives and payloads are passed to
+// the message handler in pieces, so messages of any size can be received
+// without being reassembled. Pings are answered automatically. Extensions,
+// such as compression, aren't supported.
+class WebSocketServer final {
+ public:
+  // Identifies a connection. IDs aren't reused.
+  using ConnectionId = uint32_t;
+
+  enum class MessageType {
+    kText,
+    kBinary,
+  };
+
+  // A piece of a message. A message arrives as one or more pieces, in order.
+  // 'offset' is the position of this piece within the message and 'last' is
+  // whether it's the final piece. The data is only valid inside the handler.
+  struct Fragment final {
+    MessageType type;
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool last;
+  };
+
+  // Called when a handshake is received. Returning false rejects the
+  // connection with a "403 Forbidden". The path is only valid inside
+  // the handler.
+  using ConnectHandler = std::function<bool(ConnectionId id, const char *path)>;
+
+  using MessageHandler =
+      std::function<void(ConnectionId id, const Fragment &fragment)>;
+
+  // Called after a connection is closed, for any reason.
+  using DisconnectHandler = std::function<void(ConnectionId id)>;
+
+  // Creates a server on the given port that handles at most 'maxConnections'
+  // connections at once.
+  WebSocketServer(uint16_t port, size_t maxConnections);
+
+  // Creates a server with at most 4 connections.
+  explicit WebSocketServer(uint16_t port) : WebSocketServer(port, 4) {}
+
+  ~WebSocketServer();
+
+  // Disallow copying
+  WebSocketServer(const WebSocketServer &) = delete;
+  WebSocketServer &operator=(const WebSocketServer &) = delete;
+
+  // Starts listening. This returns whether successful.
+  bool begin();
+
+  // Closes all connections and stops listening.
+  void end();
+
+  void onConnect(ConnectHandler handler) {
+    connectHandler_ = std::move(handler);
+  }
+
+  void onMessage(MessageHandler handler) {
+    messageHandler_ = std::move(handler);
+  }
+
+  void onDisconnect(DisconnectHandler handler) {
+    disconnectHandler_ = std::move(handler);
+  }
+
+  // Sends a message to one connection. This returns whether the whole message
+  // was sent.
+  bool send(ConnectionId id, MessageType type, const uint8_t *data,
+            size_t size);
+
+  // Sends a text message to one connection.
+  bool sendText(ConnectionId id, const char *s);
+
+  // Sends a message to all open connections. The frame header is built once
+  // and the payload isn't copied per connection. A connection that has no
+  // room in its send buffer is skipped so that one slow client doesn't hold
+  // up the rest. This returns the number of connections the message was
+  // sent to.
+  size_t broadcast(MessageType type, const uint8_t *data, size_t size);
+
+  // Sends a text message to all open connections.
+  size_t broadcastText(const char *s);
+
+  // Sends a ping with an optional payload of up to 125 bytes. This returns
+  // whether successful.
+  bool ping(ConnectionId id, const uint8_t *data = nullptr, size_t size = 0);
+
+  // Starts closing a connection with the given status code. The connection
+  // is closed when the peer answers or after the close timeout.
+  void close(ConnectionId id, uint16_t code = 1000);
+
+  // Sets how long, in milliseconds, a handshake or a close may take. The
+  // default is 5 seconds.
+  void setTimeout(uint32_t timeout) {
+    timeout_ = timeout;
+  }
+
+  uint32_t timeout() const {
+    return timeout_;
+  }
+
+  // Returns the number of open WebSocket connections, not including any still
+  // in the handshake.
+  size_t connectionCount() const;
+
+  // Accepts connections, reads frames, and calls handlers. Call this
+  // regularly, for example from the main loop.
+  void loop();
+
+ private:
+  // Size of the buffer that holds a handshake request.
+  static constexpr size_t kHandshakeBufSize = 1024;
+
+  // Maximum frame header size: 2 + 8 (length) + 4 (mask key).
+  static constexpr size_t kMaxHeaderSize = 14;
+
+  enum class State {
+    kHandshake,
+    kOpen,
+    kClosing,  // A close frame was sent
+    kClosed,   // The TCP connection should be closed
+  };
+
+  struct Conn final {
+    EthernetClient client;
+    ConnectionId id = 0;
+    State state = State::kHandshake;
+    uint32_t stateTime = 0;  // When the handshake or close started
+
+    // Handshake request; freed when the handshake is done
+    std::unique_ptr<char[]> hs;
+    size_t hsLen = 0;
+
+    // Frame parser
+    uint8_t header[kMaxHeaderSize];
+    size_t headerLen = 0;
+    size_t headerNeed = 2;
+    uint8_t opcode = 0;
+    bool fin = false;
+    uint8_t mask[4]{0};
+    uint64_t payloadLeft = 0;
+    uint64_t payloadPos = 0;
+
+    // The message in progress
+    bool inMessage = false;
+    MessageType msgType = MessageType::kText;
+    size_t msgOffset = 0;
+
+    // The control frame in progress
+    uint8_t control[125];
+    size_t controlLen = 0;
+  };
+
+  // Reads and processes the handshake. This returns false if the connection
+  // should be closed.
+  bool processHandshake(Conn &conn);
+
+  // Processes received frame data. The data is unmasked in place.
+  void processFrames(Conn &conn, uint8_t *data, size_t size);
+
+  // Checks a complete frame header. This returns false if the frame isn't
+  // allowed here, after starting the close.
+  bool checkHeader(Conn &conn);
+
+  // Processes a complete control frame.
+  void processControl(Conn &conn);
+
+  // Sends a frame, blocking until it's all sent. This returns whether
+  // successful.
+  bool sendFrame(Conn &conn, uint8_t opcode, const uint8_t *data,
+                 size_t size);
+
+  // Sends a close frame and moves to the closing state.
+  void startClose(Conn &conn, uint16_t code);
+
+  Conn *find(ConnectionId id);
+
+  EthernetServer server_;
+  const size_t maxConns_;
+  uint32_t timeout_ = 5'000;
+  ConnectionId nextId_ = 1;
+
+  std::vector<Conn> conns_;
+  ConnectHandler connectHandler_ = nullptr;
+  MessageHandler messageHandler_ = nullptr;
+  DisconnectHandler disconnectHandler_ = nullptr;
+};
+
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
@@ -11,8 +11,11 @@
 #include "driver_w5500_config.h"
 
 // C++ includes
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <iterator>
+#include <new>
 #include <type_traits>
 
 #include <Arduino.h>  // For pinMode() and digitalWrite()
@@ -24,6 +27,11 @@
 #include "lwip/def.h"
 #include "lwip/err.h"
 #include "lwip/stats.h"
+#if QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+#include "lwip/altcp.h"
+#include "lwip/priv/altcp_priv.h"
+#include "lwip/tcpbase.h"
+#endif  // QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
 
 // --------------------------------------------------------------------------
 //  Types
@@ -102,13 +110,19 @@ struct Reg {
 };
 
 static constexpr Reg<uint8_t> kMR{0x0000, blocks::kCommon};             // Mode register
+static constexpr Reg<uint8_t> kGAR{0x0001, blocks::kCommon};            // Gateway IP Address Register (1/4)
+static constexpr Reg<uint8_t> kSUBR{0x0005, blocks::kCommon};           // Subnet Mask Register (1/4)
 static constexpr Reg<uint8_t> kSHAR{0x0009, blocks::kCommon};           // Source Hardware Address Register (1/6)
+static constexpr Reg<uint8_t> kSIPR{0x000f, blocks::kCommon};           // Source IP Address Register (1/4)
 static constexpr Reg<uint8_t> kPHYCFGR{0x002e, blocks::kCommon};        // PHY configuration
 static constexpr Reg<uint8_t> kVERSIONR{0x0039, blocks::kCommon};       // Chip version
 static constexpr Reg<uint8_t> kSn_MR{0x0000, blocks::kSocket};          // Socket n Mode
 static constexpr Reg<uint8_t> kSn_CR{0x0001, blocks::kSocket};          // Socket n Command
 static constexpr Reg<uint8_t> kSn_IR{0x0002, blocks::kSocket};          // Socket n Interrupt
 static constexpr Reg<uint8_t> kSn_SR{0x0003, blocks::kSocket};          // Socket n Status
+static constexpr Reg<uint16_t> kSn_PORT{0x0004, blocks::kSocket};       // Socket n Source Port (16 bits)
+static constexpr Reg<uint8_t> kSn_DIPR{0x000c, blocks::kSocket};        // Socket n Destination IP Address (1/4)
+static constexpr Reg<uint16_t> kSn_DPORT{0x0010, blocks::kSocket};      // Socket n Destination Port (16 bits)
 static constexpr Reg<uint8_t> kSn_RXBUF_SIZE{0x001e, blocks::kSocket};  // Socket n RX Buffer Size
 static constexpr Reg<uint8_t> kSn_TXBUF_SIZE{0x001f, blocks::kSocket};  // Socket n TX Buffer Size
 static constexpr Reg<uint16_t> kSn_TX_FSR{0x0020, blocks::kSocket};     // Socket n TX Free Size (16 bits)
@@ -116,35 +130,58 @@ static constexpr Reg<uint16_t> kSn_TX_WR{0x0024, blocks::kSocket};      // Socke
 static constexpr Reg<uint16_t> kSn_RX_RSR{0x0026, blocks::kSocket};     // Socket n RX Received Size (16 bits)
 static constexpr Reg<uint16_t> kSn_RX_RD{0x0028, blocks::kSocket};      // Socket n RX Read Pointer (16 bits)
 static constexpr Reg<uint8_t> kSn_IMR{0x002c, blocks::kSocket};         // Socket n Interrupt Mask Register
+static constexpr Reg<uint8_t> kSn_KPALVTR{0x002f, blocks::kSocket};     // Socket n Keep Alive Time (5s units)
+
+// Mode register bits.
+namespace modes {
+  static constexpr uint8_t kPB = (1 << 4);  // Ping Block mode
+}  // namespace modes
 
 // Socket modes.
 namespace socketmodes {
   static constexpr uint8_t kMFEN   = (1 << 7);  // MAC Filter Enable in MACRAW mode
   static constexpr uint8_t kBCASTB = (1 << 6);  // Broadcast Blocking in MACRAW and UDP mode
+  static constexpr uint8_t kTCP    = 0x01;      // The TCP protocol mode
   static constexpr uint8_t kMacraw = 0x04;      // The MACRAW protocol mode
 }  // namespace socketmodes
 
 // Socket states.
 namespace socketstates {
-  static constexpr uint8_t kClosed = 0x00;
-  static constexpr uint8_t kMacraw = 0x42;
+  static constexpr uint8_t kClosed      = 0x00;
+  static constexpr uint8_t kInit        = 0x13;
+  static constexpr uint8_t kListen      = 0x14;
+  static constexpr uint8_t kSynSent     = 0x15;
+  static constexpr uint8_t kSynRecv     = 0x16;
+  static constexpr uint8_t kEstablished = 0x17;
+  static constexpr uint8_t kFinWait     = 0x18;
+  static constexpr uint8_t kClosing     = 0x1a;
+  static constexpr uint8_t kTimeWait    = 0x1b;
+  static constexpr uint8_t kCloseWait   = 0x1c;
+  static constexpr uint8_t kLastAck     = 0x1d;
+  static constexpr uint8_t kMacraw      = 0x42;
 }  // namespace socketstates
 
 // Socket commands.
 namespace socketcommands {
-  static constexpr uint8_t kOpen  = 0x01;  // Socket n is initialized and opened according to the protocol
-                                           // selected in Sn_MR (P3:P0)
-  static constexpr uint8_t kClose = 0x10;  // Close Socket n
-  static constexpr uint8_t kSend  = 0x20;  // SEND transmits all the data in the Socket n TX buffer
-  static constexpr uint8_t kRecv  = 0x40;  // RECV completes the processing of the received data in
-                                           // Socket n RX Buffer by using a RX read pointer register
-                                           // (Sn_RX_RD)
+  static constexpr uint8_t kOpen    = 0x01;  // Socket n is initialized and opened according to the protocol
+                                             // selected in Sn_MR (P3:P0)
+  static constexpr uint8_t kListen  = 0x02;  // Socket n waits for a connection request (TCP)
+  static constexpr uint8_t kConnect = 0x04;  // Socket n sends a connection request (TCP)
+  static constexpr uint8_t kDiscon  = 0x08;  // Socket n starts the disconnect process (TCP)
+  static constexpr uint8_t kClose   = 0x10;  // Close Socket n
+  static constexpr uint8_t kSend    = 0x20;  // SEND transmits all the data in the Socket n TX buffer
+  static constexpr uint8_t kRecv    = 0x40;  // RECV completes the processing of the received data in
+                                             // Socket n RX Buffer by using a RX read pointer register
+                                             // (Sn_RX_RD)
 }  // namespace socketcommands
 
 // Socket interrupt masks.
 namespace socketinterrupts {
-  static constexpr uint8_t kSendOk = (1 << 4);  // This is issued when SEND command is completed
-  static constexpr uint8_t kRecv   = (1 << 2);  // This is issued whenever data is received from a peer
+  static constexpr uint8_t kSendOk  = (1 << 4);  // This is issued when SEND command is completed
+  static constexpr uint8_t kTimeout = (1 << 3);  // This is issued when ARP or TCP timeout occurs
+  static constexpr uint8_t kRecv    = (1 << 2);  // This is issued whenever data is received from a peer
+  static constexpr uint8_t kDiscon  = (1 << 1);  // This is issued when FIN or FIN/ACK is received
+  static constexpr uint8_t kCon     = (1 << 0);  // This is issued when a connection is established
 }  // namespace socketinterrupts
 
 // --------------------------------------------------------------------------
@@ -172,6 +209,11 @@ static int s_chipSelectPin = kDefaultCSPin;
 static bool s_macFilteringEnabled = false;  // Whether actually enabled
 #endif  // !QNETHERNET_ENABLE_PROMISCUOUS_MODE
 
+// Shadowed TX state, to avoid reading registers for every frame. The free size
+// is a conservative estimate because the chip only ever frees space.
+static uint16_t s_txWritePtr = 0;  // Shadow of Sn_TX_WR
+static uint16_t s_txFreeSize = 0;  // Lower bound of Sn_TX_FSR
+
 // PHY status, polled
 static bool s_linkSpeed10Not100 = false;
 static bool s_linkIsFullDuplex  = false;
@@ -292,13 +334,26 @@ static inline void write_reg_word(uint16_t addr, uint8_t block, uint16_t v) {
 // --------------------------------------------------------------------------
 
 // Sends a socket command and ensures it completes.
-static void set_socket_command(uint8_t v) {
-  kSn_CR = v;
-  while (*kSn_CR != 0) {
+static void set_socket_command(uint8_t v, uint8_t socket = 0) {
+  const Reg<uint8_t> cr{kSn_CR, socket};
+  cr = v;
+  while (*cr != 0) {
     // Wait for Sn_CR to be zero
   }
 }
 
+// Opens the MACRAW socket and initializes the shadowed TX state. This returns
+// whether the socket is in the MACRAW state.
+static bool open_socket() {
+  set_socket_command(socketcommands::kOpen);
+  if (*kSn_SR != socketstates::kMacraw) {
+    return false;
+  }
+  s_txWritePtr = *kSn_TX_WR;
+  s_txFreeSize = 0;  // Force a read on the first send
+  return true;
+}
+
 // Soft resets the chip.
 static bool soft_reset() {
   int count = 0;
@@ -361,6 +416,15 @@ static void low_level_init() {
   s_macFilteringEnabled = true;
 #endif  // QNETHERNET_ENABLE_PROMISCUOUS_MODE || QNETHERNET_ENABLE_RAW_FRAME_SUPPORT
 
+#if QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+  kSn_RXBUF_SIZE = kMacrawBufSize;
+  kSn_TXBUF_SIZE = kMacrawBufSize;
+  for (uint8_t i = 1; i < 8; i++) {
+    const uint8_t size = (i <= kTCPSocketCount) ? kTCPSocketBufSize : 0;
+    Reg<uint8_t>{kSn_RXBUF_SIZE, i} = size;
+    Reg<uint8_t>{kSn_TXBUF_SIZE, i} = size;
+  }
+#else
   kSn_RXBUF_SIZE = 16;
   kSn_TXBUF_SIZE = 16;
   // Set the others to 0k
@@ -368,14 +432,14 @@ static void low_level_init() {
     Reg<uint8_t>{kSn_RXBUF_SIZE, i} = 0;
     Reg<uint8_t>{kSn_TXBUF_SIZE, i} = 0;
   }
+#endif  // QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
   if /*constexpr*/ (!kSocketInterruptsEnabled) {
     // Disable the socket interrupts
     kSn_IMR = 0;
   } else {
     kSn_IMR = socketinterrupts::kSendOk | socketinterrupts::kRecv;
   }
-  set_socket_command(socketcommands::kOpen);
-  if (*kSn_SR != socketstates::kMacraw) {
+  if (!open_socket()) {
     s_initState = EnetInitStates::kNotInitialized;
     return;
   }
@@ -389,29 +453,39 @@ low_level_init_nohardware:
 }
 
 // Sends a frame. This uses data already in s_frameBuf.
+//
+// The TX write pointer and free size are shadowed so that, in the steady state,
+// sending a frame only needs the data write, the pointer write, and the
+// command. The registers are only read when the free-size estimate is too small
+// for the frame.
 static err_t send_frame(size_t len) {
   if (len == 0) {
     return ERR_OK;
   }
 
-  // Check for space in the transmit buffer
-  uint16_t size;
-  if (!read_reg_word(kSn_TX_FSR, size)) {
-    return ERR_WOULDBLOCK;
-  }
-  if (size < len) {
-    return ERR_MEM;
-  }
+  // Check for space in the transmit buffer, refreshing the estimate if needed
+  if (s_txFreeSize < len) {
+    uint16_t size;
+    if (!read_reg_word(kSn_TX_FSR, size)) {
+      return ERR_WOULDBLOCK;
+    }
+    s_txFreeSize = size;
+    if (size < len) {
+      return ERR_MEM;
+    }
 
-  // Check that the socket is open
-  if (*kSn_SR == socketstates::kClosed) {
-    return ERR_CLSD;
+    // Check that the socket is open
+    if (*kSn_SR == socketstates::kClosed) {
+      s_txFreeSize = 0;
+      return ERR_CLSD;
+    }
   }
 
   // Send the data
-  uint16_t ptr = *kSn_TX_WR;
-  write_frame(ptr, blocks::kSocketTx, len);
-  kSn_TX_WR = ptr + len;
+  write_frame(s_txWritePtr, blocks::kSocketTx, len);
+  s_txWritePtr += len;
+  s_txFreeSize -= len;
+  kSn_TX_WR = s_txWritePtr;
   set_socket_command(socketcommands::kSend);
   if /*constexpr*/ (kSocketInterruptsEnabled) {
     // TODO: See if there's a way to make this non-blocking
@@ -447,6 +521,891 @@ static void check_link_status(struct netif *netif) {
   }
 }
 
+#if QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+
+// --------------------------------------------------------------------------
+//  Hardware TCP Sockets
+// --------------------------------------------------------------------------
+
+// State for one altcp connection backed by a hardware TCP socket. Listeners
+// keep up to kTCPListenSockets hardware sockets listening. When one of those
+// connects, it's handed to a new connection and the listener opens another.
+struct TCPConn final {
+  struct altcp_pcb *conn = nullptr;
+  int socket = -1;  // Hardware socket, or -1 if none; always -1 for listeners
+
+  bool listening  = false;
+  bool connecting = false;
+  bool rxClosed   = false;  // Whether the remote close was delivered
+  bool txClosed   = false;  // Whether our side was shut down
+  bool sending    = false;  // Whether a SEND command is outstanding
+  bool sendQueued = false;  // Whether there's unsent data in the TX buffer
+  uint16_t queuedLen  = 0;  // Unsent bytes in the TX buffer
+  uint16_t sendingLen = 0;  // Bytes in the outstanding SEND command
+  bool noDelay    = false;
+
+  // Callback handling; the connection can't be freed while in a callback
+  bool inCallback  = false;
+  bool freePending = false;
+
+  uint16_t rcvWnd = TCP_WND;  // How much data the application can accept
+  struct pbuf *refused = nullptr;
+  altcp_connected_fn connected = nullptr;
+
+  ip_addr_t localIP  = *IP4_ADDR_ANY;
+  ip_addr_t remoteIP = *IP4_ADDR_ANY;
+  uint16_t localPort  = 0;
+  uint16_t remotePort = 0;
+};
+
+// Hardware socket owners; index zero is the MACRAW socket and is never used
+static TCPConn *s_tcpSockets[kTCPSocketCount + 1]{nullptr};
+
+// Sockets that are disconnecting and no longer have an owner
+static bool s_tcpSocketClosing[kTCPSocketCount + 1]{false};
+
+// Listeners, kept so that they can resume listening when a socket frees up
+static TCPConn *s_tcpListeners[kTCPSocketCount]{nullptr};
+
+// The next ephemeral port
+static uint16_t s_tcpNextPort = 0xc000;
+
+// Returns the register block for the given socket's TX buffer.
+static inline uint8_t tx_block(int socket) {
+  return blocks::kSocketTx + (socket << 2);
+}
+
+// Returns the register block for the given socket's RX buffer.
+static inline uint8_t rx_block(int socket) {
+  return blocks::kSocketRx + (socket << 2);
+}
+
+// Copies the netif's IPv4 configuration to the chip so that the hardware
+// sockets can use it. Ping replies are blocked because lwIP already answers
+// them through the MACRAW socket.
+static void sync_ip_config() {
+  const struct netif *netif = netif_default;
+  if (netif == nullptr) {
+    return;
+  }
+  std::memcpy(s_frameBuf, netif_ip4_addr(netif), 4);
+  write_frame(kSIPR, 4);
+  std::memcpy(s_frameBuf, netif_ip4_netmask(netif), 4);
+  write_frame(kSUBR, 4);
+  std::memcpy(s_frameBuf, netif_ip4_gw(netif), 4);
+  write_frame(kGAR, 4);
+  kMR = *kMR | modes::kPB;
+}
+
+// Returns whether the given local port is used by a connection or listener.
+static bool is_port_used(uint16_t port) {
+  for (const TCPConn *c : s_tcpSockets) {
+    if (c != nullptr && c->localPort == port) {
+      return true;
+    }
+  }
+  for (const TCPConn *c : s_tcpListeners) {
+    if (c != nullptr && c->localPort == port) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Chooses an unused ephemeral port.
+static uint16_t next_port() {
+  uint16_t port;
+  do {
+    port = s_tcpNextPort++;
+    if (s_tcpNextPort == 0) {
+      s_tcpNextPort = 0xc000;
+    }
+  } while (is_port_used(port));
+  return port;
+}
+
+// Closes a hardware socket and clears any interrupt bits it left behind so that
+// they aren't seen as events by the socket's next user.
+static void close_tcp_socket(uint8_t socket) {
+  set_socket_command(socketcommands::kClose, socket);
+  Reg<uint8_t>{kSn_IR, socket} = 0xff;
+}
+
+// Assigns a free hardware socket to the connection and opens it in TCP mode.
+// This returns whether successful.
+static bool open_tcp_socket(TCPConn *c) {
+  for (int i = 1; i <= kTCPSocketCount; i++) {
+    if (s_tcpSockets[i] != nullptr || s_tcpSocketClosing[i]) {
+      continue;
+    }
+
+    Reg<uint8_t>{kSn_MR, static_cast<uint8_t>(i)} = socketmodes::kTCP;
+    Reg<uint16_t>{kSn_PORT, static_cast<uint8_t>(i)} = c->localPort;
+    Reg<uint8_t>{kSn_IMR, static_cast<uint8_t>(i)} =
+        socketinterrupts::kSendOk | socketinterrupts::kTimeout |
+        socketinterrupts::kRecv | socketinterrupts::kDiscon |
+        socketinterrupts::kCon;
+    set_socket_command(socketcommands::kOpen, i);
+    Reg<uint8_t>{kSn_IR, static_cast<uint8_t>(i)} = 0xff;
+    if (*Reg<uint8_t>{kSn_SR, static_cast<uint8_t>(i)} != socketstates::kInit) {
+      close_tcp_socket(i);
+      return false;
+    }
+
+    s_tcpSockets[i] = c;
+    c->socket = i;
+    return true;
+  }
+  return false;
+}
+
+// Releases the connection's hardware socket, if it has one. If `graceful` is
+// true then the socket is disconnected and reclaimed later when it closes.
+// Listeners have all their sockets closed.
+static void release_socket(TCPConn *c, bool graceful) {
+  if (c->listening) {
+    for (int i = 1; i <= kTCPSocketCount; i++) {
+      if (s_tcpSockets[i] == c) {
+        close_tcp_socket(i);
+        s_tcpSockets[i] = nullptr;
+      }
+    }
+    return;
+  }
+  if (c->socket < 0) {
+    return;
+  }
+  if (graceful) {
+    set_socket_command(socketcommands::kDiscon, c->socket);
+    s_tcpSocketClosing[c->socket] = true;
+  } else {
+    close_tcp_socket(c->socket);
+  }
+  s_tcpSockets[c->socket] = nullptr;
+  c->socket = -1;
+}
+
+// Starts listening on another free hardware socket. The listener's sockets are
+// the ones it owns in s_tcpSockets. This returns whether successful.
+static bool start_listening(TCPConn *c) {
+  if (!open_tcp_socket(c)) {
+    return false;
+  }
+  const uint8_t socket = c->socket;
+  c->socket = -1;
+  set_socket_command(socketcommands::kListen, socket);
+  if (*Reg<uint8_t>{kSn_SR, socket} != socketstates::kListen) {
+    close_tcp_socket(socket);
+    s_tcpSockets[socket] = nullptr;
+    return false;
+  }
+  return true;
+}
+
+// Frees the connection, or marks it to be freed if it's inside a callback.
+static void free_conn(TCPConn *c) {
+  struct altcp_pcb *conn = c->conn;
+  conn->accept    = nullptr;
+  conn->connected = nullptr;
+  conn->recv      = nullptr;
+  conn->sent      = nullptr;
+  conn->poll      = nullptr;
+  conn->err       = nullptr;
+  if (c->inCallback) {
+    c->freePending = true;
+  } else {
+    altcp_free(conn);
+  }
+}
+
+// Marks the start of a callback.
+static inline void begin_callback(TCPConn *c) {
+  c->inCallback = true;
+}
+
+// Marks the end of a callback. This returns false if the connection was freed.
+static bool end_callback(TCPConn *c) {
+  c->inCallback = false;
+  if (c->freePending) {
+    altcp_free(c->conn);
+    return false;
+  }
+  return true;
+}
+
+// Closes the hardware socket, reports the error, and then frees
+// the connection.
+static void report_error(TCPConn *c, err_t err) {
+  struct altcp_pcb *conn = c->conn;
+  release_socket(c, false);
+  if (conn->err != nullptr) {
+    conn->err(conn->arg, err);
+  }
+  free_conn(c);
+}
+
+// Issues a SEND command if there's queued data and no outstanding send.
+static void maybe_send(TCPConn *c) {
+  if (c->sendQueued && !c->sending) {
+    set_socket_command(socketcommands::kSend, c->socket);
+    c->sending    = true;
+    c->sendQueued = false;
+    c->sendingLen = c->queuedLen;
+    c->queuedLen  = 0;
+  }
+}
+
+// Passes a pbuf to the application. This returns false if the connection was
+// freed. Unaccepted data is kept and offered again later.
+static bool deliver(TCPConn *c, struct pbuf *p) {
+  struct altcp_pcb *conn = c->conn;
+  if (conn->recv == nullptr) {
+    c->rcvWnd += p->tot_len;
+    pbuf_free(p);
+    return true;
+  }
+
+  begin_callback(c);
+  err_t err = conn->recv(conn->arg, conn, p, ERR_OK);
+  if (!end_callback(c)) {
+    return false;
+  }
+  if (err != ERR_OK) {
+    c->refused = p;
+  }
+  return true;
+}
+
+// Reads received data from the socket and passes it to the application. This
+// returns false if the connection was freed.
+static bool receive(TCPConn *c) {
+  if (c->refused != nullptr) {
+    struct pbuf *p = c->refused;
+    c->refused = nullptr;
+    if (!deliver(c, p)) {
+      return false;
+    }
+    if (c->refused != nullptr) {
+      return true;
+    }
+  }
+
+  const uint8_t socket = c->socket;
+  uint16_t size;
+  if (!read_reg_word(Reg<uint16_t>{kSn_RX_RSR, socket}, size)) {
+    return true;
+  }
+  size = std::min(size, c->rcvWnd);
+  if (size == 0) {
+    return true;
+  }
+
+  struct pbuf *p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
+  if (p == nullptr) {
+    return true;
+  }
+
+  const Reg<uint16_t> rxRd{kSn_RX_RD, socket};
+  uint16_t ptr = *rxRd;
+  for (struct pbuf *q = p; q != nullptr; q = q->next) {
+    read(ptr, rx_block(socket), q->payload, q->len);
+    ptr += q->len;
+  }
+  rxRd = ptr;
+  set_socket_command(socketcommands::kRecv, socket);
+
+  c->rcvWnd -= size;
+  return deliver(c, p);
+}
+
+// Handles a listener's sockets. Spare sockets are kept listening so that
+// connections arriving while another is being accepted aren't refused. If a
+// connection arrived then a new connection is created and passed to the accept
+// callback. Only one is accepted per call because the callback may close the
+// listener.
+static void poll_listener(TCPConn *c) {
+  int ready = -1;  // The connected socket to hand off
+  uint8_t count = 0;
+  for (int i = 1; i <= kTCPSocketCount; i++) {
+    if (s_tcpSockets[i] != c) {
+      continue;
+    }
+    uint8_t sr = *Reg<uint8_t>{kSn_SR, static_cast<uint8_t>(i)};
+    if (sr == socketstates::kClosed) {
+      close_tcp_socket(i);
+      s_tcpSockets[i] = nullptr;
+    } else if (sr == socketstates::kEstablished ||
+               sr == socketstates::kCloseWait) {
+      if (ready < 0) {
+        ready = i;
+      }
+    } else {
+      count++;
+    }
+  }
+  while (count < kTCPListenSockets && start_listening(c)) {
+    count++;
+  }
+  if (ready < 0) {
+    return;
+  }
+  const uint8_t socket = ready;
+
+  // Hand the socket to a new connection
+  struct altcp_pcb *conn = altcp_w5500_alloc(nullptr, IPADDR_TYPE_V4);
+  if (conn == nullptr) {
+    close_tcp_socket(socket);
+    s_tcpSockets[socket] = nullptr;
+    return;
+  }
+  TCPConn *nc = static_cast<TCPConn *>(conn->state);
+  nc->socket  = socket;
+  nc->noDelay = c->noDelay;
+  s_tcpSockets[socket] = nc;
+
+  uint8_t ip[4];
+  read(kSn_DIPR.addr, Reg<uint8_t>{kSn_DIPR, socket}.block, ip, 4);
+  IP_ADDR4(&nc->remoteIP, ip[0], ip[1], ip[2], ip[3]);
+  nc->remotePort = *Reg<uint16_t>{kSn_DPORT, socket};
+  nc->localIP    = c->localIP;
+  nc->localPort  = c->localPort;
+
+  struct altcp_pcb *listener = c->conn;
+  if (listener->accept == nullptr) {
+    report_error(nc, ERR_ABRT);
+    return;
+  }
+  begin_callback(nc);
+  err_t err = listener->accept(listener->arg, conn, ERR_OK);
+  if (end_callback(nc) && err != ERR_OK && err != ERR_ABRT) {
+    report_error(nc, ERR_ABRT);
+  }
+}
+
+// Handles a connection's socket.
+static void poll_connection(TCPConn *c) {
+  const uint8_t socket = c->socket;
+  const Reg<uint8_t> ir{kSn_IR, socket};
+  uint8_t irv = *ir;
+  uint8_t sr = *Reg<uint8_t>{kSn_SR, socket};
+
+  if (c->connecting) {
+    if (sr == socketstates::kEstablished || sr == socketstates::kCloseWait) {
+      c->connecting = false;
+      ir = socketinterrupts::kCon;
+      if (c->connected != nullptr) {
+        struct altcp_pcb *conn = c->conn;
+        begin_callback(c);
+        c->connected(conn->arg, conn, ERR_OK);
+        if (!end_callback(c)) {
+          return;
+        }
+      }
+    } else if (sr == socketstates::kClosed ||
+               (irv & socketinterrupts::kTimeout) != 0) {
+      report_error(c, ERR_RST);
+    }
+    return;
+  }
+
+  if (c->sending && (irv & socketinterrupts::kSendOk) != 0) {
+    ir = socketinterrupts::kSendOk;
+    c->sending = false;
+
+    // The chip has the ACKs, so report completed sends as sent data
+    struct altcp_pcb *conn = c->conn;
+    if (conn->sent != nullptr && c->sendingLen > 0) {
+      begin_callback(c);
+      conn->sent(conn->arg, conn, c->sendingLen);
+      if (!end_callback(c)) {
+        return;
+      }
+    }
+    c->sendingLen = 0;
+  }
+  maybe_send(c);
+
+  if ((irv & socketinterrupts::kRecv) != 0) {
+    ir = socketinterrupts::kRecv;
+  }
+  if (!receive(c)) {
+    return;
+  }
+
+  if ((irv & socketinterrupts::kTimeout) != 0) {
+    report_error(c, ERR_ABRT);
+  } else if (sr == socketstates::kClosed) {
+    // After our FIN, the chip closes the socket when the peer's FIN arrives
+    if (!c->txClosed || (irv & socketinterrupts::kDiscon) == 0 ||
+        c->refused != nullptr) {
+      report_error(c, ERR_RST);
+      return;
+    }
+    release_socket(c, false);
+    if (!c->rxClosed) {
+      c->rxClosed = true;
+      struct altcp_pcb *conn = c->conn;
+      if (conn->recv != nullptr) {
+        begin_callback(c);
+        conn->recv(conn->arg, conn, nullptr, ERR_OK);
+        end_callback(c);
+      }
+    }
+  } else if (sr == socketstates::kCloseWait && !c->rxClosed &&
+             c->refused == nullptr) {
+    uint16_t size;
+    if (read_reg_word(Reg<uint16_t>{kSn_RX_RSR, socket}, size) && size == 0) {
+      c->rxClosed = true;
+      struct altcp_pcb *conn = c->conn;
+      if (conn->recv != nullptr) {
+        begin_callback(c);
+        conn->recv(conn->arg, conn, nullptr, ERR_OK);
+        end_callback(c);
+      }
+    }
+  }
+}
+
+// Polls all the hardware TCP sockets.
+static void poll_tcp_sockets() {
+  for (int i = 1; i <= kTCPSocketCount; i++) {
+    if (s_tcpSocketClosing[i]) {
+      const uint8_t socket = i;
+      uint8_t sr = *Reg<uint8_t>{kSn_SR, socket};
+      if (sr == socketstates::kClosed) {
+        Reg<uint8_t>{kSn_IR, socket} = 0xff;
+        s_tcpSocketClosing[i] = false;
+      } else if ((*Reg<uint8_t>{kSn_IR, socket} &
+                  socketinterrupts::kTimeout) != 0) {
+        close_tcp_socket(socket);
+        s_tcpSocketClosing[i] = false;
+      }
+      continue;
+    }
+
+    TCPConn *c = s_tcpSockets[i];
+    if (c == nullptr || c->listening) {
+      continue;
+    }
+    poll_connection(c);
+  }
+
+  for (TCPConn *c : s_tcpListeners) {
+    if (c != nullptr) {
+      poll_listener(c);
+    }
+  }
+}
+
+// Closes all the hardware TCP sockets. Connections are aborted and listeners
+// resume listening when the driver is next polled.
+static void close_tcp_sockets() {
+  for (int i = 1; i <= kTCPSocketCount; i++) {
+    TCPConn *c = s_tcpSockets[i];
+    if (c == nullptr) {
+      continue;
+    }
+    if (c->listening) {
+      release_socket(c, false);
+    } else {
+      report_error(c, ERR_ABRT);
+    }
+  }
+  std::fill_n(s_tcpSocketClosing, kTCPSocketCount + 1, false);
+}
+
+// altcp functions
+
+static void w5500_set_poll(struct altcp_pcb *conn, u8_t interval) {
+  LWIP_UNUSED_ARG(conn);
+  LWIP_UNUSED_ARG(interval);
+}
+
+static void w5500_recved(struct altcp_pcb *conn, u16_t len) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c != nullptr) {
+    c->rcvWnd = std::min<uint32_t>(uint32_t{c->rcvWnd} + len, TCP_WND);
+  }
+}
+
+static err_t w5500_bind(struct altcp_pcb *conn, const ip_addr_t *ipaddr,
+                        u16_t port) {
+  LWIP_UNUSED_ARG(ipaddr);
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return ERR_VAL;
+  }
+  if (port != 0 && is_port_used(port)) {
+    return ERR_USE;
+  }
+  c->localPort = port;
+  return ERR_OK;
+}
+
+static err_t w5500_connect(struct altcp_pcb *conn, const ip_addr_t *ipaddr,
+                           u16_t port, altcp_connected_fn connected) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr || ipaddr == nullptr || !IP_IS_V4(ipaddr)) {
+    return ERR_VAL;
+  }
+  if (c->socket >= 0 || c->listening) {
+    return ERR_ISCONN;
+  }
+  if (s_initState != EnetInitStates::kInitialized) {
+    return ERR_IF;
+  }
+
+  sync_ip_config();
+  if (c->localPort == 0) {
+    c->localPort = next_port();
+  }
+  if (!open_tcp_socket(c)) {
+    return ERR_MEM;
+  }
+
+  std::memcpy(s_frameBuf, ip_2_ip4(ipaddr), 4);
+  write_frame(Reg<uint8_t>{kSn_DIPR, static_cast<uint8_t>(c->socket)}, 4);
+  Reg<uint16_t>{kSn_DPORT, static_cast<uint8_t>(c->socket)} = port;
+  set_socket_command(socketcommands::kConnect, c->socket);
+
+  c->connecting = true;
+  c->connected  = connected;
+  ip_addr_copy_from_ip4(c->localIP, *netif_ip4_addr(netif_default));
+  ip_addr_copy(c->remoteIP, *ipaddr);
+  c->remotePort = port;
+  return ERR_OK;
+}
+
+static struct altcp_pcb *w5500_listen(struct altcp_pcb *conn, u8_t backlog,
+                                      err_t *err) {
+  LWIP_UNUSED_ARG(backlog);
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr || c->socket >= 0 || c->listening) {
+    if (err != nullptr) {
+      *err = ERR_VAL;
+    }
+    return nullptr;
+  }
+
+  auto it = std::find(std::begin(s_tcpListeners), std::end(s_tcpListeners),
+                      nullptr);
+  if (it == std::end(s_tcpListeners)) {
+    if (err != nullptr) {
+      *err = ERR_MEM;
+    }
+    return nullptr;
+  }
+
+  if (s_initState == EnetInitStates::kInitialized) {
+    sync_ip_config();
+    ip_addr_copy_from_ip4(c->localIP, *netif_ip4_addr(netif_default));
+  }
+  if (c->localPort == 0) {
+    c->localPort = next_port();
+  }
+  c->listening = true;
+  *it = c;
+
+  // Anything that doesn't succeed now is retried when polled
+  if (s_initState == EnetInitStates::kInitialized) {
+    for (int i = 0; i < kTCPListenSockets; i++) {
+      if (!start_listening(c)) {
+        break;
+      }
+    }
+  }
+
+  if (err != nullptr) {
+    *err = ERR_OK;
+  }
+  return conn;
+}
+
+static void w5500_abort(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c != nullptr) {
+    report_error(c, ERR_ABRT);
+  }
+}
+
+static err_t w5500_close(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    altcp_free(conn);
+    return ERR_OK;
+  }
+  if (c->socket >= 0 || c->listening) {
+    bool graceful = !c->listening && !c->connecting;
+    if (graceful) {
+      maybe_send(c);
+    }
+    release_socket(c, graceful);
+  }
+  free_conn(c);
+  return ERR_OK;
+}
+
+static err_t w5500_shutdown(struct altcp_pcb *conn, int shut_rx, int shut_tx) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return ERR_VAL;
+  }
+  if (shut_rx && shut_tx) {
+    return w5500_close(conn);
+  }
+  if (shut_tx && c->socket >= 0 && !c->listening && !c->connecting) {
+    maybe_send(c);
+    set_socket_command(socketcommands::kDiscon, c->socket);
+    c->txClosed = true;
+  }
+  return ERR_OK;
+}
+
+static err_t w5500_write(struct altcp_pcb *conn, const void *dataptr, u16_t len,
+                         u8_t apiflags) {
+  LWIP_UNUSED_ARG(apiflags);
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr || c->socket < 0 || c->listening || c->connecting) {
+    return ERR_CONN;
+  }
+  if (len == 0) {
+    return ERR_OK;
+  }
+
+  // Sn_TX_FSR doesn't count data written since the last SEND, so the queued
+  // data is subtracted here
+  const uint8_t socket = c->socket;
+  uint16_t size;
+  if (!read_reg_word(Reg<uint16_t>{kSn_TX_FSR, socket}, size) ||
+      size < uint32_t{c->queuedLen} + len) {
+    return ERR_MEM;
+  }
+
+  c->queuedLen += len;
+
+  const Reg<uint16_t> txWr{kSn_TX_WR, socket};
+  uint16_t ptr = *txWr;
+  const uint8_t *data = static_cast<const uint8_t *>(dataptr);
+  while (len > 0) {
+    size_t n = std::min(size_t{len}, size_t{MAX_FRAME_LEN - 4});
+    std::memcpy(s_frameBuf, data, n);
+    write_frame(ptr, tx_block(socket), n);
+    ptr  += n;
+    data += n;
+    len  -= n;
+  }
+  txWr = ptr;
+  c->sendQueued = true;
+  return ERR_OK;
+}
+
+static err_t w5500_output(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr || c->socket < 0 || c->listening || c->connecting) {
+    return ERR_CONN;
+  }
+  maybe_send(c);
+  return ERR_OK;
+}
+
+static u16_t w5500_mss(struct altcp_pcb *conn) {
+  LWIP_UNUSED_ARG(conn);
+  return TCP_MSS;
+}
+
+static u16_t w5500_sndbuf(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr || c->socket < 0 || c->listening || c->connecting) {
+    return 0;
+  }
+  uint16_t size;
+  if (!read_reg_word(Reg<uint16_t>{kSn_TX_FSR, static_cast<uint8_t>(c->socket)},
+                     size)) {
+    return 0;
+  }
+  return (size > c->queuedLen) ? size - c->queuedLen : 0;
+}
+
+static u16_t w5500_sndqueuelen(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return 0;
+  }
+  return (c->sendQueued || c->sending) ? 1 : 0;
+}
+
+// The chip doesn't implement Nagle's algorithm; the flag is only remembered.
+static void w5500_nagle_disable(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c != nullptr) {
+    c->noDelay = true;
+  }
+}
+
+static void w5500_nagle_enable(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c != nullptr) {
+    c->noDelay = false;
+  }
+}
+
+static int w5500_nagle_disabled(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  return (c != nullptr) && c->noDelay;
+}
+
+static void w5500_setprio(struct altcp_pcb *conn, u8_t prio) {
+  LWIP_UNUSED_ARG(conn);
+  LWIP_UNUSED_ARG(prio);
+}
+
+static void w5500_dealloc(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return;
+  }
+  release_socket(c, false);
+  auto it = std::find(std::begin(s_tcpListeners), std::end(s_tcpListeners), c);
+  if (it != std::end(s_tcpListeners)) {
+    *it = nullptr;
+  }
+  if (c->refused != nullptr) {
+    pbuf_free(c->refused);
+  }
+  delete c;
+  conn->state = nullptr;
+}
+
+static err_t w5500_get_tcp_addrinfo(struct altcp_pcb *conn, int local,
+                                    ip_addr_t *addr, u16_t *port) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return ERR_VAL;
+  }
+  if (addr != nullptr) {
+    ip_addr_copy(*addr, local ? c->localIP : c->remoteIP);
+  }
+  if (port != nullptr) {
+    *port = local ? c->localPort : c->remotePort;
+  }
+  return ERR_OK;
+}
+
+static ip_addr_t *w5500_get_ip(struct altcp_pcb *conn, int local) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return nullptr;
+  }
+  return local ? &c->localIP : &c->remoteIP;
+}
+
+static u16_t w5500_get_port(struct altcp_pcb *conn, int local) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return 0;
+  }
+  return local ? c->localPort : c->remotePort;
+}
+
+#if LWIP_TCP_KEEPALIVE
+static void w5500_keepalive_disable(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c != nullptr && c->socket >= 0) {
+    Reg<uint8_t>{kSn_KPALVTR, static_cast<uint8_t>(c->socket)} = 0;
+  }
+}
+
+// The chip only has a keep-alive interval, in units of 5 seconds.
+static void w5500_keepalive_enable(struct altcp_pcb *conn, u32_t idle,
+                                   u32_t intvl, u32_t count) {
+  LWIP_UNUSED_ARG(intvl);
+  LWIP_UNUSED_ARG(count);
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c != nullptr && c->socket >= 0) {
+    Reg<uint8_t>{kSn_KPALVTR, static_cast<uint8_t>(c->socket)} =
+        std::clamp<u32_t>(idle / 5000, 1, 255);
+  }
+}
+#endif  // LWIP_TCP_KEEPALIVE
+
+#ifdef LWIP_DEBUG
+static enum tcp_state w5500_dbg_get_tcp_state(struct altcp_pcb *conn) {
+  TCPConn *c = static_cast<TCPConn *>(conn->state);
+  if (c == nullptr) {
+    return CLOSED;
+  }
+  if (c->socket < 0) {
+    return c->listening ? LISTEN : CLOSED;
+  }
+  switch (*Reg<uint8_t>{kSn_SR, static_cast<uint8_t>(c->socket)}) {
+    case socketstates::kListen:      return LISTEN;
+    case socketstates::kSynSent:     return SYN_SENT;
+    case socketstates::kSynRecv:     return SYN_RCVD;
+    case socketstates::kEstablished: return ESTABLISHED;
+    case socketstates::kFinWait:     return FIN_WAIT_1;
+    case socketstates::kClosing:     return CLOSING;
+    case socketstates::kTimeWait:    return TIME_WAIT;
+    case socketstates::kCloseWait:   return CLOSE_WAIT;
+    case socketstates::kLastAck:     return LAST_ACK;
+    default:                         return CLOSED;
+  }
+}
+#endif  // LWIP_DEBUG
+
+static const struct altcp_functions kW5500Functions{
+    w5500_set_poll,
+    w5500_recved,
+    w5500_bind,
+    w5500_connect,
+    w5500_listen,
+    w5500_abort,
+    w5500_close,
+    w5500_shutdown,
+    w5500_write,
+    w5500_output,
+    w5500_mss,
+    w5500_sndbuf,
+    w5500_sndqueuelen,
+    w5500_nagle_disable,
+    w5500_nagle_enable,
+    w5500_nagle_disabled,
+    w5500_setprio,
+    w5500_dealloc,
+    w5500_get_tcp_addrinfo,
+    w5500_get_ip,
+    w5500_get_port,
+#if LWIP_TCP_KEEPALIVE
+    w5500_keepalive_disable,
+    w5500_keepalive_enable,
+#endif  // LWIP_TCP_KEEPALIVE
+#ifdef LWIP_DEBUG
+    w5500_dbg_get_tcp_state,
+#endif  // LWIP_DEBUG
+};
+
+extern "C" struct altcp_pcb *altcp_w5500_alloc(void *arg, u8_t ip_type) {
+  LWIP_UNUSED_ARG(arg);
+  if (ip_type == IPADDR_TYPE_V6) {
+    return nullptr;
+  }
+
+  struct altcp_pcb *conn = altcp_alloc();
+  if (conn == nullptr) {
+    return nullptr;
+  }
+  TCPConn *c = new (std::nothrow) TCPConn{};
+  if (c == nullptr) {
+    altcp_free(conn);
+    return nullptr;
+  }
+  c->conn     = conn;
+  conn->state = c;
+  conn->fns   = &kW5500Functions;
+  return conn;
+}
+
+#endif  // QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+
 // --------------------------------------------------------------------------
 //  Driver Interface
 // --------------------------------------------------------------------------
@@ -528,8 +1487,13 @@ void driver_deinit() {
       break;
   }
 
+#if QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+  close_tcp_sockets();
+#endif  // QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+
   // Close the socket
   set_socket_command(socketcommands::kClose);
+  s_txFreeSize = 0;
 
   spi.end();
   s_initState = EnetInitStates::kStart;
@@ -540,6 +1504,10 @@ void driver_proc_input(struct netif *netif) {
     return;
   }
 
+#if QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+  poll_tcp_sockets();
+#endif  // QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+
   uint16_t size;
   if (!read_reg_word(kSn_RX_RSR, size)) {
     return;
@@ -562,8 +1530,7 @@ void driver_proc_input(struct netif *netif) {
 
     // Recommendation is to close and then re-open the socket
     set_socket_command(socketcommands::kClose);
-    set_socket_command(socketcommands::kOpen);
-    if (*kSn_SR != socketstates::kMacraw) {
+    if (!open_socket()) {
       s_initState = EnetInitStates::kNotInitialized;
       return;
     }
@@ -657,7 +1624,7 @@ bool driver_output_frame(const uint8_t *frame, size_t len) {
   }
 
   std::memcpy(s_frameBuf, frame, len);
-  return send_frame(len);
+  return (send_frame(len) == ERR_OK);
 }
 #endif  // QNETHERNET_ENABLE_RAW_FRAME_SUPPORT
 
@@ -8,3 +8,22 @@
 
 #define MTU           1500
 #define MAX_FRAME_LEN 1522  /* Includes the 4-byte FCS (frame check sequence) */
+
+#if QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
+
+#include "lwip/altcp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Allocates an altcp connection that uses one of the chip's hardware TCP
+// sockets instead of lwIP's TCP stack. This has the same signature as
+// 'altcp_new_fn'. Only IPv4 is supported.
+struct altcp_pcb *altcp_w5500_alloc(void *arg, u8_t ip_type);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#endif  // QNETHERNET_ENABLE_W5500_TCP_OFFLOAD && LWIP_ALTCP
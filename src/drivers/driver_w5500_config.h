@@ -8,6 +8,8 @@
 
 #include <SPI.h>
 
+#include "lwip/opt.h"
+
 // SPI settings
 // static SPISettings kSPISettings{14000000, MSBFIRST, SPI_MODE0};
 static const SPISettings kSPISettings{30000000, MSBFIRST, SPI_MODE0};
@@ -15,3 +17,28 @@ static SPIClass &spi = SPI;
 static constexpr int kDefaultCSPin = 10;
 
 static constexpr bool kSocketInterruptsEnabled = false;
+
+// Hardware TCP socket configuration, used when
+// QNETHERNET_ENABLE_W5500_TCP_OFFLOAD is enabled. Socket 0 remains the MACRAW
+// socket and sockets 1 to kTCPSocketCount are the TCP sockets.
+//
+// Buffer sizes are in KiB and must be one of 0, 1, 2, 4, 8, or 16. The total
+// for each of TX and RX can't exceed 16KiB. The TCP window of a hardware
+// socket is its RX buffer size.
+static constexpr uint8_t kTCPSocketCount   = 7;
+static constexpr uint8_t kMacrawBufSize    = 8;
+static constexpr uint8_t kTCPSocketBufSize = 1;
+
+// The number of hardware sockets each listener keeps listening. With more than
+// one, a connection that arrives while another is being handed off isn't
+// refused. Listening sockets aren't available for other connections.
+static constexpr uint8_t kTCPListenSockets = 2;
+
+static_assert(kTCPSocketCount <= 7, "Too many TCP sockets");
+static_assert(kTCPListenSockets >= 1, "Listeners need at least one socket");
+#if QNETHERNET_ENABLE_W5500_TCP_OFFLOAD
+static_assert(kTCPSocketCount <= QNETHERNET_INTERNAL_HW_TCP_SOCKETS,
+              "MEMP_NUM_SYS_TIMEOUT doesn't count all the TCP sockets");
+#endif  // QNETHERNET_ENABLE_W5500_TCP_OFFLOAD
+static_assert(kMacrawBufSize + kTCPSocketCount*kTCPSocketBufSize <= 16,
+              "Total buffer size must not exceed 16KiB");
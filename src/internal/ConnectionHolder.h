@@ -33,6 +33,9 @@ struct ConnectionHolder final {
   /*volatile*/ size_t remainingPos = 0;
   std::vector<uint8_t> remaining;
   // `remainingPos` should never be past the end of `remaining`
+
+  // Whether the unread received data must not be moved
+  bool bufPinned = false;
 };
 
 }  // namespace internal
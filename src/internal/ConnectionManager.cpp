@@ -10,6 +10,7 @@
 
 // C++ includes
 #include <algorithm>
+#include <cerrno>
 #if LWIP_ALTCP
 #include <functional>
 #endif  // LWIP_ALTCP
@@ -17,10 +18,9 @@
 
 #include "QNEthernet.h"
 #include "lwip/arch.h"
+#include "lwip/err.h"
 #include "lwip/ip.h"
-#if LWIP_ALTCP
 #include "lwip/tcp.h"
-#endif  // LWIP_ALTCP
 
 #if LWIP_ALTCP
 // This is a function that fills in the given 'altcp_allocator_t' with an
@@ -44,12 +44,91 @@ extern std::function<bool(const ip_addr_t *ipaddr, uint16_t port,
 // if it has not already been freed.
 extern std::function<void(const altcp_allocator_t &allocator)>
     qnethernet_altcp_free_allocator;
+
+// The lwIP TCP functions, used to identify TCP layers.
+extern "C" const struct altcp_functions altcp_tcp_functions;
 #endif  // LWIP_ALTCP
 
 namespace qindesign {
 namespace network {
 namespace internal {
 
+struct tcp_pcb *innermostTCPPCB(altcp_pcb *pcb) {
+#if LWIP_ALTCP
+  if (pcb == nullptr) {
+    return nullptr;
+  }
+  altcp_pcb *innermost = pcb;
+  while (innermost->inner_conn != nullptr) {
+    innermost = innermost->inner_conn;
+  }
+  if (innermost->fns != &altcp_tcp_functions) {
+    return nullptr;
+  }
+  return static_cast<tcp_pcb *>(innermost->state);
+#else
+  return pcb;
+#endif  // LWIP_ALTCP
+}
+
+const struct tcp_cc *toTCPCC(CongestionControl cc) {
+  switch (cc) {
+    case CongestionControl::kNewReno:
+      return &tcp_cc_newreno;
+    case CongestionControl::kLAN:
+      return &tcp_cc_lan;
+    case CongestionControl::kLANDelay:
+      return &tcp_cc_lan_delay;
+    default:
+      return &LWIP_TCP_CC_DEFAULT;
+  }
+}
+
+CongestionControl fromTCPCC(const struct tcp_cc *cc) {
+  if (cc == &tcp_cc_newreno) {
+    return CongestionControl::kNewReno;
+  }
+  if (cc == &tcp_cc_lan) {
+    return CongestionControl::kLAN;
+  }
+  if (cc == &tcp_cc_lan_delay) {
+    return CongestionControl::kLANDelay;
+  }
+  return CongestionControl::kDefault;
+}
+
+void applySocketOptions(altcp_pcb *pcb, const SocketOptions &options) {
+  if (options.noDelay) {
+    altcp_nagle_disable(pcb);
+  } else {
+    altcp_nagle_enable(pcb);
+  }
+
+  tcp_pcb *tpcb = innermostTCPPCB(pcb);
+  if (tpcb != nullptr) {
+    tpcb->tos = options.diffServ;
+    tcp_set_cc(tpcb, toTCPCC(options.congestionControl));
+    if (options.keepAlive) {
+      ip_set_option(tpcb, SOF_KEEPALIVE);
+#if LWIP_TCP_KEEPALIVE
+      tpcb->keep_idle  = options.keepIdle;
+      tpcb->keep_intvl = options.keepIntvl;
+      tpcb->keep_cnt   = options.keepCount;
+#endif  // LWIP_TCP_KEEPALIVE
+    } else {
+      ip_reset_option(tpcb, SOF_KEEPALIVE);
+    }
+  }
+#if LWIP_ALTCP && LWIP_TCP_KEEPALIVE
+  else if (options.keepAlive) {
+    altcp_keepalive_enable(pcb, options.keepIdle, options.keepIntvl,
+                           options.keepCount);
+  } else {
+    altcp_keepalive_disable(pcb);
+  }
+#endif  // LWIP_ALTCP && LWIP_TCP_KEEPALIVE
+}
+
 ConnectionManager &ConnectionManager::instance() {
   static ConnectionManager instance;
   return instance;
@@ -86,7 +165,8 @@ static inline bool isAvailable(const std::unique_ptr<ConnectionState> &state) {
 }
 
 // Copy any remaining data from the state to the "remaining" buffer. This first
-// clears the 'remaining' buffer.
+// clears the 'remaining' buffer. If the data is pinned then the buffer itself
+// is moved instead so that the data stays where it is.
 //
 // This assumes holder->state != NULL.
 static void maybeCopyRemaining(ConnectionHolder *holder) {
@@ -98,7 +178,12 @@ static void maybeCopyRemaining(ConnectionHolder *holder) {
   holder->remainingPos = 0;
 
   if (isAvailable(state)) {
-    v.insert(v.end(), state->buf.cbegin() + state->bufPos, state->buf.cend());
+    if (holder->bufPinned) {
+      v.swap(state->buf);
+      holder->remainingPos = state->bufPos;
+    } else {
+      v.insert(v.end(), state->buf.cbegin() + state->bufPos, state->buf.cend());
+    }
   }
 }
 
@@ -115,6 +200,8 @@ void ConnectionManager::errFunc(void *arg, err_t err) {
 
   if (holder->state != nullptr && err != ERR_OK) {
     // Copy any buffered data
+    holder->state->unsplice(false);
+    holder->state->completeAllPosted();
     maybeCopyRemaining(holder);
 
     holder->state = nullptr;
@@ -141,7 +228,14 @@ err_t ConnectionManager::recvFunc(void *arg, struct altcp_pcb *tpcb,
     holder->connected = false;
 
     if (state != nullptr) {
+      // A FIN is passed along a splice after the data before it
+      if (p == nullptr && err == ERR_OK) {
+        state->finishSplice();
+      }
+
       // Copy any buffered data
+      state->unsplice(true);
+      state->completeAllPosted();
       maybeCopyRemaining(holder);
 
       if (p != nullptr) {
@@ -177,19 +271,47 @@ err_t ConnectionManager::recvFunc(void *arg, struct altcp_pcb *tpcb,
 
   holder->connected = true;
 
+  // Spliced data is forwarded and only acknowledged once it's been written
+  if (state != nullptr && state->spliceTo != nullptr) {
+    if (state->spliceQueue == nullptr) {
+      state->spliceQueue = p;
+    } else {
+      pbuf_cat(state->spliceQueue, p);
+    }
+    state->pushSpliced();
+    state->ackReceived();
+    return ERR_OK;
+  }
+
   if (state != nullptr) {
     auto &v = state->buf;
 
-    // Check that we can store all the data
-    size_t rem = v.capacity() - v.size() + state->bufPos;
-    if (rem < p->tot_len) {
+    // Data goes straight into any posted application buffers first, as long as
+    // nothing is buffered ahead of it
+    size_t posted = 0;
+    if (!isAvailable(state)) {
+      posted = std::min(size_t{p->tot_len}, state->postedSpace());
+    }
+    size_t len = p->tot_len - posted;
+
+    // Check that we can store all the data; pinned data can't be moved to
+    // make room
+    size_t rem = v.capacity() - v.size();
+    if (!holder->bufPinned) {
+      rem += state->bufPos;
+    }
+    if (rem < len) {
       altcp_recved(tpcb, rem);
       return ERR_INPROGRESS;  // ERR_MEM? Other?
     }
 
+    if (posted > 0) {
+      state->receivePosted(p, posted);
+    }
+
     // If there isn't enough space at the end, move all the data in the buffer
     // to the top
-    if (v.capacity() - v.size() < p->tot_len) {
+    if (v.capacity() - v.size() < len) {
       size_t n = v.size() - state->bufPos;
       if (n > 0) {
         std::copy_n(v.begin() + state->bufPos, n, v.begin());
@@ -200,20 +322,58 @@ err_t ConnectionManager::recvFunc(void *arg, struct altcp_pcb *tpcb,
       state->bufPos = 0;
     }
 
-    // Copy all the data from the pbuf
-    while (p != nullptr) {
-      uint8_t *data = static_cast<uint8_t *>(p->payload);
-      v.insert(v.end(), &data[0], &data[p->len]);
-      p = p->next;
+    // Copy the rest of the data from the pbuf
+    if (len > 0) {
+      size_t size = v.size();
+      v.resize(size + len);
+      pbuf_copy_partial(p, &v[size], len, posted);
     }
   }
 
   altcp_recved(tpcb, pHead->tot_len);
   pbuf_free(pHead);
 
+  if (state != nullptr) {
+    state->ackReceived();
+  }
+
+  return ERR_OK;
+}
+
+// Sent data callback, used for spliced connections.
+err_t ConnectionManager::sentFunc(void *arg, struct altcp_pcb *tpcb,
+                                  u16_t len) {
+  LWIP_UNUSED_ARG(tpcb);
+  LWIP_UNUSED_ARG(len);
+
+  if (arg == nullptr) {
+    return ERR_OK;
+  }
+
+  // Space was freed in this connection's send buffer
+  ConnectionHolder *holder = static_cast<ConnectionHolder *>(arg);
+  const auto &state = holder->state;
+  if (state != nullptr) {
+    if (state->splicedFrom != nullptr) {
+      state->splicedFrom->pushSpliced();
+    } else if (state->spliceFinPending) {
+      state->sendCorked();  // Data left over from a finished splice
+    }
+  }
   return ERR_OK;
 }
 
+// Gets the local port from the given tcp_pcb.
+static uint16_t getLocalPort(altcp_pcb *pcb) {
+#if LWIP_ALTCP
+  return altcp_get_port(pcb, 1);
+#else
+  uint16_t port;
+  altcp_get_tcp_addrinfo(pcb, 1, nullptr, &port);
+  return port;
+#endif  // LWIP_ALTCP
+}
+
 // Accepted connection callback.
 err_t ConnectionManager::acceptFunc(void *arg, struct altcp_pcb *newpcb,
                                     err_t err) {
@@ -243,6 +403,20 @@ err_t ConnectionManager::acceptFunc(void *arg, struct altcp_pcb *newpcb,
   altcp_recv(newpcb, &recvFunc);
   m->addConnection(holder);
 
+  // Apply the listener's options
+  uint16_t port = getLocalPort(newpcb);
+  auto it = std::find_if(
+      m->listeners_.begin(), m->listeners_.end(), [port](const auto &elem) {
+        return (elem.pcb != nullptr) && (getLocalPort(elem.pcb) == port);
+      });
+  if (it != m->listeners_.end()) {
+    it->accepted++;
+    applySocketOptions(newpcb, it->options);
+    holder->state->setAckPolicy(it->options.ackPolicy,
+                                it->options.quickAckCount,
+                                it->options.quickAckIdle);
+  }
+
   return ERR_OK;
 }
 
@@ -281,7 +455,7 @@ static altcp_pcb *create_altcp_pcb(const ip_addr_t *ipaddr, uint16_t port,
 }
 
 std::shared_ptr<ConnectionHolder> ConnectionManager::connect(
-    const ip_addr_t *ipaddr, uint16_t port) {
+    const ip_addr_t *ipaddr, uint16_t port, const uint8_t *data, size_t size) {
   if (ipaddr == nullptr) {
     return nullptr;
   }
@@ -304,6 +478,28 @@ std::shared_ptr<ConnectionHolder> ConnectionManager::connect(
   altcp_err(pcb, &errFunc);
   altcp_recv(pcb, &recvFunc);
 
+  if (size > 0 && size > altcp_sndbuf(pcb)) {
+    altcp_abort(pcb);
+    errno = ENOMEM;
+    return nullptr;
+  }
+
+#if LWIP_TCP_FASTOPEN
+  // Data can only go with the SYN if TCP itself is writing it; a layer such as
+  // TLS has to complete its own handshake first
+  if (size > 0) {
+#if LWIP_ALTCP
+    tcp_pcb *tpcb = (pcb->inner_conn == nullptr) ? innermostTCPPCB(pcb)
+                                                 : nullptr;
+#else
+    tcp_pcb *tpcb = pcb;
+#endif  // LWIP_ALTCP
+    if (tpcb != nullptr) {
+      tcp_fastopen(tpcb);
+    }
+  }
+#endif  // LWIP_TCP_FASTOPEN
+
   // Try to connect
   if (altcp_connect(pcb, ipaddr, port, &connectedFunc) != ERR_OK) {
     // holder->state will be removed when holder is removed
@@ -311,11 +507,24 @@ std::shared_ptr<ConnectionHolder> ConnectionManager::connect(
     return nullptr;
   }
 
+  // Queue the initial data before anything is sent. With Fast Open, the SYN
+  // is held until the output call so it can carry the data.
+  if (size > 0) {
+    err_t err = altcp_write(pcb, data, size, TCP_WRITE_FLAG_COPY);
+    if (err != ERR_OK) {
+      altcp_abort(pcb);
+      errno = err_to_errno(err);
+      return nullptr;
+    }
+    altcp_output(pcb);
+  }
+
   addConnection(holder);
   return holder;
 }
 
-int32_t ConnectionManager::listen(uint16_t port, bool reuse) {
+int32_t ConnectionManager::listen(uint16_t port, bool reuse,
+                                  const SocketOptions &options) {
   altcp_pcb *pcb = create_altcp_pcb(nullptr, port, IPADDR_TYPE_ANY);
   if (pcb == nullptr) {
     Ethernet.loop();  // Allow the stack to move along
@@ -324,23 +533,21 @@ int32_t ConnectionManager::listen(uint16_t port, bool reuse) {
 
   // Try to bind
   if (reuse) {
-#if LWIP_ALTCP
-    altcp_pcb *innermost = pcb;
-    while (innermost->inner_conn != nullptr) {
-      innermost = innermost->inner_conn;
+    tcp_pcb *tpcb = innermostTCPPCB(pcb);
+    if (tpcb != nullptr) {
+      ip_set_option(tpcb, SOF_REUSEADDR);
     }
-    ip_set_option(static_cast<tcp_pcb *>(innermost->state), SOF_REUSEADDR);
-#else
-    ip_set_option(pcb, SOF_REUSEADDR);
-#endif  // LWIP_ALTCP
   }
   if (altcp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK) {
     altcp_abort(pcb);
     return -1;
   }
 
+  // The listening socket copies some of these, for example, SO_KEEPALIVE
+  applySocketOptions(pcb, options);
+
   // Try to listen
-  altcp_pcb *pcbNew = altcp_listen(pcb);
+  altcp_pcb *pcbNew = altcp_listen_with_backlog(pcb, options.backlog);
   if (pcbNew == nullptr) {
     altcp_abort(pcb);
     Ethernet.loop();  // Allow the stack to move along
@@ -348,8 +555,15 @@ int32_t ConnectionManager::listen(uint16_t port, bool reuse) {
   }
   pcb = pcbNew;
 
+#if LWIP_TCP_FASTOPEN
+  tcp_pcb *lpcb = innermostTCPPCB(pcb);
+  if (lpcb != nullptr) {
+    tcp_listen_fastopen(lpcb, options.fastOpen);
+  }
+#endif  // LWIP_TCP_FASTOPEN
+
   // Finally, accept connections
-  listeners_.push_back(pcb);
+  listeners_.push_back(Listener{pcb, options});
   altcp_arg(pcb, this);
   altcp_accept(pcb, &acceptFunc);
 
@@ -359,34 +573,86 @@ int32_t ConnectionManager::listen(uint16_t port, bool reuse) {
   return port;
 }
 
-// Gets the local port from the given tcp_pcb.
-static uint16_t getLocalPort(altcp_pcb *pcb) {
-#if LWIP_ALTCP
-  return altcp_get_port(pcb, 1);
-#else
-  uint16_t port;
-  altcp_get_tcp_addrinfo(pcb, 1, nullptr, &port);
-  return port;
-#endif  // LWIP_ALTCP
-}
-
 bool ConnectionManager::isListening(uint16_t port) const {
   auto it = std::find_if(
       listeners_.begin(), listeners_.end(), [port](const auto &elem) {
-        return (elem != nullptr) && (getLocalPort(elem) == port);
+        return (elem.pcb != nullptr) && (getLocalPort(elem.pcb) == port);
       });
   return (it != listeners_.end());
 }
 
+bool ConnectionManager::setListenerOptions(uint16_t port,
+                                           const SocketOptions &options) {
+  auto it = std::find_if(
+      listeners_.begin(), listeners_.end(), [port](const auto &elem) {
+        return (elem.pcb != nullptr) && (getLocalPort(elem.pcb) == port);
+      });
+  if (it == listeners_.end()) {
+    return false;
+  }
+  it->options = options;
+
+  // New connections copy these from the listener before the SYN-ACK is sent
+  tcp_pcb *tpcb = innermostTCPPCB(it->pcb);
+  if (tpcb != nullptr) {
+    tpcb->tos = options.diffServ;
+    tcp_set_cc(tpcb, toTCPCC(options.congestionControl));
+    if (options.keepAlive) {
+      ip_set_option(tpcb, SOF_KEEPALIVE);
+    } else {
+      ip_reset_option(tpcb, SOF_KEEPALIVE);
+    }
+#if TCP_LISTEN_BACKLOG
+    tcp_backlog_set(tpcb, options.backlog);
+#endif  // TCP_LISTEN_BACKLOG
+#if LWIP_TCP_FASTOPEN
+    tcp_listen_fastopen(tpcb, options.fastOpen);
+#endif  // LWIP_TCP_FASTOPEN
+  }
+  return true;
+}
+
+bool ConnectionManager::acceptStats(uint16_t port, AcceptStats &stats) const {
+  auto it = std::find_if(
+      listeners_.begin(), listeners_.end(), [port](const auto &elem) {
+        return (elem.pcb != nullptr) && (getLocalPort(elem.pcb) == port);
+      });
+  if (it == listeners_.end()) {
+    return false;
+  }
+
+  stats = AcceptStats{};
+  stats.accepted = it->accepted;
+
+  // Hardware sockets have no lwIP listener
+  const auto *lpcb = reinterpret_cast<const tcp_pcb_listen *>(
+      innermostTCPPCB(it->pcb));
+  if (lpcb != nullptr) {
+#if TCP_LISTEN_BACKLOG
+    stats.backlog = lpcb->backlog;
+    stats.pending = lpcb->accepts_pending;
+#endif  // TCP_LISTEN_BACKLOG
+    stats.dropped = lpcb->syns_dropped;
+#if TCP_SYN_COOKIES
+    stats.cookiesSent     = lpcb->syn_cookies_sent;
+    stats.cookiesAccepted = lpcb->syn_cookies_accepted;
+#endif  // TCP_SYN_COOKIES
+#if LWIP_TCP_FASTOPEN
+    stats.fastOpenAccepted = lpcb->fastopen_accepted;
+#endif  // LWIP_TCP_FASTOPEN
+  }
+  return true;
+}
+
 bool ConnectionManager::stopListening(uint16_t port) {
   auto it = std::find_if(
       listeners_.begin(), listeners_.end(), [port](const auto &elem) {
-        return (elem != nullptr) && (getLocalPort(elem) == port);
+        return (elem.pcb != nullptr) && (getLocalPort(elem.pcb) == port);
       });
   if (it == listeners_.end()) {
     return false;
   }
-  altcp_pcb *pcb = *it;
+  altcp_pcb *pcb = it->pcb;
   listeners_.erase(it);
   if (altcp_close(pcb) != ERR_OK) {
     altcp_abort(pcb);
@@ -423,6 +689,27 @@ std::shared_ptr<ConnectionHolder> ConnectionManager::findAvailable(
   return nullptr;
 }
 
+bool ConnectionManager::splice(const std::shared_ptr<ConnectionHolder> &from,
+                               const std::shared_ptr<ConnectionHolder> &to) {
+  if (from == nullptr || to == nullptr || from == to) {
+    return false;
+  }
+  const auto &fromState = from->state;
+  const auto &toState = to->state;
+  if (fromState == nullptr || toState == nullptr ||
+      fromState->spliceTo != nullptr || toState->splicedFrom != nullptr) {
+    return false;
+  }
+
+  fromState->spliceTo = toState.get();
+  toState->splicedFrom = fromState.get();
+  altcp_sent(toState->pcb, &sentFunc);
+
+  // Forward anything already buffered
+  fromState->pushSpliced();
+  return true;
+}
+
 bool ConnectionManager::remove(
     const std::shared_ptr<ConnectionHolder> &holder) {
   auto it =
@@ -446,6 +733,9 @@ size_t ConnectionManager::write(uint16_t port, uint8_t b) {
                   if (state == nullptr || getLocalPort(state->pcb) != port) {
                     return;
                   }
+                  if (!state->pushCorked()) {  // Keep the data in order
+                    return;
+                  }
                   if (altcp_sndbuf(state->pcb) < 1) {
                     if (altcp_output(state->pcb) != ERR_OK) {
                       return;
@@ -471,6 +761,9 @@ size_t ConnectionManager::write(uint16_t port, const uint8_t *b, size_t len) {
                   if (state == nullptr || getLocalPort(state->pcb) != port) {
                     return;
                   }
+                  if (!state->pushCorked()) {  // Keep the data in order
+                    return;
+                  }
                   if (altcp_sndbuf(state->pcb) < size16) {
                     if (altcp_output(state->pcb) != ERR_OK) {
                       return;
@@ -493,6 +786,7 @@ void ConnectionManager::flush(uint16_t port) {
                   if (state == nullptr || getLocalPort(state->pcb) != port) {
                     return;
                   }
+                  state->pushCorked();
                   altcp_output(state->pcb);
                   Ethernet.loop();
                 });
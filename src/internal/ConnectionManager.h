@@ -15,29 +15,61 @@
 #include <vector>
 
 #include "ConnectionHolder.h"
+#include "SocketOptions.h"
 #include "lwip/altcp.h"
 #include "lwip/ip_addr.h"
+#include "lwip/tcp.h"
 
 namespace qindesign {
 namespace network {
 namespace internal {
 
+// Returns the innermost lwIP TCP PCB of the given connection. This will return
+// NULL if the innermost layer is not an lwIP TCP PCB; for example, if the
+// connection is backed by hardware TCP sockets.
+struct tcp_pcb *innermostTCPPCB(altcp_pcb *pcb);
+
+// Returns the lwIP algorithm for the given congestion control value.
+const struct tcp_cc *toTCPCC(CongestionControl cc);
+
+// Returns the congestion control value for the given lwIP algorithm. This
+// returns CongestionControl::kDefault for an algorithm not in the enum.
+CongestionControl fromTCPCC(const struct tcp_cc *cc);
+
+// Applies socket options to the given connection.
+void applySocketOptions(altcp_pcb *pcb, const SocketOptions &options);
+
 // ConnectionState holds all the state needed for a connection.
 class ConnectionManager final {
  public:
   // Accesses the singleton instance.
   static ConnectionManager &instance();
 
+  // Connects to the given address. Any initial data is queued before the SYN
+  // is sent, and goes with the SYN if TCP Fast Open is possible. All the data
+  // must fit in the send buffer. This returns nullptr if the attempt was not
+  // successful, and errno will be set if there was an error.
   std::shared_ptr<ConnectionHolder> connect(const ip_addr_t *ipaddr,
-                                            uint16_t port);
+                                            uint16_t port,
+                                            const uint8_t *data = nullptr,
+                                            size_t size = 0);
 
   // Listens on a port. The `reuse` parameter controls the SO_REUSEADDR flag.
-  // This returns a negative value if the attempt was not successful or the port
-  // number otherwise. In theory, this shouldn't return zero.
-  int32_t listen(uint16_t port, bool reuse);
+  // The options are applied to the listening socket and to each accepted
+  // connection. This returns a negative value if the attempt was not successful
+  // or the port number otherwise. In theory, this shouldn't return zero.
+  int32_t listen(uint16_t port, bool reuse, const SocketOptions &options);
 
   bool isListening(uint16_t port) const;
 
+  // Replaces the options applied to connections accepted on the specified port.
+  // This returns whether there's a listener on that port.
+  bool setListenerOptions(uint16_t port, const SocketOptions &options);
+
+  // Fills in the connection statistics for the listener on the specified port.
+  // This returns whether there's a listener on that port.
+  bool acceptStats(uint16_t port, AcceptStats &stats) const;
+
   // Stops listening on the specified port. This returns true if the listener
   // was found and successfully stopped. This returns false if the listener was
   // not found or was found and not successfully stopped.
@@ -53,6 +85,13 @@ class ConnectionManager final {
   // the list and was removed.
   bool remove(const std::shared_ptr<ConnectionHolder> &holder);
 
+  // Forwards data received on 'from' to 'to' until either connection is
+  // closed or unspliced. This returns false if either connection isn't
+  // connected, if they're the same connection, or if 'from' is already
+  // spliced to another connection or 'to' already has a source.
+  bool splice(const std::shared_ptr<ConnectionHolder> &from,
+              const std::shared_ptr<ConnectionHolder> &to);
+
   // Output routines
   size_t write(uint16_t port, uint8_t b);
   size_t write(uint16_t port, const uint8_t *b, size_t len);
@@ -68,13 +107,21 @@ class ConnectionManager final {
   static err_t recvFunc(void *arg, struct altcp_pcb *tpcb, struct pbuf *p,
                         err_t err);
   static err_t acceptFunc(void *arg, struct altcp_pcb *newpcb, err_t err);
+  static err_t sentFunc(void *arg, struct altcp_pcb *tpcb, u16_t len);
 
   // Adds a created connection to the list. It is expected that the object is
   // already set up.
   void addConnection(const std::shared_ptr<ConnectionHolder> &holder);
 
+  // A listening socket and the options for its accepted connections.
+  struct Listener final {
+    struct altcp_pcb *pcb;
+    SocketOptions options;
+    uint32_t accepted = 0;
+  };
+
   std::vector<std::shared_ptr<ConnectionHolder>> connections_;
-  std::vector<struct altcp_pcb *> listeners_;
+  std::vector<Listener> listeners_;
 };
 
 }  // namespace internal
@@ -0,0 +1,384 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// ConnectionState.cpp implements the connection state's output, ACK, splice,
+// and posted receive functions.
+// This file is part of the QNEthernet library.
+
+#include "ConnectionState.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <algorithm>
+#include <utility>
+
+#include "ConnectionManager.h"
+#include "lwip/err.h"
+#include "lwip/memp.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/sys.h"
+#include "lwip/tcpbase.h"
+#include "lwip/timeouts.h"
+
+namespace qindesign {
+namespace network {
+namespace internal {
+
+// Returns whether sys_timeout() can add a timeout. lwIP asserts, instead of
+// failing, when its timeout pool is empty.
+static bool isTimeoutAvailable() {
+  void *t = memp_malloc(MEMP_SYS_TIMEOUT);
+  if (t == nullptr) {
+    return false;
+  }
+  memp_free(MEMP_SYS_TIMEOUT, t);
+  return true;
+}
+
+// Called when the cork timer expires.
+static void corkTimerFunc(void *arg) {
+  ConnectionState *state = static_cast<ConnectionState *>(arg);
+  state->corkTimerRunning = false;
+  state->pushCorked();
+}
+
+bool ConnectionState::writeCorked() {
+  if (!corkBuf.empty()) {
+    size_t len = std::min(corkBuf.size(), size_t{altcp_sndbuf(pcb)});
+    if (len > 0 &&
+        altcp_write(pcb, corkBuf.data(), len, TCP_WRITE_FLAG_COPY) == ERR_OK) {
+      corkBuf.erase(corkBuf.begin(), corkBuf.begin() + len);
+    }
+    altcp_output(pcb);
+  }
+  return corkBuf.empty();
+}
+
+bool ConnectionState::pushCorked() {
+  if (sendCorked()) {
+    stopCorkTimer();
+    return true;
+  }
+  startCorkTimer();  // Try again later
+  return false;
+}
+
+bool ConnectionState::sendCorked() {
+  if (!writeCorked()) {
+    return false;
+  }
+  if (spliceFinPending) {
+    spliceFinPending = false;
+    altcp_shutdown(pcb, 0, 1);
+  }
+  return true;
+}
+
+void ConnectionState::startCorkTimer() {
+  if (corkTimerRunning) {
+    return;
+  }
+  if (!isTimeoutAvailable()) {
+    // Without a timer, nothing would send the data later, so send what fits now
+    writeCorked();
+    return;
+  }
+  // A zero timeout would be re-run by the same sys_check_timeouts() call for
+  // as long as the data doesn't fit, so use at least 1ms
+  sys_timeout(std::max(corkTimeout, uint32_t{1}), &corkTimerFunc, this);
+  corkTimerRunning = true;
+}
+
+void ConnectionState::stopCorkTimer() {
+  if (corkTimerRunning) {
+    sys_untimeout(&corkTimerFunc, this);
+    corkTimerRunning = false;
+  }
+}
+
+void ConnectionState::pushSpliced() {
+  if (spliceTo == nullptr) {
+    return;
+  }
+  altcp_pcb *out = spliceTo->pcb;
+  bool wrote = false;
+
+  // Anything the application corked on the egress connection was written
+  // before this data, so it goes first
+  if (!spliceTo->pushCorked()) {
+    return;
+  }
+
+  // Data buffered before the splice goes first
+  while (bufPos < buf.size()) {
+    size_t len = std::min(buf.size() - bufPos, size_t{altcp_sndbuf(out)});
+    if (len == 0 ||
+        altcp_write(out, &buf[bufPos], len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+      break;
+    }
+    bufPos += len;
+    wrote = true;
+  }
+
+  if (bufPos >= buf.size()) {
+    buf.clear();
+    bufPos = 0;
+
+    // Write received data straight from the pbufs, and only acknowledge it on
+    // this connection once it's in the egress send buffer
+    size_t acked = 0;
+    while (spliceQueue != nullptr) {
+      size_t len = std::min(size_t{spliceQueue->len},
+                            size_t{altcp_sndbuf(out)});
+      if (len == 0 || altcp_write(out, spliceQueue->payload, len,
+                                  TCP_WRITE_FLAG_COPY) != ERR_OK) {
+        break;
+      }
+      spliceQueue = pbuf_free_header(spliceQueue, len);
+      acked += len;
+    }
+    if (acked > 0) {
+      altcp_recved(pcb, acked);
+      wrote = true;
+    }
+  }
+
+  if (wrote) {
+    altcp_output(out);
+  }
+}
+
+void ConnectionState::finishSplice() {
+  if (spliceTo == nullptr) {
+    return;
+  }
+  pushSpliced();
+
+  // The rest waits behind any corked data on the egress connection, which
+  // outlives this one
+  auto &v = spliceTo->corkBuf;
+  v.insert(v.end(), buf.cbegin() + bufPos, buf.cend());
+  buf.clear();
+  bufPos = 0;
+  if (spliceQueue != nullptr) {
+    size_t len = spliceQueue->tot_len;
+    size_t size = v.size();
+    v.resize(size + len);
+    pbuf_copy_partial(spliceQueue, &v[size], len, 0);
+    pbuf_free(spliceQueue);
+    spliceQueue = nullptr;
+    altcp_recved(pcb, len);
+  }
+
+  spliceTo->spliceFinPending = true;
+  if (spliceTo->corked) {
+    spliceTo->pushCorked();
+  } else {
+    // Don't wait for the cork timer; what doesn't fit now is written from the
+    // egress connection's "sent" callback as its send buffer frees up
+    spliceTo->sendCorked();
+  }
+}
+
+void ConnectionState::unsplice(bool pcbValid) {
+  // Egress side
+  if (splicedFrom != nullptr) {
+    ConnectionState *from = splicedFrom;
+    splicedFrom = nullptr;
+    from->spliceTo = nullptr;
+    if (pcbValid) {
+      altcp_sent(pcb, nullptr);
+    }
+    from->drainSpliceQueue(true);
+  }
+
+  // Ingress side
+  if (spliceTo != nullptr) {
+    if (!spliceTo->spliceFinPending) {  // Still needed for any leftovers
+      altcp_sent(spliceTo->pcb, nullptr);
+    }
+    spliceTo->splicedFrom = nullptr;
+    spliceTo = nullptr;
+  }
+  drainSpliceQueue(pcbValid);
+}
+
+void ConnectionState::drainSpliceQueue(bool ack) {
+  if (spliceQueue == nullptr) {
+    return;
+  }
+  size_t len = spliceQueue->tot_len;
+  size_t size = buf.size();
+  buf.resize(size + len);
+  pbuf_copy_partial(spliceQueue, &buf[size], len, 0);
+  pbuf_free(spliceQueue);
+  spliceQueue = nullptr;
+  if (ack) {
+    altcp_recved(pcb, len);
+  }
+}
+
+// Completed posted buffers whose callbacks haven't been called yet.
+static std::deque<ConnectionState::PostedBuffer> completedPosted;
+
+// Called when no data has arrived for a partially filled posted buffer for the
+// idle timeout.
+static void postedTimerFunc(void *arg) {
+  ConnectionState *state = static_cast<ConnectionState *>(arg);
+  state->postedTimerRunning = false;
+  if (!state->posted.empty() && state->posted.front().len > 0) {
+    state->completePosted();
+  }
+}
+
+void ConnectionState::postReceive(
+    uint8_t *data, size_t size,
+    std::function<void(uint8_t *data, size_t len)> callback,
+    uint32_t idleTimeout) {
+  postedIdleTimeout = idleTimeout;
+  posted.push_back(PostedBuffer{data, size, 0, std::move(callback)});
+
+  // Data that was already buffered goes first
+  while (bufPos < buf.size() && !posted.empty()) {
+    PostedBuffer &b = posted.front();
+    size_t len = std::min(b.size - b.len, buf.size() - bufPos);
+    std::copy_n(&buf[bufPos], len, &b.data[b.len]);
+    b.len += len;
+    bufPos += len;
+    if (b.len < b.size) {
+      break;
+    }
+    completePosted();
+  }
+}
+
+size_t ConnectionState::postedSpace() const {
+  size_t space = 0;
+  for (const PostedBuffer &b : posted) {
+    space += b.size - b.len;
+  }
+  return space;
+}
+
+void ConnectionState::receivePosted(const struct pbuf *p, size_t len) {
+  size_t offset = 0;
+  while (offset < len && !posted.empty()) {
+    PostedBuffer &b = posted.front();
+    size_t n = std::min(b.size - b.len, len - offset);
+    pbuf_copy_partial(p, &b.data[b.len], n, offset);
+    b.len += n;
+    offset += n;
+    if (b.len >= b.size) {
+      completePosted();
+    }
+  }
+
+  if (posted.empty() || posted.front().len == 0) {
+    return;
+  }
+  if ((p->flags & PBUF_FLAG_PUSH) != 0) {
+    completePosted();
+  } else if (postedIdleTimeout > 0) {
+    // Restart the idle timer
+    if (postedTimerRunning) {
+      sys_untimeout(&postedTimerFunc, this);
+      postedTimerRunning = false;
+    }
+    if (!isTimeoutAvailable()) {
+      // Without a timer, the buffer could wait forever, so complete it now
+      completePosted();
+      return;
+    }
+    sys_timeout(postedIdleTimeout, &postedTimerFunc, this);
+    postedTimerRunning = true;
+  }
+}
+
+void ConnectionState::completePosted() {
+  if (postedTimerRunning) {
+    sys_untimeout(&postedTimerFunc, this);
+    postedTimerRunning = false;
+  }
+  if (posted.empty()) {
+    return;
+  }
+  completedPosted.push_back(std::move(posted.front()));
+  posted.pop_front();
+}
+
+void ConnectionState::completeAllPosted() {
+  if (postedTimerRunning) {
+    sys_untimeout(&postedTimerFunc, this);
+    postedTimerRunning = false;
+  }
+
+  for (PostedBuffer &b : posted) {
+    completedPosted.push_back(std::move(b));
+  }
+  posted.clear();
+}
+
+void ConnectionState::callCompletedPosted() {
+  // A callback may call Ethernet.loop(), which calls this
+  static bool busy = false;
+  if (busy) {
+    return;
+  }
+  busy = true;
+  while (!completedPosted.empty()) {
+    PostedBuffer b = std::move(completedPosted.front());
+    completedPosted.pop_front();
+    if (b.callback != nullptr) {
+      b.callback(b.data, b.len);
+    }
+  }
+  busy = false;
+}
+
+void ConnectionState::setAckPolicy(AckPolicy policy, uint16_t quickCount,
+                                   uint32_t quickIdle) {
+  ackPolicy     = policy;
+  quickAckCount = quickCount;
+  quickAckIdle  = quickIdle;
+  quickAcksLeft = quickCount;
+  lastRecvTime  = sys_now();
+}
+
+void ConnectionState::ackReceived() {
+  bool ackNow = false;
+  switch (ackPolicy) {
+    case AckPolicy::kImmediate:
+      ackNow = true;
+      break;
+    case AckPolicy::kQuick: {
+      uint32_t t = sys_now();
+      if (t - lastRecvTime >= quickAckIdle) {
+        quickAcksLeft = quickAckCount;
+      }
+      lastRecvTime = t;
+      if (quickAcksLeft > 0) {
+        quickAcksLeft--;
+        ackNow = true;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  // lwIP sends the ACK when it calls tcp_output() after the receive callback
+  if (ackNow) {
+    tcp_pcb *tpcb = innermostTCPPCB(pcb);
+    if (tpcb != nullptr) {
+      tcp_ack_now(tpcb);
+    }
+  }
+}
+
+}  // namespace internal
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
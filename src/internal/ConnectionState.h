@@ -11,9 +11,11 @@
 #if LWIP_TCP
 
 // C++ includes
+#include <deque>
 #include <functional>
 #include <vector>
 
+#include "SocketOptions.h"
 #include "lwip/altcp.h"
 
 namespace qindesign {
@@ -32,6 +34,10 @@ struct ConnectionState final {
   // Sets the callback arg to nullptr and then calls the 'remove' function. The
   // object should be deleted before more 'tcp' functions are called.
   ~ConnectionState() {
+    stopCorkTimer();
+    unsplice(false);
+    completeAllPosted();
+
     // Ensure callbacks are no longer called with this as the argument
     altcp_arg(pcb, nullptr);
 
@@ -48,6 +54,119 @@ struct ConnectionState final {
 
   // Called from the destructor after the callback arg is deleted.
   std::function<void(ConnectionState *)> removeFunc = nullptr;
+
+  // Writes as much corked data as fits in the send buffer and then outputs it.
+  // If some data remains then the cork timer is started so that it's tried
+  // again later. Once it's all written, the sending side is shut down if
+  // 'spliceFinPending' is set. This doesn't move the stack along. This returns
+  // whether all the corked data was written.
+  bool pushCorked();
+
+  // Like pushCorked(), but doesn't start or stop the cork timer. This is used
+  // for data left over from a splice when this connection isn't corked.
+  bool sendCorked();
+
+  // Writes as much corked data as fits in the send buffer and then outputs it.
+  // This returns whether all the corked data was written.
+  bool writeCorked();
+
+  // Starts the cork timer if it isn't already running. If no timer is
+  // available then as much corked data as fits is written instead.
+  void startCorkTimer();
+
+  // Stops the cork timer if it's running.
+  void stopCorkTimer();
+
+  // Sets the ACK policy and restarts any quick ACKs.
+  void setAckPolicy(AckPolicy policy, uint16_t quickCount, uint32_t quickIdle);
+
+  // Applies the ACK policy to newly-received data.
+  void ackReceived();
+
+  // ACK policy
+  AckPolicy ackPolicy = AckPolicy::kDelayed;
+  uint16_t quickAckCount = 0;
+  uint32_t quickAckIdle = 0;  // In milliseconds
+  uint16_t quickAcksLeft = 0;
+  uint32_t lastRecvTime = 0;
+
+  // Corked output, held until there's a full segment, the cork is removed, or
+  // the cork timer expires
+  bool corked = false;
+  uint32_t corkTimeout = 0;  // In milliseconds
+  bool corkTimerRunning = false;
+  std::vector<uint8_t> corkBuf;
+
+  // Set when a connection spliced into this one has closed; its last data is
+  // in 'corkBuf' and the sending side is shut down after that's written
+  bool spliceFinPending = false;
+
+  // Writes as much buffered and received data as fits into the egress
+  // connection's send buffer, acknowledges it on this connection, and then
+  // outputs it. This does nothing if this connection isn't spliced.
+  void pushSpliced();
+
+  // Called when this connection receives a FIN while spliced. This forwards
+  // everything received, moving what doesn't fit yet into the egress
+  // connection's cork buffer, and half-closes the egress connection after it.
+  // The splice itself is ended by unsplice().
+  void finishSplice();
+
+  // Ends any splice this connection is a part of, in either direction. Any
+  // received data that wasn't forwarded is moved into the receive buffer. The
+  // 'pcbValid' parameter indicates whether this connection's pcb can still
+  // be used.
+  void unsplice(bool pcbValid);
+
+  // Moves any received data that wasn't forwarded into the receive buffer. If
+  // 'ack' is true then the data is also acknowledged.
+  void drainSpliceQueue(bool ack);
+
+  // An application buffer that received data is copied into directly.
+  struct PostedBuffer final {
+    uint8_t *data;
+    size_t size;
+    size_t len;  // How much has been filled
+    std::function<void(uint8_t *data, size_t len)> callback;
+  };
+
+  // Adds a posted receive buffer and fills it with any data that's already
+  // been buffered.
+  void postReceive(uint8_t *data, size_t size,
+                   std::function<void(uint8_t *data, size_t len)> callback,
+                   uint32_t idleTimeout);
+
+  // Returns the amount of free space in all the posted buffers.
+  size_t postedSpace() const;
+
+  // Copies 'len' bytes from the start of the pbuf into the posted buffers,
+  // completing each one that fills. If the pbuf ends a push then a partially
+  // filled buffer is also completed. This assumes there's enough space.
+  void receivePosted(const struct pbuf *p, size_t len);
+
+  // Removes the first posted buffer and queues its callback. The callbacks are
+  // called later by callCompletedPosted() so that they never run inside an
+  // lwIP callback or a destructor.
+  void completePosted();
+
+  // Completes all posted buffers, for example, when the connection closes.
+  void completeAllPosted();
+
+  // Calls the callbacks of all completed posted buffers, in order. This is
+  // called from Ethernet.loop() and does nothing if it's already running.
+  static void callCompletedPosted();
+
+  // Posted receive buffers, and the idle timer for completing a partially
+  // filled buffer
+  std::deque<PostedBuffer> posted;
+  uint32_t postedIdleTimeout = 0;  // In milliseconds; zero to disable
+  bool postedTimerRunning = false;
+
+  // Splicing: data received on this connection is forwarded to 'spliceTo'
+  // instead of being buffered, and 'splicedFrom' is the reverse link
+  ConnectionState *spliceTo = nullptr;
+  ConnectionState *splicedFrom = nullptr;
+  struct pbuf *spliceQueue = nullptr;  // Received and not yet forwarded
 };
 
 }  // namespace internal
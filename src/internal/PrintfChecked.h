@@ -6,21 +6,26 @@
 // platforms, which is why this is defined here.
 //
 // To use this class:
-// 1. Derive from PrintfChecked in addition to Print, and
-// 2. Put `using qindesign::network::internal::PrintfChecked::printf;` in the
-//    public area of your class.
+// 1. Derive from PrintfChecked<YourClass> in addition to Print, and
+// 2. Put `using internal::PrintfChecked<YourClass>::printf;` in the public area
+//    of your class.
 //
 // This file is part of the QNEthernet library.
 
 #pragma once
 
 #include <cstdarg>
-#include <cstdio>
+
+#include "util/PrintUtils.h"
 
 namespace qindesign {
 namespace network {
 namespace internal {
 
+// The template parameter is the derived class, which must also derive from
+// Print. Output is formatted with util::vformat() straight into the derived
+// class's write() function instead of going through stdio.
+template <typename T>
 class PrintfChecked {
  public:
   // Define a format-checked printf.
@@ -28,7 +33,7 @@ class PrintfChecked {
   int printf(const char *format, ...) {
     std::va_list args;
     va_start(args, format);
-    int retval = vdprintf(reinterpret_cast<int>(this), format, args);
+    int retval = util::vformat(*static_cast<T *>(this), format, args);
     va_end(args);
     return retval;
   }
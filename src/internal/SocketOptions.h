@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// SocketOptions.h defines default TCP socket options for listeners and new
+// connections.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP
+
+// C++ includes
+#include <cstdint>
+
+#if LWIP_TCP_KEEPALIVE
+#include "lwip/priv/tcp_priv.h"
+#endif  // LWIP_TCP_KEEPALIVE
+
+namespace qindesign {
+namespace network {
+
+// Policies for acknowledging received TCP data.
+enum class AckPolicy {
+  kDelayed,    // lwIP's default: every second full segment or the fast timer
+  kImmediate,  // Acknowledge every segment immediately
+  kQuick,      // Immediately for the first segments and after an idle period
+};
+
+// TCP congestion control algorithms. See the lwIP 'struct tcp_cc' instances.
+enum class CongestionControl {
+  kDefault,   // LWIP_TCP_CC_DEFAULT, NewReno unless configured otherwise
+  kNewReno,   // NewReno with the RFC 3390 initial window of about 3 segments
+  kLAN,       // NewReno with a 10-segment initial window (RFC 6928)
+  kLANDelay,  // kLAN, but backs off when queueing delay builds
+};
+
+// Connection statistics for a listening socket.
+struct AcceptStats final {
+  uint8_t backlog = 0;           // Maximum number of half-open connections
+  uint8_t pending = 0;           // Current number of half-open connections
+  uint32_t accepted = 0;         // Connections passed to the server
+  uint32_t dropped = 0;          // SYNs dropped for a full backlog or no PCB
+  uint32_t cookiesSent = 0;      // SYNs answered with a SYN cookie
+  uint32_t cookiesAccepted = 0;  // Connections made from a SYN cookie
+  uint32_t fastOpenAccepted = 0;  // Connections whose SYN data was accepted
+};
+
+namespace internal {
+
+// Default number of quick ACKs for AckPolicy::kQuick.
+static constexpr uint16_t kDefaultQuickAckCount = 16;
+
+// Default idle time, in milliseconds, after which AckPolicy::kQuick sends
+// quick ACKs again.
+static constexpr uint32_t kDefaultQuickAckIdle = 1000;
+
+// SocketOptions holds the options a listener applies to each accepted
+// connection before the application sees it.
+struct SocketOptions final {
+  bool noDelay = false;    // TCP_NODELAY
+  uint8_t diffServ = 0;    // The DiffServ field in the outgoing IP header
+  bool keepAlive = false;  // SO_KEEPALIVE
+  bool fastOpen = false;   // TCP_FASTOPEN; this applies to the listener itself
+
+  // How received data is acknowledged
+  AckPolicy ackPolicy = AckPolicy::kDelayed;
+  uint16_t quickAckCount = kDefaultQuickAckCount;
+  uint32_t quickAckIdle = kDefaultQuickAckIdle;  // In milliseconds
+
+  // Congestion control, inherited from the listener when the SYN arrives
+  CongestionControl congestionControl = CongestionControl::kDefault;
+
+  // Maximum half-open connections; this applies to the listener itself
+  uint8_t backlog = TCP_DEFAULT_LISTEN_BACKLOG;
+
+#if LWIP_TCP_KEEPALIVE
+  // Keep-alive parameters, in milliseconds for the times
+  uint32_t keepIdle  = TCP_KEEPIDLE_DEFAULT;
+  uint32_t keepIntvl = TCP_KEEPINTVL_DEFAULT;
+  uint32_t keepCount = TCP_KEEPCNT_DEFAULT;
+#endif  // LWIP_TCP_KEEPALIVE
+};
+
+}  // namespace internal
+}  // namespace network
+}  // namespace qindesign
+
+#endif  // LWIP_TCP
@@ -1328,6 +1328,39 @@
 #define LWIP_TCP_SACK_OUT               0
 #endif
 
+/**
+ * LWIP_TCP_SACK_IN==1: TCP will use the selective acknowledgements (SACKs) it
+ * receives for loss recovery (RFC 6675). Segments the remote host has SACKed
+ * are kept on a scoreboard and not retransmitted, several holes can be
+ * repaired in one round trip, and an estimate of the data in flight takes the
+ * place of congestion window inflation during recovery.
+ * Requires LWIP_TCP_SACK_OUT, which negotiates SACK with the remote host.
+ */
+#if !defined LWIP_TCP_SACK_IN || defined __DOXYGEN__
+#define LWIP_TCP_SACK_IN                0
+#endif
+
+/**
+ * LWIP_TCP_CC_DEFAULT: The congestion control algorithm new TCP pcbs use,
+ * one of the 'struct tcp_cc' instances declared in tcp.h. It can be changed
+ * per pcb with tcp_set_cc(); connections accepted by a listener use the
+ * listener's algorithm.
+ * - tcp_cc_newreno: NewReno with the RFC 3390 initial window (default)
+ * - tcp_cc_lan: NewReno with a ten-segment initial window (RFC 6928)
+ * - tcp_cc_lan_delay: tcp_cc_lan plus a back-off when the RTT rises
+ */
+#if !defined LWIP_TCP_CC_DEFAULT || defined __DOXYGEN__
+#define LWIP_TCP_CC_DEFAULT             tcp_cc_newreno
+#endif
+
+/**
+ * LWIP_TCP_CC_DELAY_TARGET: For tcp_cc_lan_delay, the queueing delay, in
+ * milliseconds above the smallest RTT seen, that counts as congestion.
+ */
+#if !defined LWIP_TCP_CC_DELAY_TARGET || defined __DOXYGEN__
+#define LWIP_TCP_CC_DELAY_TARGET        5
+#endif
+
 /**
  * LWIP_TCP_MAX_SACK_NUM: The maximum number of SACK values to include in TCP segments.
  * Must be at least 1, but is only used if LWIP_TCP_SACK_OUT is enabled.
@@ -1471,6 +1504,35 @@
 #define TCP_DEFAULT_LISTEN_BACKLOG      0xff
 #endif
 
+/**
+ * TCP_SYN_COOKIES==1: Answer a SYN with a SYN cookie (RFC 4987) instead of
+ * dropping it when the listen backlog is full or no PCB can be allocated.
+ * The connection is created when an ACK carrying a valid cookie arrives.
+ * Only the MSS option is kept for such connections, coarsely encoded.
+ */
+#if !defined TCP_SYN_COOKIES || defined __DOXYGEN__
+#define TCP_SYN_COOKIES                 0
+#endif
+
+/**
+ * LWIP_TCP_FASTOPEN==1: Support TCP Fast Open (RFC 7413). A connection marked
+ * with tcp_fastopen() carries its first data in the SYN once the server has
+ * given it a cookie, and a listener marked with tcp_listen_fastopen() hands
+ * data that arrives with a valid cookie to the application before the
+ * handshake completes. Cookies are 8 bytes.
+ */
+#if !defined LWIP_TCP_FASTOPEN || defined __DOXYGEN__
+#define LWIP_TCP_FASTOPEN               0
+#endif
+
+/**
+ * LWIP_TCP_FASTOPEN_CACHE_SIZE: The number of servers whose Fast Open cookies
+ * a client remembers. The oldest entry is replaced when the cache is full.
+ */
+#if !defined LWIP_TCP_FASTOPEN_CACHE_SIZE || defined __DOXYGEN__
+#define LWIP_TCP_FASTOPEN_CACHE_SIZE    4
+#endif
+
 /**
  * TCP_OVERSIZE: The maximum number of bytes that tcp_write may
  * allocate ahead of time in an attempt to create shorter pbuf chains
@@ -55,6 +55,11 @@
 extern "C" {
 #endif
 
+/** Initial CWND calculation as defined RFC 2581 */
+#ifndef LWIP_TCP_CALC_INITIAL_CWND
+#define LWIP_TCP_CALC_INITIAL_CWND(mss) ((tcpwnd_size_t)LWIP_MIN((4U * (mss)), LWIP_MAX((2U * (mss)), 4380U)))
+#endif
+
 /* Functions for interfacing with TCP: */
 
 /* Lower layer interface to TCP: */
@@ -85,6 +90,9 @@ err_t            tcp_rexmit_rto_prepare(struct tcp_pcb *pcb);
 void             tcp_rexmit_rto_commit(struct tcp_pcb *pcb);
 void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
 void             tcp_rexmit_fast (struct tcp_pcb *pcb);
+#if LWIP_TCP_SACK_IN
+void             tcp_sack_rexmit_fast(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK_IN */
 u32_t            tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb);
 err_t            tcp_process_refused_data(struct tcp_pcb *pcb);
 
@@ -126,7 +134,9 @@ err_t            tcp_process_refused_data(struct tcp_pcb *pcb);
 #endif /* TCP_SLOW_INTERVAL */
 
 #define TCP_FIN_WAIT_TIMEOUT 20000 /* milliseconds */
+#ifndef TCP_SYN_RCVD_TIMEOUT
 #define TCP_SYN_RCVD_TIMEOUT 20000 /* milliseconds */
+#endif
 
 #define TCP_OOSEQ_TIMEOUT        6U /* x RTO */
 
@@ -267,6 +277,10 @@ struct tcp_seg {
                                                checksummed into 'chksum' */
 #define TF_SEG_OPTS_WND_SCALE   (u8_t)0x08U /* Include WND SCALE option (only used in SYN segments) */
 #define TF_SEG_OPTS_SACK_PERM   (u8_t)0x10U /* Include SACK Permitted option (only used in SYN segments) */
+#define TF_SEG_OPTS_FASTOPEN    (u8_t)0x20U /* Include a Fast Open cookie (only used in SYN segments) */
+#define TF_SEG_OPTS_FASTOPEN_REQ (u8_t)0x40U /* Include a Fast Open cookie request (only used in SYN segments) */
+#define TF_SEG_SACKED           (u8_t)0x80U /* The remote host has SACKed this
+                                               segment (only used in unacked) */
   struct tcp_hdr *tcphdr;  /* the TCP header */
 };
 
@@ -275,7 +289,9 @@ struct tcp_seg {
 #define LWIP_TCP_OPT_MSS        2
 #define LWIP_TCP_OPT_WS         3
 #define LWIP_TCP_OPT_SACK_PERM  4
+#define LWIP_TCP_OPT_SACK       5
 #define LWIP_TCP_OPT_TS         8
+#define LWIP_TCP_OPT_FASTOPEN   34
 
 #define LWIP_TCP_OPT_LEN_MSS    4
 #if LWIP_TCP_TIMESTAMPS
@@ -298,11 +314,23 @@ struct tcp_seg {
 #define LWIP_TCP_OPT_LEN_SACK_PERM_OUT 0
 #endif
 
+#if LWIP_TCP_FASTOPEN
+#define LWIP_TCP_OPT_LEN_FASTOPEN_REQ     2
+#define LWIP_TCP_OPT_LEN_FASTOPEN         (LWIP_TCP_OPT_LEN_FASTOPEN_REQ + TCP_FASTOPEN_COOKIE_LEN)
+#define LWIP_TCP_OPT_LEN_FASTOPEN_REQ_OUT 4 /* aligned for output (includes NOP padding) */
+#define LWIP_TCP_OPT_LEN_FASTOPEN_OUT     (LWIP_TCP_OPT_LEN_FASTOPEN + 2) /* aligned for output (includes NOP padding) */
+#else
+#define LWIP_TCP_OPT_LEN_FASTOPEN_REQ_OUT 0
+#define LWIP_TCP_OPT_LEN_FASTOPEN_OUT     0
+#endif
+
 #define LWIP_TCP_OPT_LENGTH(flags) \
   ((flags) & TF_SEG_OPTS_MSS       ? LWIP_TCP_OPT_LEN_MSS           : 0) + \
   ((flags) & TF_SEG_OPTS_TS        ? LWIP_TCP_OPT_LEN_TS_OUT        : 0) + \
   ((flags) & TF_SEG_OPTS_WND_SCALE ? LWIP_TCP_OPT_LEN_WS_OUT        : 0) + \
-  ((flags) & TF_SEG_OPTS_SACK_PERM ? LWIP_TCP_OPT_LEN_SACK_PERM_OUT : 0)
+  ((flags) & TF_SEG_OPTS_SACK_PERM ? LWIP_TCP_OPT_LEN_SACK_PERM_OUT : 0) + \
+  ((flags) & TF_SEG_OPTS_FASTOPEN  ? LWIP_TCP_OPT_LEN_FASTOPEN_OUT  : 0) + \
+  ((flags) & TF_SEG_OPTS_FASTOPEN_REQ ? LWIP_TCP_OPT_LEN_FASTOPEN_REQ_OUT : 0)
 
 /** This returns a TCP header option for MSS in an u32_t */
 #define TCP_BUILD_MSS_OPTION(mss) lwip_htonl(0x02040000 | ((mss) & 0xFFFF))
@@ -467,6 +495,17 @@ void tcp_rst(const struct tcp_pcb* pcb, u32_t seqno, u32_t ackno,
 void tcp_rst_netif(struct netif *netif, u32_t seqno, u32_t ackno,
                    const ip_addr_t *local_ip, const ip_addr_t *remote_ip,
                    u16_t local_port, u16_t remote_port);
+#if TCP_SYN_COOKIES
+void tcp_syncookie_synack_netif(struct netif *netif, u32_t seqno, u32_t ackno,
+                                const ip_addr_t *local_ip, const ip_addr_t *remote_ip,
+                                u16_t local_port, u16_t remote_port);
+#endif /* TCP_SYN_COOKIES */
+#if LWIP_TCP_FASTOPEN
+void tcp_fastopen_cookie_calc(const ip_addr_t *addr, u8_t *cookie);
+u8_t tcp_fastopen_cache_get(const ip_addr_t *addr, u8_t *cookie);
+void tcp_fastopen_cache_set(const ip_addr_t *addr, const u8_t *cookie);
+void tcp_fastopen_cache_remove(const ip_addr_t *addr);
+#endif /* LWIP_TCP_FASTOPEN */
 
 u32_t tcp_next_iss(struct tcp_pcb *pcb);
 
@@ -889,6 +889,7 @@ tcp_listen_with_backlog_and_err(struct tcp_pcb *pcb, u8_t backlog, err_t *err)
   lpcb->local_port = pcb->local_port;
   lpcb->state = LISTEN;
   lpcb->prio = pcb->prio;
+  lpcb->cc = pcb->cc;
   lpcb->so_options = pcb->so_options;
   lpcb->netif_idx = pcb->netif_idx;
   lpcb->ttl = pcb->ttl;
@@ -915,6 +916,15 @@ tcp_listen_with_backlog_and_err(struct tcp_pcb *pcb, u8_t backlog, err_t *err)
   lpcb->accepts_pending = 0;
   tcp_backlog_set(lpcb, backlog);
 #endif /* TCP_LISTEN_BACKLOG */
+  lpcb->syns_dropped = 0;
+#if TCP_SYN_COOKIES
+  lpcb->syn_cookies_sent = 0;
+  lpcb->syn_cookies_accepted = 0;
+#endif /* TCP_SYN_COOKIES */
+#if LWIP_TCP_FASTOPEN
+  lpcb->fastopen = 0;
+  lpcb->fastopen_accepted = 0;
+#endif /* LWIP_TCP_FASTOPEN */
   TCP_REG(&tcp_listen_pcbs.pcbs, (struct tcp_pcb *)lpcb);
   res = ERR_OK;
 done:
@@ -1180,11 +1190,119 @@ tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port,
     TCP_REG_ACTIVE(pcb);
     MIB2_STATS_INC(mib2.tcpactiveopens);
 
-    tcp_output(pcb);
+#if LWIP_TCP_FASTOPEN
+    /* The caller queues the data to send with the SYN and then calls
+       tcp_output() */
+    if (!(pcb->flags & TF_FASTOPEN))
+#endif /* LWIP_TCP_FASTOPEN */
+    {
+      tcp_output(pcb);
+    }
   }
   return ret;
 }
 
+#if LWIP_TCP_FASTOPEN
+/** One server's Fast Open cookie */
+struct tcp_fastopen_cache_entry {
+  ip_addr_t addr;
+  u8_t cookie[TCP_FASTOPEN_COOKIE_LEN];
+  u8_t valid;
+};
+
+static struct tcp_fastopen_cache_entry tcp_fastopen_cache[LWIP_TCP_FASTOPEN_CACHE_SIZE];
+static u8_t tcp_fastopen_cache_next;
+
+/**
+ * @ingroup tcp_raw
+ * Marks a pcb to use TCP Fast Open (RFC 7413) when it connects. This must be
+ * called before tcp_connect().
+ *
+ * tcp_connect() then doesn't send the SYN. Instead, the caller queues the
+ * first data with tcp_write() and calls tcp_output(). If a cookie from an
+ * earlier connection to the same server is known, that data is sent with the
+ * SYN, otherwise the SYN asks the server for a cookie and the data follows the
+ * handshake as usual.
+ *
+ * @param pcb the tcp_pcb to mark
+ */
+void
+tcp_fastopen(struct tcp_pcb *pcb)
+{
+  LWIP_ASSERT_CORE_LOCKED();
+
+  LWIP_ERROR("tcp_fastopen: invalid pcb", pcb != NULL, return);
+  LWIP_ERROR("tcp_fastopen: can only be set in state CLOSED", pcb->state == CLOSED, return);
+
+  tcp_set_flags(pcb, TF_FASTOPEN);
+}
+
+/**
+ * Finds the cookie for a server.
+ *
+ * @param addr the server's address
+ * @param cookie where to store the cookie, TCP_FASTOPEN_COOKIE_LEN bytes
+ * @return 1 if a cookie was found and 0 otherwise
+ */
+u8_t
+tcp_fastopen_cache_get(const ip_addr_t *addr, u8_t *cookie)
+{
+  u8_t i;
+
+  for (i = 0; i < LWIP_TCP_FASTOPEN_CACHE_SIZE; i++) {
+    if (tcp_fastopen_cache[i].valid && ip_addr_eq(&tcp_fastopen_cache[i].addr, addr)) {
+      MEMCPY(cookie, tcp_fastopen_cache[i].cookie, TCP_FASTOPEN_COOKIE_LEN);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Stores the cookie for a server, replacing any previous one. If the cache is
+ * full, the oldest entry is replaced.
+ *
+ * @param addr the server's address
+ * @param cookie the cookie, TCP_FASTOPEN_COOKIE_LEN bytes
+ */
+void
+tcp_fastopen_cache_set(const ip_addr_t *addr, const u8_t *cookie)
+{
+  u8_t i;
+
+  for (i = 0; i < LWIP_TCP_FASTOPEN_CACHE_SIZE; i++) {
+    if (tcp_fastopen_cache[i].valid && ip_addr_eq(&tcp_fastopen_cache[i].addr, addr)) {
+      break;
+    }
+  }
+  if (i == LWIP_TCP_FASTOPEN_CACHE_SIZE) {
+    i = tcp_fastopen_cache_next;
+    tcp_fastopen_cache_next = (u8_t)((i + 1) % LWIP_TCP_FASTOPEN_CACHE_SIZE);
+  }
+  ip_addr_copy(tcp_fastopen_cache[i].addr, *addr);
+  MEMCPY(tcp_fastopen_cache[i].cookie, cookie, TCP_FASTOPEN_COOKIE_LEN);
+  tcp_fastopen_cache[i].valid = 1;
+}
+
+/**
+ * Forgets the cookie for a server. This is used when a SYN with data goes
+ * unanswered, in case something on the path drops such SYNs.
+ *
+ * @param addr the server's address
+ */
+void
+tcp_fastopen_cache_remove(const ip_addr_t *addr)
+{
+  u8_t i;
+
+  for (i = 0; i < LWIP_TCP_FASTOPEN_CACHE_SIZE; i++) {
+    if (tcp_fastopen_cache[i].valid && ip_addr_eq(&tcp_fastopen_cache[i].addr, addr)) {
+      tcp_fastopen_cache[i].valid = 0;
+    }
+  }
+}
+#endif /* LWIP_TCP_FASTOPEN */
+
 /**
  * Called every 500 ms and implements the retransmission timer and the timer that
  * removes PCBs that have been in TIME-WAIT for enough time. It also increments
@@ -1196,7 +1314,6 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *prev;
-  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
@@ -1296,13 +1413,16 @@ tcp_slowtmr_start:
             /* Reset the retransmission timer. */
             pcb->rtime = 0;
 
-            /* Reduce congestion window and ssthresh. */
-            eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
-            pcb->ssthresh = eff_wnd >> 1;
-            if (pcb->ssthresh < (tcpwnd_size_t)(pcb->mss << 1)) {
-              pcb->ssthresh = (tcpwnd_size_t)(pcb->mss << 1);
+#if LWIP_TCP_FASTOPEN
+            if ((pcb->state == SYN_SENT) && (pcb->flags & TF_FASTOPEN_DATA)) {
+              /* The retransmitted SYN doesn't carry the data */
+              tcp_clear_flags(pcb, TF_FASTOPEN_DATA);
+              tcp_fastopen_cache_remove(&pcb->remote_ip);
             }
-            pcb->cwnd = pcb->mss;
+#endif /* LWIP_TCP_FASTOPEN */
+
+            /* Reduce congestion window and ssthresh. */
+            pcb->cc->rto(pcb);
             LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
                                          " ssthresh %"TCPWNDSIZE_F"\n",
                                          pcb->cwnd, pcb->ssthresh));
@@ -1654,6 +1774,154 @@ tcp_setprio(struct tcp_pcb *pcb, u8_t prio)
   pcb->prio = prio;
 }
 
+/**
+ * @ingroup tcp_raw
+ * Sets the congestion control algorithm of a connection. A listening pcb
+ * passes its algorithm on to the connections it accepts.
+ *
+ * @param pcb the tcp_pcb to manipulate
+ * @param cc the algorithm, or NULL for LWIP_TCP_CC_DEFAULT
+ */
+void
+tcp_set_cc(struct tcp_pcb *pcb, const struct tcp_cc *cc)
+{
+  LWIP_ASSERT_CORE_LOCKED();
+
+  LWIP_ERROR("tcp_set_cc: invalid pcb", pcb != NULL, return);
+
+  if (cc == NULL) {
+    cc = &LWIP_TCP_CC_DEFAULT;
+  }
+  if (pcb->cc != cc) {
+    pcb->cc = cc;
+    if (pcb->state != LISTEN) {
+      pcb->cc_state = 0;
+    }
+  }
+}
+
+/* NewReno (RFC 5681, RFC 6582), with Appropriate Byte Counting (RFC 3465) */
+
+static tcpwnd_size_t
+tcp_cc_newreno_initial_cwnd(struct tcp_pcb *pcb)
+{
+  pcb->cc_state = 0;
+  return LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+}
+
+static void
+tcp_cc_newreno_ack(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  if (pcb->cwnd < pcb->ssthresh) {
+    tcpwnd_size_t increase;
+    /* limit to 1 SMSS segment during period following RTO */
+    u8_t num_seg = (pcb->flags & TF_RTO) ? 1 : 2;
+    /* RFC 3465, section 2.2 Slow Start */
+    increase = LWIP_MIN(acked, (tcpwnd_size_t)(num_seg * pcb->mss));
+    TCP_WND_INC(pcb->cwnd, increase);
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+  } else {
+    /* RFC 3465, section 2.1 Congestion Avoidance */
+    TCP_WND_INC(pcb->bytes_acked, acked);
+    if (pcb->bytes_acked >= pcb->cwnd) {
+      pcb->bytes_acked = (tcpwnd_size_t)(pcb->bytes_acked - pcb->cwnd);
+      TCP_WND_INC(pcb->cwnd, pcb->mss);
+    }
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+  }
+}
+
+static void
+tcp_cc_newreno_loss(struct tcp_pcb *pcb)
+{
+  /* Set ssthresh to half of the minimum of the current
+   * cwnd and the advertised window */
+  pcb->ssthresh = LWIP_MIN(pcb->cwnd, pcb->snd_wnd) / 2;
+
+  /* The minimum value for ssthresh should be 2 MSS */
+  if (pcb->ssthresh < (2U * pcb->mss)) {
+    LWIP_DEBUGF(TCP_FR_DEBUG,
+                ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F
+                 " should be min 2 mss %"U16_F"...\n",
+                 pcb->ssthresh, (u16_t)(2 * pcb->mss)));
+    pcb->ssthresh = 2 * pcb->mss;
+  }
+}
+
+static void
+tcp_cc_newreno_rto(struct tcp_pcb *pcb)
+{
+  tcp_cc_newreno_loss(pcb);
+  pcb->cwnd = pcb->mss;
+}
+
+const struct tcp_cc tcp_cc_newreno = {
+  tcp_cc_newreno_initial_cwnd,
+  tcp_cc_newreno_ack,
+  tcp_cc_newreno_loss,
+  tcp_cc_newreno_rto,
+  NULL
+};
+
+/* The LAN profile: a path with a sub-millisecond RTT and no queue to speak of
+   is better served by an initial window of ten segments (RFC 6928), which
+   sends most short responses in one round trip. */
+
+static tcpwnd_size_t
+tcp_cc_lan_initial_cwnd(struct tcp_pcb *pcb)
+{
+  pcb->cc_state = 0;
+  return (tcpwnd_size_t)LWIP_MIN(10U * pcb->mss, LWIP_MAX(2U * pcb->mss, 14600U));
+}
+
+const struct tcp_cc tcp_cc_lan = {
+  tcp_cc_lan_initial_cwnd,
+  tcp_cc_newreno_ack,
+  tcp_cc_newreno_loss,
+  tcp_cc_newreno_rto,
+  NULL
+};
+
+/* The LAN profile with a delay signal: cc_state holds one more than the
+   smallest RTT seen, in milliseconds, or zero before the first sample. Once
+   the RTT rises LWIP_TCP_CC_DELAY_TARGET above that, a queue is building, so
+   slow start ends or, in congestion avoidance, cwnd shrinks by an eighth.
+   There's one sample per round trip, so this reacts at most once per RTT. */
+
+static void
+tcp_cc_lan_delay_rtt(struct tcp_pcb *pcb, u32_t rtt_ms)
+{
+  u32_t base;
+
+  if ((pcb->cc_state == 0) || (rtt_ms < pcb->cc_state - 1)) {
+    pcb->cc_state = rtt_ms + 1;
+  }
+  base = pcb->cc_state - 1;
+  if (rtt_ms - base <= LWIP_TCP_CC_DELAY_TARGET) {
+    return;
+  }
+
+  if (pcb->cwnd < pcb->ssthresh) {
+    pcb->ssthresh = LWIP_MAX(pcb->cwnd, (tcpwnd_size_t)(2U * pcb->mss));
+  } else {
+    tcpwnd_size_t cwnd = (tcpwnd_size_t)(pcb->cwnd - (pcb->cwnd >> 3));
+    pcb->cwnd = LWIP_MAX(cwnd, (tcpwnd_size_t)(2U * pcb->mss));
+    pcb->ssthresh = pcb->cwnd;
+    pcb->bytes_acked = 0;
+  }
+  LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_cc_lan_delay_rtt: rtt %"U32_F" base %"U32_F
+                               " cwnd %"TCPWNDSIZE_F" ssthresh %"TCPWNDSIZE_F"\n",
+                               rtt_ms, base, pcb->cwnd, pcb->ssthresh));
+}
+
+const struct tcp_cc tcp_cc_lan_delay = {
+  tcp_cc_lan_initial_cwnd,
+  tcp_cc_newreno_ack,
+  tcp_cc_newreno_loss,
+  tcp_cc_newreno_rto,
+  tcp_cc_lan_delay_rtt
+};
+
 #if TCP_QUEUE_OOSEQ
 /**
  * Returns a copy of the given TCP segment.
@@ -1917,6 +2185,7 @@ tcp_alloc(u8_t prio)
     connection is established. To avoid these complications, we set ssthresh to the
     largest effective cwnd (amount of in-flight data) that the sender can have. */
     pcb->ssthresh = TCP_SND_BUF;
+    pcb->cc = &LWIP_TCP_CC_DEFAULT;
 
 #if LWIP_CALLBACK_API
     pcb->recv = tcp_recv_null;
@@ -206,6 +206,13 @@ struct tcp_pcb_ext_args {
 typedef u16_t tcpflags_t;
 #define TCP_ALLFLAGS 0xffffU
 
+#if LWIP_TCP_FASTOPEN
+/** Length of the Fast Open cookies this stack makes and remembers */
+#define TCP_FASTOPEN_COOKIE_LEN 8
+#endif /* LWIP_TCP_FASTOPEN */
+
+struct tcp_cc;
+
 /**
  * members common to struct tcp_pcb and struct tcp_listen_pcb
  */
@@ -215,6 +222,8 @@ typedef u16_t tcpflags_t;
   TCP_PCB_EXTARGS \
   enum tcp_state state; /* TCP state */ \
   u8_t prio; \
+  /* congestion control algorithm; listeners pass it on to new connections */ \
+  const struct tcp_cc *cc; \
   /* ports are in host byte order */ \
   u16_t local_port
 
@@ -235,6 +244,20 @@ struct tcp_pcb_listen {
   u8_t backlog;
   u8_t accepts_pending;
 #endif /* TCP_LISTEN_BACKLOG */
+
+  /* SYNs dropped because of a full backlog or no free PCB */
+  u32_t syns_dropped;
+#if TCP_SYN_COOKIES
+  u32_t syn_cookies_sent;
+  u32_t syn_cookies_accepted;
+#endif /* TCP_SYN_COOKIES */
+
+#if LWIP_TCP_FASTOPEN
+  /* Whether to accept data in a SYN that carries a valid Fast Open cookie */
+  u8_t fastopen;
+  /* Connections whose SYN data was accepted */
+  u32_t fastopen_accepted;
+#endif /* LWIP_TCP_FASTOPEN */
 };
 
 
@@ -269,6 +292,10 @@ struct tcp_pcb {
 #define TF_RTO         0x0800U /* RTO timer has fired, in-flight data moved to unsent and being retransmitted */
 #if LWIP_TCP_SACK_OUT
 #define TF_SACK        0x1000U /* Selective ACKs enabled */
+#endif
+#if LWIP_TCP_FASTOPEN
+#define TF_FASTOPEN    0x2000U /* Client: use Fast Open; server: peer sent the Fast Open option */
+#define TF_FASTOPEN_DATA 0x4000U /* Client: data went with the SYN; server: SYN data was accepted */
 #endif
 
   /* the rest of the fields are in host byte order
@@ -291,6 +318,13 @@ struct tcp_pcb {
 #define LWIP_TCP_SACK_VALID(pcb, idx) ((pcb)->rcv_sacks[idx].left != (pcb)->rcv_sacks[idx].right)
 #endif /* LWIP_TCP_SACK_OUT */
 
+#if LWIP_TCP_SACK_IN
+  /* SACK loss recovery (RFC 6675), valid while TF_INFR is set: snd_nxt when
+     recovery started, and the end of the highest retransmission since */
+  u32_t sack_recovery_point;
+  u32_t sack_high_rxt;
+#endif /* LWIP_TCP_SACK_IN */
+
   /* Retransmission timer. */
   s16_t rtime;
 
@@ -299,6 +333,7 @@ struct tcp_pcb {
   /* RTT (round trip time) estimation variables */
   u32_t rttest; /* RTT estimate in 500ms ticks */
   u32_t rtseq;  /* sequence number being timed */
+  u32_t rtstart; /* sys_now() when the timing started */
   s16_t sa, sv; /* @see "Congestion Avoidance and Control" by Van Jacobson and Karels */
 
   s16_t rto;    /* retransmission time-out (in ticks of TCP_SLOW_INTERVAL) */
@@ -311,6 +346,7 @@ struct tcp_pcb {
   /* congestion avoidance/control variables */
   tcpwnd_size_t cwnd;
   tcpwnd_size_t ssthresh;
+  u32_t cc_state; /* private to the congestion control algorithm */
 
   /* first byte following last rto byte */
   u32_t rto_end;
@@ -386,8 +422,44 @@ struct tcp_pcb {
   u8_t snd_scale;
   u8_t rcv_scale;
 #endif
+
+#if LWIP_TCP_FASTOPEN
+  /* Client: the cookie to send in the SYN, if TF_SEG_OPTS_FASTOPEN is set */
+  u8_t fastopen_cookie[TCP_FASTOPEN_COOKIE_LEN];
+#endif /* LWIP_TCP_FASTOPEN */
+};
+
+/**
+ * @ingroup tcp_raw
+ * A congestion control algorithm, selected per connection with tcp_set_cc().
+ * lwIP handles loss detection and recovery; the algorithm decides how the
+ * congestion window (cwnd) and slow start threshold (ssthresh) change.
+ */
+struct tcp_cc {
+  /** Returns the initial cwnd, called when the connection is established.
+   * This may also reset any state in pcb->cc_state. */
+  tcpwnd_size_t (*initial_cwnd)(struct tcp_pcb *pcb);
+  /** Called for each ACK of new data outside of loss recovery, to grow cwnd.
+   * pcb->lastack has already been advanced. */
+  void (*ack)(struct tcp_pcb *pcb, tcpwnd_size_t acked);
+  /** Called when fast retransmit or SACK loss recovery starts, to set
+   * ssthresh. lwIP then sets cwnd from ssthresh. */
+  void (*loss)(struct tcp_pcb *pcb);
+  /** Called for a retransmission timeout, to set ssthresh and cwnd. */
+  void (*rto)(struct tcp_pcb *pcb);
+  /** Called with each round-trip time sample, in milliseconds. This may be
+   * NULL. Samples are never taken from retransmitted data. */
+  void (*rtt)(struct tcp_pcb *pcb, u32_t rtt_ms);
 };
 
+/** NewReno: the classic lwIP behaviour and the default */
+extern const struct tcp_cc tcp_cc_newreno;
+/** NewReno with a ten-segment initial window (RFC 6928), for LANs */
+extern const struct tcp_cc tcp_cc_lan;
+/** Like tcp_cc_lan, but ends slow start and backs off when the round-trip
+ * time rises more than LWIP_TCP_CC_DELAY_TARGET above the smallest seen */
+extern const struct tcp_cc tcp_cc_lan_delay;
+
 #if LWIP_EVENT_API
 
 enum lwip_event {
@@ -454,6 +526,15 @@ void             tcp_backlog_accepted(struct tcp_pcb* pcb);
 #endif /* TCP_LISTEN_BACKLOG */
 #define          tcp_accepted(pcb) do { LWIP_UNUSED_ARG(pcb); } while(0) /* compatibility define, not needed any more */
 
+void             tcp_set_cc  (struct tcp_pcb *pcb, const struct tcp_cc *cc);
+
+#if LWIP_TCP_FASTOPEN
+void             tcp_fastopen(struct tcp_pcb *pcb);
+#define          tcp_listen_fastopen(pcb, enable) do { \
+  LWIP_ASSERT("pcb->state == LISTEN (called for wrong pcb?)", (pcb)->state == LISTEN); \
+  ((struct tcp_pcb_listen *)(pcb))->fastopen = ((enable) != 0); } while(0)
+#endif /* LWIP_TCP_FASTOPEN */
+
 void             tcp_recved  (struct tcp_pcb *pcb, u16_t len);
 err_t            tcp_bind    (struct tcp_pcb *pcb, const ip_addr_t *ipaddr,
                               u16_t port);
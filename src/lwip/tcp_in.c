@@ -58,6 +58,7 @@
 #if LWIP_ND6_TCP_REACHABILITY_HINTS
 #include "lwip/nd6.h"
 #endif /* LWIP_ND6_TCP_REACHABILITY_HINTS */
+#include "lwip/sys.h"
 
 #include <string.h>
 
@@ -65,9 +66,6 @@
 #include LWIP_HOOK_FILENAME
 #endif
 
-/** Initial CWND calculation as defined RFC 2581 */
-#define LWIP_TCP_CALC_INITIAL_CWND(mss) ((tcpwnd_size_t)LWIP_MIN((4U * (mss)), LWIP_MAX((2U * (mss)), 4380U)))
-
 /* These variables are global to all functions involved in the input
    processing of TCP segments. They are set by the tcp_input()
    function. */
@@ -85,6 +83,21 @@ static u8_t flags;
 static u8_t recv_flags;
 static struct pbuf *recv_data;
 
+#if LWIP_TCP_FASTOPEN
+/* The Fast Open option in the current SYN or SYN-ACK: its cookie length, or
+   TCP_FASTOPEN_OPT_NONE if there isn't one */
+#define TCP_FASTOPEN_OPT_NONE 0xffU
+static u8_t tcp_fastopen_optlen;
+static u8_t tcp_fastopen_optcookie[TCP_FASTOPEN_COOKIE_LEN];
+#endif /* LWIP_TCP_FASTOPEN */
+
+#if LWIP_TCP_SACK_IN
+/* The SACK blocks in the current segment; four is the most that fit */
+#define TCP_SACK_IN_MAX_BLOCKS 4
+static u8_t tcp_sack_in_num;
+static struct tcp_sack_range tcp_sack_in_blocks[TCP_SACK_IN_MAX_BLOCKS];
+#endif /* LWIP_TCP_SACK_IN */
+
 struct tcp_pcb *tcp_input_pcb;
 
 /* Forward declarations. */
@@ -97,6 +110,20 @@ static void tcp_timewait_input(struct tcp_pcb *pcb);
 
 static int tcp_input_delayed_close(struct tcp_pcb *pcb);
 
+#if TCP_SYN_COOKIES
+static void tcp_syncookie_send(struct tcp_pcb_listen *pcb);
+static int tcp_syncookie_accept(struct tcp_pcb_listen *pcb);
+#endif /* TCP_SYN_COOKIES */
+
+#if LWIP_TCP_FASTOPEN
+static err_t tcp_fastopen_accept(struct tcp_pcb_listen *pcb, struct tcp_pcb *npcb);
+static void tcp_fastopen_synack(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_FASTOPEN */
+
+#if LWIP_TCP_SACK_IN
+static void tcp_sack_mark(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK_IN */
+
 #if LWIP_TCP_SACK_OUT
 static void tcp_add_sack(struct tcp_pcb *pcb, u32_t left, u32_t right);
 static void tcp_remove_sacks_lt(struct tcp_pcb *pcb, u32_t seq);
@@ -377,7 +404,17 @@ tcp_input(struct pbuf *p, struct netif *inp)
                                      tcphdr_opt1len, tcphdr_opt2, p) == ERR_OK)
 #endif
       {
+#if LWIP_TCP_FASTOPEN
+        /* Data in a SYN may be passed to the application */
+        inseg.next = NULL;
+        inseg.len = p->tot_len;
+        inseg.p = p;
+        inseg.tcphdr = tcphdr;
+#endif /* LWIP_TCP_FASTOPEN */
         tcp_listen_input(lpcb);
+#if LWIP_TCP_FASTOPEN
+        inseg.p = NULL;
+#endif /* LWIP_TCP_FASTOPEN */
       }
       pbuf_free(p);
       return;
@@ -643,6 +680,12 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
   /* In the LISTEN state, we check for incoming SYN segments,
      creates a new PCB, and responds with a SYN|ACK. */
   if (flags & TCP_ACK) {
+#if TCP_SYN_COOKIES
+    /* This may complete a handshake that was answered with a SYN cookie */
+    if (tcp_syncookie_accept(pcb)) {
+      return;
+    }
+#endif /* TCP_SYN_COOKIES */
     /* For incoming segments with the ACK flag set, respond with a
        RST. */
     LWIP_DEBUGF(TCP_RST_DEBUG, ("tcp_listen_input: ACK in LISTEN, sending reset\n"));
@@ -653,6 +696,11 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 #if TCP_LISTEN_BACKLOG
     if (pcb->accepts_pending >= pcb->backlog) {
       LWIP_DEBUGF(TCP_DEBUG, ("tcp_listen_input: listen backlog exceeded for port %"U16_F"\n", tcphdr->dest));
+#if TCP_SYN_COOKIES
+      tcp_syncookie_send(pcb);
+#else /* TCP_SYN_COOKIES */
+      pcb->syns_dropped++;
+#endif /* TCP_SYN_COOKIES */
       return;
     }
 #endif /* TCP_LISTEN_BACKLOG */
@@ -664,8 +712,15 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
       err_t err;
       LWIP_DEBUGF(TCP_DEBUG, ("tcp_listen_input: could not allocate PCB\n"));
       TCP_STATS_INC(tcp.memerr);
+#if TCP_SYN_COOKIES
+      /* The connection doesn't need a PCB until the handshake completes */
+      tcp_syncookie_send(pcb);
+      LWIP_UNUSED_ARG(err);
+#else /* TCP_SYN_COOKIES */
+      pcb->syns_dropped++;
       TCP_EVENT_ACCEPT(pcb, NULL, pcb->callback_arg, ERR_MEM, err);
       LWIP_UNUSED_ARG(err); /* err not useful here */
+#endif /* TCP_SYN_COOKIES */
       return;
     }
 #if TCP_LISTEN_BACKLOG
@@ -695,6 +750,8 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 #endif /* LWIP_VLAN_PCP */
     /* inherit socket options */
     npcb->so_options = pcb->so_options & SOF_INHERITED;
+    npcb->cc = pcb->cc;
+    npcb->tos = pcb->tos;
     npcb->netif_idx = pcb->netif_idx;
     /* Register the new PCB so that we can begin receiving segments
        for it. */
@@ -704,6 +761,12 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
     tcp_parseopt(npcb);
     npcb->snd_wnd = tcphdr->wnd;
     npcb->snd_wnd_max = npcb->snd_wnd;
+#if LWIP_TCP_FASTOPEN
+    if (pcb->fastopen && (tcp_fastopen_optlen != TCP_FASTOPEN_OPT_NONE)) {
+      /* Answer with a cookie */
+      tcp_set_flags(npcb, TF_FASTOPEN);
+    }
+#endif /* LWIP_TCP_FASTOPEN */
 
 #if TCP_CALCULATE_EFF_SEND_MSS
     npcb->mss = tcp_eff_send_mss(npcb->mss, &npcb->local_ip, &npcb->remote_ip);
@@ -724,6 +787,11 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
       tcp_abandon(npcb, 0);
       return;
     }
+#if LWIP_TCP_FASTOPEN
+    if ((npcb->flags & TF_FASTOPEN) && (tcp_fastopen_accept(pcb, npcb) == ERR_ABRT)) {
+      return;
+    }
+#endif /* LWIP_TCP_FASTOPEN */
     tcp_output(npcb);
   }
   return;
@@ -807,6 +875,13 @@ tcp_process(struct tcp_pcb *pcb)
       if (ackno == pcb->snd_nxt) {
         acceptable = 1;
       }
+#if LWIP_TCP_FASTOPEN
+      /* The data in a Fast Open SYN might not have been acknowledged */
+      else if ((pcb->flags & TF_FASTOPEN_DATA) &&
+               TCP_SEQ_BETWEEN(ackno, pcb->lastack + 1, pcb->snd_nxt)) {
+        acceptable = 1;
+      }
+#endif /* LWIP_TCP_FASTOPEN */
     } else {
       /* "In all states except SYN-SENT, all reset (RST) segments are validated
           by checking their SEQ-fields." */
@@ -867,7 +942,13 @@ tcp_process(struct tcp_pcb *pcb)
                                     pcb->unacked ? lwip_ntohl(pcb->unacked->tcphdr->seqno) : 0));
       /* received SYN ACK with expected sequence number? */
       if ((flags & TCP_ACK) && (flags & TCP_SYN)
-          && (ackno == pcb->lastack + 1)) {
+          && ((ackno == pcb->lastack + 1)
+#if LWIP_TCP_FASTOPEN
+              /* Some or all of the data in a Fast Open SYN may be acknowledged */
+              || ((pcb->flags & TF_FASTOPEN_DATA) &&
+                  TCP_SEQ_BETWEEN(ackno, pcb->lastack + 1, pcb->snd_nxt))
+#endif /* LWIP_TCP_FASTOPEN */
+             )) {
         pcb->rcv_nxt = seqno + 1;
         pcb->rcv_ann_right_edge = pcb->rcv_nxt;
         pcb->lastack = ackno;
@@ -880,7 +961,7 @@ tcp_process(struct tcp_pcb *pcb)
         pcb->mss = tcp_eff_send_mss(pcb->mss, &pcb->local_ip, &pcb->remote_ip);
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
 
-        pcb->cwnd = LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+        pcb->cwnd = pcb->cc->initial_cwnd(pcb);
         LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_process (SENT): cwnd %"TCPWNDSIZE_F
                                      " ssthresh %"TCPWNDSIZE_F"\n",
                                      pcb->cwnd, pcb->ssthresh));
@@ -899,6 +980,12 @@ tcp_process(struct tcp_pcb *pcb)
         }
         tcp_seg_free(rseg);
 
+#if LWIP_TCP_FASTOPEN
+        if (pcb->flags & TF_FASTOPEN) {
+          tcp_fastopen_synack(pcb);
+        }
+#endif /* LWIP_TCP_FASTOPEN */
+
         /* If there's nothing left to acknowledge, stop the retransmit
            timer, otherwise reset it to start again */
         if (pcb->unacked == NULL) {
@@ -941,6 +1028,12 @@ tcp_process(struct tcp_pcb *pcb)
         if (TCP_SEQ_BETWEEN(ackno, pcb->lastack + 1, pcb->snd_nxt)) {
           pcb->state = ESTABLISHED;
           LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
+#if LWIP_TCP_FASTOPEN
+          if (pcb->flags & TF_FASTOPEN_DATA) {
+            /* Already accepted along with the data in its SYN */
+            err = ERR_OK;
+          } else
+#endif /* LWIP_TCP_FASTOPEN */
 #if LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG
           if (pcb->listener == NULL) {
             /* listen pcb might be closed by now */
@@ -973,7 +1066,7 @@ tcp_process(struct tcp_pcb *pcb)
             recv_acked--;
           }
 
-          pcb->cwnd = LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+          pcb->cwnd = pcb->cc->initial_cwnd(pcb);
           LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_process (SYN_RCVD): cwnd %"TCPWNDSIZE_F
                                        " ssthresh %"TCPWNDSIZE_F"\n",
                                        pcb->cwnd, pcb->ssthresh));
@@ -1162,6 +1255,10 @@ tcp_receive(struct tcp_pcb *pcb)
   if (flags & TCP_ACK) {
     right_wnd_edge = pcb->snd_wnd + pcb->snd_wl2;
 
+#if LWIP_TCP_SACK_IN
+    tcp_sack_mark(pcb);
+#endif /* LWIP_TCP_SACK_IN */
+
     /* Update window. */
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
         (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
@@ -1219,13 +1316,22 @@ tcp_receive(struct tcp_pcb *pcb)
               if ((u8_t)(pcb->dupacks + 1) > pcb->dupacks) {
                 ++pcb->dupacks;
               }
-              if (pcb->dupacks > 3) {
-                /* Inflate the congestion window */
-                TCP_WND_INC(pcb->cwnd, pcb->mss);
-              }
-              if (pcb->dupacks >= 3) {
-                /* Do fast retransmit (checked via TF_INFR, not via dupacks count) */
-                tcp_rexmit_fast(pcb);
+#if LWIP_TCP_SACK_IN
+              if (pcb->flags & TF_SACK) {
+                /* The scoreboard decides when to start recovery, and the
+                   estimate of the data in flight replaces window inflation */
+                tcp_sack_rexmit_fast(pcb);
+              } else
+#endif /* LWIP_TCP_SACK_IN */
+              {
+                if (pcb->dupacks > 3) {
+                  /* Inflate the congestion window */
+                  TCP_WND_INC(pcb->cwnd, pcb->mss);
+                }
+                if (pcb->dupacks >= 3) {
+                  /* Do fast retransmit (checked via TF_INFR, not via dupacks count) */
+                  tcp_rexmit_fast(pcb);
+                }
               }
             }
           }
@@ -1239,9 +1345,18 @@ tcp_receive(struct tcp_pcb *pcb)
          in fast retransmit. Also reset the congestion window to the
          slow start threshold. */
       if (pcb->flags & TF_INFR) {
-        tcp_clear_flags(pcb, TF_INFR);
-        pcb->cwnd = pcb->ssthresh;
-        pcb->bytes_acked = 0;
+#if LWIP_TCP_SACK_IN
+        if ((pcb->flags & TF_SACK) &&
+            TCP_SEQ_LT(ackno, pcb->sack_recovery_point)) {
+          /* A partial ACK: SACK loss recovery goes on until everything
+             that was outstanding when it started is acknowledged */
+        } else
+#endif /* LWIP_TCP_SACK_IN */
+        {
+          tcp_clear_flags(pcb, TF_INFR);
+          pcb->cwnd = pcb->ssthresh;
+          pcb->bytes_acked = 0;
+        }
       }
 
       /* Reset the number of retransmissions. */
@@ -1259,24 +1374,8 @@ tcp_receive(struct tcp_pcb *pcb)
 
       /* Update the congestion control variables (cwnd and
          ssthresh). */
-      if (pcb->state >= ESTABLISHED) {
-        if (pcb->cwnd < pcb->ssthresh) {
-          tcpwnd_size_t increase;
-          /* limit to 1 SMSS segment during period following RTO */
-          u8_t num_seg = (pcb->flags & TF_RTO) ? 1 : 2;
-          /* RFC 3465, section 2.2 Slow Start */
-          increase = LWIP_MIN(acked, (tcpwnd_size_t)(num_seg * pcb->mss));
-          TCP_WND_INC(pcb->cwnd, increase);
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
-        } else {
-          /* RFC 3465, section 2.1 Congestion Avoidance */
-          TCP_WND_INC(pcb->bytes_acked, acked);
-          if (pcb->bytes_acked >= pcb->cwnd) {
-            pcb->bytes_acked = (tcpwnd_size_t)(pcb->bytes_acked - pcb->cwnd);
-            TCP_WND_INC(pcb->cwnd, pcb->mss);
-          }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
-        }
+      if ((pcb->state >= ESTABLISHED) && !(pcb->flags & TF_INFR)) {
+        pcb->cc->ack(pcb, acked);
       }
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %"U32_F", unacked->seqno %"U32_F":%"U32_F"\n",
                                     ackno,
@@ -1368,6 +1467,10 @@ tcp_receive(struct tcp_pcb *pcb)
       LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: RTO %"U16_F" (%"U16_F" milliseconds)\n",
                                   pcb->rto, (u16_t)(pcb->rto * TCP_SLOW_INTERVAL)));
 
+      if (pcb->cc->rtt != NULL) {
+        pcb->cc->rtt(pcb, sys_now() - pcb->rtstart);
+      }
+
       pcb->rttest = 0;
     }
   }
@@ -1932,6 +2035,13 @@ tcp_parseopt(struct tcp_pcb *pcb)
 
   LWIP_ASSERT("tcp_parseopt: invalid pcb", pcb != NULL);
 
+#if LWIP_TCP_FASTOPEN
+  tcp_fastopen_optlen = TCP_FASTOPEN_OPT_NONE;
+#endif /* LWIP_TCP_FASTOPEN */
+#if LWIP_TCP_SACK_IN
+  tcp_sack_in_num = 0;
+#endif /* LWIP_TCP_SACK_IN */
+
   /* Parse the TCP MSS option, if present. */
   if (tcphdr_optlen != 0) {
     for (tcp_optidx = 0; tcp_optidx < tcphdr_optlen; ) {
@@ -2024,6 +2134,56 @@ tcp_parseopt(struct tcp_pcb *pcb)
           }
           break;
 #endif /* LWIP_TCP_SACK_OUT */
+#if LWIP_TCP_SACK_IN
+        case LWIP_TCP_OPT_SACK:
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: SACK\n"));
+          data = tcp_get_next_optbyte();
+          if (data < 10 || ((data - 2) % 8) != 0 || (tcp_optidx - 2 + data) > tcphdr_optlen) {
+            /* Bad length */
+            LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+            return;
+          }
+          if ((pcb->flags & TF_SACK) && !(flags & TCP_SYN)) {
+            u8_t n = (u8_t)((data - 2) / 8);
+            u8_t i, j;
+            for (i = 0; i < n; i++) {
+              u32_t edges[2] = {0, 0};
+              for (j = 0; j < 8; j++) {
+                edges[j / 4] = (edges[j / 4] << 8) | tcp_get_next_optbyte();
+              }
+              if (tcp_sack_in_num < TCP_SACK_IN_MAX_BLOCKS) {
+                tcp_sack_in_blocks[tcp_sack_in_num].left = edges[0];
+                tcp_sack_in_blocks[tcp_sack_in_num].right = edges[1];
+                tcp_sack_in_num++;
+              }
+            }
+          } else {
+            tcp_optidx += data - 2;
+          }
+          break;
+#endif /* LWIP_TCP_SACK_IN */
+#if LWIP_TCP_FASTOPEN
+        case LWIP_TCP_OPT_FASTOPEN:
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: FASTOPEN\n"));
+          data = tcp_get_next_optbyte();
+          if (data < LWIP_TCP_OPT_LEN_FASTOPEN_REQ || (tcp_optidx - 2 + data) > tcphdr_optlen) {
+            /* Bad length */
+            LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+            return;
+          }
+          /* Only a request or a cookie of our length is understood */
+          if ((flags & TCP_SYN) &&
+              ((data == LWIP_TCP_OPT_LEN_FASTOPEN_REQ) || (data == LWIP_TCP_OPT_LEN_FASTOPEN))) {
+            u8_t i;
+            tcp_fastopen_optlen = (u8_t)(data - 2);
+            for (i = 0; i < tcp_fastopen_optlen; i++) {
+              tcp_fastopen_optcookie[i] = tcp_get_next_optbyte();
+            }
+          } else {
+            tcp_optidx += data - 2;
+          }
+          break;
+#endif /* LWIP_TCP_FASTOPEN */
         default:
           LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: other\n"));
           data = tcp_get_next_optbyte();
@@ -2041,12 +2201,438 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 
+#if TCP_SYN_COOKIES || LWIP_TCP_FASTOPEN
+/** Mixes one 32-bit word into a hash (the MurmurHash3 block step). */
+static u32_t
+tcp_syncookie_mix(u32_t h, u32_t v)
+{
+  v *= 0xcc9e2d51UL;
+  v = (v << 15) | (v >> 17);
+  v *= 0x1b873593UL;
+  h ^= v;
+  h = (h << 13) | (h >> 19);
+  return h * 5 + 0xe6546b64UL;
+}
+
+/** Mixes an IP address into a hash. */
+static u32_t
+tcp_syncookie_mix_addr(u32_t h, const ip_addr_t *addr)
+{
+#if LWIP_IPV6
+  if (IP_IS_V6(addr)) {
+    int i;
+    for (i = 0; i < 4; i++) {
+      h = tcp_syncookie_mix(h, ip_2_ip6(addr)->addr[i]);
+    }
+    return h;
+  }
+#endif /* LWIP_IPV6 */
+#if LWIP_IPV4
+  h = tcp_syncookie_mix(h, ip4_addr_get_u32(ip_2_ip4(addr)));
+#endif /* LWIP_IPV4 */
+  return h;
+}
+
+/** Finishes a hash (the MurmurHash3 finalizer). */
+static u32_t
+tcp_syncookie_fmix(u32_t h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bUL;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35UL;
+  h ^= h >> 16;
+  return h;
+}
+#endif /* TCP_SYN_COOKIES || LWIP_TCP_FASTOPEN */
+
+#if TCP_SYN_COOKIES
+/* Peer MSS values that a SYN cookie can encode, in its low two bits */
+static const u16_t tcp_syncookie_mss[] = { 536, 1300, 1440, 1460 };
+
+/* A cookie is valid for the period in which it was made and the next one. The
+   period is 2^7 slow timer ticks, or 64 seconds. */
+#define TCP_SYNCOOKIE_PERIOD_SHIFT 7
+
+/* The MSS to assume when a SYN has no MSS option */
+#define TCP_SYNCOOKIE_DEFAULT_MSS 536
+
+static u32_t tcp_syncookie_secret[2];
+static u8_t tcp_syncookie_secret_set;
+
+/**
+ * Calculates the cookie for the current segment's addresses and ports, the
+ * peer's initial sequence number, and a period and MSS index. The low two bits
+ * of the result are the MSS index.
+ */
+static u32_t
+tcp_syncookie_calc(u32_t isn, u32_t period, u8_t mss_idx)
+{
+  u32_t h;
+
+  if (!tcp_syncookie_secret_set) {
+    tcp_syncookie_secret[0] = LWIP_RAND();
+    tcp_syncookie_secret[1] = LWIP_RAND();
+    tcp_syncookie_secret_set = 1;
+  }
+
+  h = tcp_syncookie_secret[0];
+  h = tcp_syncookie_mix_addr(h, ip_current_src_addr());
+  h = tcp_syncookie_mix_addr(h, ip_current_dest_addr());
+  h = tcp_syncookie_mix(h, ((u32_t)tcphdr->src << 16) | tcphdr->dest);
+  h = tcp_syncookie_mix(h, isn);
+  h = tcp_syncookie_mix(h, (period << 2) | mss_idx);
+  h = tcp_syncookie_mix(h, tcp_syncookie_secret[1]);
+  h = tcp_syncookie_fmix(h);
+
+  return (h & ~(u32_t)3) | mss_idx;
+}
+
+/**
+ * Returns the MSS option in the current SYN, or TCP_SYNCOOKIE_DEFAULT_MSS if
+ * there isn't one.
+ */
+static u16_t
+tcp_syncookie_parse_mss(void)
+{
+  for (tcp_optidx = 0; tcp_optidx < tcphdr_optlen; ) {
+    u8_t opt = tcp_get_next_optbyte();
+    u8_t len;
+    if (opt == LWIP_TCP_OPT_EOL) {
+      break;
+    }
+    if (opt == LWIP_TCP_OPT_NOP) {
+      continue;
+    }
+    len = tcp_get_next_optbyte();
+    if ((len < 2) || (tcp_optidx - 2 + len > tcphdr_optlen)) {
+      /* Malformed options */
+      break;
+    }
+    if ((opt == LWIP_TCP_OPT_MSS) && (len == LWIP_TCP_OPT_LEN_MSS)) {
+      u16_t mss = (u16_t)(tcp_get_next_optbyte() << 8);
+      mss |= tcp_get_next_optbyte();
+      return (mss == 0) ? TCP_SYNCOOKIE_DEFAULT_MSS : mss;
+    }
+    tcp_optidx += len - 2;
+  }
+  return TCP_SYNCOOKIE_DEFAULT_MSS;
+}
+
+/**
+ * Answers the current SYN with a SYN cookie instead of creating a PCB.
+ *
+ * Called by tcp_listen_input() when the backlog is full or no PCB could be
+ * allocated.
+ *
+ * @param pcb the tcp_pcb_listen for which the SYN arrived
+ */
+static void
+tcp_syncookie_send(struct tcp_pcb_listen *pcb)
+{
+  u16_t mss = tcp_syncookie_parse_mss();
+  u8_t mss_idx = 0;
+  u32_t cookie;
+
+  /* Use the largest encodable MSS that doesn't exceed the peer's */
+  while ((mss_idx + 1 < (u8_t)LWIP_ARRAYSIZE(tcp_syncookie_mss)) &&
+         (tcp_syncookie_mss[mss_idx + 1] <= mss)) {
+    mss_idx++;
+  }
+  cookie = tcp_syncookie_calc(seqno, tcp_ticks >> TCP_SYNCOOKIE_PERIOD_SHIFT, mss_idx);
+
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_syncookie_send: sending SYN cookie for port %"U16_F"\n", tcphdr->dest));
+  tcp_syncookie_synack_netif(ip_data.current_input_netif, cookie, seqno + 1,
+                             ip_current_dest_addr(), ip_current_src_addr(),
+                             tcphdr->dest, tcphdr->src);
+  pcb->syn_cookies_sent++;
+}
+
+/**
+ * Checks whether the current ACK carries a valid SYN cookie and, if so,
+ * creates an established connection and passes it to the accept callback.
+ *
+ * Called by tcp_listen_input() for an ACK that doesn't match any connection.
+ * Any data in the segment is dropped; the peer retransmits it once the
+ * connection exists.
+ *
+ * @param pcb the tcp_pcb_listen for which the ACK arrived
+ * @return 1 if the segment was consumed and 0 if it should be answered with a
+ *         RST because it wasn't a valid cookie or no PCB could be allocated
+ */
+static int
+tcp_syncookie_accept(struct tcp_pcb_listen *pcb)
+{
+  struct tcp_pcb *npcb;
+  u32_t cookie = ackno - 1;
+  u32_t isn = seqno - 1;
+  u32_t period;
+  u8_t mss_idx = (u8_t)(cookie & 3);
+  err_t err;
+
+  /* Only consider cookies if this listener has sent any */
+  if ((pcb->syn_cookies_sent == 0) || (flags & TCP_SYN)) {
+    return 0;
+  }
+  period = tcp_ticks >> TCP_SYNCOOKIE_PERIOD_SHIFT;
+  if ((tcp_syncookie_calc(isn, period, mss_idx) != cookie) &&
+      (tcp_syncookie_calc(isn, period - 1, mss_idx) != cookie)) {
+    return 0;
+  }
+
+  npcb = tcp_alloc(pcb->prio);
+  if (npcb == NULL) {
+    /* The handshake state is gone, so reset the peer's half-open connection
+       rather than leaving it to time out */
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_syncookie_accept: could not allocate PCB\n"));
+    TCP_STATS_INC(tcp.memerr);
+    return 0;
+  }
+  LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established from SYN cookie %"U16_F" -> %"U16_F".\n", tcphdr->src, tcphdr->dest));
+
+  /* Set up the new PCB as if the handshake had just completed */
+  ip_addr_copy(npcb->local_ip, *ip_current_dest_addr());
+  ip_addr_copy(npcb->remote_ip, *ip_current_src_addr());
+  npcb->local_port = pcb->local_port;
+  npcb->remote_port = tcphdr->src;
+  npcb->state = ESTABLISHED;
+  npcb->rcv_nxt = seqno;
+  npcb->rcv_ann_right_edge = npcb->rcv_nxt;
+  npcb->snd_wl2 = ackno;
+  npcb->snd_nxt = ackno;
+  npcb->lastack = ackno;
+  npcb->snd_lbb = ackno;
+  npcb->snd_wl1 = seqno - 1;/* initialise to seqno-1 to force window update */
+  npcb->snd_wnd = tcphdr->wnd;
+  npcb->snd_wnd_max = npcb->snd_wnd;
+  npcb->callback_arg = pcb->callback_arg;
+#if LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG
+  npcb->listener = pcb;
+#endif /* LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG */
+#if LWIP_VLAN_PCP
+  npcb->netif_hints.tci = pcb->netif_hints.tci;
+#endif /* LWIP_VLAN_PCP */
+  /* inherit socket options */
+  npcb->so_options = pcb->so_options & SOF_INHERITED;
+  npcb->cc = pcb->cc;
+  npcb->tos = pcb->tos;
+  npcb->netif_idx = pcb->netif_idx;
+
+  npcb->mss = LWIP_MIN(tcp_syncookie_mss[mss_idx], TCP_MSS);
+#if TCP_CALCULATE_EFF_SEND_MSS
+  npcb->mss = tcp_eff_send_mss(npcb->mss, &npcb->local_ip, &npcb->remote_ip);
+#endif /* TCP_CALCULATE_EFF_SEND_MSS */
+  npcb->cwnd = npcb->cc->initial_cwnd(npcb);
+
+  TCP_REG_ACTIVE(npcb);
+  MIB2_STATS_INC(mib2.tcppassiveopens);
+
+#if LWIP_TCP_PCB_NUM_EXT_ARGS
+  if (tcp_ext_arg_invoke_callbacks_passive_open(pcb, npcb) != ERR_OK) {
+    tcp_abandon(npcb, 0);
+    return 1;
+  }
+#endif
+
+  pcb->syn_cookies_accepted++;
+
+  /* Call the accept function. */
+  TCP_EVENT_ACCEPT(pcb, npcb, pcb->callback_arg, ERR_OK, err);
+  if (err != ERR_OK) {
+    /* If the accept function returns with an error, we abort
+     * the connection. */
+    /* Already aborted? */
+    if (err != ERR_ABRT) {
+      tcp_abort(npcb);
+    }
+  }
+  return 1;
+}
+#endif /* TCP_SYN_COOKIES */
+
+#if LWIP_TCP_FASTOPEN
+static u32_t tcp_fastopen_secret[2];
+static u8_t tcp_fastopen_secret_set;
+
+/**
+ * Calculates the Fast Open cookie this server gives to a client.
+ *
+ * @param addr the client's address
+ * @param cookie where to store the cookie, TCP_FASTOPEN_COOKIE_LEN bytes
+ */
+void
+tcp_fastopen_cookie_calc(const ip_addr_t *addr, u8_t *cookie)
+{
+  u32_t h[2];
+  u8_t i;
+
+  if (!tcp_fastopen_secret_set) {
+    tcp_fastopen_secret[0] = LWIP_RAND();
+    tcp_fastopen_secret[1] = LWIP_RAND();
+    tcp_fastopen_secret_set = 1;
+  }
+
+  for (i = 0; i < 2; i++) {
+    h[i] = tcp_syncookie_mix(tcp_fastopen_secret[i], i);
+    h[i] = tcp_syncookie_mix_addr(h[i], addr);
+    h[i] = tcp_syncookie_mix(h[i], tcp_fastopen_secret[i ^ 1]);
+    h[i] = tcp_syncookie_fmix(h[i]);
+  }
+  MEMCPY(cookie, h, TCP_FASTOPEN_COOKIE_LEN);
+}
+
+/**
+ * Accepts the data in a SYN that carries a valid Fast Open cookie. The new
+ * connection is passed to the accept callback and then the data to the receive
+ * callback, all before the handshake completes.
+ *
+ * Called by tcp_listen_input() after the SYN-ACK has been enqueued, so that
+ * anything the application sends follows it.
+ *
+ * @param pcb the tcp_pcb_listen for which the SYN arrived
+ * @param npcb the new connection, in SYN_RCVD
+ * @return ERR_ABRT if npcb was aborted, and ERR_OK otherwise
+ */
+static err_t
+tcp_fastopen_accept(struct tcp_pcb_listen *pcb, struct tcp_pcb *npcb)
+{
+  u8_t cookie[TCP_FASTOPEN_COOKIE_LEN];
+  struct pbuf *p = inseg.p;
+  err_t err;
+
+  if ((p == NULL) || (p->tot_len == 0) ||
+      (tcp_fastopen_optlen != TCP_FASTOPEN_COOKIE_LEN) ||
+      (p->tot_len > npcb->rcv_wnd)) {
+    return ERR_OK;
+  }
+  tcp_fastopen_cookie_calc(&npcb->remote_ip, cookie);
+  if (memcmp(cookie, tcp_fastopen_optcookie, TCP_FASTOPEN_COOKIE_LEN) != 0) {
+    /* The SYN-ACK carries a good cookie and the client sends the data again */
+    return ERR_OK;
+  }
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_fastopen_accept: %"U16_F" bytes with the SYN\n", p->tot_len));
+
+  /* The SYN-ACK, which hasn't been sent yet, acknowledges the data */
+  npcb->rcv_nxt += p->tot_len;
+  npcb->rcv_wnd -= p->tot_len;
+  npcb->rcv_ann_right_edge = npcb->rcv_nxt;
+  tcp_update_rcv_ann_wnd(npcb);
+  npcb->cwnd = npcb->cc->initial_cwnd(npcb);
+  tcp_set_flags(npcb, TF_FASTOPEN_DATA);
+  pcb->fastopen_accepted++;
+
+  tcp_backlog_accepted(npcb);
+  TCP_EVENT_ACCEPT(pcb, npcb, npcb->callback_arg, ERR_OK, err);
+  if (err != ERR_OK) {
+    /* Already aborted? */
+    if (err != ERR_ABRT) {
+      tcp_abort(npcb);
+    }
+    return ERR_ABRT;
+  }
+
+  /* tcp_input() frees its own reference */
+  pbuf_ref(p);
+  TCP_EVENT_RECV(npcb, p, ERR_OK, err);
+  if (err == ERR_ABRT) {
+    return ERR_ABRT;
+  }
+  if (err != ERR_OK) {
+    /* If the upper layer can't receive this data, store it */
+    npcb->refused_data = p;
+  }
+  return ERR_OK;
+}
+
+/**
+ * Finishes a Fast Open connect after the SYN was acknowledged: remembers any
+ * cookie, frees the data the server acknowledged, and queues the rest to be
+ * sent again.
+ *
+ * Called by tcp_process() in SYN_SENT after the SYN segment has been freed.
+ *
+ * @param pcb the tcp_pcb that just became established
+ */
+static void
+tcp_fastopen_synack(struct tcp_pcb *pcb)
+{
+  if (tcp_fastopen_optlen == TCP_FASTOPEN_COOKIE_LEN) {
+    tcp_fastopen_cache_set(&pcb->remote_ip, tcp_fastopen_optcookie);
+  }
+  tcp_clear_flags(pcb, TF_FASTOPEN_DATA);
+
+  while ((pcb->unacked != NULL) &&
+         TCP_SEQ_LEQ(lwip_ntohl(pcb->unacked->tcphdr->seqno) + TCP_TCPLEN(pcb->unacked), ackno)) {
+    struct tcp_seg *seg = pcb->unacked;
+    pcb->unacked = seg->next;
+    LWIP_ASSERT("pcb->snd_queuelen >= pbuf_clen(seg->p)",
+                (pcb->snd_queuelen >= pbuf_clen(seg->p)));
+    pcb->snd_queuelen = (u16_t)(pcb->snd_queuelen - pbuf_clen(seg->p));
+    pcb->snd_buf = (tcpwnd_size_t)(pcb->snd_buf + seg->len);
+    recv_acked = (tcpwnd_size_t)(recv_acked + seg->len);
+    tcp_seg_free(seg);
+  }
+
+  if (pcb->unacked != NULL) {
+    /* The server didn't take all of the data, so send the rest now */
+    struct tcp_seg *seg = pcb->unacked;
+    while (seg->next != NULL) {
+      seg = seg->next;
+    }
+    seg->next = pcb->unsent;
+    pcb->unsent = pcb->unacked;
+    pcb->unacked = NULL;
+    pcb->snd_nxt = lwip_ntohl(pcb->unsent->tcphdr->seqno);
+    /* Don't take any RTT measurement from the retransmission */
+    pcb->rttest = 0;
+  }
+}
+#endif /* LWIP_TCP_FASTOPEN */
+
 void
 tcp_trigger_input_pcb_close(void)
 {
   recv_flags |= TF_CLOSED;
 }
 
+#if LWIP_TCP_SACK_IN
+/**
+ * Records the SACK blocks in the incoming ACK on the scoreboard: each segment
+ * in the unacked queue that a block fully covers is marked as SACKed. Blocks
+ * below the cumulative ACK (D-SACKs) cover nothing that's still queued.
+ *
+ * Called from tcp_receive().
+ *
+ * @param pcb the tcp_pcb that received the ACK
+ */
+static void
+tcp_sack_mark(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  u8_t i;
+
+  if (tcp_sack_in_num == 0) {
+    return;
+  }
+
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    u32_t left = lwip_ntohl(seg->tcphdr->seqno);
+    u32_t right = left + seg->len;
+
+    if ((seg->len == 0) || (seg->flags & TF_SEG_SACKED)) {
+      continue;
+    }
+    for (i = 0; i < tcp_sack_in_num; i++) {
+      if (TCP_SEQ_LEQ(tcp_sack_in_blocks[i].left, left) &&
+          TCP_SEQ_LEQ(right, tcp_sack_in_blocks[i].right)) {
+        seg->flags |= TF_SEG_SACKED;
+        break;
+      }
+    }
+  }
+}
+#endif /* LWIP_TCP_SACK_IN */
+
 #if LWIP_TCP_SACK_OUT
 /**
  * Called by tcp_receive() to add new SACK entry.
@@ -74,9 +74,7 @@
 #include "lwip/stats.h"
 #include "lwip/ip6.h"
 #include "lwip/ip6_addr.h"
-#if LWIP_TCP_TIMESTAMPS
 #include "lwip/sys.h"
-#endif
 
 #include <string.h>
 
@@ -126,6 +124,13 @@
 
 /* Forward declarations.*/
 static err_t tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif);
+#if LWIP_TCP_FASTOPEN
+static u16_t tcp_fastopen_len(const struct tcp_pcb *pcb, const struct tcp_seg *syn);
+static err_t tcp_output_fastopen(struct tcp_pcb *pcb, struct netif *netif, u16_t len);
+#endif /* LWIP_TCP_FASTOPEN */
+#if LWIP_TCP_SACK_IN
+static err_t tcp_sack_output_lost(struct tcp_pcb *pcb, u32_t *pipe);
+#endif /* LWIP_TCP_SACK_IN */
 static err_t tcp_output_control_segment_netif(const struct tcp_pcb *pcb, struct pbuf *p,
                                               const ip_addr_t *src, const ip_addr_t *dst,
                                               struct netif *netif);
@@ -1066,6 +1071,18 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
       optflags |= TF_SEG_OPTS_SACK_PERM;
     }
 #endif /* LWIP_TCP_SACK_OUT */
+#if LWIP_TCP_FASTOPEN
+    if (pcb->flags & TF_FASTOPEN) {
+      if (pcb->state == SYN_RCVD) {
+        /* The peer asked for a cookie or sent one */
+        optflags |= TF_SEG_OPTS_FASTOPEN;
+      } else if (tcp_fastopen_cache_get(&pcb->remote_ip, pcb->fastopen_cookie)) {
+        optflags |= TF_SEG_OPTS_FASTOPEN;
+      } else {
+        optflags |= TF_SEG_OPTS_FASTOPEN_REQ;
+      }
+    }
+#endif /* LWIP_TCP_FASTOPEN */
   }
 #if LWIP_TCP_TIMESTAMPS
   if ((pcb->flags & TF_TIMESTAMP) || ((flags & TCP_SYN) && (pcb->state != SYN_RCVD))) {
@@ -1244,6 +1261,10 @@ tcp_output(struct tcp_pcb *pcb)
   u32_t wnd, snd_nxt;
   err_t err;
   struct netif *netif;
+#if LWIP_TCP_SACK_IN
+  u8_t sack_recovery;
+  u32_t pipe = 0;
+#endif /* LWIP_TCP_SACK_IN */
 #if TCP_CWND_DEBUG
   s16_t i = 0;
 #endif /* TCP_CWND_DEBUG */
@@ -1265,6 +1286,20 @@ tcp_output(struct tcp_pcb *pcb)
 
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
 
+#if LWIP_TCP_SACK_IN
+  /* In SACK loss recovery, the segments presumed lost go first, and the
+     estimate of the data in flight rather than the distance from lastack
+     limits what else is sent (RFC 6675) */
+  sack_recovery = ((pcb->flags & (TF_SACK | TF_INFR)) == (TF_SACK | TF_INFR));
+  if (sack_recovery) {
+    err = tcp_sack_output_lost(pcb, &pipe);
+    if (err != ERR_OK) {
+      return err;
+    }
+    wnd = pcb->snd_wnd;
+  }
+#endif /* LWIP_TCP_SACK_IN */
+
   seg = pcb->unsent;
 
   if (seg == NULL) {
@@ -1327,6 +1362,22 @@ tcp_output(struct tcp_pcb *pcb)
   /* Stop persist timer, above conditions are not active */
   pcb->persist_backoff = 0;
 
+#if LWIP_TCP_FASTOPEN
+  /* The first transmission of a Fast Open SYN takes the first data along */
+  if ((pcb->state == SYN_SENT) && (seg->flags & TF_SEG_OPTS_FASTOPEN) &&
+      (pcb->unacked == NULL) && (pcb->nrtx == 0)) {
+    u16_t len = tcp_fastopen_len(pcb, seg);
+    if (len > 0) {
+      err = tcp_output_fastopen(pcb, netif, len);
+      if (err != ERR_OK) {
+        tcp_set_flags(pcb, TF_NAGLEMEMERR);
+        return err;
+      }
+      goto output_done;
+    }
+  }
+#endif /* LWIP_TCP_FASTOPEN */
+
   /* useg should point to last segment on unacked queue */
   useg = pcb->unacked;
   if (useg != NULL) {
@@ -1348,6 +1399,16 @@ tcp_output(struct tcp_pcb *pcb)
         ((pcb->flags & (TF_NAGLEMEMERR | TF_FIN)) == 0)) {
       break;
     }
+    /* Data queued in SYN_SENT waits for the handshake, even if a
+       retransmission timeout has opened the congestion window */
+    if ((pcb->state == SYN_SENT) && !(TCPH_FLAGS(seg->tcphdr) & TCP_SYN)) {
+      break;
+    }
+#if LWIP_TCP_SACK_IN
+    if (sack_recovery && (pipe + seg->len > pcb->cwnd)) {
+      break;
+    }
+#endif /* LWIP_TCP_SACK_IN */
 #if TCP_CWND_DEBUG
     LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
                                  pcb->snd_wnd, pcb->cwnd, wnd,
@@ -1378,6 +1439,9 @@ tcp_output(struct tcp_pcb *pcb)
     if (TCP_SEQ_LT(pcb->snd_nxt, snd_nxt)) {
       pcb->snd_nxt = snd_nxt;
     }
+#if LWIP_TCP_SACK_IN
+    pipe += TCP_TCPLEN(seg);
+#endif /* LWIP_TCP_SACK_IN */
     /* put segment on unacknowledged list if length > 0 */
     if (TCP_TCPLEN(seg) > 0) {
       seg->next = NULL;
@@ -1423,6 +1487,94 @@ output_done:
   return ERR_OK;
 }
 
+#if LWIP_TCP_FASTOPEN
+/**
+ * Returns how much of the data following a Fast Open SYN can go with it. The
+ * SYN's options count against the MSS.
+ *
+ * @param pcb the tcp_pcb in SYN_SENT
+ * @param syn the SYN segment at the head of the unsent queue
+ * @return the number of data bytes, or zero if there's no data or room
+ */
+static u16_t
+tcp_fastopen_len(const struct tcp_pcb *pcb, const struct tcp_seg *syn)
+{
+  const struct tcp_seg *data = syn->next;
+  u8_t optlen = LWIP_TCP_OPT_LENGTH_SEGMENT(syn->flags, pcb);
+
+  if ((data == NULL) || (data->len == 0) || (pcb->mss <= optlen)) {
+    return 0;
+  }
+  return LWIP_MIN(data->len, (u16_t)(pcb->mss - optlen));
+}
+
+/**
+ * Sends the SYN at the head of the unsent queue in one packet with the start
+ * of the data segment that follows it. The queued segments are left alone and
+ * both move to the unacked queue; the SYN-ACK tells which data to send again.
+ *
+ * Called by tcp_output() for the first transmission of a Fast Open SYN.
+ *
+ * @param pcb the tcp_pcb in SYN_SENT
+ * @param netif the netif used to send the packet
+ * @param len the number of data bytes to send, from tcp_fastopen_len()
+ */
+static err_t
+tcp_output_fastopen(struct tcp_pcb *pcb, struct netif *netif, u16_t len)
+{
+  struct tcp_seg *syn = pcb->unsent;
+  struct tcp_seg *data = syn->next;
+  struct tcp_seg *seg;
+  struct pbuf *p;
+  u8_t optlen = LWIP_TCP_OPT_LENGTH_SEGMENT(syn->flags, pcb);
+  u16_t offset;
+  err_t err;
+
+  p = pbuf_alloc(PBUF_TRANSPORT, (u16_t)(optlen + len), PBUF_RAM);
+  if (p == NULL) {
+    TCP_STATS_INC(tcp.memerr);
+    return ERR_MEM;
+  }
+  offset = (u16_t)(((u8_t *)data->tcphdr - (u8_t *)data->p->payload) +
+                   TCPH_HDRLEN_BYTES(data->tcphdr));
+  if (pbuf_copy_partial(data->p, (u8_t *)p->payload + optlen, len, offset) != len) {
+    pbuf_free(p);
+    return ERR_BUF;
+  }
+  seg = tcp_create_segment(pcb, p, TCP_SYN, lwip_ntohl(syn->tcphdr->seqno), syn->flags);
+  if (seg == NULL) {
+    TCP_STATS_INC(tcp.memerr);
+    return ERR_MEM;
+  }
+#if TCP_CHECKSUM_ON_COPY
+  tcp_seg_add_chksum(~inet_chksum((u8_t *)(seg->tcphdr + 1) + optlen, len), len,
+                     &seg->chksum, &seg->chksum_swapped);
+  seg->flags |= TF_SEG_DATA_CHECKSUMMED;
+#endif /* TCP_CHECKSUM_ON_COPY */
+
+  err = tcp_output_segment(seg, pcb, netif);
+  tcp_seg_free(seg);
+  if (err != ERR_OK) {
+    return err;
+  }
+
+  pcb->unsent = data->next;
+  data->next = NULL;
+  pcb->unacked = syn;
+#if TCP_OVERSIZE_DBGCHECK
+  data->oversize_left = 0;
+#endif /* TCP_OVERSIZE_DBGCHECK */
+#if TCP_OVERSIZE
+  if (pcb->unsent == NULL) {
+    pcb->unsent_oversize = 0;
+  }
+#endif /* TCP_OVERSIZE */
+  pcb->snd_nxt = lwip_ntohl(syn->tcphdr->seqno) + 1 + len;
+  tcp_set_flags(pcb, TF_FASTOPEN_DATA);
+  return ERR_OK;
+}
+#endif /* LWIP_TCP_FASTOPEN */
+
 /** Check if a segment's pbufs are used by someone else than TCP.
  * This can happen on retransmission if the pbuf of this segment is still
  * referenced by the netif driver due to deferred transmission.
@@ -1532,6 +1684,22 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif
     *(opts++) = PP_HTONL(0x01010402);
   }
 #endif
+#if LWIP_TCP_FASTOPEN
+  if (seg->flags & TF_SEG_OPTS_FASTOPEN) {
+    /* Pad with two NOP options to make everything nicely aligned */
+    *(opts++) = PP_HTONL(0x01010000 | (LWIP_TCP_OPT_FASTOPEN << 8) | LWIP_TCP_OPT_LEN_FASTOPEN);
+    if (TCPH_FLAGS(seg->tcphdr) & TCP_ACK) {
+      /* A server makes the cookie from the client's address */
+      tcp_fastopen_cookie_calc(&pcb->remote_ip, (u8_t *)opts);
+    } else {
+      MEMCPY(opts, pcb->fastopen_cookie, TCP_FASTOPEN_COOKIE_LEN);
+    }
+    opts += TCP_FASTOPEN_COOKIE_LEN / 4;
+  }
+  if (seg->flags & TF_SEG_OPTS_FASTOPEN_REQ) {
+    *(opts++) = PP_HTONL(0x01010000 | (LWIP_TCP_OPT_FASTOPEN << 8) | LWIP_TCP_OPT_LEN_FASTOPEN_REQ);
+  }
+#endif /* LWIP_TCP_FASTOPEN */
 
   /* Set retransmission timer running if it is not currently enabled
      This must be set before checking the route. */
@@ -1541,6 +1709,7 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif
 
   if (pcb->rttest == 0) {
     pcb->rttest = tcp_ticks;
+    pcb->rtstart = sys_now();
     pcb->rtseq = lwip_ntohl(seg->tcphdr->seqno);
 
     LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_output_segment: rtseq %"U32_F"\n", pcb->rtseq));
@@ -1656,6 +1825,19 @@ tcp_rexmit_rto_prepare(struct tcp_pcb *pcb)
     LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_rexmit_rto: segment busy\n"));
     return ERR_VAL;
   }
+#if LWIP_TCP_SACK_IN
+  /* The remote host may discard data it has SACKed, so SACKs don't count
+     after a timeout (RFC 2018), and the timeout ends any SACK loss recovery */
+  {
+    struct tcp_seg *s;
+    for (s = pcb->unacked; s != NULL; s = s->next) {
+      s->flags &= (u8_t)~TF_SEG_SACKED;
+    }
+  }
+  if (pcb->flags & TF_SACK) {
+    tcp_clear_flags(pcb, TF_INFR);
+  }
+#endif /* LWIP_TCP_SACK_IN */
   /* concatenate unsent queue after unacked queue */
   seg->next = pcb->unsent;
 #if TCP_OVERSIZE_DBGCHECK
@@ -1796,19 +1978,7 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
                  (u16_t)pcb->dupacks, pcb->lastack,
                  lwip_ntohl(pcb->unacked->tcphdr->seqno)));
     if (tcp_rexmit(pcb) == ERR_OK) {
-      /* Set ssthresh to half of the minimum of the current
-       * cwnd and the advertised window */
-      pcb->ssthresh = LWIP_MIN(pcb->cwnd, pcb->snd_wnd) / 2;
-
-      /* The minimum value for ssthresh should be 2 MSS */
-      if (pcb->ssthresh < (2U * pcb->mss)) {
-        LWIP_DEBUGF(TCP_FR_DEBUG,
-                    ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F
-                     " should be min 2 mss %"U16_F"...\n",
-                     pcb->ssthresh, (u16_t)(2 * pcb->mss)));
-        pcb->ssthresh = 2 * pcb->mss;
-      }
-
+      pcb->cc->loss(pcb);
       pcb->cwnd = pcb->ssthresh + 3 * pcb->mss;
       tcp_set_flags(pcb, TF_INFR);
 
@@ -1818,6 +1988,181 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_TCP_SACK_IN
+/* RFC 6675 DupThresh: the number of duplicate ACKs, or of SACKed segments
+   above a hole, that marks a segment as lost */
+#define TCP_SACK_DUPTHRESH 3
+
+/**
+ * Walks the SACK scoreboard, the unacked queue, to estimate how much data is
+ * in the network ("pipe" in RFC 6675). A segment that isn't SACKed counts
+ * unless it's presumed lost, and counts again if it was retransmitted in the
+ * current loss recovery.
+ *
+ * @param pcb the tcp_pcb whose unacked queue to walk
+ * @param lost receives the first segment presumed lost that hasn't been
+ *        retransmitted in the current loss recovery, or NULL if there's none
+ * @return the estimated number of bytes in flight
+ */
+static u32_t
+tcp_sack_pipe(const struct tcp_pcb *pcb, struct tcp_seg **lost)
+{
+  struct tcp_seg *seg;
+  u32_t pipe = 0;
+  u32_t sacked_bytes = 0;
+  u16_t sacked_segs = 0;
+
+  *lost = NULL;
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_segs++;
+      sacked_bytes += seg->len;
+    }
+  }
+
+  /* The counts now cover the SACKed segments above the current one */
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    u32_t seqno = lwip_ntohl(seg->tcphdr->seqno);
+    u8_t is_lost;
+
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_segs--;
+      sacked_bytes -= seg->len;
+      continue;
+    }
+
+    /* IsLost(), plus the first segment once DupThresh duplicate ACKs have
+       arrived, which starts recovery even if the SACKs are missing */
+    is_lost = (sacked_segs >= TCP_SACK_DUPTHRESH) ||
+              (sacked_bytes > (u32_t)(TCP_SACK_DUPTHRESH - 1) * pcb->mss) ||
+              ((seqno == pcb->lastack) && (pcb->dupacks >= TCP_SACK_DUPTHRESH));
+    if (!is_lost) {
+      pipe += TCP_TCPLEN(seg);
+    }
+    if ((pcb->flags & TF_INFR) && TCP_SEQ_LT(seqno, pcb->sack_high_rxt)) {
+      pipe += TCP_TCPLEN(seg);
+    } else if (is_lost && (*lost == NULL)) {
+      *lost = seg;
+    }
+  }
+  return pipe;
+}
+
+/**
+ * Retransmits a segment where it is in the unacked queue, for SACK loss
+ * recovery. Unlike tcp_rexmit(), this can repair a hole anywhere in the queue
+ * without the window check in tcp_output() holding it back.
+ *
+ * @param pcb the tcp_pcb in loss recovery
+ * @param seg the segment to retransmit, in the unacked queue
+ */
+static err_t
+tcp_sack_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  struct netif *netif;
+  err_t err;
+
+  /* Give up if the segment is still referenced by the netif driver
+     due to deferred transmission. */
+  if (tcp_output_segment_busy(seg)) {
+    LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_sack_rexmit_seg busy\n"));
+    return ERR_VAL;
+  }
+
+  netif = tcp_route(pcb, &pcb->local_ip, &pcb->remote_ip);
+  if (netif == NULL) {
+    return ERR_RTE;
+  }
+
+  /* Don't take any rtt measurements from a retransmission. */
+  pcb->rttest = 0;
+  err = tcp_output_segment(seg, pcb, netif);
+  pcb->rttest = 0;
+  if (err != ERR_OK) {
+    return err;
+  }
+
+  pcb->sack_high_rxt = lwip_ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
+  MIB2_STATS_INC(mib2.tcpretranssegs);
+  return ERR_OK;
+}
+
+/**
+ * Retransmits the segments presumed lost while the congestion window leaves
+ * room for at least one segment (NextSeg() rule 1 of RFC 6675).
+ *
+ * Called by tcp_output() during SACK loss recovery.
+ *
+ * @param pcb the tcp_pcb in loss recovery
+ * @param pipe receives the estimate of the data in flight afterwards
+ */
+static err_t
+tcp_sack_output_lost(struct tcp_pcb *pcb, u32_t *pipe)
+{
+  struct tcp_seg *seg;
+  err_t err;
+
+  for (;;) {
+    *pipe = tcp_sack_pipe(pcb, &seg);
+    if ((seg == NULL) || (*pipe + pcb->mss > pcb->cwnd)) {
+      return ERR_OK;
+    }
+    err = tcp_sack_rexmit_seg(pcb, seg);
+    if (err == ERR_VAL) {
+      /* Try again on the next ACK */
+      return ERR_OK;
+    }
+    if (err != ERR_OK) {
+      return err;
+    }
+  }
+}
+
+/**
+ * Handle a duplicate ACK on a connection that uses SACK: start loss recovery
+ * (RFC 6675) if the first unacked segment is presumed lost.
+ *
+ * The first segment is retransmitted right away. tcp_output() then sends the
+ * other lost segments and new data as the estimate of the data in flight
+ * allows.
+ *
+ * @param pcb the tcp_pcb that received a duplicate ACK
+ */
+void
+tcp_sack_rexmit_fast(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *lost;
+
+  LWIP_ASSERT("tcp_sack_rexmit_fast: invalid pcb", pcb != NULL);
+
+  if ((pcb->unacked == NULL) || (pcb->flags & TF_INFR)) {
+    return;
+  }
+  tcp_sack_pipe(pcb, &lost);
+  if (lost != pcb->unacked) {
+    return;
+  }
+
+  LWIP_DEBUGF(TCP_FR_DEBUG,
+              ("tcp_receive: dupacks %"U16_F" (%"U32_F
+               "), SACK recovery %"U32_F"\n",
+               (u16_t)pcb->dupacks, pcb->lastack,
+               lwip_ntohl(lost->tcphdr->seqno)));
+
+  pcb->cc->loss(pcb);
+  pcb->cwnd = pcb->ssthresh;
+  pcb->sack_recovery_point = pcb->snd_nxt;
+  pcb->sack_high_rxt = pcb->lastack;
+  tcp_set_flags(pcb, TF_INFR);
+
+  /* The first retransmission doesn't wait for the pipe to drain */
+  tcp_sack_rexmit_seg(pcb, lost);
+
+  /* Reset the retransmission timer to prevent immediate rto retransmissions */
+  pcb->rtime = 0;
+}
+#endif /* LWIP_TCP_SACK_IN */
+
 static struct pbuf *
 tcp_output_alloc_header_common(u32_t ackno, u16_t optlen, u16_t datalen,
                         u32_t seqno_be /* already in network byte order */,
@@ -2080,6 +2425,55 @@ tcp_rst_netif(struct netif *netif, u32_t seqno, u32_t ackno,
   }
 }
 
+#if TCP_SYN_COOKIES
+/**
+ * Send a SYN|ACK whose sequence number is a SYN cookie. No PCB exists for the
+ * connection yet, so only the MSS option is sent.
+ *
+ * Called by tcp_listen_input() when the listen backlog is full or no PCB
+ * could be allocated for a connection request.
+ *
+ * @param netif the netif on which to send the SYN|ACK
+ * @param seqno the SYN cookie, used as our initial sequence number
+ * @param ackno the acknowledge number to use for the outgoing segment
+ * @param local_ip the local IP address to send the segment from
+ * @param remote_ip the remote IP address to send the segment to
+ * @param local_port the local TCP port to send the segment from
+ * @param remote_port the remote TCP port to send the segment to
+ */
+void
+tcp_syncookie_synack_netif(struct netif *netif, u32_t seqno, u32_t ackno,
+                           const ip_addr_t *local_ip, const ip_addr_t *remote_ip,
+                           u16_t local_port, u16_t remote_port)
+{
+  struct pbuf *p;
+  struct tcp_hdr *tcphdr;
+  u16_t mss = TCP_MSS;
+
+  if (netif == NULL) {
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_syncookie_synack_netif: no netif given\n"));
+    return;
+  }
+
+#if TCP_CALCULATE_EFF_SEND_MSS
+  mss = tcp_eff_send_mss_netif(mss, netif, remote_ip);
+#endif /* TCP_CALCULATE_EFF_SEND_MSS */
+
+  /* The window in a SYN is never scaled */
+  p = tcp_output_alloc_header_common(ackno, LWIP_TCP_OPT_LEN_MSS, 0, lwip_htonl(seqno),
+    local_port, remote_port, TCP_SYN | TCP_ACK, TCPWND_MIN16(TCP_WND));
+  if (p == NULL) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_syncookie_synack_netif: could not allocate memory for pbuf\n"));
+    return;
+  }
+  tcphdr = (struct tcp_hdr *)p->payload;
+  *(u32_t *)(void *)(tcphdr + 1) = TCP_BUILD_MSS_OPTION(mss);
+
+  LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_syncookie_synack_netif: seqno %"U32_F" ackno %"U32_F".\n", seqno, ackno));
+  tcp_output_control_segment_netif(NULL, p, local_ip, remote_ip, netif);
+}
+#endif /* TCP_SYN_COOKIES */
+
 /**
  * Send an ACK without data.
  *
@@ -14,6 +14,9 @@
 #include "lwip/etharp.h"
 #include "lwip/init.h"
 #include "lwip/prot/ieee.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
 #include "lwip/timeouts.h"
 #include "netif/ethernet.h"
 
@@ -37,6 +40,19 @@ static struct dhcp s_dhcp;
 static struct autoip s_autoip;
 #endif  // LWIP_AUTOIP
 
+// TCP receive coalescing only works if lwIP doesn't check the IP and TCP
+// checksums because they aren't updated for the merged segment
+#define COALESCE_TCP_RX (QNETHERNET_ENABLE_TCP_RX_COALESCING && LWIP_IPV4 && \
+                         LWIP_TCP && !CHECKSUM_CHECK_IP && !CHECKSUM_CHECK_TCP)
+
+#if COALESCE_TCP_RX
+// The pending coalesced segment, passed to lwIP at the end of each input batch
+static struct pbuf *s_coalesced        = NULL;
+static uint16_t s_coalescedSegs        = 0;
+static uint32_t s_coalescedNextSeqno   = 0;  // Host order
+static bool s_coalescedPush            = false;
+#endif  // COALESCE_TCP_RX
+
 // --------------------------------------------------------------------------
 //  Internal Functions
 // --------------------------------------------------------------------------
@@ -52,6 +68,152 @@ static err_t link_output(struct netif *netif, struct pbuf *p) {
   return driver_output(p);
 }
 
+#if COALESCE_TCP_RX
+
+// Returns the IP header of the frame, in the first pbuf, if it's an
+// unfragmented IPv4 TCP segment without IP options, and carrying data, and
+// having only the ACK and, optionally, PSH flags set. Otherwise, this
+// returns NULL.
+static struct ip_hdr *coalescable_ip_hdr(const struct pbuf *p) {
+  if (p->len < SIZEOF_ETH_HDR + IP_HLEN + TCP_HLEN) {
+    return NULL;
+  }
+  const struct eth_hdr *ethhdr = (const struct eth_hdr *)p->payload;
+  if (ethhdr->type != PP_HTONS(ETHTYPE_IP)) {
+    return NULL;
+  }
+
+  struct ip_hdr *iphdr = (struct ip_hdr *)((uint8_t *)p->payload +
+                                           SIZEOF_ETH_HDR);
+  if (IPH_V(iphdr) != 4 || IPH_HL_BYTES(iphdr) != IP_HLEN ||
+      IPH_PROTO(iphdr) != IP_PROTO_TCP ||
+      (IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK | IP_MF)) != 0) {
+    return NULL;
+  }
+  uint16_t ipLen = lwip_ntohs(IPH_LEN(iphdr));
+  if (SIZEOF_ETH_HDR + ipLen > p->tot_len) {
+    return NULL;
+  }
+
+  const struct tcp_hdr *tcphdr =
+      (const struct tcp_hdr *)((const uint8_t *)iphdr + IP_HLEN);
+  uint16_t tcphdrLen = TCPH_HDRLEN_BYTES(tcphdr);
+  if (tcphdrLen < TCP_HLEN || ipLen <= IP_HLEN + tcphdrLen ||
+      p->len < SIZEOF_ETH_HDR + IP_HLEN + tcphdrLen) {
+    return NULL;
+  }
+
+  // Also exclude ECE and CWR
+  if ((lwip_ntohs(tcphdr->_hdrlen_rsvd_flags) & 0xff & ~TCP_PSH) != TCP_ACK) {
+    return NULL;
+  }
+
+  return iphdr;
+}
+
+// Passes any pending coalesced segment to lwIP.
+static void flush_coalesced(struct netif *netif) {
+  if (s_coalesced == NULL) {
+    return;
+  }
+  struct pbuf *p = s_coalesced;
+  s_coalesced = NULL;
+  if (ethernet_input(p, netif) != ERR_OK) {
+    pbuf_free(p);
+  }
+}
+
+// Appends the segment to the pending one if it's the next one in the same
+// flow. This returns whether the segment was appended.
+static bool append_coalesced(struct pbuf *p, const struct ip_hdr *iphdr) {
+  if (s_coalescedSegs >= QNETHERNET_TCP_RX_COALESCE_MAX_SEGS) {
+    return false;
+  }
+
+  const struct eth_hdr *ethhdr = (const struct eth_hdr *)p->payload;
+  const struct tcp_hdr *tcphdr =
+      (const struct tcp_hdr *)((const uint8_t *)iphdr + IP_HLEN);
+  struct eth_hdr *headEthhdr = (struct eth_hdr *)s_coalesced->payload;
+  struct ip_hdr *headIphdr = (struct ip_hdr *)((uint8_t *)headEthhdr +
+                                               SIZEOF_ETH_HDR);
+  struct tcp_hdr *headTcphdr = (struct tcp_hdr *)((uint8_t *)headIphdr +
+                                                  IP_HLEN);
+
+  uint16_t tcphdrLen = TCPH_HDRLEN_BYTES(tcphdr);
+  uint16_t dataLen = lwip_ntohs(IPH_LEN(iphdr)) - IP_HLEN - tcphdrLen;
+  uint32_t headIPLen = lwip_ntohs(IPH_LEN(headIphdr));
+  if (headIPLen + dataLen > 0xffff) {
+    return false;
+  }
+
+  // Same addresses, ports, TOS, ACK, header length, and options, and
+  // in sequence
+  if (memcmp(&ethhdr->dest, &headEthhdr->dest, 2*ETH_HWADDR_LEN) != 0 ||
+      memcmp(&iphdr->src, &headIphdr->src, 2*sizeof(iphdr->src)) != 0 ||
+      IPH_TOS(iphdr) != IPH_TOS(headIphdr) ||
+      tcphdr->src != headTcphdr->src || tcphdr->dest != headTcphdr->dest ||
+      tcphdr->ackno != headTcphdr->ackno ||
+      tcphdrLen != TCPH_HDRLEN_BYTES(headTcphdr) ||
+      lwip_ntohl(tcphdr->seqno) != s_coalescedNextSeqno ||
+      memcmp(tcphdr + 1, headTcphdr + 1, tcphdrLen - TCP_HLEN) != 0) {
+    return false;
+  }
+
+  // Trim any Ethernet padding and strip the headers
+  pbuf_realloc(p, SIZEOF_ETH_HDR + IP_HLEN + tcphdrLen + dataLen);
+  if (pbuf_remove_header(p, SIZEOF_ETH_HDR + IP_HLEN + tcphdrLen) != 0) {
+    return false;
+  }
+
+  // Fix up the head's headers; the last window and any PSH win
+  IPH_LEN_SET(headIphdr, lwip_htons((uint16_t)(headIPLen + dataLen)));
+  headTcphdr->wnd = tcphdr->wnd;
+  if ((TCPH_FLAGS(tcphdr) & TCP_PSH) != 0) {
+    TCPH_SET_FLAG(headTcphdr, TCP_PSH);
+    s_coalescedPush = true;
+  }
+  pbuf_cat(s_coalesced, p);
+  s_coalescedSegs++;
+  s_coalescedNextSeqno += dataLen;
+  return true;
+}
+
+// Input function that merges consecutive in-order TCP segments of the same flow
+// into one pbuf chain before passing them to ethernet_input(). Anything pending
+// is flushed on a gap, a flag change, a different frame, or at the end of the
+// input batch.
+static err_t coalesce_input(struct pbuf *p, struct netif *netif) {
+  const struct ip_hdr *iphdr = coalescable_ip_hdr(p);
+  if (iphdr == NULL) {
+    flush_coalesced(netif);
+    return ethernet_input(p, netif);
+  }
+
+  if (s_coalesced == NULL || !append_coalesced(p, iphdr)) {
+    flush_coalesced(netif);
+
+    const struct tcp_hdr *tcphdr =
+        (const struct tcp_hdr *)((const uint8_t *)iphdr + IP_HLEN);
+    uint16_t ipLen = lwip_ntohs(IPH_LEN(iphdr));
+    pbuf_realloc(p, SIZEOF_ETH_HDR + ipLen);  // Trim any Ethernet padding
+    s_coalesced          = p;
+    s_coalescedSegs      = 1;
+    s_coalescedNextSeqno = lwip_ntohl(tcphdr->seqno) + ipLen - IP_HLEN -
+                           TCPH_HDRLEN_BYTES(tcphdr);
+    s_coalescedPush      = ((TCPH_FLAGS(tcphdr) & TCP_PSH) != 0);
+  }
+
+  if (s_coalescedPush) {
+    flush_coalesced(netif);
+  }
+  return ERR_OK;
+}
+
+#define NETIF_INPUT coalesce_input
+#else
+#define NETIF_INPUT ethernet_input
+#endif  // COALESCE_TCP_RX
+
 // Initializes the netif.
 static err_t init_netif(struct netif *netif) {
   if (netif == NULL) {
@@ -167,7 +329,7 @@ bool enet_init(const uint8_t mac[ETH_HWADDR_LEN],
 
   if (!s_isNetifAdded) {
     netif_add_ext_callback(&netif_callback, callback);
-    if (netif_add_noaddr(&s_netif, NULL, init_netif, ethernet_input) == NULL) {
+    if (netif_add_noaddr(&s_netif, NULL, init_netif, NETIF_INPUT) == NULL) {
       netif_remove_ext_callback(&netif_callback);
       return false;
     }
@@ -215,6 +377,9 @@ void enet_deinit() {
 
 void enet_proc_input() {
   driver_proc_input(&s_netif);
+#if COALESCE_TCP_RX
+  flush_coalesced(&s_netif);
+#endif  // COALESCE_TCP_RX
 }
 
 void enet_poll() {
@@ -252,6 +417,9 @@ bool enet_output_frame(const uint8_t *frame, size_t len) {
       if (s_netif.input(p, &s_netif) != ERR_OK) {
         pbuf_free(p);
       }
+#if COALESCE_TCP_RX
+      flush_coalesced(&s_netif);
+#endif  // COALESCE_TCP_RX
     }
     // TODO: Collect stats?
     return true;
@@ -80,14 +80,23 @@ void qnethernet_hal_check_core_locking(const char *file, int line,
    (LWIP_TCP + IP_REASSEMBLY + LWIP_ARP + (2*LWIP_DHCP) + LWIP_ACD + \
     LWIP_IGMP + LWIP_DNS + PPP_NUM_TIMEOUTS +                        \
     (LWIP_IPV6*(1 + LWIP_IPV6_REASS + LWIP_IPV6_MLD + LWIP_IPV6_DHCP6)))*/
+// The W5500 hardware TCP sockets don't use PCBs, but their connections use the
+// same timers; this must be at least the driver's kTCPSocketCount
+#if defined(QNETHERNET_DRIVER_W5500) && QNETHERNET_ENABLE_W5500_TCP_OFFLOAD
+#define QNETHERNET_INTERNAL_HW_TCP_SOCKETS 7
+#else
+#define QNETHERNET_INTERNAL_HW_TCP_SOCKETS 0
+#endif  // defined(QNETHERNET_DRIVER_W5500) && QNETHERNET_ENABLE_W5500_TCP_OFFLOAD
+// Increment MEMP_NUM_SYS_TIMEOUT by two per TCP socket, PCB or hardware, for
+// the cork and posted receive timers
 #if !defined(LWIP_MDNS_RESPONDER) || LWIP_MDNS_RESPONDER
 // Increment MEMP_NUM_SYS_TIMEOUT by 8 for mDNS
 // Refs:
 // * https://lists.nongnu.org/archive/html/lwip-users/2024-05/msg00000.html
 // * https://savannah.nongnu.org/patch/?9523#comment18
-#define MEMP_NUM_SYS_TIMEOUT               ((LWIP_NUM_SYS_TIMEOUT_INTERNAL) + (8))  /* LWIP_NUM_SYS_TIMEOUT_INTERNAL */
+#define MEMP_NUM_SYS_TIMEOUT               ((LWIP_NUM_SYS_TIMEOUT_INTERNAL) + (8) + (2 * LWIP_TCP * (MEMP_NUM_TCP_PCB + QNETHERNET_INTERNAL_HW_TCP_SOCKETS)))  /* LWIP_NUM_SYS_TIMEOUT_INTERNAL */
 #else
-// #define MEMP_NUM_SYS_TIMEOUT               LWIP_NUM_SYS_TIMEOUT_INTERNAL
+#define MEMP_NUM_SYS_TIMEOUT               ((LWIP_NUM_SYS_TIMEOUT_INTERNAL) + (2 * LWIP_TCP * (MEMP_NUM_TCP_PCB + QNETHERNET_INTERNAL_HW_TCP_SOCKETS)))  /* LWIP_NUM_SYS_TIMEOUT_INTERNAL */
 #endif  // !defined(LWIP_MDNS_RESPONDER) || LWIP_MDNS_RESPONDER
 // #define MEMP_NUM_NETBUF                    2
 // #define MEMP_NUM_NETCONN                   4
@@ -224,11 +233,23 @@ void qnethernet_hal_check_core_locking(const char *file, int line,
 // #define TCP_SYNMAXRTX              6
 // #define TCP_QUEUE_OOSEQ            LWIP_TCP
 // #define LWIP_TCP_SACK_OUT          0
+// Received SACKs are used whenever they're negotiated
+#ifndef LWIP_TCP_SACK_IN
+#define LWIP_TCP_SACK_IN           LWIP_TCP_SACK_OUT  /* 0 */
+#endif  // !LWIP_TCP_SACK_IN
 // #define LWIP_TCP_MAX_SACK_NUM      4
 #define TCP_MSS                    1460  /* 536 */
 // #define TCP_CALCULATE_EFF_SEND_MSS 1
 // #define LWIP_TCP_RTO_TIME          3000
 #define TCP_SND_BUF                (4 * TCP_MSS)  /* (2 * TCP_MSS) */
+// NewReno's initial congestion window, from RFC 2581 (about 3 segments)
+/* #define LWIP_TCP_CALC_INITIAL_CWND(mss) \
+   ((tcpwnd_size_t)LWIP_MIN((4U * (mss)), LWIP_MAX((2U * (mss)), 4380U)))*/
+// Congestion control for new sockets; tcp_cc_lan (10 initial segments) and
+// tcp_cc_lan_delay suit lightly-loaded LANs, but note that sending is also
+// limited by TCP_SND_BUF
+// #define LWIP_TCP_CC_DEFAULT        tcp_cc_newreno
+// #define LWIP_TCP_CC_DELAY_TARGET   5
 // #define TCP_SND_QUEUELEN           ((4 * (TCP_SND_BUF) + (TCP_MSS - 1))/(TCP_MSS))
 /* #define TCP_SNDLOWAT \
    LWIP_MIN(LWIP_MAX(((TCP_SND_BUF)/2), (2 * TCP_MSS) + 1), (TCP_SND_BUF) - 1)*/
@@ -237,12 +258,23 @@ void qnethernet_hal_check_core_locking(const char *file, int line,
 // #if TCP_OOSEQ_MAX_BYTES
 // #define TCP_OOSEQ_BYTES_LIMIT(pcb) TCP_OOSEQ_MAX_BYTES
 // #endif
+// With SACKs, a limit of, say, 8 keeps one connection's out-of-sequence queue
+// from taking the whole pbuf pool, so that SACKed data isn't dropped again
+// under memory pressure
 // #define TCP_OOSEQ_MAX_PBUFS        0
 // #if TCP_OOSEQ_MAX_PBUFS
 // #define TCP_OOSEQ_PBUFS_LIMIT(pcb) TCP_OOSEQ_MAX_PBUFS
 // #endif
+// TCP_LISTEN_BACKLOG limits half-open connections per listener so that a burst
+// of connection attempts can't use up all the PCBs, and TCP_SYN_COOKIES answers
+// the excess SYNs with SYN cookies. A backlog below the number of clients that
+// connect at once refuses or delays real clients.
 // #define TCP_LISTEN_BACKLOG         0
 // #define TCP_DEFAULT_LISTEN_BACKLOG 0xff
+// #define TCP_SYN_COOKIES            0
+// #define LWIP_TCP_FASTOPEN          0
+// #define LWIP_TCP_FASTOPEN_CACHE_SIZE 4
+// #define TCP_SYN_RCVD_TIMEOUT       20000
 // #define TCP_OVERSIZE               TCP_MSS
 // #define LWIP_TCP_TIMESTAMPS        0
 // #define TCP_WND_UPDATE_THRESHOLD   LWIP_MIN((TCP_WND / 4), (TCP_MSS * 4))
@@ -57,6 +57,12 @@
 #define QNETHERNET_ENABLE_ALTCP_DEFAULT_FUNCTIONS 0
 #endif
 
+// Enables formatting of most '%f' conversions in util::vformat() without
+// snprintf(). The result is the same, but it needs a fast fma().
+#ifndef QNETHERNET_ENABLE_PRINTF_FIXED
+#define QNETHERNET_ENABLE_PRINTF_FIXED 0
+#endif
+
 // Enables promiscuous mode.
 #ifndef QNETHERNET_ENABLE_PROMISCUOUS_MODE
 #define QNETHERNET_ENABLE_PROMISCUOUS_MODE 0
@@ -73,6 +79,19 @@
 #define QNETHERNET_ENABLE_RAW_FRAME_SUPPORT 0
 #endif
 
+// Enables coalescing of consecutive in-order TCP segments from the same flow,
+// received in the same input batch, before they're passed to lwIP. This has no
+// effect if lwIP checks IP or TCP checksums in software.
+#ifndef QNETHERNET_ENABLE_TCP_RX_COALESCING
+#define QNETHERNET_ENABLE_TCP_RX_COALESCING 0
+#endif
+
+// Enables the W5500 hardware TCP sockets as an altcp allocator,
+// 'altcp_w5500_alloc'. This requires LWIP_ALTCP and the W5500 driver.
+#ifndef QNETHERNET_ENABLE_W5500_TCP_OFFLOAD
+#define QNETHERNET_ENABLE_W5500_TCP_OFFLOAD 0
+#endif
+
 // Follows every call to 'EthernetClient::write()` with a flush. This may reduce
 // TCP efficency. This option is for use with hard-to-modify code or libraries
 // that assume data will get sent immediately. The preferred approach is to call
@@ -86,6 +105,19 @@
 #define QNETHERNET_LWIP_MEMORY_IN_RAM1 0
 #endif
 
+// The size of the stack buffer used to format printf() output for the
+// networking objects, see util::vformat(). Longer output is written in pieces
+// of this size.
+#ifndef QNETHERNET_PRINTF_BUFFER_SIZE
+#define QNETHERNET_PRINTF_BUFFER_SIZE 512
+#endif
+
+// The maximum number of TCP segments merged into one when TCP receive
+// coalescing is enabled.
+#ifndef QNETHERNET_TCP_RX_COALESCE_MAX_SEGS
+#define QNETHERNET_TCP_RX_COALESCE_MAX_SEGS 8
+#endif
+
 // Use the Entropy library instead of internal functions. (Teensy 4)
 #ifndef QNETHERNET_USE_ENTROPY_LIB
 #define QNETHERNET_USE_ENTROPY_LIB 0
@@ -0,0 +1,118 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// sha1.cpp implements SHA1.
+// This file is part of the QNEthernet library.
+
+#include "sha1.h"
+
+// C++ includes
+#include <cstring>
+
+namespace qindesign {
+namespace security {
+
+static inline uint32_t rol(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+void SHA1::reset() {
+  h_[0] = 0x67452301;
+  h_[1] = 0xEFCDAB89;
+  h_[2] = 0x98BADCFE;
+  h_[3] = 0x10325476;
+  h_[4] = 0xC3D2E1F0;
+  blockLen_ = 0;
+  totalLen_ = 0;
+}
+
+void SHA1::processBlock(const uint8_t *block) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t{block[i*4]} << 24) | (uint32_t{block[i*4 + 1]} << 16) |
+           (uint32_t{block[i*4 + 2]} << 8) | uint32_t{block[i*4 + 3]};
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32_t a = h_[0];
+  uint32_t b = h_[1];
+  uint32_t c = h_[2];
+  uint32_t d = h_[3];
+  uint32_t e = h_[4];
+  for (int i = 0; i < 80; i++) {
+    uint32_t f;
+    uint32_t k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    uint32_t t = rol(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rol(b, 30);
+    b = a;
+    a = t;
+  }
+  h_[0] += a;
+  h_[1] += b;
+  h_[2] += c;
+  h_[3] += d;
+  h_[4] += e;
+}
+
+void SHA1::update(const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  totalLen_ += size;
+  while (size > 0) {
+    size_t n = sizeof(block_) - blockLen_;
+    if (n > size) {
+      n = size;
+    }
+    std::memcpy(&block_[blockLen_], p, n);
+    blockLen_ += n;
+    p += n;
+    size -= n;
+    if (blockLen_ == sizeof(block_)) {
+      processBlock(block_);
+      blockLen_ = 0;
+    }
+  }
+}
+
+void SHA1::final(uint8_t digest[kDigestSize]) {
+  uint64_t bits = totalLen_ * 8;
+
+  // Padding: a 1 bit, zeros, and then the 64-bit length
+  block_[blockLen_++] = 0x80;
+  if (blockLen_ > sizeof(block_) - 8) {
+    std::memset(&block_[blockLen_], 0, sizeof(block_) - blockLen_);
+    processBlock(block_);
+    blockLen_ = 0;
+  }
+  std::memset(&block_[blockLen_], 0, sizeof(block_) - 8 - blockLen_);
+  for (int i = 0; i < 8; i++) {
+    block_[56 + i] = static_cast<uint8_t>(bits >> (56 - i*8));
+  }
+  processBlock(block_);
+
+  for (int i = 0; i < 5; i++) {
+    digest[i*4]     = static_cast<uint8_t>(h_[i] >> 24);
+    digest[i*4 + 1] = static_cast<uint8_t>(h_[i] >> 16);
+    digest[i*4 + 2] = static_cast<uint8_t>(h_[i] >> 8);
+    digest[i*4 + 3] = static_cast<uint8_t>(h_[i]);
+  }
+}
+
+}  // namespace security
+}  // namespace qindesign
@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// sha1.h defines a SHA-1 hash implementation.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+
+namespace qindesign {
+namespace security {
+
+// SHA1 computes a SHA-1 digest. This is for protocols that require it, such as
+// the WebSocket handshake, and shouldn't be used for anything security-related.
+class SHA1 final {
+ public:
+  static constexpr size_t kDigestSize = 20;
+
+  SHA1() { reset(); }
+  ~SHA1() = default;
+
+  // Starts a new digest.
+  void reset();
+
+  // Adds data to the digest.
+  void update(const void *data, size_t size);
+
+  // Finishes the digest and stores it in 'digest'. Call reset() before using
+  // this object again.
+  void final(uint8_t digest[kDigestSize]);
+
+ private:
+  void processBlock(const uint8_t *block);
+
+  uint32_t h_[5];
+  uint8_t block_[64];
+  size_t blockLen_;
+  uint64_t totalLen_;
+};
+
+}  // namespace security
+}  // namespace qindesign
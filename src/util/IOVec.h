@@ -0,0 +1,33 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// IOVec.h defines a buffer segment for gather writes.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+
+namespace qindesign {
+namespace network {
+
+// IOVec describes one buffer in a list of buffers that are written together;
+// for example, a header, a body, and a trailer.
+struct IOVec final {
+  const uint8_t *data;
+  size_t size;
+};
+
+// Returns the total size of the given segments.
+inline size_t iovecSize(const IOVec *iov, size_t count) {
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += iov[i].size;
+  }
+  return total;
+}
+
+}  // namespace network
+}  // namespace qindesign
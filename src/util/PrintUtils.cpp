@@ -6,6 +6,18 @@
 
 #include "PrintUtils.h"
 
+// C++ includes
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include "qnethernet_opts.h"
+
 namespace qindesign {
 namespace network {
 
@@ -52,6 +64,596 @@ size_t writeMagic(Print &p, const uint8_t mac[ETH_HWADDR_LEN],
   return written;
 }
 
+// --------------------------------------------------------------------------
+//  Formatting
+// --------------------------------------------------------------------------
+
+// Collects formatted output and writes it to a Print object whenever the
+// buffer fills.
+class FormatBuffer final {
+ public:
+  explicit FormatBuffer(Print &p) : p_(p) {}
+
+  void put(char c) {
+    if (len_ == sizeof(buf_)) {
+      flush();
+    }
+    buf_[len_++] = c;
+    count_++;
+  }
+
+  void put(const char *s, size_t n) {
+    count_ += n;
+    while (n > 0) {
+      if (len_ == sizeof(buf_)) {
+        flush();
+      }
+      const size_t size = std::min(n, sizeof(buf_) - len_);
+      std::memcpy(&buf_[len_], s, size);
+      len_ += size;
+      s += size;
+      n -= size;
+    }
+  }
+
+  void pad(char c, int n) {
+    while (n > 0) {
+      if (len_ == sizeof(buf_)) {
+        flush();
+      }
+      const size_t size = std::min(static_cast<size_t>(n), sizeof(buf_) - len_);
+      std::memset(&buf_[len_], c, size);
+      len_ += size;
+      count_ += size;
+      n -= size;
+    }
+  }
+
+  void setError() {
+    error_ = true;
+  }
+
+  int count() const {
+    return count_;
+  }
+
+  // Writes anything left and returns the printf()-style result: the number
+  // of characters written, or -1 if there was a formatting error.
+  int finish() {
+    flush();
+    return error_ ? -1 : written_;
+  }
+
+ private:
+  // Nothing more is written after a short write.
+  void flush() {
+    if (len_ > 0 && !shortWrite_) {
+      const size_t n = p_.write(reinterpret_cast<const uint8_t *>(buf_), len_);
+      written_ += n;
+      if (n != len_) {
+        shortWrite_ = true;
+      }
+    }
+    len_ = 0;
+  }
+
+  Print &p_;
+  char buf_[QNETHERNET_PRINTF_BUFFER_SIZE];
+  size_t len_ = 0;
+  int count_ = 0;    // Characters formatted
+  int written_ = 0;  // Characters accepted by the Print object
+  bool shortWrite_ = false;
+  bool error_ = false;
+};
+
+// Conversion flags
+enum Flags : uint8_t {
+  kLeft  = 0x01,  // '-'
+  kPlus  = 0x02,  // '+'
+  kSpace = 0x04,  // ' '
+  kAlt   = 0x08,  // '#'
+  kZero  = 0x10,  // '0'
+};
+
+// Length modifiers
+enum class Length : uint8_t {
+  kNone,
+  kChar,        // hh
+  kShort,       // h
+  kLong,        // l
+  kLongLong,    // ll
+  kIntMax,      // j
+  kSize,        // z
+  kPtrDiff,     // t
+  kLongDouble,  // L
+};
+
+using ssize_type = std::make_signed<size_t>::type;
+
+// Writes a padded field whose contents are a prefix, some zeros, and a body.
+static void putField(FormatBuffer &out, uint8_t flags, int width,
+                     const char *prefix, size_t prefixLen, int zeros,
+                     const char *body, size_t bodyLen) {
+  int padding = width - static_cast<int>(prefixLen + bodyLen) - zeros;
+  if ((flags & kLeft) == 0) {
+    out.pad(' ', padding);
+  }
+  out.put(prefix, prefixLen);
+  out.pad('0', zeros);
+  out.put(body, bodyLen);
+  if ((flags & kLeft) != 0) {
+    out.pad(' ', padding);
+  }
+}
+
+// Formats an integer conversion. A negative precision means there
+// wasn't one.
+static void putInteger(FormatBuffer &out, uint8_t flags, int width,
+                       int precision, char conv, uintmax_t v, bool negative) {
+  static constexpr char kLower[] = "0123456789abcdef";
+  static constexpr char kUpper[] = "0123456789ABCDEF";
+
+  const unsigned base = (conv == 'o') ? 8
+                        : (conv == 'x' || conv == 'X' || conv == 'p') ? 16
+                                                                        : 10;
+  const char *const table = (conv == 'X') ? kUpper : kLower;
+
+  // Digits, generated from the end; 64-bit octal needs 22
+  char digits[24];
+  char *const end = &digits[sizeof(digits)];
+  char *d = end;
+  const bool isZero = (v == 0);
+  if (!isZero || precision != 0) {
+    // Avoid 64-bit division when possible
+    if (v <= UINT32_MAX) {
+      uint32_t v32 = v;
+      do {
+        *--d = table[v32 % base];
+        v32 /= base;
+      } while (v32 != 0);
+    } else {
+      do {
+        *--d = table[v % base];
+        v /= base;
+      } while (v != 0);
+    }
+  }
+  size_t nDigits = end - d;
+
+  char prefix[2];
+  size_t prefixLen = 0;
+  if (negative) {
+    prefix[prefixLen++] = '-';
+  } else if ((flags & kPlus) != 0 && (conv == 'd' || conv == 'i')) {
+    prefix[prefixLen++] = '+';
+  } else if ((flags & kSpace) != 0 && (conv == 'd' || conv == 'i')) {
+    prefix[prefixLen++] = ' ';
+  } else if (conv == 'p' || ((flags & kAlt) != 0 && base == 16 && !isZero)) {
+    prefix[prefixLen++] = '0';
+    prefix[prefixLen++] = (conv == 'X') ? 'X' : 'x';
+  }
+
+  // '#' with 'o' makes the first digit a zero
+  if ((flags & kAlt) != 0 && base == 8 &&
+      (nDigits == 0 || *d != '0') &&
+      precision <= static_cast<int>(nDigits)) {
+    precision = nDigits + 1;
+  }
+
+  int zeros = 0;
+  if (precision >= 0) {
+    zeros = std::max(0, precision - static_cast<int>(nDigits));
+  } else if ((flags & (kZero | kLeft)) == kZero) {
+    zeros = std::max(0, width - static_cast<int>(prefixLen + nDigits));
+  }
+  putField(out, flags, width, prefix, prefixLen, zeros, d, nDigits);
+}
+
+// Writes the digits of a value into the end of a buffer and returns a pointer
+// to the first digit. At least 'minDigits' digits are written.
+static char *putDecimal(char *end, uint64_t v, int minDigits) {
+  char *d = end;
+  while (v > UINT32_MAX) {
+    *--d = '0' + (v % 10);
+    v /= 10;
+  }
+  uint32_t v32 = v;
+  do {
+    *--d = '0' + (v32 % 10);
+    v32 /= 10;
+  } while (v32 != 0);
+  while (end - d < minDigits) {
+    *--d = '0';
+  }
+  return d;
+}
+
+#if QNETHERNET_ENABLE_PRINTF_FIXED
+// Formats a finite 'f' conversion without snprintf() when the scaled value
+// fits in a double's mantissa. The result is rounded exactly, the same as
+// printf(), by using fma() to find the error in the scaling. This returns
+// false if the value can't be formatted here.
+static bool putFixed(FormatBuffer &out, uint8_t flags, int width,
+                     int precision, double v) {
+  static constexpr double kPow10[]{
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+      1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+  };
+  static constexpr double kLimit = 4503599627370496.0;  // 2^52
+
+  if (precision < 0) {
+    precision = 6;
+  }
+  if (precision >= static_cast<int>(std::size(kPow10)) || !std::isfinite(v)) {
+    return false;
+  }
+  const bool negative = std::signbit(v);
+  const double a = std::fabs(v);
+  const double scale = kPow10[precision];
+  const double p = a * scale;
+  if (!(p < kLimit)) {
+    return false;
+  }
+
+  // The exact product is p + err; round it to the nearest integer, with ties
+  // going to even
+  const double err = std::fma(a, scale, -p);
+  double r = std::nearbyint(p);
+  const double diff = p - r;  // Exact
+  if (diff == 0.5 && err > 0) {
+    r += 1;
+  } else if (diff == -0.5 && err < 0) {
+    r -= 1;
+  }
+  const uint64_t n = static_cast<uint64_t>(r);
+  const uint64_t iscale = static_cast<uint64_t>(scale);
+
+  // Integer part, '.', and fraction; 2^52 has 16 digits
+  char digits[40];
+  char *const end = &digits[sizeof(digits)];
+  char *d = end;
+  if (precision > 0) {
+    d = putDecimal(d, n % iscale, precision);
+  }
+  if (precision > 0 || (flags & kAlt) != 0) {
+    *--d = '.';
+  }
+  d = putDecimal(d, n / iscale, 1);
+  const size_t len = end - d;
+
+  char prefix[1];
+  size_t prefixLen = 0;
+  if (negative) {
+    prefix[prefixLen++] = '-';
+  } else if ((flags & kPlus) != 0) {
+    prefix[prefixLen++] = '+';
+  } else if ((flags & kSpace) != 0) {
+    prefix[prefixLen++] = ' ';
+  }
+
+  int zeros = 0;
+  if ((flags & (kZero | kLeft)) == kZero) {
+    zeros = std::max(0, width - static_cast<int>(prefixLen + len));
+  }
+  putField(out, flags, width, prefix, prefixLen, zeros, d, len);
+  return true;
+}
+#endif  // QNETHERNET_ENABLE_PRINTF_FIXED
+
+// Formats a floating-point conversion with snprintf(). T is double or
+// long double.
+template <typename T>
+static void putFloat(FormatBuffer &out, uint8_t flags, int width,
+                     int precision, char conv, T v) {
+  char spec[12];
+  size_t n = 0;
+  spec[n++] = '%';
+  if ((flags & kLeft) != 0)  spec[n++] = '-';
+  if ((flags & kPlus) != 0)  spec[n++] = '+';
+  if ((flags & kSpace) != 0) spec[n++] = ' ';
+  if ((flags & kAlt) != 0)   spec[n++] = '#';
+  if ((flags & kZero) != 0)  spec[n++] = '0';
+  spec[n++] = '*';
+  spec[n++] = '.';
+  spec[n++] = '*';
+  if (std::is_same<T, long double>::value) {
+    spec[n++] = 'L';
+  }
+  spec[n++] = conv;
+  spec[n] = '\0';
+
+  char buf[64];
+  int size = std::snprintf(buf, sizeof(buf), spec, width, precision, v);
+  if (size < 0) {
+    out.setError();
+    return;
+  }
+  if (static_cast<size_t>(size) < sizeof(buf)) {
+    out.put(buf, size);
+    return;
+  }
+
+  // Rare: very large values with 'f' or large widths or precisions
+  std::unique_ptr<char[]> big{new (std::nothrow) char[size + 1]};
+  if (big == nullptr) {
+    errno = ENOMEM;
+    out.setError();
+    return;
+  }
+  std::snprintf(big.get(), size + 1, spec, width, precision, v);
+  out.put(big.get(), size);
+}
+
+// Reads a signed integer argument of the given length.
+static intmax_t signedArg(Length length, std::va_list &args) {
+  switch (length) {
+    case Length::kChar:
+      return static_cast<signed char>(va_arg(args, int));
+    case Length::kShort:
+      return static_cast<short>(va_arg(args, int));
+    case Length::kLong:
+      return va_arg(args, long);
+    case Length::kLongLong:
+      return va_arg(args, long long);
+    case Length::kIntMax:
+      return va_arg(args, intmax_t);
+    case Length::kSize:
+      return va_arg(args, ssize_type);
+    case Length::kPtrDiff:
+      return va_arg(args, ptrdiff_t);
+    default:
+      return va_arg(args, int);
+  }
+}
+
+// Reads an unsigned integer argument of the given length.
+static uintmax_t unsignedArg(Length length, std::va_list &args) {
+  switch (length) {
+    case Length::kChar:
+      return static_cast<unsigned char>(va_arg(args, unsigned));
+    case Length::kShort:
+      return static_cast<unsigned short>(va_arg(args, unsigned));
+    case Length::kLong:
+      return va_arg(args, unsigned long);
+    case Length::kLongLong:
+      return va_arg(args, unsigned long long);
+    case Length::kIntMax:
+      return va_arg(args, uintmax_t);
+    case Length::kSize:
+      return va_arg(args, size_t);
+    case Length::kPtrDiff:
+      return static_cast<std::make_unsigned<ptrdiff_t>::type>(
+          va_arg(args, ptrdiff_t));
+    default:
+      return va_arg(args, unsigned);
+  }
+}
+
+// Stores the count for 'n'.
+static void storeCount(Length length, int count, std::va_list &args) {
+  switch (length) {
+    case Length::kChar:
+      *va_arg(args, signed char *) = count;
+      break;
+    case Length::kShort:
+      *va_arg(args, short *) = count;
+      break;
+    case Length::kLong:
+      *va_arg(args, long *) = count;
+      break;
+    case Length::kLongLong:
+      *va_arg(args, long long *) = count;
+      break;
+    case Length::kIntMax:
+      *va_arg(args, intmax_t *) = count;
+      break;
+    case Length::kSize:
+      *va_arg(args, ssize_type *) = count;
+      break;
+    case Length::kPtrDiff:
+      *va_arg(args, ptrdiff_t *) = count;
+      break;
+    default:
+      *va_arg(args, int *) = count;
+      break;
+  }
+}
+
+int vformat(Print &p, const char *format, std::va_list args) {
+  // Work on a copy so it can be passed by reference on all platforms
+  std::va_list ap;
+  va_copy(ap, args);
+
+  FormatBuffer out{p};
+  const char *s = format;
+  while (*s != '\0') {
+    // Copy everything up to the next conversion
+    const char *pct = std::strchr(s, '%');
+    if (pct == nullptr) {
+      out.put(s, std::strlen(s));
+      break;
+    }
+    out.put(s, pct - s);
+    const char *const specStart = pct;
+    s = pct + 1;
+
+    // Flags
+    uint8_t flags = 0;
+    while (true) {
+      switch (*s) {
+        case '-': flags |= kLeft;  s++; continue;
+        case '+': flags |= kPlus;  s++; continue;
+        case ' ': flags |= kSpace; s++; continue;
+        case '#': flags |= kAlt;   s++; continue;
+        case '0': flags |= kZero;  s++; continue;
+      }
+      break;
+    }
+
+    // Width
+    int width = 0;
+    if (*s == '*') {
+      width = va_arg(ap, int);
+      if (width < 0) {
+        flags |= kLeft;
+        width = -width;
+      }
+      s++;
+    } else {
+      while ('0' <= *s && *s <= '9') {
+        width = width * 10 + (*s++ - '0');
+      }
+    }
+
+    // Precision
+    int precision = -1;
+    if (*s == '.') {
+      s++;
+      if (*s == '*') {
+        precision = std::max(-1, va_arg(ap, int));
+        s++;
+      } else {
+        precision = 0;
+        while ('0' <= *s && *s <= '9') {
+          precision = precision * 10 + (*s++ - '0');
+        }
+      }
+    }
+
+    // Length
+    Length length = Length::kNone;
+    switch (*s) {
+      case 'h':
+        s++;
+        length = Length::kShort;
+        if (*s == 'h') {
+          s++;
+          length = Length::kChar;
+        }
+        break;
+      case 'l':
+        s++;
+        length = Length::kLong;
+        if (*s == 'l') {
+          s++;
+          length = Length::kLongLong;
+        }
+        break;
+      case 'j': s++; length = Length::kIntMax;     break;
+      case 'z': s++; length = Length::kSize;       break;
+      case 't': s++; length = Length::kPtrDiff;    break;
+      case 'L': s++; length = Length::kLongDouble; break;
+    }
+
+    const char conv = *s;
+    if (conv == '\0') {
+      // Incomplete conversion; print it as-is
+      out.put(specStart, s - specStart);
+      break;
+    }
+    s++;
+
+    switch (conv) {
+      case 'd':
+      case 'i': {
+        const intmax_t v = signedArg(length, ap);
+        const uintmax_t mag = (v < 0) ? -static_cast<uintmax_t>(v)
+                                      : static_cast<uintmax_t>(v);
+        putInteger(out, flags, width, precision, conv, mag, v < 0);
+        break;
+      }
+
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        putInteger(out, flags, width, precision, conv, unsignedArg(length, ap),
+                   false);
+        break;
+
+      case 'p':
+        putInteger(out, flags & ~(kPlus | kSpace), width, precision, conv,
+                   reinterpret_cast<uintptr_t>(va_arg(ap, void *)), false);
+        break;
+
+      case 'c': {
+        const char c = va_arg(ap, int);
+        putField(out, flags, width, nullptr, 0, 0, &c, 1);
+        break;
+      }
+
+      case 's': {
+        const char *str = va_arg(ap, const char *);
+        if (str == nullptr) {
+          str = "(null)";
+        }
+        size_t len;
+        if (precision >= 0) {
+          // The string doesn't need to be terminated within the precision
+          const void *nul = std::memchr(str, '\0', precision);
+          len = (nul == nullptr) ? precision
+                                 : static_cast<const char *>(nul) - str;
+        } else {
+          len = std::strlen(str);
+        }
+        putField(out, flags, width, nullptr, 0, 0, str, len);
+        break;
+      }
+
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        if (length == Length::kLongDouble) {
+          putFloat(out, flags, width, precision, conv,
+                   va_arg(ap, long double));
+        } else {
+          const double v = va_arg(ap, double);
+#if QNETHERNET_ENABLE_PRINTF_FIXED
+          if ((conv == 'f' || conv == 'F') &&
+              putFixed(out, flags, width, precision, v)) {
+            break;
+          }
+#endif  // QNETHERNET_ENABLE_PRINTF_FIXED
+          putFloat(out, flags, width, precision, conv, v);
+        }
+        break;
+
+      case 'n':
+        storeCount(length, out.count(), ap);
+        break;
+
+      case '%':
+        out.put('%');
+        break;
+
+      default:
+        // Unknown conversion; print it as-is
+        out.put(specStart, s - specStart);
+        break;
+    }
+  }
+
+  va_end(ap);
+  return out.finish();
+}
+
+int format(Print &p, const char *format, ...) {
+  std::va_list args;
+  va_start(args, format);
+  int retval = vformat(p, format, args);
+  va_end(args);
+  return retval;
+}
+
+// --------------------------------------------------------------------------
+//  StdioPrint
+// --------------------------------------------------------------------------
+
 // NOTE: It's not possible to override clearWriteError(), so check it in
 //       each function
 
@@ -7,6 +7,7 @@
 #pragma once
 
 // C++ includes
+#include <cstdarg>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -39,6 +40,27 @@ size_t writeFully(Print &p, const uint8_t *buf, size_t size,
 size_t writeMagic(Print &p, const uint8_t mac[ETH_HWADDR_LEN],
                   std::function<bool()> breakf = nullptr);
 
+// Formats like vprintf() and writes the output to the given Print object.
+//
+// The output is built in a stack buffer of QNETHERNET_PRINTF_BUFFER_SIZE bytes
+// and written with one write() call each time the buffer fills and once at the
+// end, so most messages become a single write and nothing is allocated.
+// Integer, character, and string conversions are done here, and so are most
+// 'f' conversions if QNETHERNET_ENABLE_PRINTF_FIXED is set; other
+// floating-point conversions use snprintf(), and only allocate if one
+// conversion doesn't fit in a small buffer.
+//
+// This returns the number of characters written, which is less than the
+// formatted size if a write didn't accept all its data; nothing more is
+// written after a short write. This returns -1 if a conversion failed or there
+// wasn't enough memory.
+int vformat(Print &p, const char *format, std::va_list args);
+
+// Formats like printf() and writes the output to the given Print object. See
+// vformat().
+[[gnu::format(printf, 2, 3)]]
+int format(Print &p, const char *format, ...);
+
 // A Print decorator for stdio output files. The purpose of this is to utilize
 // the Print class's ability to print Printable objects but using the underlying
 // FILE*. This ensures that a Printable object gets printed using the same
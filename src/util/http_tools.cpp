@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// http_tools.cpp implements the HTTP utility functions.
+// This file is part of the QNEthernet library.
+
+#include "http_tools.h"
+
+// C++ includes
+#include <cstddef>
+#include <cstring>
+
+#include <strings.h>
+
+namespace qindesign {
+namespace network {
+
+bool http_has_token(const char *value, const char *token) {
+  const size_t tokenLen = std::strlen(token);
+  while (*value != '\0') {
+    while (*value == ' ' || *value == '\t' || *value == ',') {
+      value++;
+    }
+    const char *end = value;
+    while (*end != '\0' && *end != ',' && *end != ';' && *end != ' ') {
+      end++;
+    }
+    if (static_cast<size_t>(end - value) == tokenLen &&
+        strncasecmp(value, token, tokenLen) == 0) {
+      return true;
+    }
+    value = end;
+    while (*value != '\0' && *value != ',') {
+      value++;
+    }
+  }
+  return false;
+}
+
+// Skips an optional weak indicator. Returns the opaque tag, including its
+// quotes, and sets its size, or returns nullptr if there isn't one.
+static const char *opaqueTag(const char *s, size_t &size) {
+  if (s[0] == 'W' && s[1] == '/') {
+    s += 2;
+  }
+  if (*s != '"') {
+    return nullptr;
+  }
+  const char *end = std::strchr(s + 1, '"');
+  if (end == nullptr) {
+    return nullptr;
+  }
+  size = end - s + 1;
+  return s;
+}
+
+bool http_etag_matches(const char *value, const char *etag) {
+  size_t tagLen;
+  const char *tag = opaqueTag(etag, tagLen);
+  if (tag == nullptr) {
+    return false;
+  }
+
+  while (*value != '\0') {
+    while (*value == ' ' || *value == '\t' || *value == ',') {
+      value++;
+    }
+    if (*value == '*') {
+      const char *end = value + 1;
+      while (*end == ' ' || *end == '\t') {
+        end++;
+      }
+      if (*end == '\0' || *end == ',') {
+        return true;
+      }
+    }
+
+    size_t len;
+    const char *t = opaqueTag(value, len);
+    if (t != nullptr) {
+      if (len == tagLen && std::strncmp(t, tag, len) == 0) {
+        return true;
+      }
+      value = t + len;
+    }
+    while (*value != '\0' && *value != ',') {
+      value++;
+    }
+  }
+  return false;
+}
+
+}  // namespace network
+}  // namespace qindesign
@@ -0,0 +1,22 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// http_tools.h defines some utilities for working with HTTP headers.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+namespace qindesign {
+namespace network {
+
+// Returns whether a comma-separated header value contains the given token,
+// ignoring case and any parameters.
+bool http_has_token(const char *value, const char *token);
+
+// Returns whether an If-None-Match header value matches the given entity tag.
+// The value is either "*" or a comma-separated list of quoted entity tags, and
+// these are compared using the weak comparison, ignoring any "W/" prefix.
+bool http_etag_matches(const char *value, const char *etag);
+
+}  // namespace network
+}  // namespace qindesign
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// mem_tools.h defines some utilities for searching memory.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace qindesign {
+namespace network {
+
+// Returns the offset of the first occurrence of 'delim' in the data, or -1 if
+// it isn't found or if 'delimLen' is zero. This uses memchr() to find
+// candidates, so it runs at memory speed instead of byte-by-byte.
+inline int mem_find(const uint8_t *data, size_t size,
+                    const uint8_t *delim, size_t delimLen) {
+  if (data == nullptr || delimLen == 0 || size < delimLen) {
+    return -1;
+  }
+  const uint8_t *p = data;
+  const uint8_t *const last = data + (size - delimLen);
+  while (p <= last) {
+    p = static_cast<const uint8_t *>(
+        std::memchr(p, delim[0], static_cast<size_t>(last - p) + 1));
+    if (p == nullptr) {
+      return -1;
+    }
+    if (std::memcmp(p + 1, delim + 1, delimLen - 1) == 0) {
+      return static_cast<int>(p - data);
+    }
+    p++;
+  }
+  return -1;
+}
+
+}  // namespace network
+}  // namespace qindesign
@@ -5,10 +5,12 @@
 // This file is part of the QNEthernet library.
 
 #include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <Arduino.h>
@@ -16,6 +18,7 @@
 #include <QNDNSClient.h>
 #include <lwip_driver.h>
 #include <lwip/dns.h>
+#include <lwip/memp.h>
 #include <lwip/opt.h>
 #include <qnethernet_opts.h>
 #include <unity.h>
@@ -808,6 +811,566 @@ static void test_udp_zero_length() {
   udp->stop();
 }
 
+// Tests sending a packet from several segments.
+static void test_udp_sendv() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t header[]{'a', 'b'};
+  constexpr uint8_t body[]{'c', 'd', 'e'};
+  constexpr uint8_t trailer[]{'f'};
+  constexpr uint8_t expected[]{'a', 'b', 'c', 'd', 'e', 'f'};
+  const IOVec iov[]{
+      {header, sizeof(header)},
+      {nullptr, 0},
+      {body, sizeof(body)},
+      {trailer, sizeof(trailer)},
+  };
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+
+  udp = std::make_unique<EthernetUDP>();
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->begin(kPort), "Expected UDP listen success");
+
+  TEST_ASSERT_TRUE_MESSAGE(udp->sendv(Ethernet.localIP(), kPort, iov, 4),
+                           "Expected packet send success");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(expected), udp->parsePacket(), "Expected one packet");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(expected, udp->data(), sizeof(expected),
+                                        "Expected gathered data");
+
+  TEST_ASSERT_TRUE_MESSAGE(udp->sendv(Ethernet.localIP(), kPort, nullptr, 0),
+                           "Expected empty packet send success");
+  TEST_ASSERT_EQUAL_MESSAGE(0, udp->parsePacket(), "Expected packet with size 0");
+
+  udp->stop();
+}
+
+static void test_udp_packet_handler() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'a', 'b', 'c'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+
+  udp = std::make_unique<EthernetUDP>();
+  size_t count = 0;
+  std::vector<uint8_t> received;
+  uint16_t remotePort = 0;
+  udp->onPacket([&](const EthernetUDP::PacketView &packet) {
+    count++;
+    received.assign(packet.data, packet.data + packet.size);
+    remotePort = packet.remotePort;
+  });
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->begin(kPort), "Expected UDP listen success");
+
+  TEST_ASSERT_TRUE_MESSAGE(udp->send(Ethernet.localIP(), kPort, data, sizeof(data)),
+                           "Expected packet send success");
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(1, count, "Expected one packet handled");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), received.size(), "Expected packet size");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(data, received.data(), sizeof(data),
+                                        "Expected packet data");
+  TEST_ASSERT_EQUAL_MESSAGE(kPort, remotePort, "Expected remote port");
+  TEST_ASSERT_LESS_THAN_MESSAGE(0, udp->parsePacket(), "Expected nothing queued");
+
+  // Back to queuing
+  udp->onPacket(nullptr);
+  TEST_ASSERT_TRUE_MESSAGE(udp->send(Ethernet.localIP(), kPort, data, sizeof(data)),
+                           "Expected packet send success");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), udp->parsePacket(), "Expected queued packet");
+  TEST_ASSERT_EQUAL_MESSAGE(1, count, "Expected no more packets handled");
+
+  udp->stop();
+}
+
+static void test_udp_spans() {
+  constexpr uint16_t kPort = 1025;
+  constexpr char kData[] = "GET / HTTP/1.1\r\nHost: x\r\n\r\ntail";
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+
+  udp = std::make_unique<EthernetUDP>();
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->begin(kPort), "Expected UDP listen success");
+
+  size_t size;
+  TEST_ASSERT_NULL_MESSAGE(udp->readableSpan(size), "Expected no span before a packet");
+  TEST_ASSERT_EQUAL_MESSAGE(-1, udp->findDelimiter('\n'), "Expected no delimiter before a packet");
+
+  TEST_ASSERT_TRUE_MESSAGE(udp->send(Ethernet.localIP(), kPort,
+                                     reinterpret_cast<const uint8_t *>(kData),
+                                     std::strlen(kData)),
+                           "Expected packet send success");
+  TEST_ASSERT_EQUAL_MESSAGE(std::strlen(kData), udp->parsePacket(), "Expected one packet");
+
+  const uint8_t *span = udp->readableSpan(size);
+  TEST_ASSERT_EQUAL_PTR_MESSAGE(udp->data(), span, "Expected span at start");
+  TEST_ASSERT_EQUAL_MESSAGE(std::strlen(kData), size, "Expected whole packet");
+  TEST_ASSERT_EQUAL_MESSAGE(14, udp->findDelimiter('\r'), "Expected delimiter offset");
+  TEST_ASSERT_EQUAL_MESSAGE(23, udp->findDelimiter("\r\n\r\n"), "Expected multi-byte delimiter offset");
+  TEST_ASSERT_EQUAL_MESSAGE(-1, udp->findDelimiter(""), "Expected empty delimiter not found");
+
+  const uint8_t *line = udp->readUntil('\n', size);
+  TEST_ASSERT_EQUAL_PTR_MESSAGE(udp->data(), line, "Expected line in place");
+  TEST_ASSERT_EQUAL_MESSAGE(16, size, "Expected line size with delimiter");
+  line = udp->readUntil('\n', size);
+  TEST_ASSERT_EQUAL_MESSAGE(9, size, "Expected second line size");
+  TEST_ASSERT_EQUAL_MESSAGE('H', line[0], "Expected second line data");
+  TEST_ASSERT_EQUAL_MESSAGE(2, udp->consume(2), "Expected consume of blank line");
+  TEST_ASSERT_NULL_MESSAGE(udp->readUntil('\n', size), "Expected no more lines");
+  TEST_ASSERT_EQUAL_MESSAGE(4, udp->available(), "Expected tail left");
+  TEST_ASSERT_EQUAL_MESSAGE('t', udp->peek(), "Expected tail data");
+  TEST_ASSERT_EQUAL_MESSAGE(4, udp->consume(100), "Expected consume clamped");
+  TEST_ASSERT_NULL_MESSAGE(udp->readableSpan(size), "Expected no span at end");
+
+  udp->stop();
+}
+
+// Tests printf() formatting straight into an outgoing packet.
+static void test_udp_printf() {
+  constexpr uint16_t kPort = 1025;
+  constexpr char kExpected[] =
+      "{\"id\":\"node-7\",\"seq\":42,\"rssi\":-61,\"flags\":\"0x00ff\","
+      "\"temp\":21.50,\"v\":-0.125}";
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+
+  udp = std::make_unique<EthernetUDP>();
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->begin(kPort), "Expected UDP listen success");
+
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->beginPacket(Ethernet.localIP(), kPort),
+                            "Expected packet start");
+  TEST_ASSERT_EQUAL_MESSAGE(
+      std::strlen(kExpected),
+      udp->printf("{\"id\":\"%s\",\"seq\":%u,\"rssi\":%d,\"flags\":\"%#06x\","
+                  "\"temp\":%.2f,\"v\":%.3f}",
+                  "node-7", 42u, -61, 0xff, 21.5, -0.125),
+      "Expected formatted size");
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->endPacket(), "Expected packet send success");
+
+  TEST_ASSERT_EQUAL_MESSAGE(std::strlen(kExpected), udp->parsePacket(),
+                            "Expected one packet");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(kExpected, udp->data(),
+                                        std::strlen(kExpected),
+                                        "Expected formatted data");
+
+  // Longer than the format buffer
+  std::string big(QNETHERNET_PRINTF_BUFFER_SIZE * 2 + 10, 'x');
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->beginPacket(Ethernet.localIP(), kPort),
+                            "Expected packet start");
+  TEST_ASSERT_EQUAL_MESSAGE(big.size() + 2, udp->printf("<%s>", big.c_str()),
+                            "Expected long formatted size");
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->endPacket(), "Expected packet send success");
+  TEST_ASSERT_EQUAL_MESSAGE(big.size() + 2, udp->parsePacket(),
+                            "Expected long packet");
+
+  // Not in a packet
+  TEST_ASSERT_EQUAL_MESSAGE(0, udp->printf("%d", 1), "Expected nothing written");
+
+  udp->stop();
+}
+
+// Waits for a packet on the test UDP socket while running the TFTP server.
+static int waitTFTP(TFTPServer &tftp) {
+  uint32_t t = millis();
+  while ((millis() - t) < 1000) {
+    tftp.loop();
+    int size = udp->parsePacket();
+    if (size >= 0) {
+      return size;
+    }
+  }
+  return -1;
+}
+
+static void test_tftp_server() {
+  constexpr uint16_t kPort = 1025;
+  static uint8_t file[1000];
+  static constexpr char kRRQ[]{
+      "\x00\x01" "fw.bin\0" "octet\0"
+      "blksize\0" "512\0" "windowsize\0" "2\0" "tsize\0" "0"};
+  static constexpr char kOACK[]{
+      "\x00\x06" "blksize\0" "512\0" "windowsize\0" "2\0" "tsize\0" "1000"};
+  static constexpr uint8_t kAck0[]{0, 4, 0, 0};
+  static constexpr uint8_t kAck2[]{0, 4, 0, 2};
+
+  for (size_t i = 0; i < sizeof(file); i++) {
+    file[i] = i;
+  }
+  TFTPMemorySource source{file, sizeof(file)};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+
+  TFTPServer tftp;
+  tftp.onRead([&source](const char *filename) -> TFTPSource * {
+    return (std::strcmp(filename, "fw.bin") == 0) ? &source : nullptr;
+  });
+  TEST_ASSERT_TRUE_MESSAGE(tftp.begin(), "Expected TFTP listen success");
+
+  // Room for a window of blocks
+  udp = std::make_unique<EthernetUDP>(4);
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->begin(kPort), "Expected UDP listen success");
+
+  // Request with options
+  TEST_ASSERT_TRUE_MESSAGE(
+      udp->send(Ethernet.localIP(), 69, reinterpret_cast<const uint8_t *>(kRRQ),
+                sizeof(kRRQ)),
+      "Expected request send success");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(kOACK), waitTFTP(tftp), "Expected OACK");
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(kOACK, udp->data(), sizeof(kOACK), "Expected options");
+  TEST_ASSERT_EQUAL_MESSAGE(1, tftp.transferCount(), "Expected one transfer");
+  const uint16_t tid = udp->remotePort();
+  TEST_ASSERT_NOT_EQUAL_MESSAGE(69, tid, "Expected a new transfer ID");
+
+  // Both blocks of the window arrive before they're acknowledged
+  udp->send(Ethernet.localIP(), tid, kAck0, sizeof(kAck0));
+  TEST_ASSERT_EQUAL_MESSAGE(4 + 512, waitTFTP(tftp), "Expected block 1");
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->data()[3], "Expected block number 1");
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(file, &udp->data()[4], 512, "Expected block 1 data");
+  TEST_ASSERT_EQUAL_MESSAGE(4 + 488, waitTFTP(tftp), "Expected block 2");
+  TEST_ASSERT_EQUAL_MESSAGE(2, udp->data()[3], "Expected block number 2");
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&file[512], &udp->data()[4], 488, "Expected block 2 data");
+
+  udp->send(Ethernet.localIP(), tid, kAck2, sizeof(kAck2));
+  tftp.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(0, tftp.transferCount(), "Expected finished transfer");
+
+  // Unknown file
+  static constexpr char kMissing[]{"\x00\x01" "nope\0" "octet"};
+  udp->send(Ethernet.localIP(), 69, reinterpret_cast<const uint8_t *>(kMissing),
+            sizeof(kMissing));
+  TEST_ASSERT_GREATER_THAN_MESSAGE(4, waitTFTP(tftp), "Expected error");
+  TEST_ASSERT_EQUAL_MESSAGE(5, udp->data()[1], "Expected error opcode");
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->data()[3], "Expected file not found");
+
+  udp->stop();
+  tftp.end();
+}
+
+// Waits for a packet on the test UDP socket while running Ethernet.loop().
+static int waitUDP() {
+  uint32_t t = millis();
+  while ((millis() - t) < 1000) {
+    Ethernet.loop();
+    int size = udp->parsePacket();
+    if (size >= 0) {
+      return size;
+    }
+  }
+  return -1;
+}
+
+static void test_log_sink() {
+  constexpr uint16_t kPort = 1025;
+  static constexpr char kMessage[]{"<134>1 - test-hostname test - - - hello"};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+  Ethernet.setHostname(kTestHostname);
+
+  udp = std::make_unique<EthernetUDP>();
+  TEST_ASSERT_EQUAL_MESSAGE(1, udp->begin(kPort), "Expected UDP listen success");
+
+  LogSink sink{64};
+  sink.setFacility(16);  // local0
+  sink.setAppName("test");
+
+  // Written before starting
+  TEST_ASSERT_EQUAL_MESSAGE(6, sink.print("hello\n"), "Expected write success");
+  TEST_ASSERT_EQUAL_MESSAGE(6, sink.pending(), "Expected pending data");
+  TEST_ASSERT_TRUE_MESSAGE(sink.beginUDP(Ethernet.localIP(), kPort),
+                           "Expected sink start success");
+  TEST_ASSERT_EQUAL_MESSAGE(std::strlen(kMessage), waitUDP(), "Expected message");
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(kMessage, udp->data(), std::strlen(kMessage),
+                                   "Expected syslog message");
+  TEST_ASSERT_EQUAL_MESSAGE(1, sink.sentLines(), "Expected one line sent");
+  TEST_ASSERT_EQUAL_MESSAGE(0, sink.pending(), "Expected nothing pending");
+
+  // A write that doesn't fit is dropped but still reports success
+  char big[100];
+  std::memset(big, 'x', sizeof(big));
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(big),
+                            sink.write(reinterpret_cast<uint8_t *>(big),
+                                       sizeof(big)),
+                            "Expected dropped write to report success");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(big), sink.dropped(), "Expected dropped bytes");
+  TEST_ASSERT_EQUAL_MESSAGE(1, sink.droppedWrites(), "Expected one dropped write");
+  TEST_ASSERT_EQUAL_MESSAGE(0, sink.pending(), "Expected nothing pending");
+
+  sink.end();
+  udp->stop();
+}
+
+// Records the strips given to it by a PixelPusherServer.
+class TestPixelReceiver final : public PixelPusherReceiver {
+ public:
+  bool begin() override { return true; }
+  void end() override {}
+  size_t numStrips() const override { return 2; }
+  size_t pixelsPerStrip() const override { return 2; }
+  uint8_t stripFlags(size_t stripNum) const override { return 0; }
+
+  void pixels(size_t stripNum, const uint8_t *pixels,
+              size_t pixelsPerStrip) override {
+    strips.push_back(stripNum);
+    lastPixels.assign(pixels, pixels + pixelsPerStrip*3);
+  }
+
+  void endPixels() override {
+    frames++;
+  }
+
+  std::vector<size_t> strips;
+  std::vector<uint8_t> lastPixels;
+  size_t frames = 0;
+};
+
+static void test_pixelpusher_server() {
+  constexpr uint16_t kPort = 5078;
+
+  // Sequence number, then two strips of two RGB pixels
+  constexpr uint8_t kFrame[]{
+      1, 0, 0, 0,
+      0, 1, 2, 3, 4, 5, 6,
+      1, 7, 8, 9, 10, 11, 12,
+  };
+  constexpr uint8_t kBadSize[]{2, 0, 0, 0, 0, 1, 2};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+
+  TestPixelReceiver recv;
+  PixelPusherServer pp;
+  TEST_ASSERT_TRUE_MESSAGE(pp.begin(&recv, kPort, 0, 0, 0, 0, 0, 0),
+                           "Expected server start success");
+  TEST_ASSERT_EQUAL_MESSAGE(kPort, pp.pixelsPort(), "Expected pixels port");
+
+  udp = std::make_unique<EthernetUDP>();
+  TEST_ASSERT_TRUE_MESSAGE(udp->send(Ethernet.localIP(), kPort, kFrame, sizeof(kFrame)),
+                           "Expected packet send success");
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(1, pp.packetCount(), "Expected one packet");
+  TEST_ASSERT_EQUAL_MESSAGE(2, recv.strips.size(), "Expected two strips");
+  TEST_ASSERT_EQUAL_MESSAGE(1, recv.frames, "Expected one frame");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(&kFrame[12], recv.lastPixels.data(), 6,
+                                        "Expected strip 1 pixels");
+
+  // The same packet again is a duplicate
+  udp->send(Ethernet.localIP(), kPort, kFrame, sizeof(kFrame));
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(2, recv.strips.size(), "Expected no more strips");
+
+  udp->send(Ethernet.localIP(), kPort, kBadSize, sizeof(kBadSize));
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(1, pp.invalidCount(), "Expected an invalid packet");
+
+  pp.end();
+  udp->stop();
+}
+
+// Records the universes given to it by a DMXServer.
+class TestDMXReceiver final : public DMXReceiver {
+ public:
+  void universe(DMXProtocol protocol, uint16_t universe,
+                const uint8_t *slots, size_t count) override {
+    this->protocol = protocol;
+    this->number = universe;
+    this->slots.assign(slots, slots + count);
+    universes++;
+  }
+
+  void universeLost(DMXProtocol protocol, uint16_t universe) override {
+    lost++;
+  }
+
+  DMXProtocol protocol = DMXProtocol::kSACN;
+  uint16_t number = 0;
+  std::vector<uint8_t> slots;
+  size_t universes = 0;
+  size_t lost = 0;
+};
+
+// Makes an sACN data packet with three slots.
+static std::vector<uint8_t> makeSACNPacket(uint8_t cidByte, uint8_t seq,
+                                           uint16_t universe,
+                                           const uint8_t slots[3]) {
+  std::vector<uint8_t> p(126 + 3, 0);
+  p[1] = 0x10;  // Preamble size
+  std::memcpy(&p[4], "ASC-E1.17", 9);
+  p[21] = 0x04;  // Root vector: data
+  p[22] = cidByte;
+  p[43] = 0x02;  // Framing vector: data
+  p[108] = 100;  // Priority
+  p[111] = seq;
+  p[113] = universe >> 8;
+  p[114] = universe;
+  p[117] = 0x02;  // DMP vector
+  p[118] = 0xa1;  // Address and data type
+  p[124] = 1 + 3;  // Property count, including the START code
+  std::memcpy(&p[126], slots, 3);
+  return p;
+}
+
+static void test_dmx_server() {
+  constexpr uint8_t kSlots1[]{10, 200, 30};
+  constexpr uint8_t kSlots2[]{50, 20, 60};
+  constexpr uint8_t kMerged[]{50, 200, 60};
+
+  // ArtDmx for port-address 3 with two slots
+  constexpr uint8_t kArtDmx[]{
+      'A', 'r', 't', '-', 'N', 'e', 't', 0,
+      0x00, 0x50,  // OpDmx, little-endian
+      0, 14,       // Protocol version
+      1,           // Sequence
+      0,           // Physical
+      3, 0,        // SubUni and Net
+      0, 2,        // Length
+      7, 8,
+  };
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+
+  TestDMXReceiver recv;
+  DMXServer dmx{2, 2};
+  TEST_ASSERT_TRUE_MESSAGE(dmx.addUniverse(DMXProtocol::kSACN, 1),
+                           "Expected add sACN universe success");
+  TEST_ASSERT_TRUE_MESSAGE(dmx.addUniverse(DMXProtocol::kArtNet, 3),
+                           "Expected add Art-Net universe success");
+  TEST_ASSERT_FALSE_MESSAGE(dmx.addUniverse(DMXProtocol::kArtNet, 4),
+                            "Expected add universe failure when full");
+  TEST_ASSERT_FALSE_MESSAGE(dmx.addUniverse(DMXProtocol::kSACN, 0),
+                            "Expected add invalid universe failure");
+  TEST_ASSERT_TRUE_MESSAGE(dmx.begin(&recv), "Expected server start success");
+
+  udp = std::make_unique<EthernetUDP>();
+
+  // Art-Net
+  TEST_ASSERT_TRUE_MESSAGE(
+      udp->send(Ethernet.localIP(), DMXServer::kArtNetPort,
+                kArtDmx, sizeof(kArtDmx)),
+      "Expected packet send success");
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(1, recv.universes, "Expected Art-Net universe");
+  TEST_ASSERT_TRUE_MESSAGE(recv.protocol == DMXProtocol::kArtNet,
+                           "Expected Art-Net protocol");
+  TEST_ASSERT_EQUAL_MESSAGE(3, recv.number, "Expected port-address 3");
+  TEST_ASSERT_EQUAL_MESSAGE(2, recv.slots.size(), "Expected 2 slots");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(&kArtDmx[18], recv.slots.data(), 2,
+                                        "Expected Art-Net slots");
+
+  // Two sACN sources with the same priority are merged HTP
+  std::vector<uint8_t> p = makeSACNPacket(1, 1, 1, kSlots1);
+  udp->send(Ethernet.localIP(), DMXServer::kSACNPort, p.data(), p.size());
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(2, recv.universes, "Expected sACN universe");
+  TEST_ASSERT_EQUAL_MESSAGE(1, recv.number, "Expected universe 1");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(kSlots1, recv.slots.data(), 3,
+                                        "Expected source 1 slots");
+
+  p = makeSACNPacket(2, 1, 1, kSlots2);
+  udp->send(Ethernet.localIP(), DMXServer::kSACNPort, p.data(), p.size());
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(2, dmx.sourceCount(DMXProtocol::kSACN, 1),
+                            "Expected two sources");
+  TEST_ASSERT_EQUAL_MESSAGE(3, recv.slots.size(), "Expected 3 slots");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(kMerged, recv.slots.data(), 3,
+                                        "Expected merged slots");
+
+  // An old sequence number is dropped
+  p = makeSACNPacket(2, 0, 1, kSlots2);
+  udp->send(Ethernet.localIP(), DMXServer::kSACNPort, p.data(), p.size());
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(3, recv.universes, "Expected no new universe");
+  TEST_ASSERT_EQUAL_MESSAGE(1, dmx.droppedCount(), "Expected one drop");
+  TEST_ASSERT_EQUAL_MESSAGE(3, dmx.packetCount(), "Expected 3 packets");
+
+  // Silent sources time out
+  dmx.setSourceTimeout(10);
+  delay(20);
+  dmx.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(0, dmx.sourceCount(DMXProtocol::kSACN, 1),
+                            "Expected no sources");
+  TEST_ASSERT_EQUAL_MESSAGE(2, recv.lost, "Expected two universes lost");
+
+  dmx.end();
+  udp->stop();
+}
+
+static void test_osc() {
+  constexpr uint16_t kPort = 8000;
+
+  // "/mixer/ch/12/fader" with a float, an int, and a string
+  constexpr uint8_t kMsg[]{
+      '/', 'm', 'i', 'x', 'e', 'r', '/', 'c', 'h', '/', '1', '2',
+      '/', 'f', 'a', 'd', 'e', 'r', 0, 0,
+      ',', 'f', 'i', 's', 0, 0, 0, 0,
+      0x3f, 0x00, 0x00, 0x00,  // 0.5
+      0xff, 0xff, 0xff, 0xf9,  // -7
+      'h', 'i', 0, 0,
+  };
+
+  // A bundle with "/mixer/*" and no arguments
+  constexpr uint8_t kBundle[]{
+      '#', 'b', 'u', 'n', 'd', 'l', 'e', 0,
+      0, 0, 0, 0, 0, 0, 0, 1,  // Immediately
+      0, 0, 0, 12,
+      '/', 'm', 'i', 'x', 'e', 'r', '/', '*', 0, 0, 0, 0,
+  };
+
+  OSCMessage msg;
+  TEST_ASSERT_TRUE_MESSAGE(msg.parse(kMsg, sizeof(kMsg)), "Expected valid message");
+  TEST_ASSERT_EQUAL_STRING_MESSAGE("/mixer/ch/12/fader", msg.address(), "Expected address");
+  TEST_ASSERT_EQUAL_MESSAGE(3, msg.argCount(), "Expected 3 arguments");
+  TEST_ASSERT_EQUAL_FLOAT_MESSAGE(0.5f, msg.arg(0).asFloat(), "Expected float");
+  TEST_ASSERT_EQUAL_MESSAGE(-7, msg.arg(1).asInt32(), "Expected int");
+  TEST_ASSERT_EQUAL_STRING_MESSAGE("hi", msg.arg(2).asString(), "Expected string");
+  TEST_ASSERT_FALSE_MESSAGE(msg.arg(3), "Expected invalid argument");
+  TEST_ASSERT_FALSE_MESSAGE(msg.parse(kMsg, sizeof(kMsg) - 4), "Expected truncated message");
+
+  int faders = 0;
+  int mains = 0;
+  OSCDispatcher osc;
+  TEST_ASSERT_TRUE_MESSAGE(
+      osc.add("/mixer/ch/12/fader", [&](const OSCMessage &m) { faders++; }),
+      "Expected add success");
+  TEST_ASSERT_TRUE_MESSAGE(
+      osc.add("/mixer/main", [&](const OSCMessage &m) { mains++; }),
+      "Expected add success");
+  TEST_ASSERT_FALSE_MESSAGE(osc.add("/mixer/*", nullptr),
+                            "Expected add pattern failure");
+
+  // Dispatch from the UDP buffer
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // send() won't work unless there's a link
+  udp = std::make_unique<EthernetUDP>();
+  TEST_ASSERT_TRUE_MESSAGE(udp->begin(kPort), "Expected UDP begin success");
+  TEST_ASSERT_TRUE_MESSAGE(udp->send(Ethernet.localIP(), kPort, kMsg, sizeof(kMsg)),
+                           "Expected packet send success");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(kMsg), waitUDP(), "Expected message");
+  TEST_ASSERT_TRUE_MESSAGE(osc.dispatch(udp->data(), udp->size()),
+                           "Expected dispatch success");
+  TEST_ASSERT_EQUAL_MESSAGE(1, faders, "Expected fader handler called");
+
+  TEST_ASSERT_TRUE_MESSAGE(osc.dispatch(kBundle, sizeof(kBundle)),
+                           "Expected bundle dispatch success");
+  TEST_ASSERT_EQUAL_MESSAGE(1, mains, "Expected pattern match");
+  TEST_ASSERT_EQUAL_MESSAGE(1, faders, "Expected no more fader calls");
+  TEST_ASSERT_EQUAL_MESSAGE(2, osc.messageCount(), "Expected 2 messages");
+
+  udp->stop();
+}
+
 static void test_udp_diffserv() {
   constexpr uint16_t kPort = 1025;
   constexpr uint8_t kDiffServ = (0x2c << 2) | 1;
@@ -1064,6 +1627,11 @@ static void test_client_options() {
   TEST_ASSERT_TRUE(client->setNoDelay(false));
   TEST_ASSERT_FALSE(client->isNoDelay());
 
+  TEST_ASSERT_TRUE(client->setCork(true));
+  TEST_ASSERT_TRUE(client->isCork());
+  TEST_ASSERT_TRUE(client->setCork(false));
+  TEST_ASSERT_FALSE(client->isCork());
+
   TEST_ASSERT_TRUE(client->setOutgoingDiffServ(0xa5));
   TEST_ASSERT_EQUAL(0xa5, client->outgoingDiffServ());
   TEST_ASSERT_TRUE(client->setOutgoingDiffServ(0));
@@ -1072,97 +1640,50 @@ static void test_client_options() {
   client->close();
 }
 
-static void test_client_diffserv() {
-  constexpr uint16_t kPort = 80;
-  constexpr uint8_t kDiffServ = (0x2c << 2) | 1;
-  constexpr char kHost[]{"www.example.com"};
-
-  if (!waitForLocalIP()) {
-    return;
-  }
-
-  client = std::make_unique<EthernetClient>();
-  client->setConnectionTimeout(kConnectTimeout);
-
-  // Check that can't set DiffServ before connect
-  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*client), "Expected not connected");
-  TEST_ASSERT_EQUAL_MESSAGE(false, client->connected(), "Expected not connected (no data)");
-  TEST_ASSERT_FALSE_MESSAGE(client->setOutgoingDiffServ(kDiffServ), "Expected can't set DiffServ");
-
-  // Connect and set DiffServ
-  TEST_MESSAGE("Connecting ...");
-  TEST_ASSERT_EQUAL_MESSAGE(true, client->connect(kHost, kPort), "Expected connect success");
-  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*client), "Expected connected");
-  TEST_ASSERT_EQUAL_MESSAGE(true, client->connected(), "Expected connected (or data)");
-  TEST_ASSERT_TRUE_MESSAGE(client->setOutgoingDiffServ(kDiffServ), "Expected can set DiffServ");
-  TEST_ASSERT_EQUAL_UINT8_MESSAGE(kDiffServ, client->outgoingDiffServ(), "Expected matching DiffServ");
-
-  client->close();
-}
-
-// Tests a variety of server object states.
-static void test_server_state() {
+// Tests writing from several segments.
+static void test_client_writev() {
   constexpr uint16_t kPort = 1025;
+  constexpr uint8_t header[]{'a', 'b'};
+  constexpr uint8_t body[]{'c', 'd', 'e'};
+  constexpr uint8_t expected[]{'a', 'b', 'c', 'd', 'e'};
+  const IOVec iov[]{
+      {header, sizeof(header)},
+      {body, sizeof(body)},
+  };
 
   TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
                            "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
 
   server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
 
-  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
-  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
-  TEST_ASSERT_TRUE_MESSAGE(server->begin(kPort), "Expected TCP listen success");
-  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*server), "Expected listening");
-  TEST_ASSERT_EQUAL_MESSAGE(kPort, server->port(), "Expected valid port");
-  server->end();
-  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
-  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
-
-  TEST_ASSERT_EQUAL_MESSAGE(MEMP_NUM_TCP_PCB_LISTEN, EthernetServer::maxListeners(),
-                            "Expected default TCP max. listeners");
-}
-
-// Tests constructing EthernetServer with an int.
-static void test_server_construct_int_port() {
-  constexpr int port = 1025;
-
-  server = std::make_unique<EthernetServer>(port);
-  TEST_ASSERT_EQUAL(uint16_t{1025}, server->port());
-}
-
-// Tests setting a server port of zero to have the system choose one.
-static void test_server_zero_port() {
-  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
-                           "Expected successful Ethernet start");
-
-  server = std::make_unique<EthernetServer>();
+  TEST_ASSERT_EQUAL_MESSAGE(0, client->writev(iov, 2), "Expected no write when not connected");
 
-  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
-  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
-  TEST_ASSERT_TRUE_MESSAGE(server->begin(0), "Expected TCP listen success");
-  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*server), "Expected listening");
-  int32_t port = server->port();
-  TEST_ASSERT_NOT_EQUAL_MESSAGE(0, port, "Expected non-zero port");
-  TEST_MESSAGE(format("Server port = %" PRId32, port).data());
-  server->end();
-  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
-  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
 
-  server = std::make_unique<EthernetServer>(0);
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(expected), client->writev(iov, 2), "Expected all written");
+  client->flush();
+  uint32_t t = millis();
+  while (c.available() < static_cast<int>(sizeof(expected)) && (millis() - t) < 1000) {
+    yield();
+  }
+  uint8_t buf[sizeof(expected)]{0};
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(expected), c.read(buf, sizeof(buf)), "Expected data");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(expected, buf, sizeof(expected), "Expected gathered data");
 
-  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
-  TEST_ASSERT_EQUAL_MESSAGE(0, server->port(), "Expected zero port");
-  server->begin();
-  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*server), "Expected listening");
-  TEST_ASSERT_NOT_EQUAL_MESSAGE(0, server->port(), "Expected zero port");
+  c.close();
+  client->close();
   server->end();
-  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
-  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
 }
 
-// Tests server accept().
-static void test_server_accept() {
+// Tests that corked data is held until flushed.
+static void test_client_cork() {
   constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
 
   TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
                            "Expected successful Ethernet start");
@@ -1171,13 +1692,1212 @@ static void test_server_accept() {
   server = std::make_unique<EthernetServer>();
   client = std::make_unique<EthernetClient>();
 
+  TEST_ASSERT_FALSE_MESSAGE(client->setCork(true), "Expected can't cork when not connected");
+  TEST_ASSERT_EQUAL_MESSAGE(200, client->corkTimeout(), "Expected default cork timeout");
+  client->setCorkTimeout(60'000);  // Long enough not to expire during the test
+
   TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
   TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
   EthernetClient c = server->accept();
   TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+
+  TEST_ASSERT_TRUE(client->setCork(true));
+  TEST_ASSERT_EQUAL(sizeof(data), client->write(data, sizeof(data)));
+  uint32_t t = millis();
+  while ((millis() - t) < 100) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(0, c.available(), "Expected data to be held");
+
+  client->flush();
+  t = millis();
+  while (c.available() < static_cast<int>(sizeof(data)) && (millis() - t) < 1000) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), c.available(), "Expected data after flush");
+  TEST_ASSERT_FALSE_MESSAGE(client->isCork(), "Expected not corked after flush");
+
+  // Later writes aren't held
+  TEST_ASSERT_EQUAL(sizeof(data), client->write(data, sizeof(data)));
+  t = millis();
+  while (c.available() < static_cast<int>(2 * sizeof(data)) && (millis() - t) < 1000) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(2 * sizeof(data), c.available(), "Expected second write to be sent");
+
+  // Removing the cork also sends what's held
+  TEST_ASSERT_TRUE(client->setCork(true));
+  TEST_ASSERT_EQUAL(sizeof(data), client->write(data, sizeof(data)));
+  t = millis();
+  while ((millis() - t) < 100) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(2 * sizeof(data), c.available(), "Expected third write to be held");
+
+  TEST_ASSERT_TRUE(client->setCork(false));
+  TEST_ASSERT_FALSE(client->isCork());
+  t = millis();
+  while (c.available() < static_cast<int>(3 * sizeof(data)) && (millis() - t) < 1000) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(3 * sizeof(data), c.available(), "Expected data after uncorking");
+
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests that a zero cork timeout is raised to the minimum and that retrying
+// corked data that doesn't fit doesn't spin.
+static void test_client_cork_zero_timeout() {
+  constexpr uint16_t kPort = 1025;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  client->setCorkTimeout(0);
+  TEST_ASSERT_EQUAL_MESSAGE(1, client->corkTimeout(), "Expected minimum cork timeout");
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+  TEST_ASSERT_TRUE(client->setCork(true));
+
+  // Write until the send buffer is full so that corked data is left over and
+  // the cork timer keeps retrying it
+  uint8_t buf[256];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = static_cast<uint8_t>(i);
+  }
+  size_t total = 0;
+  size_t written;
+  do {
+    written = client->write(buf, sizeof(buf));
+    total += written;
+  } while (written == sizeof(buf));
+
+  // Reading frees the window, and the timer sends the rest
+  size_t received = 0;
+  uint32_t t = millis();
+  while (received < total && (millis() - t) < 2000) {
+    int avail = c.available();
+    if (avail > 0) {
+      received += c.read(buf, std::min(static_cast<size_t>(avail), sizeof(buf)));
+    } else {
+      yield();
+    }
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(total, received, "Expected all the data");
+
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests that corked data is sent right away when there's no timer for it.
+static void test_client_cork_no_timer() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  client->setCorkTimeout(60'000);  // Long enough not to expire during the test
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+  TEST_ASSERT_TRUE(client->setCork(true));
+
+  // Use up all the timeouts just for the write
+  std::vector<void *> timeouts;
+  void *t;
+  while ((t = memp_malloc(MEMP_SYS_TIMEOUT)) != nullptr) {
+    timeouts.push_back(t);
+  }
+  size_t written = client->write(data, sizeof(data));
+  for (void *p : timeouts) {
+    memp_free(MEMP_SYS_TIMEOUT, p);
+  }
+  TEST_ASSERT_EQUAL(sizeof(data), written);
+
+  uint32_t start = millis();
+  while (c.available() < static_cast<int>(sizeof(data)) && (millis() - start) < 1000) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), c.available(), "Expected data without a timer");
+
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests TCP introspection.
+static void test_client_tcp_info() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  EthernetClient::TCPInfo info;
+  TEST_ASSERT_FALSE_MESSAGE(client->tcpInfo(info), "Expected no info when not connected");
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  TEST_ASSERT_TRUE_MESSAGE(client->tcpInfo(info), "Expected info");
+  TEST_ASSERT_EQUAL_MESSAGE(ESTABLISHED, info.state, "Expected established");
+  TEST_ASSERT_GREATER_THAN_MESSAGE(0, info.mss, "Expected non-zero MSS");
+  TEST_ASSERT_GREATER_THAN_MESSAGE(0, info.cwnd, "Expected non-zero cwnd");
+  TEST_ASSERT_EQUAL_MESSAGE(0, info.sndBufUsed, "Expected empty send buffer");
+
+  TEST_ASSERT_EQUAL(sizeof(data), client->write(data, sizeof(data)));
+  TEST_ASSERT_TRUE(client->tcpInfo(info));
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(sizeof(data), info.sndBufUsed,
+                                   "Expected at most the written data");
+
+  client->close();
+  server->end();
+}
+
+// Tests forwarding data from one connection to another.
+static void test_client_splice() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  EthernetClient other;
+
+  TEST_ASSERT_FALSE_MESSAGE(client->splice(other), "Expected can't splice when not connected");
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient in = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(in, "Expected accepted connection");
+  TEST_ASSERT_TRUE_MESSAGE(other.connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient out = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(out, "Expected accepted connection");
+
+  // Data written by 'client' arrives on 'in' and is forwarded through 'out'
+  // to 'other'
+  TEST_ASSERT_FALSE_MESSAGE(in.splice(in), "Expected can't splice to self");
+  TEST_ASSERT_TRUE_MESSAGE(in.splice(out), "Expected splice success");
+  TEST_ASSERT_TRUE_MESSAGE(in.isSpliced(), "Expected spliced");
+  TEST_ASSERT_FALSE_MESSAGE(out.isSpliced(), "Expected target not spliced");
+  TEST_ASSERT_FALSE_MESSAGE(client->splice(out), "Expected only one source");
+
+  TEST_ASSERT_EQUAL(sizeof(data), client->write(data, sizeof(data)));
+  client->flush();
+  uint32_t t = millis();
+  while (other.available() < static_cast<int>(sizeof(data)) && (millis() - t) < 1000) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), other.available(), "Expected forwarded data");
+  TEST_ASSERT_EQUAL_MESSAGE(0, in.available(), "Expected no data to read");
+
+  in.unsplice();
+  TEST_ASSERT_FALSE_MESSAGE(in.isSpliced(), "Expected not spliced");
+
+  in.close();
+  out.close();
+  other.close();
+  client->close();
+  server->end();
+}
+
+// Tests that data corked on the egress connection goes before spliced data, and
+// that a FIN is forwarded after the last data.
+static void test_client_splice_fin() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t kCorked[]{'a', 'b'};
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
+  constexpr uint8_t expected[]{'a', 'b', 'h', 'e', 'l', 'l', 'o'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  EthernetClient other;
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient in = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(in, "Expected accepted connection");
+  TEST_ASSERT_TRUE_MESSAGE(other.connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient out = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(out, "Expected accepted connection");
+
+  out.setCorkTimeout(60'000);  // Long enough not to expire during the test
+  TEST_ASSERT_TRUE(out.setCork(true));
+  TEST_ASSERT_EQUAL(sizeof(kCorked), out.write(kCorked, sizeof(kCorked)));
+  TEST_ASSERT_TRUE_MESSAGE(in.splice(out), "Expected splice success");
+
+  TEST_ASSERT_EQUAL(sizeof(data), client->write(data, sizeof(data)));
+  client->close();
+
+  uint8_t buf[sizeof(expected) + 1]{0};
+  size_t len = 0;
+  uint32_t t = millis();
+  while (other.connected() && (millis() - t) < 1000) {
+    int n = other.read(&buf[len], sizeof(buf) - len);
+    if (n > 0) {
+      len += n;
+    }
+    yield();
+  }
+  int n = other.read(&buf[len], sizeof(buf) - len);
+  if (n > 0) {
+    len += n;
+  }
+  TEST_ASSERT_FALSE_MESSAGE(other.connected(), "Expected the FIN to be forwarded");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(expected), len, "Expected all the data");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(expected, buf, sizeof(expected),
+                                        "Expected corked data first");
+
+  in.close();
+  out.close();
+  other.close();
+  server->end();
+}
+
+// Tests that data that doesn't fit in an uncorked accepted connection when the
+// spliced source closes is still forwarded, without waiting for the cork timer.
+static void test_client_splice_leftover() {
+  constexpr uint16_t kPort = 1025;
+  // More than the egress send buffer and the far end's window hold, so that
+  // some is left over when the FIN arrives
+  constexpr size_t kSize = TCP_WND + TCP_SND_BUF + 2 * TCP_MSS;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  EthernetClient other;
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient in = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(in, "Expected accepted connection");
+  TEST_ASSERT_TRUE_MESSAGE(other.connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient out = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(out, "Expected accepted connection");
+
+  out.setCorkTimeout(60'000);  // Long enough not to expire during the test
+  TEST_ASSERT_FALSE(out.isCork());
+  TEST_ASSERT_TRUE_MESSAGE(in.splice(out), "Expected splice success");
+
+  // Write everything while 'other' doesn't read, and then close
+  uint8_t buf[256];
+  size_t written = 0;
+  uint32_t t = millis();
+  while (written < kSize && (millis() - t) < 2000) {
+    size_t n = std::min(sizeof(buf), kSize - written);
+    for (size_t i = 0; i < n; i++) {
+      buf[i] = static_cast<uint8_t>(written + i);
+    }
+    written += client->write(buf, n);
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(kSize, written, "Expected all written");
+  client->close();
+  t = millis();
+  while ((millis() - t) < 100) {  // Let the FIN arrive
+    yield();
+  }
+
+  size_t received = 0;
+  bool inOrder = true;
+  t = millis();
+  while ((other.connected() || other.available() > 0) && (millis() - t) < 2000) {
+    int n = other.read(buf, sizeof(buf));
+    for (int i = 0; i < n; i++) {
+      if (buf[i] != static_cast<uint8_t>(received + i)) {
+        inOrder = false;
+      }
+    }
+    if (n > 0) {
+      received += n;
+    }
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(kSize, received, "Expected all the data");
+  TEST_ASSERT_TRUE_MESSAGE(inOrder, "Expected the data in order");
+  TEST_ASSERT_FALSE_MESSAGE(other.connected(), "Expected the FIN to be forwarded");
+
+  in.close();
+  out.close();
+  other.close();
+  server->end();
+}
+
+// Tests posted receive buffers.
+static void test_client_post_receive() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  uint8_t buf[16]{0};
+  size_t received = 0;
+  int completions = 0;
+  auto callback = [&received, &completions](uint8_t *, size_t len) {
+    received = len;
+    completions++;
+  };
+
+  TEST_ASSERT_FALSE_MESSAGE(client->postReceive(buf, sizeof(buf), callback),
+                            "Expected can't post when not connected");
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+
+  TEST_ASSERT_FALSE_MESSAGE(c.postReceive(nullptr, sizeof(buf), callback),
+                            "Expected can't post NULL buffer");
+  TEST_ASSERT_TRUE_MESSAGE(c.postReceive(buf, sizeof(buf), callback), "Expected post success");
+  TEST_ASSERT_EQUAL_MESSAGE(1, c.postedReceiveCount(), "Expected one posted buffer");
+
+  TEST_ASSERT_EQUAL(sizeof(data), client->write(data, sizeof(data)));
+  client->flush();
+  uint32_t t = millis();
+  while (completions == 0 && (millis() - t) < 1000) {
+    yield();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(1, completions, "Expected completion on push");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), received, "Expected all the data");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(data, buf, sizeof(data), "Expected matching data");
+  TEST_ASSERT_EQUAL_MESSAGE(0, c.available(), "Expected nothing buffered");
+  TEST_ASSERT_EQUAL_MESSAGE(0, c.postedReceiveCount(), "Expected no posted buffers");
+
+  // Closing completes any posted buffers, and the callback is called from the
+  // next loop
+  TEST_ASSERT_TRUE(c.postReceive(buf, sizeof(buf), callback));
+  c.close();
+  Ethernet.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(2, completions, "Expected completion on close");
+  TEST_ASSERT_EQUAL_MESSAGE(0, received, "Expected no data on close");
+
+  client->close();
+  server->end();
+}
+
+// Tests the connection pool.
+static void test_connection_pool() {
+  constexpr uint16_t kPort = 1025;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  ConnectionPool pool{1, 60'000};
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(pool.checkOut(Ethernet.localIP(), kPort, *client),
+                           "Expected new connection");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+  uintptr_t id = client->connectionId();
+
+  pool.checkIn(*client);
+  TEST_ASSERT_FALSE_MESSAGE(*client, "Expected no connection after check-in");
+  TEST_ASSERT_EQUAL_MESSAGE(1, pool.idleCount(), "Expected one idle connection");
+
+  TEST_ASSERT_TRUE_MESSAGE(pool.checkOut(Ethernet.localIP(), kPort, *client),
+                           "Expected reused connection");
+  TEST_ASSERT_EQUAL_MESSAGE(id, client->connectionId(), "Expected same connection");
+  TEST_ASSERT_EQUAL_MESSAGE(0, pool.idleCount(), "Expected no idle connections");
+
+  // A remote close removes the idle connection
+  pool.checkIn(*client);
+  c.close();
+  uint32_t t = millis();
+  while (pool.idleCount() > 0 && (millis() - t) < 1000) {
+    yield();
+    pool.closeExpired();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(0, pool.idleCount(), "Expected remote close detected");
+
+  server->end();
+}
+
+// Reads a response until the given number of bytes arrives or a timeout.
+static std::string readResponse(EthernetClient &c, HTTPServer &http,
+                                size_t size) {
+  std::string s;
+  uint32_t t = millis();
+  while (s.size() < size && (millis() - t) < 1000) {
+    http.loop();
+    int b;
+    while ((b = c.read()) >= 0) {
+      s += static_cast<char>(b);
+    }
+  }
+  return s;
+}
+
+static void test_http_server() {
+  constexpr uint16_t kPort = 1025;
+  static constexpr uint8_t kAsset[]{'<', 'p', '>'};
+  static constexpr char kPipelined[]{
+      "GET /hello HTTP/1.1\r\nHost: x\r\n\r\n"
+      "GET /asset HTTP/1.1\r\nHost: x\r\nIf-None-Match: \"v1\"\r\n\r\n"};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  HTTPServer http{kPort};
+  http.on(HTTPServer::Method::kGet, "/hello",
+          [](HTTPServer::Request &req, HTTPServer::Response &res) {
+            res.send(200, "text/plain", "hi");
+          });
+  http.on(HTTPServer::Method::kGet, "/chunks/*",
+          [](HTTPServer::Request &req, HTTPServer::Response &res) {
+            res.beginChunked(200, "text/plain");
+            res.print(req.path());
+          });
+  http.on(HTTPServer::Method::kGet, "/long",
+          [](HTTPServer::Request &req, HTTPServer::Response &res) {
+            static const std::string kType = "text/plain; x=" + std::string(200, 'a');
+            res.send(200, kType.c_str(), "ok");
+          });
+  http.on(HTTPServer::Method::kGet, "/big",
+          [](HTTPServer::Request &req, HTTPServer::Response &res) {
+            static const std::string kBig(20000, 'b');
+            res.send(200, "text/plain", kBig.c_str());
+          });
+  http.serveStatic("/asset",
+                   HTTPServer::StaticAsset{kAsset, sizeof(kAsset), "text/html",
+                                           nullptr, 0, "\"v1\""});
+  TEST_ASSERT_TRUE_MESSAGE(http.begin(), "Expected listen success");
+
+  client = std::make_unique<EthernetClient>();
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+
+  // Two pipelined requests on one connection
+  client->writeFully(kPipelined);
+  client->flush();
+  std::string r = readResponse(*client, http, 80);
+  TEST_ASSERT_TRUE_MESSAGE(r.find("HTTP/1.1 200 OK\r\n") == 0, "Expected 200 first");
+  TEST_ASSERT_TRUE_MESSAGE(r.find("Content-Length: 2\r\n\r\nhi") != std::string::npos,
+                           "Expected body");
+  TEST_ASSERT_TRUE_MESSAGE(r.find("HTTP/1.1 304 Not Modified\r\n") != std::string::npos,
+                           "Expected 304 second");
+  TEST_ASSERT_EQUAL_MESSAGE(1, http.connectionCount(), "Expected kept-alive connection");
+
+  // Chunked response and prefix route
+  client->writeFully("GET /chunks/a HTTP/1.1\r\n\r\n");
+  client->flush();
+  r = readResponse(*client, http, 70);
+  TEST_ASSERT_TRUE_MESSAGE(r.find("Transfer-Encoding: chunked") != std::string::npos,
+                           "Expected chunked");
+  TEST_ASSERT_TRUE_MESSAGE(r.find("9\r\n/chunks/a\r\n0\r\n\r\n") != std::string::npos,
+                           "Expected chunks");
+
+  // A content type longer than the header buffer
+  client->writeFully("GET /long HTTP/1.1\r\n\r\n");
+  client->flush();
+  r = readResponse(*client, http, 270);
+  TEST_ASSERT_TRUE_MESSAGE(
+      r.find("Content-Type: text/plain; x=" + std::string(200, 'a') + "\r\n") !=
+          std::string::npos,
+      "Expected whole content type");
+  TEST_ASSERT_TRUE_MESSAGE(r.find("Content-Length: 2\r\n\r\nok") != std::string::npos,
+                           "Expected body after long header");
+
+  // A response larger than the send buffer is queued instead of blocking,
+  // and a request pipelined behind it waits for it
+  client->writeFully("GET /big HTTP/1.1\r\n\r\nGET /hello HTTP/1.1\r\n\r\n");
+  client->flush();
+  uint32_t t = millis();
+  while (client->available() == 0 && (millis() - t) < 1000) {
+    http.loop();
+  }
+  t = millis();
+  http.loop();
+  TEST_ASSERT_LESS_THAN_MESSAGE(100, millis() - t, "Expected loop() not to block");
+  r = readResponse(*client, http, 20000 + 200);
+  TEST_ASSERT_TRUE_MESSAGE(r.find("Content-Length: 20000\r\n\r\n" + std::string(20000, 'b')) !=
+                               std::string::npos,
+                           "Expected whole large body");
+  TEST_ASSERT_TRUE_MESSAGE(r.find("Content-Length: 2\r\n\r\nhi") ==
+                               r.size() - std::strlen("Content-Length: 2\r\n\r\nhi"),
+                           "Expected pipelined response last");
+
+  // If-None-Match lists compare whole entity tags
+  client->writeFully("GET /asset HTTP/1.1\r\nIf-None-Match: \"xv1\", \"v10\"\r\n\r\n");
+  client->flush();
+  r = readResponse(*client, http, 100);
+  TEST_ASSERT_TRUE_MESSAGE(r.find("HTTP/1.1 200 OK\r\n") == 0, "Expected 200 for no match");
+  client->writeFully("GET /asset HTTP/1.1\r\nIf-None-Match: \"a\", W/\"v1\"\r\n\r\n");
+  client->flush();
+  r = readResponse(*client, http, 40);
+  TEST_ASSERT_TRUE_MESSAGE(r.find("HTTP/1.1 304 Not Modified\r\n") == 0,
+                           "Expected 304 for a weak match in a list");
+
+  // Unknown route, then close
+  client->writeFully("GET /nope HTTP/1.1\r\nConnection: close\r\n\r\n");
+  client->flush();
+  r = readResponse(*client, http, 40);
+  TEST_ASSERT_TRUE_MESSAGE(r.find("HTTP/1.1 404 Not Found\r\n") == 0, "Expected 404");
+  http.loop();
+  TEST_ASSERT_EQUAL_MESSAGE(0, http.connectionCount(), "Expected closed connection");
+
+  client->close();
+  http.end();
+}
+
+// Reads from a client until the given number of bytes arrives or a timeout,
+// running the WebSocket server while waiting.
+static std::string readWebSocket(EthernetClient &c, WebSocketServer &ws,
+                                 size_t size) {
+  std::string s;
+  uint32_t t = millis();
+  while (s.size() < size && (millis() - t) < 1000) {
+    ws.loop();
+    int b;
+    while (s.size() < size && (b = c.read()) >= 0) {
+      s += static_cast<char>(b);
+    }
+  }
+  return s;
+}
+
+static void test_websocket_server() {
+  constexpr uint16_t kPort = 1025;
+  static constexpr char kHandshake[]{
+      "GET /ws HTTP/1.1\r\n"
+      "Host: x\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n"
+      "\r\n"};
+  static constexpr char kResponse[]{
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+      "\r\n"};
+
+  // A masked "Hello" sent as two fragments, with a ping in between
+  static constexpr uint8_t kFrames[]{
+      0x01, 0x83, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d,  // "Hel"
+      0x89, 0x84, 0x01, 0x02, 0x03, 0x04, 0x71, 0x6b, 0x6d, 0x63,  // Ping "ping"
+      0x80, 0x82, 0x37, 0xfa, 0x21, 0x3d, 0x5b, 0x95,        // "lo"
+  };
+  static constexpr uint8_t kClose[]{
+      0x88, 0x82, 0x01, 0x02, 0x03, 0x04, 0x02, 0xea,  // 1000
+  };
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  WebSocketServer ws{kPort};
+  std::string path;
+  std::string msg;
+  size_t lastOffset = 0;
+  int lastCount = 0;
+  bool disconnected = false;
+  ws.onConnect([&](WebSocketServer::ConnectionId id, const char *p) {
+    path = p;
+    return true;
+  });
+  ws.onMessage([&](WebSocketServer::ConnectionId id,
+                   const WebSocketServer::Fragment &f) {
+    msg.append(reinterpret_cast<const char *>(f.data), f.size);
+    if (f.last) {
+      lastOffset = f.offset;
+      lastCount++;
+      ws.send(id, f.type, reinterpret_cast<const uint8_t *>(msg.data()),
+              msg.size());
+    }
+  });
+  ws.onDisconnect([&](WebSocketServer::ConnectionId id) {
+    disconnected = true;
+  });
+  TEST_ASSERT_TRUE_MESSAGE(ws.begin(), "Expected listen success");
+
+  client = std::make_unique<EthernetClient>();
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+
+  client->writeFully(kHandshake);
+  client->flush();
+  std::string r = readWebSocket(*client, ws, std::strlen(kResponse));
+  TEST_ASSERT_EQUAL_STRING_MESSAGE(kResponse, r.c_str(), "Expected handshake response");
+  TEST_ASSERT_EQUAL_STRING_MESSAGE("/ws", path.c_str(), "Expected path");
+  TEST_ASSERT_EQUAL_MESSAGE(1, ws.connectionCount(), "Expected one connection");
+
+  // Fragmented message: a pong, then the echo
+  client->writeFully(kFrames, sizeof(kFrames));
+  client->flush();
+  r = readWebSocket(*client, ws, 6 + 7);
+  TEST_ASSERT_EQUAL_STRING_MESSAGE("Hello", msg.c_str(), "Expected message");
+  TEST_ASSERT_EQUAL_MESSAGE(1, lastCount, "Expected one complete message");
+  TEST_ASSERT_EQUAL_MESSAGE(3, lastOffset, "Expected ping not counted in offset");
+  TEST_ASSERT_EQUAL_MESSAGE(std::string("\x8a\x04ping\x81\x05Hello", 13), r,
+                            "Expected pong and echo");
+
+  // Broadcast
+  TEST_ASSERT_EQUAL_MESSAGE(1, ws.broadcastText("all"), "Expected one recipient");
+  r = readWebSocket(*client, ws, 5);
+  TEST_ASSERT_EQUAL_MESSAGE(std::string("\x81\x03" "all"), r, "Expected broadcast");
+
+  // Close handshake
+  client->writeFully(kClose, sizeof(kClose));
+  client->flush();
+  r = readWebSocket(*client, ws, 4);
+  TEST_ASSERT_EQUAL_MESSAGE(std::string("\x88\x02\x03\xe8", 4), r, "Expected close echo");
+  ws.loop();
+  TEST_ASSERT_TRUE_MESSAGE(disconnected, "Expected disconnect");
+  TEST_ASSERT_EQUAL_MESSAGE(0, ws.connectionCount(), "Expected no connections");
+
+  client->close();
+  ws.end();
+}
+
+static void test_client_diffserv() {
+  constexpr uint16_t kPort = 80;
+  constexpr uint8_t kDiffServ = (0x2c << 2) | 1;
+  constexpr char kHost[]{"www.example.com"};
+
+  if (!waitForLocalIP()) {
+    return;
+  }
+
+  client = std::make_unique<EthernetClient>();
+  client->setConnectionTimeout(kConnectTimeout);
+
+  // Check that can't set DiffServ before connect
+  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*client), "Expected not connected");
+  TEST_ASSERT_EQUAL_MESSAGE(false, client->connected(), "Expected not connected (no data)");
+  TEST_ASSERT_FALSE_MESSAGE(client->setOutgoingDiffServ(kDiffServ), "Expected can't set DiffServ");
+
+  // Connect and set DiffServ
+  TEST_MESSAGE("Connecting ...");
+  TEST_ASSERT_EQUAL_MESSAGE(true, client->connect(kHost, kPort), "Expected connect success");
+  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*client), "Expected connected");
+  TEST_ASSERT_EQUAL_MESSAGE(true, client->connected(), "Expected connected (or data)");
+  TEST_ASSERT_TRUE_MESSAGE(client->setOutgoingDiffServ(kDiffServ), "Expected can set DiffServ");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(kDiffServ, client->outgoingDiffServ(), "Expected matching DiffServ");
+
+  client->close();
+}
+
+// Tests a variety of server object states.
+static void test_server_state() {
+  constexpr uint16_t kPort = 1025;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+
+  server = std::make_unique<EthernetServer>();
+
+  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
+  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
+  TEST_ASSERT_TRUE_MESSAGE(server->begin(kPort), "Expected TCP listen success");
+  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*server), "Expected listening");
+  TEST_ASSERT_EQUAL_MESSAGE(kPort, server->port(), "Expected valid port");
+  server->end();
+  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
+  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
+
+  TEST_ASSERT_EQUAL_MESSAGE(MEMP_NUM_TCP_PCB_LISTEN, EthernetServer::maxListeners(),
+                            "Expected default TCP max. listeners");
+}
+
+// Tests constructing EthernetServer with an int.
+static void test_server_construct_int_port() {
+  constexpr int port = 1025;
+
+  server = std::make_unique<EthernetServer>(port);
+  TEST_ASSERT_EQUAL(uint16_t{1025}, server->port());
+}
+
+// Tests setting a server port of zero to have the system choose one.
+static void test_server_zero_port() {
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+
+  server = std::make_unique<EthernetServer>();
+
+  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
+  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
+  TEST_ASSERT_TRUE_MESSAGE(server->begin(0), "Expected TCP listen success");
+  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*server), "Expected listening");
+  int32_t port = server->port();
+  TEST_ASSERT_NOT_EQUAL_MESSAGE(0, port, "Expected non-zero port");
+  TEST_MESSAGE(format("Server port = %" PRId32, port).data());
+  server->end();
+  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
+  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
+
+  server = std::make_unique<EthernetServer>(0);
+
+  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
+  TEST_ASSERT_EQUAL_MESSAGE(0, server->port(), "Expected zero port");
+  server->begin();
+  TEST_ASSERT_TRUE_MESSAGE(static_cast<bool>(*server), "Expected listening");
+  TEST_ASSERT_NOT_EQUAL_MESSAGE(0, server->port(), "Expected zero port");
+  server->end();
+  TEST_ASSERT_FALSE_MESSAGE(static_cast<bool>(*server), "Expected not listening");
+  TEST_ASSERT_EQUAL_MESSAGE(-1, server->port(), "Expected invalid port");
+}
+
+// Tests server accept().
+static void test_server_accept() {
+  constexpr uint16_t kPort = 1025;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests connecting with initial data.
+static void test_client_connect_with_data() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort, data, sizeof(data)),
+                           "Expected connect success");
+
+  EthernetClient c;
+  uint32_t t = millis();
+  while (!(c = server->available()) && (millis() - t) < 1000) {
+    yield();
+  }
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected connection with data");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), c.available(), "Expected initial data");
+  uint8_t buf[sizeof(data)];
+  TEST_ASSERT_EQUAL(sizeof(data), c.read(buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, buf, sizeof(data));
+
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests that a Fast Open server accepts data sent with the SYN once the client
+// has a cookie.
+static void test_server_fast_open() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t data[]{'h', 'e', 'l', 'l', 'o'};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  AcceptStats stats;
+
+  TEST_ASSERT_FALSE_MESSAGE(server->isFastOpen(), "Expected Fast Open off by default");
+  server->setFastOpen(true);
+  TEST_ASSERT_TRUE(server->isFastOpen());
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+
+  // The first connection gets a cookie and the second one uses it
+  for (int i = 0; i < 2; i++) {
+    TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort, data, sizeof(data)),
+                             "Expected connect success");
+    EthernetClient c;
+    uint32_t t = millis();
+    while (!(c = server->available()) && (millis() - t) < 1000) {
+      yield();
+    }
+    TEST_ASSERT_TRUE_MESSAGE(c, "Expected connection with data");
+    uint8_t buf[sizeof(data)];
+    TEST_ASSERT_EQUAL_MESSAGE(sizeof(data), c.read(buf, sizeof(buf)), "Expected initial data");
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data, buf, sizeof(data));
+    c.close();
+    client->close();
+  }
+
+  TEST_ASSERT_TRUE(server->acceptStats(stats));
+#if LWIP_TCP_FASTOPEN
+  TEST_ASSERT_EQUAL_MESSAGE(1, stats.fastOpenAccepted, "Expected one Fast Open connection");
+#else
+  TEST_ASSERT_EQUAL_MESSAGE(0, stats.fastOpenAccepted, "Expected no Fast Open connections");
+#endif  // LWIP_TCP_FASTOPEN
+
+  server->end();
+}
+
+// Tests that accepted connections use the server's congestion control from the
+// start, including its initial window.
+static void test_server_congestion_control() {
+  constexpr uint16_t kPort = 1025;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  TEST_ASSERT_TRUE_MESSAGE(server->congestionControl() == CongestionControl::kDefault,
+                           "Expected default congestion control");
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  server->setCongestionControl(CongestionControl::kLAN);
+  TEST_ASSERT_TRUE(server->congestionControl() == CongestionControl::kLAN);
+
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+  TEST_ASSERT_TRUE_MESSAGE(c.congestionControl() == CongestionControl::kLAN,
+                           "Expected the server's congestion control");
+  TEST_ASSERT_TRUE_MESSAGE(client->congestionControl() == CongestionControl::kNewReno,
+                           "Expected NewReno for the client");
+
+  EthernetClient::TCPInfo info;
+  TEST_ASSERT_TRUE(c.tcpInfo(info));
+  TEST_ASSERT_EQUAL_MESSAGE(std::min(10U * info.mss, std::max(2U * info.mss, 14600U)),
+                            info.cwnd, "Expected a 10-segment initial window");
+
+  TEST_ASSERT_TRUE(client->setCongestionControl(CongestionControl::kLANDelay));
+  TEST_ASSERT_TRUE(client->congestionControl() == CongestionControl::kLANDelay);
+
+  c.close();
+  client->close();
+  TEST_ASSERT_FALSE_MESSAGE(client->setCongestionControl(CongestionControl::kLAN),
+                            "Expected failure when not connected");
+  server->end();
+}
+
+// Tests splitting a stream into length-prefixed messages.
+static void test_message_framer() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t kMsg1[]{'h', 'e', 'l', 'l', 'o'};
+  constexpr uint8_t kMsg2[300]{1, 2, 3};
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+
+  MessageFramer framer{MessageFramer::Format::kVarint, 1000};
+  TEST_ASSERT_TRUE_MESSAGE(framer.write(*client, kMsg1, sizeof(kMsg1)),
+                           "Expected write success");
+  TEST_ASSERT_TRUE_MESSAGE(framer.write(*client, kMsg2, sizeof(kMsg2)),
+                           "Expected write success");
+  client->flush();
+
+  std::vector<size_t> sizes;
+  auto handler = [&sizes](const uint8_t *data, size_t size) {
+    sizes.push_back(size);
+    return true;
+  };
+
+  // Wait for both messages
+  uint32_t t = millis();
+  while (sizes.size() < 2 && (millis() - t) < 1000) {
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(0, framer.process(c, handler),
+                                         "Expected valid stream");
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(2, sizes.size(), "Expected two messages");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(kMsg1), sizes[0], "Expected message 1 size");
+  TEST_ASSERT_EQUAL_MESSAGE(sizeof(kMsg2), sizes[1], "Expected message 2 size");
+  TEST_ASSERT_EQUAL_MESSAGE(0, c.available(), "Expected all data consumed");
+
+  // A message that's too large
+  const uint8_t kTooLarge[]{0xe9, 0x07};  // 1001
+  client->write(kTooLarge, sizeof(kTooLarge));
+  client->flush();
+  int result = 0;
+  t = millis();
+  while (result == 0 && (millis() - t) < 1000) {
+    result = framer.process(c, handler);
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(-1, result, "Expected invalid stream");
+  TEST_ASSERT_EQUAL_MESSAGE(EMSGSIZE, framer.error(), "Expected EMSGSIZE");
+
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests that a message stays valid while its handler echoes it and more data
+// arrives.
+static void test_message_framer_echo() {
+  constexpr uint16_t kPort = 1025;
+  constexpr size_t kSize = 1000;
+  constexpr int kCount = 40;  // More than fits in the receive buffer
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+
+  MessageFramer framer{MessageFramer::Format::kLength16, kSize};
+
+  // Each message is filled with its index
+  int sent = 0;
+  auto sendMore = [&]() {
+    uint8_t msg[kSize];
+    while (sent < kCount && client->availableForWrite() >= static_cast<int>(kSize + 2)) {
+      std::fill_n(msg, kSize, static_cast<uint8_t>(sent));
+      if (!framer.write(*client, msg, kSize)) {
+        break;
+      }
+      sent++;
+    }
+    client->flush();
+  };
+
+  size_t echoed = 0;
+  auto readEchoes = [&]() {
+    int avail;
+    while ((avail = client->available()) > 0) {
+      client->consume(avail);
+      echoed += avail;
+    }
+  };
+
+  int received = 0;
+  bool intact = true;
+  auto handler = [&](const uint8_t *data, size_t size) {
+    std::vector<uint8_t> copy(data, data + size);
+    sendMore();
+    readEchoes();
+    if (!framer.write(c, data, size)) {
+      return false;
+    }
+    c.flush();
+    Ethernet.loop();
+    intact = intact && std::equal(copy.cbegin(), copy.cend(), data) &&
+             data[0] == static_cast<uint8_t>(received);
+    received++;
+    return true;
+  };
+
+  sendMore();
+  uint32_t t = millis();
+  while (received < kCount && (millis() - t) < 10000) {
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(0, framer.process(c, handler, 1),
+                                         "Expected valid stream");
+    readEchoes();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(kCount, received, "Expected all messages");
+  TEST_ASSERT_TRUE_MESSAGE(intact, "Expected messages unchanged during the handler");
+
+  t = millis();
+  while (echoed < kCount * (kSize + 2) && (millis() - t) < 1000) {
+    readEchoes();
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(kCount * (kSize + 2), echoed, "Expected all echoes");
+
+  c.close();
+  client->close();
+  server->end();
+}
+
+static void test_client_spans() {
+  constexpr uint16_t kPort = 1025;
+  constexpr char kData[] = "line 1\r\nline 2\r\npartial";
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+
+  size_t size;
+  TEST_ASSERT_NULL_MESSAGE(c.readableSpan(size), "Expected no data yet");
+
+  TEST_ASSERT_EQUAL_MESSAGE(std::strlen(kData), client->writeFully(kData),
+                            "Expected write success");
+  client->flush();
+
+  // Wait for all the data
+  uint32_t t = millis();
+  while (c.available() < static_cast<int>(std::strlen(kData)) &&
+         (millis() - t) < 1000) {
+    // Wait for data
+  }
+
+  const uint8_t *span = c.readableSpan(size);
+  TEST_ASSERT_NOT_NULL_MESSAGE(span, "Expected data");
+  TEST_ASSERT_EQUAL_MESSAGE(std::strlen(kData), size, "Expected all the data");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(kData, span, size, "Expected the data");
+  TEST_ASSERT_EQUAL_MESSAGE(6, c.findDelimiter('\r'), "Expected delimiter offset");
+  TEST_ASSERT_EQUAL_MESSAGE(6, c.findDelimiter("\r\n"), "Expected multi-byte delimiter offset");
+
+  const uint8_t *line = c.readUntil('\n', size);
+  TEST_ASSERT_EQUAL_PTR_MESSAGE(span, line, "Expected line in place");
+  TEST_ASSERT_EQUAL_MESSAGE(8, size, "Expected line size with delimiter");
+  line = c.readUntil('\n', size);
+  TEST_ASSERT_EQUAL_MESSAGE(8, size, "Expected second line size");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE("line 2", line, 6, "Expected second line");
+  TEST_ASSERT_NULL_MESSAGE(c.readUntil('\n', size), "Expected no complete line");
+  TEST_ASSERT_EQUAL_MESSAGE(7, c.available(), "Expected partial line left");
+
+  span = c.readableSpan(size);
+  TEST_ASSERT_EQUAL_MESSAGE(7, size, "Expected partial line size");
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE("partial", span, size, "Expected partial line");
+  TEST_ASSERT_EQUAL_MESSAGE(7, c.consume(100), "Expected consume clamped");
+  TEST_ASSERT_EQUAL_MESSAGE(0, c.available(), "Expected all data consumed");
+
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests that server socket options are applied to accepted connections.
+static void test_server_options() {
+  constexpr uint16_t kPort = 1025;
+  constexpr uint8_t kDiffServ = (0x2c << 2) | 1;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+
+  TEST_ASSERT_FALSE_MESSAGE(server->isNoDelay(), "Expected default no-delay");
+  TEST_ASSERT_EQUAL_MESSAGE(0, server->outgoingDiffServ(), "Expected default DiffServ");
+  TEST_ASSERT_FALSE_MESSAGE(server->isKeepAlive(), "Expected default keep-alive");
+  TEST_ASSERT_TRUE_MESSAGE(server->ackPolicy() == AckPolicy::kDelayed, "Expected default ACK policy");
+  TEST_ASSERT_FALSE_MESSAGE(client->setAckPolicy(AckPolicy::kImmediate),
+                            "Expected can't set ACK policy when not connected");
+
+  server->setNoDelay(true);
+  TEST_ASSERT_TRUE_MESSAGE(server->setOutgoingDiffServ(kDiffServ), "Expected can set DiffServ");
+  server->setKeepAlive(true);
+  server->setAckPolicy(AckPolicy::kQuick, 4, 500);
+  TEST_ASSERT_TRUE(server->isNoDelay());
+  TEST_ASSERT_EQUAL(kDiffServ, server->outgoingDiffServ());
+  TEST_ASSERT_TRUE(server->isKeepAlive());
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+  TEST_ASSERT_TRUE_MESSAGE(c.isNoDelay(), "Expected inherited no-delay");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(kDiffServ, c.outgoingDiffServ(), "Expected inherited DiffServ");
+  TEST_ASSERT_TRUE_MESSAGE(c.isKeepAlive(), "Expected inherited keep-alive");
+  TEST_ASSERT_TRUE_MESSAGE(c.ackPolicy() == AckPolicy::kQuick, "Expected inherited ACK policy");
+  TEST_ASSERT_FALSE_MESSAGE(client->isNoDelay(), "Expected client unaffected");
+  TEST_ASSERT_FALSE_MESSAGE(client->isKeepAlive(), "Expected client keep-alive unaffected");
+  TEST_ASSERT_TRUE_MESSAGE(client->ackPolicy() == AckPolicy::kDelayed, "Expected client ACK policy unaffected");
+  TEST_ASSERT_TRUE(client->setAckPolicy(AckPolicy::kImmediate));
+  TEST_ASSERT_TRUE(client->ackPolicy() == AckPolicy::kImmediate);
+  c.close();
+  client->close();
+  server->end();
+}
+
+// Tests the server backlog and accept statistics.
+static void test_server_backlog() {
+  constexpr uint16_t kPort = 1025;
+
+  TEST_ASSERT_TRUE_MESSAGE(Ethernet.begin(kStaticIP, kSubnetMask, kGateway),
+                           "Expected successful Ethernet start");
+  Ethernet.setLinkState(true);  // connect() won't work unless there's a link
+
+  server = std::make_unique<EthernetServer>();
+  client = std::make_unique<EthernetClient>();
+  AcceptStats stats;
+
+  TEST_ASSERT_EQUAL_MESSAGE(TCP_DEFAULT_LISTEN_BACKLOG, server->backlog(), "Expected default backlog");
+  TEST_ASSERT_FALSE_MESSAGE(server->acceptStats(stats), "Expected no stats when not listening");
+
+  server->setBacklog(2);
+  TEST_ASSERT_EQUAL(2, server->backlog());
+
+  TEST_ASSERT_TRUE_MESSAGE(server->beginWithReuse(kPort), "Expected listen success");
+  TEST_ASSERT_TRUE_MESSAGE(server->acceptStats(stats), "Expected stats when listening");
+  TEST_ASSERT_EQUAL_MESSAGE(0, stats.accepted, "Expected no accepted connections");
+
+  TEST_ASSERT_TRUE_MESSAGE(client->connect(Ethernet.localIP(), kPort), "Expected connect success");
+  EthernetClient c = server->accept();
+  TEST_ASSERT_TRUE_MESSAGE(c, "Expected accepted connection");
+  TEST_ASSERT_TRUE(server->acceptStats(stats));
+  TEST_ASSERT_EQUAL_MESSAGE(1, stats.accepted, "Expected one accepted connection");
+  TEST_ASSERT_EQUAL_MESSAGE(0, stats.dropped, "Expected no dropped requests");
+  TEST_ASSERT_EQUAL_MESSAGE(0, stats.pending, "Expected no half-open connections");
+#if TCP_LISTEN_BACKLOG
+  TEST_ASSERT_EQUAL_MESSAGE(2, stats.backlog, "Expected backlog");
+
+  // Changes apply to the listener
+  server->setBacklog(1);
+  TEST_ASSERT_TRUE(server->acceptStats(stats));
+  TEST_ASSERT_EQUAL_MESSAGE(1, stats.backlog, "Expected changed backlog");
+#endif  // TCP_LISTEN_BACKLOG
+
   c.close();
   client->close();
   server->end();
+  TEST_ASSERT_FALSE_MESSAGE(server->acceptStats(stats), "Expected no stats after end");
 }
 
 // Tests state from some of the other classes.
@@ -1275,6 +2995,15 @@ void setup() {
   RUN_TEST(test_udp_state);
   RUN_TEST(test_udp_options);
   RUN_TEST(test_udp_zero_length);
+  RUN_TEST(test_udp_sendv);
+  RUN_TEST(test_udp_packet_handler);
+  RUN_TEST(test_udp_spans);
+  RUN_TEST(test_udp_printf);
+  RUN_TEST(test_tftp_server);
+  RUN_TEST(test_log_sink);
+  RUN_TEST(test_pixelpusher_server);
+  RUN_TEST(test_dmx_server);
+  RUN_TEST(test_osc);
   RUN_TEST(test_udp_diffserv);
   RUN_TEST(test_client);
   RUN_TEST(test_client_write_single_bytes);
@@ -1283,11 +3012,31 @@ void setup() {
   RUN_TEST(test_client_state);
   RUN_TEST(test_client_addr_info);
   RUN_TEST(test_client_options);
+  RUN_TEST(test_client_writev);
+  RUN_TEST(test_client_cork);
+  RUN_TEST(test_client_cork_zero_timeout);
+  RUN_TEST(test_client_cork_no_timer);
+  RUN_TEST(test_client_tcp_info);
+  RUN_TEST(test_client_splice);
+  RUN_TEST(test_client_splice_fin);
+  RUN_TEST(test_client_splice_leftover);
+  RUN_TEST(test_client_post_receive);
+  RUN_TEST(test_connection_pool);
+  RUN_TEST(test_http_server);
+  RUN_TEST(test_websocket_server);
   RUN_TEST(test_client_diffserv);
   RUN_TEST(test_server_state);
   RUN_TEST(test_server_construct_int_port);
   RUN_TEST(test_server_zero_port);
   RUN_TEST(test_server_accept);
+  RUN_TEST(test_server_options);
+  RUN_TEST(test_server_backlog);
+  RUN_TEST(test_client_connect_with_data);
+  RUN_TEST(test_server_fast_open);
+  RUN_TEST(test_server_congestion_control);
+  RUN_TEST(test_message_framer);
+  RUN_TEST(test_message_framer_echo);
+  RUN_TEST(test_client_spans);
   RUN_TEST(test_other_state);
   RUN_TEST(test_raw_frames);
   UNITY_END();
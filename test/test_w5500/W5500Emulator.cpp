@@ -0,0 +1,448 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// W5500Emulator.cpp implements the W5500 emulator.
+// This file is part of the QNEthernet library.
+
+#include "W5500Emulator.h"
+
+// C++ includes
+#include <algorithm>
+#include <cstring>
+
+// Common register addresses.
+static constexpr uint16_t kMR       = 0x0000;
+static constexpr uint16_t kPHYCFGR  = 0x002e;
+static constexpr uint16_t kVERSIONR = 0x0039;
+
+// Socket register addresses not needed by tests.
+static constexpr uint16_t kSn_RXBUF_SIZE = 0x001e;
+static constexpr uint16_t kSn_TXBUF_SIZE = 0x001f;
+
+// Socket modes and commands.
+static constexpr uint8_t kModeTCP    = 0x01;
+static constexpr uint8_t kModeMacraw = 0x04;
+static constexpr uint8_t kCmdOpen    = 0x01;
+static constexpr uint8_t kCmdListen  = 0x02;
+static constexpr uint8_t kCmdConnect = 0x04;
+static constexpr uint8_t kCmdDiscon  = 0x08;
+static constexpr uint8_t kCmdClose   = 0x10;
+static constexpr uint8_t kCmdSend    = 0x20;
+static constexpr uint8_t kCmdRecv    = 0x40;
+
+W5500Emulator &W5500Emulator::instance() {
+  static W5500Emulator emulator;
+  return emulator;
+}
+
+W5500Emulator::W5500Emulator() {
+  reset();
+}
+
+void W5500Emulator::reset() {
+  resetRegisters();
+  common_[kPHYCFGR] = 0x07;  // Link up, 100 Mbps, full duplex
+  for (Socket &s : sockets_) {
+    std::memset(s.tx, 0, sizeof(s.tx));
+    std::memset(s.rx, 0, sizeof(s.rx));
+  }
+
+  selected_  = false;
+  headerLen_ = 0;
+  addr_      = 0;
+  holdTx_    = false;
+  autoAck_   = true;
+
+  transactions_ = 0;
+  reads_.assign(kSocketCount * 0x30, 0);
+  commands_.assign(kSocketCount * 256, 0);
+  frames_.clear();
+}
+
+void W5500Emulator::resetRegisters() {
+  const uint8_t phy = common_[kPHYCFGR];
+  std::memset(common_, 0, sizeof(common_));
+  common_[kVERSIONR] = 4;
+  common_[kPHYCFGR]  = phy;
+  for (Socket &s : sockets_) {
+    std::memset(s.regs, 0, sizeof(s.regs));
+    s.regs[kSn_RXBUF_SIZE] = 2;
+    s.regs[kSn_TXBUF_SIZE] = 2;
+    s.sendWr  = 0;
+    s.recvRd  = 0;
+    s.sent.clear();
+    s.finSent = false;
+  }
+}
+
+// --------------------------------------------------------------------------
+//  SPI
+// --------------------------------------------------------------------------
+
+void W5500Emulator::select() {
+  selected_  = true;
+  headerLen_ = 0;
+  transactions_++;
+}
+
+void W5500Emulator::deselect() {
+  selected_ = false;
+}
+
+void W5500Emulator::transfer(uint8_t *buf, size_t count) {
+  if (!selected_) {
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (headerLen_ < 3) {
+      header_[headerLen_++] = buf[i];
+      if (headerLen_ == 3) {
+        addr_ = (uint16_t{header_[0]} << 8) | header_[1];
+        const uint8_t bsb = header_[2] >> 3;
+        if ((header_[2] & 0x04) == 0 && (bsb & 0x03) == 1 && addr_ < 0x30) {
+          reads_[(bsb >> 2) * 0x30 + addr_]++;
+        }
+      }
+      continue;
+    }
+    const uint8_t block = header_[2] >> 3;
+    if ((header_[2] & 0x04) != 0) {
+      writeByte(block, addr_++, buf[i]);
+    } else {
+      buf[i] = readByte(block, addr_++);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+//  Registers and Buffers
+// --------------------------------------------------------------------------
+
+size_t W5500Emulator::txSize(uint8_t socket) const {
+  return size_t{sockets_[socket].regs[kSn_TXBUF_SIZE]} * 1024;
+}
+
+size_t W5500Emulator::rxSize(uint8_t socket) const {
+  return size_t{sockets_[socket].regs[kSn_RXBUF_SIZE]} * 1024;
+}
+
+uint16_t W5500Emulator::get16(uint8_t socket, uint16_t addr) const {
+  const uint8_t *r = &sockets_[socket].regs[addr];
+  return (uint16_t{r[0]} << 8) | r[1];
+}
+
+void W5500Emulator::set16(uint8_t socket, uint16_t addr, uint16_t v) {
+  uint8_t *r = &sockets_[socket].regs[addr];
+  r[0] = v >> 8;
+  r[1] = v;
+}
+
+void W5500Emulator::updateComputed(uint8_t socket) {
+  const Socket &s = sockets_[socket];
+  const uint16_t pending = s.sendWr - get16(socket, kSn_TX_RD);
+  set16(socket, kSn_TX_FSR,
+        static_cast<uint16_t>(std::max<size_t>(txSize(socket), pending) -
+                              pending));
+  set16(socket, kSn_RX_RSR, get16(socket, kSn_RX_WR) - s.recvRd);
+}
+
+uint16_t W5500Emulator::reg16(uint8_t socket, uint16_t addr) {
+  updateComputed(socket);
+  return get16(socket, addr);
+}
+
+uint8_t W5500Emulator::readByte(uint8_t block, uint16_t addr) {
+  const uint8_t socket = block >> 2;
+  switch (block & 0x03) {
+    case 0:
+      return (block == 0 && addr < sizeof(common_)) ? common_[addr] : 0;
+    case 1:
+      if (addr >= sizeof(Socket::regs)) {
+        return 0;
+      }
+      if ((addr & ~1) == kSn_TX_FSR || (addr & ~1) == kSn_RX_RSR) {
+        updateComputed(socket);
+      }
+      return sockets_[socket].regs[addr];
+    case 2: {
+      const size_t size = txSize(socket);
+      return (size == 0) ? 0 : sockets_[socket].tx[addr & (size - 1)];
+    }
+    default: {
+      const size_t size = rxSize(socket);
+      return (size == 0) ? 0 : sockets_[socket].rx[addr & (size - 1)];
+    }
+  }
+}
+
+void W5500Emulator::writeByte(uint8_t block, uint16_t addr, uint8_t v) {
+  const uint8_t socket = block >> 2;
+  switch (block & 0x03) {
+    case 0:
+      if (block != 0 || addr >= sizeof(common_)) {
+        return;
+      }
+      if (addr == kMR && (v & 0x80) != 0) {
+        resetRegisters();
+        return;
+      }
+      if (addr != kVERSIONR && addr != kPHYCFGR) {
+        common_[addr] = v;
+      }
+      return;
+    case 1:
+      switch (addr) {
+        case kSn_CR:
+          command(socket, v);
+          return;
+        case kSn_IR:
+          sockets_[socket].regs[kSn_IR] &= ~v;
+          return;
+        case kSn_SR:
+        case kSn_TX_FSR: case kSn_TX_FSR + 1:
+        case kSn_TX_RD:  case kSn_TX_RD + 1:
+        case kSn_RX_RSR: case kSn_RX_RSR + 1:
+        case kSn_RX_WR:  case kSn_RX_WR + 1:
+          return;  // Read-only
+        default:
+          if (addr < sizeof(Socket::regs)) {
+            sockets_[socket].regs[addr] = v;
+          }
+          return;
+      }
+    case 2: {
+      const size_t size = txSize(socket);
+      if (size != 0) {
+        sockets_[socket].tx[addr & (size - 1)] = v;
+      }
+      return;
+    }
+    default: {
+      const size_t size = rxSize(socket);
+      if (size != 0) {
+        sockets_[socket].rx[addr & (size - 1)] = v;
+      }
+      return;
+    }
+  }
+}
+
+void W5500Emulator::command(uint8_t socket, uint8_t cmd) {
+  commands_[socket * 256 + cmd]++;
+
+  Socket &s = sockets_[socket];
+  uint8_t &sr = s.regs[kSn_SR];
+  switch (cmd) {
+    case kCmdOpen: {
+      const uint8_t mode = s.regs[kSn_MR] & 0x0f;
+      if (mode == kModeTCP) {
+        sr = kInit;
+      } else if (mode == kModeMacraw && socket == 0) {
+        sr = kMacraw;
+      } else {
+        sr = kClosed;
+        break;
+      }
+
+      // The pointers are kept; anything unsent or unread is dropped
+      const uint16_t txWr = get16(socket, kSn_TX_WR);
+      set16(socket, kSn_TX_RD, txWr);
+      s.sendWr = txWr;
+      const uint16_t rxWr = get16(socket, kSn_RX_WR);
+      set16(socket, kSn_RX_RD, rxWr);
+      s.recvRd = rxWr;
+      s.regs[kSn_IR] = 0;
+      s.sent.clear();
+      s.finSent = false;
+      break;
+    }
+
+    case kCmdListen:
+      if (sr == kInit) {
+        sr = kListen;
+      }
+      break;
+
+    case kCmdConnect:
+      if (sr == kInit) {
+        sr = kSynSent;
+      }
+      break;
+
+    case kCmdDiscon:
+      if (sr == kEstablished) {
+        sr = kFinWait;
+        s.finSent = true;
+      } else if (sr == kCloseWait) {
+        sr = kLastAck;
+        s.finSent = true;
+      } else if (sr != kFinWait && sr != kLastAck && sr != kTimeWait) {
+        sr = kClosed;
+      }
+      break;
+
+    case kCmdClose:
+      sr = kClosed;
+      break;
+
+    case kCmdSend: {
+      const uint16_t wr = get16(socket, kSn_TX_WR);
+      const size_t size = txSize(socket);
+      std::string data;
+      for (uint16_t p = s.sendWr; p != wr; p++) {
+        data += static_cast<char>(s.tx[p & (size - 1)]);
+      }
+      if (sr == kMacraw) {
+        frames_.push_back(data);
+        s.sendWr = wr;
+        if (!holdTx_) {
+          set16(socket, kSn_TX_RD, wr);
+        }
+      } else if (sr == kEstablished || sr == kCloseWait) {
+        s.sent += data;
+        s.sendWr = wr;
+        if (autoAck_) {
+          set16(socket, kSn_TX_RD, wr);
+        }
+      } else {
+        break;
+      }
+      s.regs[kSn_IR] |= kIRSendOk;
+      break;
+    }
+
+    case kCmdRecv:
+      s.recvRd = get16(socket, kSn_RX_RD);
+      break;
+
+    default:
+      break;
+  }
+  s.regs[kSn_CR] = 0;
+}
+
+// --------------------------------------------------------------------------
+//  Observation
+// --------------------------------------------------------------------------
+
+size_t W5500Emulator::readCount(uint8_t socket, uint16_t addr) const {
+  return reads_[socket * 0x30 + addr];
+}
+
+size_t W5500Emulator::commandCount(uint8_t socket, uint8_t cmd) const {
+  return commands_[socket * 256 + cmd];
+}
+
+int W5500Emulator::findSocket(uint8_t state, uint16_t port) const {
+  for (size_t i = 0; i < kSocketCount; i++) {
+    if (sockets_[i].regs[kSn_SR] == state &&
+        (port == 0 || get16(i, kSn_PORT) == port)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+size_t W5500Emulator::countSockets(uint8_t state, uint16_t port) const {
+  size_t count = 0;
+  for (size_t i = 0; i < kSocketCount; i++) {
+    if (sockets_[i].regs[kSn_SR] == state && get16(i, kSn_PORT) == port) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// --------------------------------------------------------------------------
+//  Control
+// --------------------------------------------------------------------------
+
+void W5500Emulator::setLinkUp(bool flag) {
+  if (flag) {
+    common_[kPHYCFGR] |= 0x01;
+  } else {
+    common_[kPHYCFGR] &= ~0x01;
+  }
+}
+
+void W5500Emulator::setState(uint8_t socket, uint8_t state) {
+  sockets_[socket].regs[kSn_SR] = state;
+}
+
+void W5500Emulator::setTxPointer(uint8_t socket, uint16_t ptr) {
+  set16(socket, kSn_TX_RD, ptr);
+  set16(socket, kSn_TX_WR, ptr);
+  sockets_[socket].sendWr = ptr;
+}
+
+void W5500Emulator::releaseTx(uint8_t socket) {
+  set16(socket, kSn_TX_RD, sockets_[socket].sendWr);
+}
+
+void W5500Emulator::receiveFrame(const std::string &frame) {
+  Socket &s = sockets_[0];
+  const size_t size = rxSize(0);
+  uint16_t wr = get16(0, kSn_RX_WR);
+  const uint16_t len = frame.size() + 2;
+  s.rx[wr++ & (size - 1)] = len >> 8;
+  s.rx[wr++ & (size - 1)] = len;
+  for (char c : frame) {
+    s.rx[wr++ & (size - 1)] = c;
+  }
+  set16(0, kSn_RX_WR, wr);
+  s.regs[kSn_IR] |= kIRRecv;
+}
+
+bool W5500Emulator::peerConnect(uint8_t socket, const uint8_t ip[4],
+                                uint16_t port) {
+  Socket &s = sockets_[socket];
+  if (s.regs[kSn_SR] != kListen) {
+    return false;
+  }
+  std::memcpy(&s.regs[kSn_DIPR], ip, 4);
+  set16(socket, kSn_DPORT, port);
+  s.regs[kSn_SR] = kEstablished;
+  s.regs[kSn_IR] |= kIRCon;
+  return true;
+}
+
+void W5500Emulator::establish(uint8_t socket) {
+  Socket &s = sockets_[socket];
+  if (s.regs[kSn_SR] == kSynSent) {
+    s.regs[kSn_SR] = kEstablished;
+    s.regs[kSn_IR] |= kIRCon;
+  }
+}
+
+void W5500Emulator::peerSend(uint8_t socket, const std::string &data) {
+  Socket &s = sockets_[socket];
+  const size_t size = rxSize(socket);
+  uint16_t wr = get16(socket, kSn_RX_WR);
+  for (char c : data) {
+    s.rx[wr++ & (size - 1)] = c;
+  }
+  set16(socket, kSn_RX_WR, wr);
+  s.regs[kSn_IR] |= kIRRecv;
+}
+
+void W5500Emulator::peerClose(uint8_t socket) {
+  Socket &s = sockets_[socket];
+  if (s.regs[kSn_SR] == kEstablished) {
+    s.regs[kSn_SR] = kCloseWait;
+  } else if (s.regs[kSn_SR] == kFinWait) {
+    s.regs[kSn_SR] = kClosed;
+  }
+  s.regs[kSn_IR] |= kIRDiscon;
+}
+
+void W5500Emulator::finishClose(uint8_t socket) {
+  Socket &s = sockets_[socket];
+  s.regs[kSn_SR] = kClosed;
+  s.regs[kSn_IR] |= kIRDiscon;
+}
+
+void W5500Emulator::timeout(uint8_t socket) {
+  Socket &s = sockets_[socket];
+  s.regs[kSn_SR] = kClosed;
+  s.regs[kSn_IR] |= kIRTimeout;
+}
@@ -0,0 +1,213 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// W5500Emulator.h defines a register-level W5500 emulator for host tests.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// W5500Emulator decodes the SPI frames the driver sends and keeps the common
+// and socket registers and the socket buffers. Socket commands take effect
+// immediately, so Sn_CR always reads back as zero.
+//
+// The peer side of each hardware TCP socket is driven by the test: it can
+// connect to a listening socket, complete a connect, send data, acknowledge
+// data, and close. Data the chip transmits is collected per socket.
+//
+// Sn_TX_FSR is the buffer size minus the data between Sn_TX_RD and the
+// Sn_TX_WR value of the last SEND, so data only counts against the free size
+// once it's been sent. Sn_TX_RD moves when the peer acknowledges, or right away
+// with auto-acknowledge, which is the default. MACRAW frames are freed as soon
+// as they're sent unless transmission is held.
+class W5500Emulator final {
+ public:
+  static constexpr size_t kSocketCount = 8;
+
+  // Socket register offsets.
+  static constexpr uint16_t kSn_MR      = 0x0000;
+  static constexpr uint16_t kSn_CR      = 0x0001;
+  static constexpr uint16_t kSn_IR      = 0x0002;
+  static constexpr uint16_t kSn_SR      = 0x0003;
+  static constexpr uint16_t kSn_PORT    = 0x0004;
+  static constexpr uint16_t kSn_DIPR    = 0x000c;
+  static constexpr uint16_t kSn_DPORT   = 0x0010;
+  static constexpr uint16_t kSn_TX_FSR  = 0x0020;
+  static constexpr uint16_t kSn_TX_RD   = 0x0022;
+  static constexpr uint16_t kSn_TX_WR   = 0x0024;
+  static constexpr uint16_t kSn_RX_RSR  = 0x0026;
+  static constexpr uint16_t kSn_RX_RD   = 0x0028;
+  static constexpr uint16_t kSn_RX_WR   = 0x002a;
+
+  // Socket states.
+  static constexpr uint8_t kClosed      = 0x00;
+  static constexpr uint8_t kInit        = 0x13;
+  static constexpr uint8_t kListen      = 0x14;
+  static constexpr uint8_t kSynSent     = 0x15;
+  static constexpr uint8_t kEstablished = 0x17;
+  static constexpr uint8_t kFinWait     = 0x18;
+  static constexpr uint8_t kTimeWait    = 0x1b;
+  static constexpr uint8_t kCloseWait   = 0x1c;
+  static constexpr uint8_t kLastAck     = 0x1d;
+  static constexpr uint8_t kMacraw      = 0x42;
+
+  // Socket interrupt bits.
+  static constexpr uint8_t kIRSendOk  = 0x10;
+  static constexpr uint8_t kIRTimeout = 0x08;
+  static constexpr uint8_t kIRRecv    = 0x04;
+  static constexpr uint8_t kIRDiscon  = 0x02;
+  static constexpr uint8_t kIRCon     = 0x01;
+
+  // Returns the emulator that the SPI stand-in talks to.
+  static W5500Emulator &instance();
+
+  // Puts the chip back into its power-on state and clears all counters and
+  // captured data.
+  void reset();
+
+  // SPI interface, called by the stand-ins.
+  void select();
+  void deselect();
+  void transfer(uint8_t *buf, size_t count);
+
+  // ----------------
+  //  Observation
+  // ----------------
+
+  // Returns the number of SPI transactions, one per chip select.
+  size_t transactionCount() const {
+    return transactions_;
+  }
+
+  // Returns the number of read transactions that started at the given
+  // register of the given socket.
+  size_t readCount(uint8_t socket, uint16_t addr) const;
+
+  // Returns the number of commands of the given kind sent to a socket.
+  size_t commandCount(uint8_t socket, uint8_t cmd) const;
+
+  uint8_t state(uint8_t socket) const {
+    return sockets_[socket].regs[kSn_SR];
+  }
+
+  // Returns a 16-bit socket register as the driver would read it.
+  uint16_t reg16(uint8_t socket, uint16_t addr);
+
+  // Returns the frames sent from the MACRAW socket, in order.
+  const std::vector<std::string> &frames() const {
+    return frames_;
+  }
+
+  // Returns all the data sent on a TCP socket since it was opened.
+  const std::string &sent(uint8_t socket) const {
+    return sockets_[socket].sent;
+  }
+
+  // Returns whether a TCP socket has sent a FIN.
+  bool finSent(uint8_t socket) const {
+    return sockets_[socket].finSent;
+  }
+
+  // Returns the first socket in the given state, or -1 if there isn't one.
+  int findSocket(uint8_t state, uint16_t port = 0) const;
+
+  // Returns the number of sockets in the given state on the given port.
+  size_t countSockets(uint8_t state, uint16_t port) const;
+
+  // ----------------
+  //  Control
+  // ----------------
+
+  void setLinkUp(bool flag);
+
+  // Sets a socket's state directly.
+  void setState(uint8_t socket, uint8_t state);
+
+  // Sets a socket's TX pointers, for example, to where a previous user of the
+  // socket left them. They are kept when the socket is opened.
+  void setTxPointer(uint8_t socket, uint16_t ptr);
+
+  // Keeps MACRAW frames in the TX buffer after they're sent, until
+  // releaseTx() is called.
+  void setHoldTx(bool flag) {
+    holdTx_ = flag;
+  }
+
+  // Frees all the sent data in a socket's TX buffer.
+  void releaseTx(uint8_t socket);
+
+  // Sets whether sent TCP data is acknowledged right away.
+  void setAutoAck(bool flag) {
+    autoAck_ = flag;
+  }
+
+  // Adds a received frame to the MACRAW socket, with its length prefix.
+  void receiveFrame(const std::string &frame);
+
+  // Has a peer connect to a socket that's listening. This returns whether
+  // successful.
+  bool peerConnect(uint8_t socket, const uint8_t ip[4], uint16_t port);
+
+  // Completes a connect started by the driver.
+  void establish(uint8_t socket);
+
+  // Has the peer send data.
+  void peerSend(uint8_t socket, const std::string &data);
+
+  // Has the peer close its side.
+  void peerClose(uint8_t socket);
+
+  // Completes a close that the driver started.
+  void finishClose(uint8_t socket);
+
+  // Has a socket time out.
+  void timeout(uint8_t socket);
+
+ private:
+  struct Socket final {
+    uint8_t regs[0x30];
+    uint8_t tx[16 * 1024];
+    uint8_t rx[16 * 1024];
+    uint16_t sendWr;  // Sn_TX_WR at the last SEND
+    uint16_t recvRd;  // Sn_RX_RD at the last RECV
+    std::string sent;
+    bool finSent;
+  };
+
+  W5500Emulator();
+
+  // Resets the registers, as a soft reset does.
+  void resetRegisters();
+
+  uint8_t readByte(uint8_t block, uint16_t addr);
+  void writeByte(uint8_t block, uint16_t addr, uint8_t v);
+  void command(uint8_t socket, uint8_t cmd);
+  void updateComputed(uint8_t socket);
+
+  size_t txSize(uint8_t socket) const;
+  size_t rxSize(uint8_t socket) const;
+  uint16_t get16(uint8_t socket, uint16_t addr) const;
+  void set16(uint8_t socket, uint16_t addr, uint16_t v);
+
+  uint8_t common_[0x40];
+  Socket sockets_[kSocketCount];
+
+  // Transaction state
+  bool selected_ = false;
+  size_t headerLen_ = 0;
+  uint8_t header_[3];
+  uint16_t addr_ = 0;
+
+  bool holdTx_  = false;
+  bool autoAck_ = true;
+
+  size_t transactions_ = 0;
+  std::vector<size_t> reads_;     // [socket][addr]
+  std::vector<size_t> commands_;  // [socket][cmd]
+  std::vector<std::string> frames_;
+};
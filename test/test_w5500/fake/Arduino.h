@@ -0,0 +1,25 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// Arduino.h is a host stand-in for the few Arduino functions the W5500 driver
+// uses. Time only moves when delay() is called or the test advances it.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define LOW    0
+#define HIGH   1
+#define INPUT  0
+#define OUTPUT 1
+
+extern "C" {
+uint32_t millis();
+void delay(uint32_t ms);
+void yield();
+}  // extern "C"
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// SPI.h is a host stand-in for the Arduino SPI library. Transfers go to the
+// W5500 emulator.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define MSBFIRST  1
+#define SPI_MODE0 0x00
+
+class SPISettings final {
+ public:
+  constexpr SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode)
+      : clock_(clock),
+        bitOrder_(bitOrder),
+        dataMode_(dataMode) {}
+
+ private:
+  uint32_t clock_;
+  uint8_t bitOrder_;
+  uint8_t dataMode_;
+};
+
+class SPIClass final {
+ public:
+  void begin() {}
+  void end() {}
+  void beginTransaction(const SPISettings &settings) {
+    static_cast<void>(settings);
+  }
+  void endTransaction() {}
+
+  // Transfers bytes in place.
+  void transfer(void *buf, size_t count);
+};
+
+extern SPIClass SPI;
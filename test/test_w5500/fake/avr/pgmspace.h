@@ -0,0 +1,13 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// pgmspace.h is a host stand-in for the AVR program memory macros.
+// This file is part of the QNEthernet library.
+
+#pragma once
+
+// C includes
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
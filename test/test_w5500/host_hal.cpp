@@ -0,0 +1,96 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// host_hal.cpp implements the Arduino, SPI, and QNEthernet HAL stand-ins for
+// the host W5500 tests.
+// This file is part of the QNEthernet library.
+
+// C++ includes
+#include <cstdint>
+#include <cstdlib>
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "W5500Emulator.h"
+#include "lwip/arch.h"
+#include "lwip/pbuf.h"
+#include "netif/ethernet.h"
+#include "qnethernet_opts.h"
+
+// Current time, in milliseconds. This only moves when delay() is called.
+static uint32_t s_now = 0;
+
+SPIClass SPI;
+
+void SPIClass::transfer(void *buf, size_t count) {
+  W5500Emulator::instance().transfer(static_cast<uint8_t *>(buf), count);
+}
+
+void pinMode(int pin, int mode) {
+  static_cast<void>(pin);
+  static_cast<void>(mode);
+}
+
+// The only output is the chip select.
+void digitalWrite(int pin, int value) {
+  static_cast<void>(pin);
+  if (value == LOW) {
+    W5500Emulator::instance().select();
+  } else {
+    W5500Emulator::instance().deselect();
+  }
+}
+
+extern "C" {
+
+uint32_t millis() {
+  return s_now;
+}
+
+void delay(uint32_t ms) {
+  s_now += ms;
+}
+
+void yield() {
+}
+
+uint32_t qnethernet_hal_millis() {
+  return s_now;
+}
+
+void qnethernet_hal_stdio_flush(int file) {
+  static_cast<void>(file);
+}
+
+void qnethernet_hal_check_core_locking(const char *file, int line,
+                                       const char *func) {
+  static_cast<void>(file);
+  static_cast<void>(line);
+  static_cast<void>(func);
+}
+
+void qnethernet_hal_init_rand() {
+}
+
+uint32_t qnethernet_hal_rand() {
+  return std::rand();
+}
+
+void qnethernet_hal_get_system_mac_address(uint8_t mac[ETH_HWADDR_LEN]) {
+  static constexpr uint8_t kMAC[ETH_HWADDR_LEN]{0x02, 0, 0, 0x55, 0, 0x01};
+  for (int i = 0; i < ETH_HWADDR_LEN; i++) {
+    mac[i] = kMAC[i];
+  }
+}
+
+#if QNETHERNET_ENABLE_RAW_FRAME_SUPPORT
+// Drops frames that lwIP doesn't know about.
+err_t unknown_eth_protocol(struct pbuf *p, struct netif *netif) {
+  static_cast<void>(netif);
+  pbuf_free(p);
+  return ERR_OK;
+}
+#endif  // QNETHERNET_ENABLE_RAW_FRAME_SUPPORT
+
+}  // extern "C"
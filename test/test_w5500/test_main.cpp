@@ -0,0 +1,761 @@
+// SPDX-FileCopyrightText: (c) 2024 Shawn Silverman <shawn@pobox.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// test_main.cpp tests the W5500 driver against a register-level emulator.
+// This file is part of the QNEthernet library.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <lwip/altcp.h>
+#include <lwip/ip_addr.h>
+#include <lwip/netif.h>
+#include <lwip/pbuf.h>
+#include <lwip/prot/ethernet.h>
+#include <lwip/prot/ip.h>
+#include <lwip/prot/tcp.h>
+#include <lwip/priv/tcp_priv.h>
+#include <lwip/tcp.h>
+#include <lwip_driver.h>
+#include <unity.h>
+
+#include "W5500Emulator.h"
+
+// --------------------------------------------------------------------------
+//  Utilities
+// --------------------------------------------------------------------------
+
+using W = W5500Emulator;
+
+static constexpr uint8_t kMAC[6]{0x02, 0, 0, 0x55, 0, 0x02};
+
+// Socket commands, as seen by the emulator.
+static constexpr uint8_t kCmdOpen = 0x01;
+static constexpr uint8_t kCmdSend = 0x20;
+
+static constexpr uint8_t kLocalIP[4]{192, 168, 0, 2};
+static constexpr uint8_t kPeerIP[4]{192, 168, 0, 3};
+
+extern "C" struct altcp_pcb *altcp_w5500_alloc(void *arg, u8_t ip_type);
+
+// Makes a frame of the given size with a recognizable pattern.
+static std::string makeFrame(size_t size, uint8_t seed) {
+  std::string frame(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    frame[i] = static_cast<char>(seed + i);
+  }
+  return frame;
+}
+
+// Sends a raw frame through the driver.
+static bool output(const std::string &frame) {
+  return driver_output_frame(reinterpret_cast<const uint8_t *>(frame.data()),
+                             frame.size());
+}
+
+// Everything the altcp callbacks saw for one connection.
+struct Events final {
+  struct altcp_pcb *accepted = nullptr;
+  Events *acceptedEvents = nullptr;  // Events for accepted connections
+  bool connected = false;
+  std::string received;
+  bool fin = false;
+  err_t err = ERR_OK;
+  bool errCalled = false;
+  size_t sent = 0;
+};
+
+static err_t recvFn(void *arg, struct altcp_pcb *conn, struct pbuf *p,
+                    err_t err) {
+  Events *e = static_cast<Events *>(arg);
+  if (p == nullptr) {
+    e->fin = true;
+    return ERR_OK;
+  }
+  for (struct pbuf *q = p; q != nullptr; q = q->next) {
+    e->received.append(static_cast<const char *>(q->payload), q->len);
+  }
+  altcp_recved(conn, p->tot_len);
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+static err_t sentFn(void *arg, struct altcp_pcb *conn, u16_t len) {
+  static_cast<Events *>(arg)->sent += len;
+  return ERR_OK;
+}
+
+static void errFn(void *arg, err_t err) {
+  Events *e = static_cast<Events *>(arg);
+  e->err = err;
+  e->errCalled = true;
+}
+
+static err_t connectedFn(void *arg, struct altcp_pcb *conn, err_t err) {
+  static_cast<Events *>(arg)->connected = true;
+  return ERR_OK;
+}
+
+static void setCallbacks(struct altcp_pcb *conn, Events *e) {
+  altcp_arg(conn, e);
+  altcp_recv(conn, recvFn);
+  altcp_sent(conn, sentFn);
+  altcp_err(conn, errFn);
+}
+
+static err_t acceptFn(void *arg, struct altcp_pcb *conn, err_t err) {
+  Events *e = static_cast<Events *>(arg);
+  e->accepted = conn;
+  setCallbacks(conn, e->acceptedEvents);
+  return ERR_OK;
+}
+
+// Allocates a hardware connection and connects it to the peer. This returns
+// the connection, and the socket in `socket`.
+static struct altcp_pcb *connect(Events &e, int &socket) {
+  W &w = W5500Emulator::instance();
+
+  struct altcp_pcb *conn = altcp_w5500_alloc(nullptr, IPADDR_TYPE_V4);
+  TEST_ASSERT_NOT_NULL_MESSAGE(conn, "Expected a connection");
+  setCallbacks(conn, &e);
+
+  ip_addr_t ip;
+  IP_ADDR4(&ip, kPeerIP[0], kPeerIP[1], kPeerIP[2], kPeerIP[3]);
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_connect(conn, &ip, 80, connectedFn),
+                            "Expected connect");
+  socket = w.findSocket(W::kSynSent);
+  TEST_ASSERT_GREATER_THAN_MESSAGE(0, socket, "Expected a connecting socket");
+
+  w.establish(socket);
+  enet_proc_input();
+  TEST_ASSERT_TRUE_MESSAGE(e.connected, "Expected connected");
+  return conn;
+}
+
+static void netifEventFn(struct netif *netif, netif_nsc_reason_t reason,
+                         const netif_ext_callback_args_t *args) {
+}
+
+// Pre-test setup. This is run before every test.
+void setUp() {
+  W5500Emulator::instance().reset();
+  TEST_ASSERT_TRUE_MESSAGE(enet_init(kMAC, netifEventFn), "Expected init");
+
+  ip4_addr_t ip;
+  ip4_addr_t mask;
+  ip4_addr_t gw;
+  IP4_ADDR(&ip, kLocalIP[0], kLocalIP[1], kLocalIP[2], kLocalIP[3]);
+  IP4_ADDR(&mask, 255, 255, 255, 0);
+  IP4_ADDR(&gw, 192, 168, 0, 1);
+  netif_set_addr(enet_netif(), &ip, &mask, &gw);
+}
+
+// Post-test teardown. This is run after every test.
+void tearDown() {
+  enet_deinit();
+}
+
+// --------------------------------------------------------------------------
+//  MACRAW Socket
+// --------------------------------------------------------------------------
+
+// Tests that frames are sent from the shadowed TX state and that the registers
+// are only read when the free-size estimate runs out.
+static void test_send_frame_shadow() {
+  W &w = W5500Emulator::instance();
+  w.setHoldTx(true);  // Sent frames keep their space
+
+  const size_t fsrReads = w.readCount(0, W::kSn_TX_FSR);
+
+  // The first send reads the free size
+  TEST_ASSERT_TRUE_MESSAGE(output(makeFrame(1000, 0)), "Expected send (1)");
+  TEST_ASSERT_EQUAL_MESSAGE(fsrReads + 2, w.readCount(0, W::kSn_TX_FSR),
+                            "Expected a stable FSR read");
+
+  // The rest fit in the 8KiB estimate and don't read any registers
+  const size_t srReads = w.readCount(0, W::kSn_SR);
+  const size_t txWrReads = w.readCount(0, W::kSn_TX_WR);
+  for (int i = 1; i < 8; i++) {
+    const size_t count = w.transactionCount();
+    TEST_ASSERT_TRUE_MESSAGE(output(makeFrame(1000, i)), "Expected send");
+    TEST_ASSERT_EQUAL_MESSAGE(4, w.transactionCount() - count,
+                              "Expected data, TX_WR, and command only");
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(fsrReads + 2, w.readCount(0, W::kSn_TX_FSR),
+                            "Expected no FSR reads");
+  TEST_ASSERT_EQUAL_MESSAGE(srReads, w.readCount(0, W::kSn_SR),
+                            "Expected no SR reads");
+  TEST_ASSERT_EQUAL_MESSAGE(txWrReads, w.readCount(0, W::kSn_TX_WR),
+                            "Expected no TX_WR reads");
+  TEST_ASSERT_EQUAL_MESSAGE(8, w.frames().size(), "Expected frame count");
+  for (int i = 0; i < 8; i++) {
+    TEST_ASSERT_TRUE_MESSAGE(w.frames()[i] == makeFrame(1000, i),
+                             "Expected frame contents");
+  }
+
+  // The estimate is now stale and the chip still holds everything
+  TEST_ASSERT_FALSE_MESSAGE(output(makeFrame(1000, 8)),
+                            "Expected no space");
+  TEST_ASSERT_EQUAL_MESSAGE(fsrReads + 4, w.readCount(0, W::kSn_TX_FSR),
+                            "Expected an FSR re-read");
+  TEST_ASSERT_EQUAL_MESSAGE(8, w.frames().size(), "Expected no new frame");
+
+  // Once the chip frees the space, the re-read finds it and checks the state
+  w.releaseTx(0);
+  TEST_ASSERT_TRUE_MESSAGE(output(makeFrame(1000, 8)), "Expected send (9)");
+  TEST_ASSERT_EQUAL_MESSAGE(fsrReads + 6, w.readCount(0, W::kSn_TX_FSR),
+                            "Expected an FSR re-read");
+  TEST_ASSERT_EQUAL_MESSAGE(srReads + 1, w.readCount(0, W::kSn_SR),
+                            "Expected an SR read");
+  TEST_ASSERT_EQUAL_MESSAGE(9, w.frames().size(), "Expected frame count");
+  TEST_ASSERT_TRUE_MESSAGE(w.frames()[8] == makeFrame(1000, 8),
+                           "Expected frame contents");
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(9000, w.reg16(0, W::kSn_TX_WR),
+                                   "Expected TX_WR");
+}
+
+// Tests that a closed socket is found when the estimate is refreshed and that
+// the estimate isn't trusted afterwards.
+static void test_send_frame_closed() {
+  W &w = W5500Emulator::instance();
+
+  w.setState(0, W::kClosed);
+  TEST_ASSERT_FALSE_MESSAGE(output(makeFrame(100, 0)), "Expected closed");
+  TEST_ASSERT_EQUAL_MESSAGE(0, w.commandCount(0, kCmdSend),
+                            "Expected no SEND");
+
+  // The next send checks again
+  w.setState(0, W::kMacraw);
+  const size_t srReads = w.readCount(0, W::kSn_SR);
+  TEST_ASSERT_TRUE_MESSAGE(output(makeFrame(100, 1)), "Expected send");
+  TEST_ASSERT_EQUAL_MESSAGE(srReads + 1, w.readCount(0, W::kSn_SR),
+                            "Expected an SR read");
+  TEST_ASSERT_EQUAL_MESSAGE(1, w.frames().size(), "Expected frame count");
+  TEST_ASSERT_TRUE_MESSAGE(w.frames()[0] == makeFrame(100, 1),
+                           "Expected frame contents");
+}
+
+// Tests that reopening the socket after a bad received frame re-reads the TX
+// write pointer and forgets the free-size estimate.
+static void test_send_frame_reopen() {
+  W &w = W5500Emulator::instance();
+
+  TEST_ASSERT_TRUE_MESSAGE(output(makeFrame(100, 0)), "Expected send (1)");
+  const size_t opens = w.commandCount(0, kCmdOpen);
+  const size_t fsrReads = w.readCount(0, W::kSn_TX_FSR);
+
+  // Move the chip's pointer so a stale shadow would write to the wrong place,
+  // then receive a frame with a bad length
+  w.setTxPointer(0, 0xfff0);
+  w.peerSend(0, std::string{"\x00\x01", 2});
+  enet_proc_input();
+  TEST_ASSERT_EQUAL_MESSAGE(opens + 1, w.commandCount(0, kCmdOpen),
+                            "Expected a reopen");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(W::kMacraw, w.state(0), "Expected MACRAW");
+
+  // The send wraps around the end of the pointer space
+  TEST_ASSERT_TRUE_MESSAGE(output(makeFrame(100, 1)), "Expected send (2)");
+  TEST_ASSERT_EQUAL_MESSAGE(fsrReads + 2, w.readCount(0, W::kSn_TX_FSR),
+                            "Expected an FSR read after reopening");
+  TEST_ASSERT_EQUAL_MESSAGE(2, w.frames().size(), "Expected frame count");
+  TEST_ASSERT_TRUE_MESSAGE(w.frames()[1] == makeFrame(100, 1),
+                           "Expected frame contents");
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(uint16_t(0xfff0 + 100),
+                                   w.reg16(0, W::kSn_TX_WR),
+                                   "Expected TX_WR");
+}
+
+// --------------------------------------------------------------------------
+//  Hardware TCP Sockets
+// --------------------------------------------------------------------------
+
+// Tests connecting, receiving, and closing.
+static void test_tcp_connect() {
+  W &w = W5500Emulator::instance();
+
+  Events e;
+  int socket;
+  struct altcp_pcb *conn = connect(e, socket);
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(80, w.reg16(socket, W::kSn_DPORT),
+                                   "Expected the destination port");
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(80, altcp_get_port(conn, 0),
+                                   "Expected the remote port");
+
+  w.peerSend(socket, "Hello");
+  enet_proc_input();
+  TEST_ASSERT_TRUE_MESSAGE(e.received == "Hello", "Expected received data");
+
+  // A graceful close sends a FIN and the socket is reclaimed once it closes
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_close(conn), "Expected close");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(W::kFinWait, w.state(socket),
+                                  "Expected FIN_WAIT");
+  TEST_ASSERT_TRUE_MESSAGE(w.finSent(socket), "Expected a FIN");
+  TEST_ASSERT_FALSE_MESSAGE(e.errCalled, "Expected no error");
+
+  w.finishClose(socket);
+  enet_proc_input();
+  Events e2;
+  int socket2;
+  conn = connect(e2, socket2);
+  TEST_ASSERT_EQUAL_MESSAGE(socket, socket2, "Expected the socket reused");
+  altcp_abort(conn);
+}
+
+// Tests that a connect that times out reports an error.
+static void test_tcp_connect_timeout() {
+  W &w = W5500Emulator::instance();
+
+  Events e;
+  struct altcp_pcb *conn = altcp_w5500_alloc(nullptr, IPADDR_TYPE_V4);
+  TEST_ASSERT_NOT_NULL_MESSAGE(conn, "Expected a connection");
+  setCallbacks(conn, &e);
+  ip_addr_t ip;
+  IP_ADDR4(&ip, kPeerIP[0], kPeerIP[1], kPeerIP[2], kPeerIP[3]);
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_connect(conn, &ip, 80, connectedFn),
+                            "Expected connect");
+  const int socket = w.findSocket(W::kSynSent);
+  TEST_ASSERT_GREATER_THAN_MESSAGE(0, socket, "Expected a connecting socket");
+
+  w.timeout(socket);
+  enet_proc_input();
+  TEST_ASSERT_FALSE_MESSAGE(e.connected, "Expected not connected");
+  TEST_ASSERT_TRUE_MESSAGE(e.errCalled, "Expected an error");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_RST, e.err, "Expected ERR_RST");
+}
+
+// Tests listening and accepting, and that the listener keeps listening.
+static void test_tcp_listen_accept() {
+  W &w = W5500Emulator::instance();
+
+  Events le;
+  Events ae;
+  le.acceptedEvents = &ae;
+  struct altcp_pcb *listener = altcp_w5500_alloc(nullptr, IPADDR_TYPE_V4);
+  TEST_ASSERT_NOT_NULL_MESSAGE(listener, "Expected a listener");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_bind(listener, IP_ANY_TYPE, 8080),
+                            "Expected bind");
+  listener = altcp_listen(listener);
+  TEST_ASSERT_NOT_NULL_MESSAGE(listener, "Expected listen");
+  altcp_arg(listener, &le);
+  altcp_accept(listener, acceptFn);
+
+  const int socket = w.findSocket(W::kListen, 8080);
+  TEST_ASSERT_GREATER_THAN_MESSAGE(0, socket, "Expected a listening socket");
+  TEST_ASSERT_TRUE_MESSAGE(w.peerConnect(socket, kPeerIP, 5000),
+                           "Expected peer connect");
+  enet_proc_input();
+  TEST_ASSERT_NOT_NULL_MESSAGE(le.accepted, "Expected accept");
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(5000, altcp_get_port(le.accepted, 0),
+                                   "Expected the remote port");
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(8080, altcp_get_port(le.accepted, 1),
+                                   "Expected the local port");
+  const ip_addr_t *ip = altcp_get_ip(le.accepted, 0);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(
+      PP_HTONL(LWIP_MAKEU32(kPeerIP[0], kPeerIP[1], kPeerIP[2], kPeerIP[3])),
+      ip_2_ip4(ip)->addr, "Expected the remote address");
+  TEST_ASSERT_EQUAL_MESSAGE(2, w.countSockets(W::kListen, 8080),
+                            "Expected still listening on two sockets");
+
+  // Data and the peer's FIN
+  w.peerSend(socket, "abc");
+  w.peerClose(socket);
+  enet_proc_input();
+  TEST_ASSERT_TRUE_MESSAGE(ae.received == "abc", "Expected received data");
+  TEST_ASSERT_TRUE_MESSAGE(ae.fin, "Expected FIN");
+
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_close(le.accepted), "Expected close");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(W::kLastAck, w.state(socket),
+                                  "Expected LAST_ACK");
+
+  // Closing the listener frees its sockets
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_close(listener),
+                            "Expected listener close");
+  TEST_ASSERT_EQUAL_MESSAGE(0, w.countSockets(W::kListen, 8080),
+                            "Expected no listening sockets");
+}
+
+// Tests that a listener's spare socket accepts a connection that arrives while
+// another is being handed off.
+static void test_tcp_listen_spare() {
+  W &w = W5500Emulator::instance();
+
+  Events le;
+  Events ae;
+  le.acceptedEvents = &ae;
+  struct altcp_pcb *listener = altcp_w5500_alloc(nullptr, IPADDR_TYPE_V4);
+  TEST_ASSERT_NOT_NULL_MESSAGE(listener, "Expected a listener");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_bind(listener, IP_ANY_TYPE, 8080),
+                            "Expected bind");
+  listener = altcp_listen(listener);
+  TEST_ASSERT_NOT_NULL_MESSAGE(listener, "Expected listen");
+  altcp_arg(listener, &le);
+  altcp_accept(listener, acceptFn);
+  TEST_ASSERT_EQUAL_MESSAGE(2, w.countSockets(W::kListen, 8080),
+                            "Expected two listening sockets");
+
+  // Two peers connect before the driver is polled
+  const int s1 = w.findSocket(W::kListen, 8080);
+  TEST_ASSERT_TRUE_MESSAGE(w.peerConnect(s1, kPeerIP, 5001),
+                           "Expected peer connect (1)");
+  const int s2 = w.findSocket(W::kListen, 8080);
+  TEST_ASSERT_GREATER_THAN_MESSAGE(0, s2, "Expected a spare socket");
+  TEST_ASSERT_TRUE_MESSAGE(w.peerConnect(s2, kPeerIP, 5002),
+                           "Expected peer connect (2)");
+
+  enet_proc_input();
+  TEST_ASSERT_NOT_NULL_MESSAGE(le.accepted, "Expected accept (1)");
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(5001, altcp_get_port(le.accepted, 0),
+                                   "Expected the first peer");
+  struct altcp_pcb *c1 = le.accepted;
+  le.accepted = nullptr;
+
+  enet_proc_input();
+  TEST_ASSERT_NOT_NULL_MESSAGE(le.accepted, "Expected accept (2)");
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(5002, altcp_get_port(le.accepted, 0),
+                                   "Expected the second peer");
+  TEST_ASSERT_EQUAL_MESSAGE(2, w.countSockets(W::kListen, 8080),
+                            "Expected two listening sockets again");
+
+  altcp_abort(c1);
+  altcp_abort(le.accepted);
+  altcp_close(listener);
+}
+
+// Tests that writes don't overrun the TX buffer, counting both unacknowledged
+// data and data that hasn't been sent yet.
+static void test_tcp_write_shortfall() {
+  W &w = W5500Emulator::instance();
+  w.setAutoAck(false);
+
+  Events e;
+  int socket;
+  struct altcp_pcb *conn = connect(e, socket);
+  TEST_ASSERT_EQUAL_MESSAGE(1024, altcp_sndbuf(conn), "Expected sndbuf");
+
+  const std::string a = makeFrame(600, 0);
+  const std::string b = makeFrame(400, 1);
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_write(conn, a.data(), a.size(), 0),
+                            "Expected write (1)");
+  TEST_ASSERT_EQUAL_MESSAGE(424, altcp_sndbuf(conn), "Expected sndbuf");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_MEM, altcp_write(conn, a.data(), a.size(), 0),
+                            "Expected no space for queued data");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_output(conn), "Expected output");
+  TEST_ASSERT_TRUE_MESSAGE(w.sent(socket) == a, "Expected sent data");
+
+  // Sent but unacknowledged data still takes space
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_MEM, altcp_write(conn, a.data(), a.size(), 0),
+                            "Expected no space for unacknowledged data");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_write(conn, b.data(), b.size(), 0),
+                            "Expected write (2)");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_output(conn), "Expected output");
+  TEST_ASSERT_TRUE_MESSAGE(w.sent(socket) == a,
+                           "Expected one outstanding SEND");
+
+  // The ACK completes the first send and starts the next
+  w.releaseTx(socket);
+  enet_proc_input();
+  TEST_ASSERT_EQUAL_MESSAGE(600, e.sent, "Expected sent callback");
+  TEST_ASSERT_TRUE_MESSAGE(w.sent(socket) == a + b, "Expected sent data");
+  w.releaseTx(socket);
+  enet_proc_input();
+  TEST_ASSERT_EQUAL_MESSAGE(1000, e.sent, "Expected sent callback");
+  TEST_ASSERT_EQUAL_MESSAGE(1024, altcp_sndbuf(conn), "Expected sndbuf");
+  altcp_abort(conn);
+}
+
+// Tests shutting down the sending side and then receiving the peer's close.
+static void test_tcp_shutdown() {
+  W &w = W5500Emulator::instance();
+
+  Events e;
+  int socket;
+  struct altcp_pcb *conn = connect(e, socket);
+
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_write(conn, "abc", 3, 0),
+                            "Expected write");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_shutdown(conn, 0, 1),
+                            "Expected shutdown");
+  TEST_ASSERT_TRUE_MESSAGE(w.sent(socket) == "abc", "Expected queued data");
+  TEST_ASSERT_TRUE_MESSAGE(w.finSent(socket), "Expected a FIN");
+
+  // Data still arrives, and the peer's FIN closes the socket cleanly
+  w.peerSend(socket, "xyz");
+  w.peerClose(socket);
+  enet_proc_input();
+  TEST_ASSERT_TRUE_MESSAGE(e.received == "xyz", "Expected received data");
+  TEST_ASSERT_TRUE_MESSAGE(e.fin, "Expected FIN");
+  TEST_ASSERT_FALSE_MESSAGE(e.errCalled, "Expected no error");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(W::kClosed, w.state(socket),
+                                  "Expected closed");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, altcp_close(conn), "Expected close");
+}
+
+// --------------------------------------------------------------------------
+//  TCP Receive Coalescing
+// --------------------------------------------------------------------------
+
+#if QNETHERNET_ENABLE_TCP_RX_COALESCING && !CHECKSUM_CHECK_IP && \
+    !CHECKSUM_CHECK_TCP
+
+static constexpr uint8_t kPeerMAC[6]{0x02, 0, 0, 0, 0, 0x03};
+static constexpr uint16_t kPeerPort = 5000;
+static constexpr uint32_t kPeerISS  = 1000;
+
+// A TCP header as seen in a sent frame.
+struct Segment final {
+  uint32_t seqno;
+  uint32_t ackno;
+  uint8_t flags;
+};
+
+// What the raw TCP callbacks saw for one connection.
+struct RawEvents final {
+  struct tcp_pcb *accepted = nullptr;
+  size_t recvCount = 0;
+  std::string received;
+};
+
+static void put16(std::string &s, uint16_t v) {
+  s.push_back(static_cast<char>(v >> 8));
+  s.push_back(static_cast<char>(v));
+}
+
+static void put32(std::string &s, uint32_t v) {
+  put16(s, v >> 16);
+  put16(s, v);
+}
+
+static uint32_t get32(const std::string &s, size_t i) {
+  return (uint32_t{static_cast<uint8_t>(s[i])} << 24) |
+         (uint32_t{static_cast<uint8_t>(s[i + 1])} << 16) |
+         (uint32_t{static_cast<uint8_t>(s[i + 2])} << 8) |
+         uint32_t{static_cast<uint8_t>(s[i + 3])};
+}
+
+// Makes a frame from the peer to the local address. The checksums are left as
+// zero because coalescing requires that they aren't checked.
+static std::string tcpFrame(uint32_t seqno, uint32_t ackno, uint8_t flags,
+                            const std::string &data) {
+  std::string f(reinterpret_cast<const char *>(kMAC), 6);
+  f.append(reinterpret_cast<const char *>(kPeerMAC), 6);
+  put16(f, ETHTYPE_IP);
+
+  put16(f, 0x4500);                  // Version, IHL, and TOS
+  put16(f, 20 + 20 + data.size());  // Total length
+  put32(f, 0);                       // ID, flags, and fragment offset
+  put16(f, (64 << 8) | IP_PROTO_TCP);
+  put16(f, 0);                       // Checksum
+  f.append(reinterpret_cast<const char *>(kPeerIP), 4);
+  f.append(reinterpret_cast<const char *>(kLocalIP), 4);
+
+  put16(f, kPeerPort);
+  put16(f, 80);
+  put32(f, seqno);
+  put32(f, ackno);
+  put16(f, (5 << 12) | flags);
+  put16(f, 16 * 1024);  // Window
+  put32(f, 0);          // Checksum and urgent pointer
+  f.append(data);
+  return f;
+}
+
+// Makes an ARP request from the peer for the local address.
+static std::string arpRequest() {
+  std::string f(6, '\xff');
+  f.append(reinterpret_cast<const char *>(kPeerMAC), 6);
+  put16(f, ETHTYPE_ARP);
+  put16(f, 1);       // Hardware type
+  put16(f, ETHTYPE_IP);
+  put16(f, 0x0604);  // Address sizes
+  put16(f, 1);       // Request
+  f.append(reinterpret_cast<const char *>(kPeerMAC), 6);
+  f.append(reinterpret_cast<const char *>(kPeerIP), 4);
+  f.append(6, '\0');
+  f.append(reinterpret_cast<const char *>(kLocalIP), 4);
+  return f;
+}
+
+// Passes frames to the netif as one input batch, the way a driver that reads
+// several frames per poll would.
+static void inputBatch(const std::vector<std::string> &frames) {
+  struct netif *netif = enet_netif();
+  for (const std::string &frame : frames) {
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, frame.size(), PBUF_POOL);
+    TEST_ASSERT_NOT_NULL_MESSAGE(p, "Expected a pbuf");
+    pbuf_take(p, frame.data(), frame.size());
+    if (netif->input(p, netif) != ERR_OK) {
+      pbuf_free(p);
+    }
+  }
+  enet_proc_input();  // Ends the batch
+}
+
+// Returns the TCP segments sent to the peer, starting at the given frame.
+static std::vector<Segment> sentSegments(size_t from) {
+  const std::vector<std::string> &frames = W5500Emulator::instance().frames();
+  std::vector<Segment> segs;
+  for (size_t i = from; i < frames.size(); i++) {
+    const std::string &f = frames[i];
+    if (f.size() < 14 + 20 + 20 || f[12] != 0x08 || f[13] != 0x00 ||
+        f[14 + 9] != IP_PROTO_TCP) {
+      continue;
+    }
+    segs.push_back(Segment{get32(f, 14 + 20 + 4), get32(f, 14 + 20 + 8),
+                           static_cast<uint8_t>(f[14 + 20 + 13])});
+  }
+  return segs;
+}
+
+static err_t rawRecvFn(void *arg, struct tcp_pcb *tpcb, struct pbuf *p,
+                       err_t err) {
+  RawEvents *e = static_cast<RawEvents *>(arg);
+  if (p == nullptr) {
+    return ERR_OK;
+  }
+  e->recvCount++;
+  for (struct pbuf *q = p; q != nullptr; q = q->next) {
+    e->received.append(static_cast<const char *>(q->payload), q->len);
+  }
+  tcp_recved(tpcb, p->tot_len);
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+static err_t rawAcceptFn(void *arg, struct tcp_pcb *newpcb, err_t err) {
+  RawEvents *e = static_cast<RawEvents *>(arg);
+  e->accepted = newpcb;
+  tcp_arg(newpcb, e);
+  tcp_recv(newpcb, rawRecvFn);
+  return ERR_OK;
+}
+
+// Has the peer connect to a lwIP listener on port 80. This returns the
+// listener, and the local ISS in `iss`.
+static struct tcp_pcb *rawConnect(RawEvents &e, uint32_t &iss) {
+  W &w = W5500Emulator::instance();
+  w.setLinkUp(true);
+  enet_poll();
+  netif_set_up(enet_netif());
+
+  struct tcp_pcb *listener = tcp_new();
+  TEST_ASSERT_NOT_NULL_MESSAGE(listener, "Expected a PCB");
+  TEST_ASSERT_EQUAL_MESSAGE(ERR_OK, tcp_bind(listener, IP_ANY_TYPE, 80),
+                            "Expected bind");
+  listener = tcp_listen(listener);
+  TEST_ASSERT_NOT_NULL_MESSAGE(listener, "Expected listen");
+  tcp_arg(listener, &e);
+  tcp_accept(listener, rawAcceptFn);
+
+  inputBatch({arpRequest()});
+  const size_t start = w.frames().size();
+  inputBatch({tcpFrame(kPeerISS, 0, TCP_SYN, "")});
+  std::vector<Segment> segs = sentSegments(start);
+  TEST_ASSERT_EQUAL_MESSAGE(1, segs.size(), "Expected a SYN-ACK");
+  TEST_ASSERT_EQUAL_MESSAGE(TCP_SYN | TCP_ACK, segs[0].flags,
+                            "Expected SYN-ACK flags");
+  TEST_ASSERT_EQUAL_MESSAGE(kPeerISS + 1, segs[0].ackno,
+                            "Expected SYN-ACK ackno");
+  iss = segs[0].seqno;
+
+  inputBatch({tcpFrame(kPeerISS + 1, iss + 1, TCP_ACK, "")});
+  TEST_ASSERT_NOT_NULL_MESSAGE(e.accepted, "Expected accept");
+  return listener;
+}
+
+// Tests that in-order segments received in one batch are passed to lwIP as one
+// and acknowledged once, by the delayed ACK.
+static void test_rx_coalesce_ack() {
+  W &w = W5500Emulator::instance();
+  RawEvents e;
+  uint32_t iss;
+  struct tcp_pcb *listener = rawConnect(e, iss);
+
+  std::vector<std::string> frames;
+  std::string data;
+  uint32_t seqno = kPeerISS + 1;
+  for (int i = 0; i < 4; i++) {
+    std::string seg = makeFrame(100, i * 100);
+    frames.push_back(tcpFrame(seqno, iss + 1, TCP_ACK, seg));
+    data += seg;
+    seqno += seg.size();
+  }
+  const size_t start = w.frames().size();
+  inputBatch(frames);
+  TEST_ASSERT_EQUAL_MESSAGE(1, e.recvCount, "Expected one coalesced segment");
+  TEST_ASSERT_TRUE_MESSAGE(e.received == data, "Expected the data, in order");
+
+  // Uncoalesced, every second segment would have been acknowledged right away
+  TEST_ASSERT_EQUAL_MESSAGE(0, sentSegments(start).size(),
+                            "Expected the ACK to be delayed");
+
+  // The delayed ACK still goes out and covers everything
+  delay(TCP_TMR_INTERVAL);
+  enet_poll();
+  std::vector<Segment> segs = sentSegments(start);
+  TEST_ASSERT_EQUAL_MESSAGE(1, segs.size(), "Expected one ACK");
+  TEST_ASSERT_EQUAL_MESSAGE(TCP_ACK, segs[0].flags, "Expected a bare ACK");
+  TEST_ASSERT_EQUAL_MESSAGE(seqno, segs[0].ackno, "Expected all acknowledged");
+
+  tcp_abort(e.accepted);
+  tcp_close(listener);
+}
+
+// Tests that a PSH ends a coalesced segment and that a second segment in the
+// same batch is acknowledged immediately.
+static void test_rx_coalesce_push() {
+  W &w = W5500Emulator::instance();
+  RawEvents e;
+  uint32_t iss;
+  struct tcp_pcb *listener = rawConnect(e, iss);
+
+  std::vector<std::string> frames;
+  std::string data;
+  uint32_t seqno = kPeerISS + 1;
+  for (int i = 0; i < 4; i++) {
+    std::string seg = makeFrame(100, i * 100);
+    frames.push_back(tcpFrame(seqno, iss + 1,
+                              (i == 1) ? (TCP_ACK | TCP_PSH) : TCP_ACK, seg));
+    data += seg;
+    seqno += seg.size();
+  }
+  const size_t start = w.frames().size();
+  inputBatch(frames);
+  TEST_ASSERT_EQUAL_MESSAGE(2, e.recvCount, "Expected two coalesced segments");
+  TEST_ASSERT_TRUE_MESSAGE(e.received == data, "Expected the data, in order");
+
+  std::vector<Segment> segs = sentSegments(start);
+  TEST_ASSERT_EQUAL_MESSAGE(1, segs.size(), "Expected an immediate ACK");
+  TEST_ASSERT_EQUAL_MESSAGE(seqno, segs[0].ackno, "Expected all acknowledged");
+
+  tcp_abort(e.accepted);
+  tcp_close(listener);
+}
+
+#endif  // QNETHERNET_ENABLE_TCP_RX_COALESCING && !CHECKSUM_CHECK_IP &&
+        // !CHECKSUM_CHECK_TCP
+
+// --------------------------------------------------------------------------
+//  Main Program
+// --------------------------------------------------------------------------
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_send_frame_shadow);
+  RUN_TEST(test_send_frame_closed);
+  RUN_TEST(test_send_frame_reopen);
+  RUN_TEST(test_tcp_connect);
+  RUN_TEST(test_tcp_connect_timeout);
+  RUN_TEST(test_tcp_listen_accept);
+  RUN_TEST(test_tcp_listen_spare);
+  RUN_TEST(test_tcp_write_shortfall);
+  RUN_TEST(test_tcp_shutdown);
+#if QNETHERNET_ENABLE_TCP_RX_COALESCING && !CHECKSUM_CHECK_IP && \
+    !CHECKSUM_CHECK_TCP
+  RUN_TEST(test_rx_coalesce_ack);
+  RUN_TEST(test_rx_coalesce_push);
+#endif  // QNETHERNET_ENABLE_TCP_RX_COALESCING && !CHECKSUM_CHECK_IP &&
+        // !CHECKSUM_CHECK_TCP
+  return UNITY_END();
+}